@@ -0,0 +1,585 @@
+// Times the step kernels over a matrix of sizes and prints one record per case, CSV (default) or JSON lines.
+// Connection visits are counted from the loops of each kernel, the byte estimate assumes every visit streams its
+// connection struct from memory (twice for the learning kernels, which write it back), so it is an upper bound on traffic.
+// Where perf_event_open works the timed calls are also counted: IPC, LLC misses per connection visit and estimated bytes per cycle.
+// The counter columns are left empty when counters are not available (containers usually block them)
+
+#include <neo/PredictiveHierarchy.h>
+#include <neo/Agent.h>
+#include <neo/Column.h>
+#include <neo/PerfCounters.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <cstdlib>
+
+#include "../libs/argparse.hpp"
+
+using namespace neo;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	std::string _filter;
+	std::string _format;
+	double _minTime;
+	int _trials;
+
+	// Whether sparse coders may use the fixed radius kernels
+	bool _fixed;
+
+	PerfCounters* _perfCounters;
+};
+
+struct Case {
+	std::string _kernel;
+
+	int _grid, _radius, _iter, _layers, _inputs, _cells;
+
+	// Weights in the model
+	double _connections;
+
+	// Connection visits and estimated bytes moved per step
+	double _visits;
+	double _bytes;
+
+	Case(const std::string &kernel)
+		: _kernel(kernel), _grid(0), _radius(0), _iter(0), _layers(0), _inputs(0), _cells(0), _connections(0.0), _visits(0.0), _bytes(0.0)
+	{}
+};
+
+struct SparseCoderCounts {
+	double _feedForward, _recurrent, _lateral;
+};
+
+SparseCoderCounts countConnections(const SparseCoder &sc) {
+	SparseCoderCounts counts = { 0.0, 0.0, 0.0 };
+
+	for (int hi = 0; hi < sc.getNumHidden(); hi++) {
+		counts._feedForward += sc.getHiddenNode(hi)._feedForwardConnections.size();
+		counts._recurrent += sc.getHiddenNode(hi)._recurrentConnections.size();
+		counts._lateral += sc.getHiddenNode(hi)._lateralConnections.size();
+	}
+
+	return counts;
+}
+
+// Visits of one activate call: every iteration excites from all three connection sets and reconstructs over two
+double activateVisits(const SparseCoderCounts &counts, int iter) {
+	return iter * (2.0 * counts._feedForward + 2.0 * counts._recurrent + counts._lateral);
+}
+
+double learnVisits(const SparseCoderCounts &counts) {
+	return counts._feedForward + counts._recurrent + counts._lateral;
+}
+
+// Column::simStep: excitation and reconstruction per iteration, then the value, action and SDR updates
+double columnVisits(const Column &c, int iter) {
+	double cells = c.getNumCells();
+	double states = c.getNumStates();
+
+	return iter * cells * (2.0 * states + cells) + 2.0 * (c.getNumActions() + 1) * cells + cells * (states + cells);
+}
+
+double columnConnections(const Column &c) {
+	double cells = c.getNumCells();
+
+	return cells * (c.getNumStates() + cells) + (c.getNumActions() + 1) * cells;
+}
+
+struct Measurement {
+	// Sorted ns per call of each trial
+	std::vector<double> _ns;
+
+	// Summed over all timed calls
+	PerfCounters::Sample _counters;
+	long _calls;
+};
+
+// Median ns per call over the trials, each trial running for at least minTime / trials
+Measurement measure(const Options &options, const std::function<void()> &step) {
+	// Warm up caches and size the trials
+	Clock::time_point start = Clock::now();
+
+	step();
+
+	double once = std::chrono::duration<double>(Clock::now() - start).count();
+
+	int callsPerTrial = std::max(1, static_cast<int>(options._minTime / options._trials / std::max(once, 1e-9)));
+
+	Measurement m;
+	m._ns.resize(options._trials);
+	m._calls = static_cast<long>(callsPerTrial) * options._trials;
+
+	for (int t = 0; t < options._trials; t++) {
+		PerfCounters::Sample before = options._perfCounters->read();
+
+		start = Clock::now();
+
+		for (int i = 0; i < callsPerTrial; i++)
+			step();
+
+		m._ns[t] = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / callsPerTrial;
+
+		m._counters += options._perfCounters->read() - before;
+	}
+
+	std::sort(m._ns.begin(), m._ns.end());
+
+	return m;
+}
+
+void report(const Options &options, const Case &c, const Measurement &m) {
+	const std::vector<double> &ns = m._ns;
+
+	double median = ns[ns.size() / 2];
+	double seconds = median * 1e-9;
+
+	// Per call
+	double cycles = static_cast<double>(m._counters[PerfCounters::_cycles]) / m._calls;
+	double instructions = static_cast<double>(m._counters[PerfCounters::_instructions]) / m._calls;
+	double misses = static_cast<double>(m._counters[PerfCounters::_llcMisses]) / m._calls;
+
+	bool counters = options._perfCounters->isAvailable() && cycles > 0.0;
+	bool haveInstructions = counters && options._perfCounters->hasCounter(PerfCounters::_instructions);
+	bool haveMisses = counters && options._perfCounters->hasCounter(PerfCounters::_llcMisses);
+
+	if (options._format == "json") {
+		std::cout << "{\"kernel\":\"" << c._kernel << "\",\"grid\":" << c._grid << ",\"radius\":" << c._radius << ",\"iter\":" << c._iter
+			<< ",\"layers\":" << c._layers << ",\"inputs\":" << c._inputs << ",\"cells\":" << c._cells
+			<< ",\"connections\":" << c._connections << ",\"ns_per_step\":" << median << ",\"ns_min\":" << ns.front()
+			<< ",\"visits_per_step\":" << c._visits << ",\"connections_per_sec\":" << c._visits / seconds
+			<< ",\"est_bytes_per_step\":" << c._bytes << ",\"est_gb_per_sec\":" << c._bytes / seconds * 1e-9;
+
+		std::cout << ",\"cycles_per_step\":";
+
+		if (counters)
+			std::cout << cycles;
+		else
+			std::cout << "null";
+
+		std::cout << ",\"ipc\":";
+
+		if (haveInstructions)
+			std::cout << instructions / cycles;
+		else
+			std::cout << "null";
+
+		std::cout << ",\"llc_misses_per_visit\":";
+
+		if (haveMisses)
+			std::cout << misses / std::max(c._visits, 1.0);
+		else
+			std::cout << "null";
+
+		std::cout << ",\"est_bytes_per_cycle\":";
+
+		if (counters)
+			std::cout << c._bytes / cycles;
+		else
+			std::cout << "null";
+
+		std::cout << "}" << std::endl;
+	}
+	else {
+		std::cout << c._kernel << "," << c._grid << "," << c._radius << "," << c._iter << "," << c._layers << "," << c._inputs << "," << c._cells << ","
+			<< c._connections << "," << median << "," << ns.front() << "," << c._visits << "," << c._visits / seconds << ","
+			<< c._bytes << "," << c._bytes / seconds * 1e-9 << ",";
+
+		if (counters)
+			std::cout << cycles;
+
+		std::cout << ",";
+
+		if (haveInstructions)
+			std::cout << instructions / cycles;
+
+		std::cout << ",";
+
+		if (haveMisses)
+			std::cout << misses / std::max(c._visits, 1.0);
+
+		std::cout << ",";
+
+		if (counters)
+			std::cout << c._bytes / cycles;
+
+		std::cout << std::endl;
+	}
+}
+
+bool selected(const Options &options, const std::string &kernel) {
+	return options._filter.empty() || kernel.find(options._filter) != std::string::npos;
+}
+
+void benchSparseCoder(const Options &options, const std::vector<int> &grids, const std::vector<int> &radii, const std::vector<int> &iters) {
+	const char* kernels[5] = { "SparseCoder::activate", "SparseCoder::activateNoise", "SparseCoder::reconstructFromStates", "SparseCoder::learn", "SparseCoder::learnRewards" };
+
+	bool any = false;
+
+	for (int k = 0; k < 5; k++)
+		any = any || selected(options, kernels[k]);
+
+	if (!any)
+		return;
+
+	for (int gi = 0; gi < grids.size(); gi++)
+		for (int ri = 0; ri < radii.size(); ri++) {
+			int grid = grids[gi];
+			int radius = radii[ri];
+
+			std::mt19937 generator(1234);
+			std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+			SparseCoder sc;
+
+			sc.createRandom(grid, grid, grid, grid, radius, radius, radius, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+			sc.setFixedKernels(options._fixed);
+
+			SparseCoder::State state;
+
+			sc.initState(state);
+
+			for (int i = 0; i < state._visibleInputs.size(); i++)
+				state._visibleInputs[i] = dist01(generator) < 0.1f ? 1.0f : 0.0f;
+
+			// Realistic activity for reconstruction and learning
+			sc.activate(state, 10, 0.1f, generator);
+
+			std::vector<float> rewards(sc.getNumHidden(), 0.5f);
+
+			SparseCoderCounts counts = countConnections(sc);
+
+			Case c("");
+			c._grid = grid;
+			c._radius = radius;
+			c._inputs = sc.getNumVisible();
+			c._connections = counts._feedForward + counts._recurrent + counts._lateral;
+
+			for (int ii = 0; ii < iters.size(); ii++) {
+				c._iter = iters[ii];
+				c._visits = activateVisits(counts, c._iter);
+				c._bytes = c._visits * sizeof(SparseCoder::Connection);
+
+				if (selected(options, kernels[0])) {
+					c._kernel = kernels[0];
+
+					report(options, c, measure(options, [&] { sc.activate(state, c._iter, 0.1f, generator); }));
+				}
+
+				if (selected(options, kernels[1])) {
+					c._kernel = kernels[1];
+
+					report(options, c, measure(options, [&] { sc.activateNoise(state, c._iter, 0.1f, 0.05f, generator); }));
+				}
+			}
+
+			c._iter = 0;
+
+			if (selected(options, kernels[2])) {
+				c._kernel = kernels[2];
+				c._visits = counts._feedForward + counts._recurrent;
+				c._bytes = c._visits * sizeof(SparseCoder::Connection);
+
+				report(options, c, measure(options, [&] { sc.reconstructFromStates(state, 1.0f); }));
+			}
+
+			c._visits = learnVisits(counts);
+			c._bytes = 2.0 * c._visits * sizeof(SparseCoder::Connection);
+
+			if (selected(options, kernels[3])) {
+				c._kernel = kernels[3];
+
+				report(options, c, measure(options, [&] { sc.learn(state, 0.001f, 0.001f, 0.001f, 0.001f, 0.08f, 0.0f); }));
+			}
+
+			if (selected(options, kernels[4])) {
+				c._kernel = kernels[4];
+
+				report(options, c, measure(options, [&] { sc.learn(state, rewards, 0.95f, 0.001f, 0.001f, 0.001f, 0.001f, 0.08f, 0.0f); }));
+			}
+		}
+}
+
+void benchColumn(const Options &options, const std::vector<int> &cellCounts, const std::vector<int> &stateCounts) {
+	if (!selected(options, "Column::simStep"))
+		return;
+
+	for (int ci = 0; ci < cellCounts.size(); ci++)
+		for (int si = 0; si < stateCounts.size(); si++) {
+			std::mt19937 generator(1234);
+			std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+			Column column;
+
+			column.createRandom(stateCounts[si], Agent::_numColumnActions, cellCounts[ci], -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+			for (int i = 0; i < stateCounts[si]; i++)
+				column.setState(i, dist01(generator));
+
+			Case c("Column::simStep");
+			c._iter = 7;
+			c._inputs = stateCounts[si];
+			c._cells = cellCounts[ci];
+			c._connections = columnConnections(column);
+			c._visits = columnVisits(column, c._iter);
+			c._bytes = c._visits * 8.0;
+
+			report(options, c, measure(options, [&] {
+				column.simStep(0.1f, 0.125f, 0.99f, c._iter, 0.1f, 0.04f, 0.1f, 0.01f, 0.01f, 0.1f, 0.98f, 0.05f, 0.01f, generator);
+			}));
+		}
+}
+
+void benchHierarchy(const Options &options, const std::vector<int> &grids, const std::vector<int> &layerCounts) {
+	if (!selected(options, "PredictiveHierarchy::simStep"))
+		return;
+
+	for (int gi = 0; gi < grids.size(); gi++)
+		for (int li = 0; li < layerCounts.size(); li++) {
+			std::mt19937 generator(1234);
+			std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+			std::vector<PredictiveHierarchy::LayerDesc> layerDescs(layerCounts[li]);
+
+			for (int l = 0; l < layerDescs.size(); l++) {
+				layerDescs[l]._width = grids[gi];
+				layerDescs[l]._height = grids[gi];
+			}
+
+			PredictiveHierarchy ph;
+
+			ph.createRandom(grids[gi], grids[gi], 8, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+			Case c("PredictiveHierarchy::simStep");
+			c._grid = grids[gi];
+			c._radius = layerDescs.front()._receptiveRadius;
+			c._iter = layerDescs.front()._sdrIter;
+			c._layers = layerCounts[li];
+			c._inputs = grids[gi] * grids[gi];
+
+			double predictionConnections = 0.0;
+
+			for (int l = 0; l < ph.getNumLayers(); l++) {
+				SparseCoderCounts counts = countConnections(ph.getLayer(l)._sdr);
+
+				c._connections += counts._feedForward + counts._recurrent + counts._lateral;
+				c._visits += activateVisits(counts, layerDescs[l]._sdrIter) + learnVisits(counts);
+				c._bytes += (activateVisits(counts, layerDescs[l]._sdrIter) + 2.0 * learnVisits(counts)) * sizeof(SparseCoder::Connection);
+
+				for (int pi = 0; pi < ph.getLayer(l)._predictionNodes.size(); pi++)
+					predictionConnections += ph.getLayer(l)._predictionNodes[pi]._feedBackConnections.size() + ph.getLayer(l)._predictionNodes[pi]._predictiveConnections.size();
+			}
+
+			for (int pi = 0; pi < ph.getInputPredictionNodes().size(); pi++)
+				predictionConnections += ph.getInputPredictionNodes()[pi]._feedBackConnections.size();
+
+			// Predicted once and learned once
+			c._connections += predictionConnections;
+			c._visits += 2.0 * predictionConnections;
+			c._bytes += 3.0 * predictionConnections * sizeof(PredictiveHierarchy::Connection);
+
+			report(options, c, measure(options, [&] {
+				for (int i = 0; i < c._inputs; i++)
+					ph.setInput(i, dist01(generator) < 0.1f ? 1.0f : 0.0f);
+
+				ph.simStep(generator, true);
+			}));
+		}
+}
+
+void benchAgent(const Options &options, const std::vector<int> &grids, const std::vector<int> &layerCounts) {
+	if (!selected(options, "Agent::simStep"))
+		return;
+
+	for (int gi = 0; gi < grids.size(); gi++)
+		for (int li = 0; li < layerCounts.size(); li++) {
+			std::mt19937 generator(1234);
+			std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+			std::vector<Agent::LayerDesc> layerDescs(layerCounts[li]);
+
+			for (int l = 0; l < layerDescs.size(); l++) {
+				layerDescs[l]._width = grids[gi];
+				layerDescs[l]._height = grids[gi];
+				layerDescs[l]._columnGamma = 0.99f;
+				layerDescs[l]._columnGammaLambda = 0.98f;
+			}
+
+			Agent agent;
+
+			agent._columnGamma = 0.99f;
+			agent._columnGammaLambda = 0.98f;
+
+			agent.createRandom(grids[gi], grids[gi], 4, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+			Case c("Agent::simStep");
+			c._grid = grids[gi];
+			c._radius = layerDescs.front()._receptiveRadius;
+			c._iter = layerDescs.front()._sdrIter;
+			c._layers = layerCounts[li];
+			c._inputs = grids[gi] * grids[gi];
+			c._cells = layerDescs.front()._cellsPerColumn;
+
+			for (int l = 0; l < agent.getLayers().size(); l++) {
+				SparseCoderCounts counts = countConnections(agent.getLayers()[l]._sdr);
+
+				c._connections += counts._feedForward + counts._recurrent + counts._lateral;
+				c._visits += activateVisits(counts, layerDescs[l]._sdrIter) + learnVisits(counts);
+				c._bytes += (activateVisits(counts, layerDescs[l]._sdrIter) + 2.0 * learnVisits(counts)) * sizeof(SparseCoder::Connection);
+
+				for (int pi = 0; pi < agent.getLayers()[l]._predictionNodes.size(); pi++) {
+					const Column &column = agent.getLayers()[l]._predictionNodes[pi]._column;
+
+					c._connections += columnConnections(column);
+					c._visits += columnVisits(column, layerDescs[l]._columnIter);
+					c._bytes += columnVisits(column, layerDescs[l]._columnIter) * 8.0;
+				}
+			}
+
+			for (int pi = 0; pi < agent.getInputPredictionNodes().size(); pi++) {
+				const Column &column = agent.getInputPredictionNodes()[pi]._column;
+
+				c._connections += columnConnections(column);
+				c._visits += columnVisits(column, agent._columnIter);
+				c._bytes += columnVisits(column, agent._columnIter) * 8.0;
+			}
+
+			report(options, c, measure(options, [&] {
+				for (int i = 0; i < c._inputs; i++)
+					agent.setInput(i, dist01(generator) < 0.1f ? 1.0f : 0.0f);
+
+				agent.simStep(0.1f, generator, true);
+			}));
+		}
+}
+
+// Model construction, serial std::mt19937 against the counter based parallel fill
+void benchInit(const Options &options, const std::vector<int> &grids) {
+	const char* kernels[4] = { "PredictiveHierarchy::createRandom(generator)", "PredictiveHierarchy::createRandom(seed)", "Agent::createRandom(generator)", "Agent::createRandom(seed)" };
+
+	for (int gi = 0; gi < grids.size(); gi++) {
+		int grid = grids[gi];
+
+		std::vector<PredictiveHierarchy::LayerDesc> layerDescs(2);
+		std::vector<Agent::LayerDesc> agentLayerDescs(2);
+
+		for (int l = 0; l < 2; l++) {
+			layerDescs[l]._width = layerDescs[l]._height = grid;
+			agentLayerDescs[l]._width = agentLayerDescs[l]._height = grid / 2;
+		}
+
+		Case c("");
+		c._grid = grid;
+		c._layers = 2;
+		c._inputs = grid * grid;
+		// Bytes of the built model, so est_gb_per_sec is the fill rate
+		c._bytes = static_cast<double>(PredictiveHierarchy::computeFootprint(grid, grid, 8, layerDescs).getTotal());
+
+		std::mt19937 generator(1234);
+
+		if (selected(options, kernels[0])) {
+			c._kernel = kernels[0];
+
+			report(options, c, measure(options, [&] {
+				PredictiveHierarchy ph;
+
+				ph.createRandom(grid, grid, 8, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+			}));
+		}
+
+		if (selected(options, kernels[1])) {
+			c._kernel = kernels[1];
+
+			report(options, c, measure(options, [&] {
+				PredictiveHierarchy ph;
+
+				ph.createRandom(grid, grid, 8, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, 1234ull);
+			}));
+		}
+
+		c._inputs = grid * grid / 4;
+		c._cells = agentLayerDescs.front()._cellsPerColumn;
+		c._bytes = static_cast<double>(Agent().computeFootprint(grid / 2, grid / 2, 4, agentLayerDescs).getTotal());
+
+		if (selected(options, kernels[2])) {
+			c._kernel = kernels[2];
+
+			report(options, c, measure(options, [&] {
+				Agent agent;
+
+				agent.createRandom(grid / 2, grid / 2, 4, agentLayerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+			}));
+		}
+
+		if (selected(options, kernels[3])) {
+			c._kernel = kernels[3];
+
+			report(options, c, measure(options, [&] {
+				Agent agent;
+
+				agent.createRandom(grid / 2, grid / 2, 4, agentLayerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, 1234ull);
+			}));
+		}
+	}
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--filter", 1);
+	parser.addArgument("--format", 1);
+	parser.addArgument("--mintime", 1);
+	parser.addArgument("--trials", 1);
+	parser.addArgument("--matrix", 1);
+	parser.addArgument("--fixed", 1);
+
+	parser.parse(argc, argv);
+
+	Options options;
+	options._filter = parser.retrieve("filter", "");
+	options._format = parser.retrieve("format", "csv");
+	options._minTime = std::atof(parser.retrieve("mintime", "0.3").c_str());
+	options._trials = std::max(1, std::atoi(parser.retrieve("trials", "3").c_str()));
+
+	options._fixed = std::atoi(parser.retrieve("fixed", "1").c_str()) != 0;
+
+	// Counts this thread, which runs every kernel
+	PerfCounters perfCounters;
+
+	if (!perfCounters.open())
+		std::cerr << "Hardware counters not available (" << perfCounters.getError() << "), counter columns left empty" << std::endl;
+
+	options._perfCounters = &perfCounters;
+
+	// quick for a smoke run, full for the whole matrix
+	bool quick = parser.retrieve("matrix", "full") == "quick";
+
+	if (options._format != "json")
+		std::cout << "kernel,grid,radius,iter,layers,inputs,cells,connections,ns_per_step,ns_min,visits_per_step,connections_per_sec,est_bytes_per_step,est_gb_per_sec,cycles_per_step,ipc,llc_misses_per_visit,est_bytes_per_cycle" << std::endl;
+
+	if (quick) {
+		benchSparseCoder(options, { 16, 32 }, { 2, 4 }, { 10 });
+		benchColumn(options, { 16 }, { 64 });
+		benchHierarchy(options, { 16 }, { 1, 2 });
+		benchAgent(options, { 8 }, { 1 });
+		benchInit(options, { 32 });
+	}
+	else {
+		benchSparseCoder(options, { 16, 32, 64 }, { 2, 4, 6 }, { 10, 30 });
+		benchColumn(options, { 8, 16, 32 }, { 32, 128, 512 });
+		benchHierarchy(options, { 16, 32 }, { 1, 2, 4 });
+		benchAgent(options, { 8, 16 }, { 1, 2 });
+		benchInit(options, { 32, 64, 128 });
+	}
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+// Sharded sparse coder run: one layer split into row strips, each settled and trained by its own local process, which
+// swap halos with their neighbours over socket pairs every settle iteration. The same layer also runs whole in this process
+// on the same inputs, and the report shows how closely the sharded states follow it, the time per step of both and what one strip holds.
+// A lone sparse coder learning without rewards, the rest of a PredictiveHierarchy layer is not sharded (see SparseCoderShard)
+
+#include <neo/SparseCoderShard.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "../libs/argparse.hpp"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace neo;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	int _visibleSize, _hiddenSize;
+	int _receptiveRadius, _recurrentRadius, _lateralRadius;
+	int _iter;
+	float _leak;
+	bool _learn;
+	unsigned long long _seed;
+};
+
+// Two soft blobs circling the frame, so every strip sees moving input
+void makeFrame(int t, int size, std::vector<float> &frame) {
+	frame.resize(size * size);
+
+	float radius = size * 0.15f;
+
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++) {
+			float value = 0.0f;
+
+			for (int b = 0; b < 2; b++) {
+				float angle = t * 0.1f * (b + 1) + b * 3.14159f;
+
+				float cx = size * (0.5f + 0.3f * std::cos(angle));
+				float cy = size * (0.5f + 0.3f * std::sin(angle));
+
+				float d = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+
+				value = std::max(value, 1.0f - d / radius);
+			}
+
+			frame[x + y * size] = value;
+		}
+}
+
+void create(const Options &o, SparseCoder &sc) {
+	sc.createRandom(o._visibleSize, o._visibleSize, o._hiddenSize, o._hiddenSize, o._receptiveRadius, o._recurrentRadius, o._lateralRadius, -0.1f, 0.1f, 0.0f, 0.1f, 0.5f, o._seed, 1);
+}
+
+void learn(SparseCoder &sc, SparseCoder::State &state) {
+	sc.learn(state, 0.01f, 0.01f, 0.05f, 0.01f, 0.08f, 0.0f);
+}
+
+bool writeFully(int fd, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+
+	while (size > 0) {
+		ssize_t n = ::write(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool readFully(int fd, void* data, size_t size) {
+	char* p = static_cast<char*>(data);
+
+	while (size > 0) {
+		ssize_t n = ::read(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+// Body of one shard process: step through the frames and send the owned states of every step to the parent
+int runShard(const Options &o, const std::vector<SparseCoder::Strip> &strips, int index, int upLink, int downLink, int resultFd, int steps) {
+	SparseCoderShard shard;
+
+	shard.create(o._visibleSize, o._visibleSize, o._hiddenSize, o._hiddenSize, o._receptiveRadius, o._recurrentRadius, o._lateralRadius, -0.1f, 0.1f, 0.0f, 0.1f, 0.5f, o._seed, strips, index, upLink, downLink);
+
+	std::mt19937 generator(o._seed);
+
+	std::vector<float> frame;
+
+	for (int t = 0; t < steps; t++) {
+		makeFrame(t, o._visibleSize, frame);
+
+		shard.setInputs(frame.data());
+
+		if (!shard.activate(o._iter, o._leak, generator))
+			return 1;
+
+		if (!writeFully(resultFd, shard.getOwnedStates(), shard.getNumOwned() * sizeof(float)))
+			return 1;
+
+		if (o._learn)
+			shard.learn(0.01f, 0.01f, 0.05f, 0.01f, 0.08f, 0.0f);
+
+		shard.stepEnd();
+	}
+
+	return 0;
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--shards", 1);
+	parser.addArgument("--visible", 1);
+	parser.addArgument("--hidden", 1);
+	parser.addArgument("--radius", 1);
+	parser.addArgument("--steps", 1);
+	parser.addArgument("--iter", 1);
+	parser.addArgument("--learn", 1);
+	parser.addArgument("--seed", 1);
+
+	parser.parse(argc, argv);
+
+	int numShards = std::max(1, std::atoi(parser.retrieve("shards", "4").c_str()));
+	int steps = std::max(1, std::atoi(parser.retrieve("steps", "50").c_str()));
+
+	Options o;
+
+	o._visibleSize = std::max(2, std::atoi(parser.retrieve("visible", "64").c_str()));
+	o._hiddenSize = std::max(2, std::atoi(parser.retrieve("hidden", "48").c_str()));
+	o._receptiveRadius = o._recurrentRadius = o._lateralRadius = std::max(1, std::atoi(parser.retrieve("radius", "4").c_str()));
+	o._iter = std::max(1, std::atoi(parser.retrieve("iter", "30").c_str()));
+	o._leak = 0.1f;
+	o._learn = std::atoi(parser.retrieve("learn", "1").c_str()) != 0;
+	o._seed = std::strtoull(parser.retrieve("seed", "1").c_str(), nullptr, 10);
+
+	std::vector<SparseCoder::Strip> strips;
+
+	if (!SparseCoder::computeStrips(o._visibleSize, o._hiddenSize, o._receptiveRadius, o._recurrentRadius, o._lateralRadius, numShards, strips)) {
+		std::cerr << "Cannot split " << o._hiddenSize << " hidden rows with radius " << o._receptiveRadius << " into " << numShards << " strips" << std::endl;
+
+		return 1;
+	}
+
+	int numHidden = o._hiddenSize * o._hiddenSize;
+
+	// Whole layer in this process
+	SparseCoder whole;
+	SparseCoder::State state;
+
+	create(o, whole);
+	whole.initState(state);
+
+	std::mt19937 generator(o._seed);
+
+	std::vector<float> frame;
+	std::vector<float> reference(steps * numHidden);
+
+	Clock::time_point start = Clock::now();
+
+	for (int t = 0; t < steps; t++) {
+		makeFrame(t, o._visibleSize, frame);
+
+		std::copy(frame.begin(), frame.end(), state._visibleInputs.begin());
+
+		whole.activate(state, o._iter, o._leak, generator);
+
+		std::copy(state._hiddenStates.begin(), state._hiddenStates.end(), reference.begin() + t * numHidden);
+
+		if (o._learn)
+			learn(whole, state);
+
+		whole.stepEnd(state);
+	}
+
+	double wholeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << "Whole layer " << o._visibleSize << "x" << o._visibleSize << " -> " << o._hiddenSize << "x" << o._hiddenSize
+		<< ", " << whole.getFootprint().getTotal() / 1024 << " KB" << std::endl;
+
+	for (int i = 0; i < numShards; i++) {
+		SparseCoder strip;
+
+		strip.createRandomStrip(o._visibleSize, o._visibleSize, o._hiddenSize, o._hiddenSize, o._receptiveRadius, o._recurrentRadius, o._lateralRadius, -0.1f, 0.1f, 0.0f, 0.1f, 0.5f, o._seed, strips[i], 1);
+
+		std::cout << "Shard " << i << " owns rows " << strips[i]._ownedBegin << "-" << strips[i]._ownedEnd
+			<< ", holds " << strips[i]._hiddenBegin << "-" << strips[i]._hiddenEnd
+			<< ", sees " << strips[i]._visibleBegin << "-" << strips[i]._visibleEnd
+			<< ", " << strip.getFootprint().getTotal() / 1024 << " KB" << std::endl;
+	}
+
+	// Sharded, one process per strip
+	std::vector<std::pair<int, int> > links;
+
+	if (!SparseCoderShard::createLinks(numShards, links)) {
+		std::cerr << "Could not create the links between shards" << std::endl;
+
+		return 1;
+	}
+
+	std::vector<int> resultFds(numShards);
+	std::vector<pid_t> pids(numShards);
+
+	start = Clock::now();
+
+	for (int i = 0; i < numShards; i++) {
+		int fds[2];
+
+		if (pipe(fds) != 0) {
+			std::cerr << "Could not create a pipe" << std::endl;
+
+			return 1;
+		}
+
+		pids[i] = fork();
+
+		if (pids[i] == 0) {
+			close(fds[0]);
+
+			int upLink = i > 0 ? links[i - 1].second : -1;
+			int downLink = i + 1 < numShards ? links[i].first : -1;
+
+			// Keep only this shard's ends
+			for (int j = 0; j < links.size(); j++) {
+				if (links[j].first != downLink)
+					close(links[j].first);
+
+				if (links[j].second != upLink)
+					close(links[j].second);
+			}
+
+			for (int j = 0; j < i; j++)
+				close(resultFds[j]);
+
+			_exit(runShard(o, strips, i, upLink, downLink, fds[1], steps));
+		}
+
+		close(fds[1]);
+
+		resultFds[i] = fds[0];
+	}
+
+	for (int j = 0; j < links.size(); j++) {
+		SparseCoderShard::closeLink(links[j].first);
+		SparseCoderShard::closeLink(links[j].second);
+	}
+
+	// Gather step by step, a shard blocked on a full pipe would stall its neighbours
+	std::vector<float> sharded(steps * numHidden);
+
+	bool failed = false;
+
+	for (int t = 0; t < steps && !failed; t++)
+		for (int i = 0; i < numShards; i++) {
+			int offset = t * numHidden + strips[i]._ownedBegin * o._hiddenSize;
+			int count = (strips[i]._ownedEnd - strips[i]._ownedBegin) * o._hiddenSize;
+
+			if (!readFully(resultFds[i], &sharded[offset], count * sizeof(float))) {
+				failed = true;
+
+				break;
+			}
+		}
+
+	double shardedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (int i = 0; i < numShards; i++) {
+		close(resultFds[i]);
+
+		int status;
+
+		waitpid(pids[i], &status, 0);
+
+		failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	}
+
+	if (failed) {
+		std::cerr << "A shard failed" << std::endl;
+
+		return 1;
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Whole   " << wholeSeconds * 1000.0 / steps << " ms/step" << std::endl;
+	std::cout << "Sharded " << shardedSeconds * 1000.0 / steps << " ms/step on " << numShards << " processes" << std::endl;
+
+	// Reconstructions shared by two strips are summed in another order, so states agree to rounding until a node near its threshold flips
+	int firstFlip = -1;
+
+	for (int t = 0; t < steps; t++) {
+		float maxDifference = 0.0f;
+		int flips = 0;
+
+		for (int hi = 0; hi < numHidden; hi++) {
+			float a = reference[t * numHidden + hi];
+			float b = sharded[t * numHidden + hi];
+
+			maxDifference = std::max(maxDifference, std::abs(a - b));
+			flips += (a > 0.0f) != (b > 0.0f);
+		}
+
+		if (flips > 0 && firstFlip == -1)
+			firstFlip = t;
+
+		if (t == 0 || t == steps - 1 || (flips > 0 && t == firstFlip))
+			std::cout << "Step " << t << ": max state difference " << std::setprecision(6) << maxDifference << ", " << flips << " of " << numHidden << " nodes differ in activity" << std::setprecision(3) << std::endl;
+	}
+
+	if (firstFlip == -1)
+		std::cout << "Activity identical in all " << steps << " steps" << std::endl;
+
+	return 0;
+}
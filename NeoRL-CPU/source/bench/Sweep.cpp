@@ -0,0 +1,473 @@
+// Hyperparameter sweep over the text prediction model: a grid or random search over the model options of the text prediction
+// example and the LayerDesc fields. Trials run concurrently on worker threads of one process, all reading one memory mapped corpus,
+// and every trial reports next symbol accuracy, steps per second and model memory into a results table
+
+#include <neo/PredictiveHierarchy.h>
+
+#include "../examples/TextSource.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "../libs/argparse.hpp"
+
+using namespace neo;
+
+typedef std::chrono::steady_clock Clock;
+
+// A swept option, with the value used when it is not given
+struct Param {
+	const char* _name;
+	float _default;
+
+	// LayerDesc field it sets on every layer, if any
+	int PredictiveHierarchy::LayerDesc::* _intField;
+	float PredictiveHierarchy::LayerDesc::* _floatField;
+};
+
+typedef PredictiveHierarchy::LayerDesc LayerDesc;
+
+// The model options first, with the text prediction example's defaults
+const Param params[] = {
+	{ "nlayers", 3.0f, nullptr, nullptr },
+	{ "lw", 16.0f, nullptr, nullptr },
+	{ "lh", 16.0f, nullptr, nullptr },
+	{ "ifbradius", 16.0f, nullptr, nullptr },
+	{ "receptive", 4.0f, &LayerDesc::_receptiveRadius, nullptr },
+	{ "recurrent", 4.0f, &LayerDesc::_recurrentRadius, nullptr },
+	{ "lateral", 4.0f, &LayerDesc::_lateralRadius, nullptr },
+	{ "predictive", 4.0f, &LayerDesc::_predictiveRadius, nullptr },
+	{ "feedback", 4.0f, &LayerDesc::_feedBackRadius, nullptr },
+	{ "learnff", 0.01f, nullptr, &LayerDesc::_learnFeedForward },
+	{ "learnrec", 0.01f, nullptr, &LayerDesc::_learnRecurrent },
+	{ "learnlat", 0.05f, nullptr, &LayerDesc::_learnLateral },
+	{ "learnfb", 0.1f, nullptr, &LayerDesc::_learnFeedBack },
+	{ "learnpred", 0.03f, nullptr, &LayerDesc::_learnPrediction },
+	{ "sdriter", 30.0f, &LayerDesc::_sdrIter, nullptr },
+	{ "sdrleak", 0.1f, nullptr, &LayerDesc::_sdrLeak },
+	{ "sdrlambda", 0.95f, nullptr, &LayerDesc::_sdrLambda },
+	{ "sparsity", 0.08f, nullptr, &LayerDesc::_sdrSparsity },
+	{ "sensitivity", 6.0f, nullptr, &LayerDesc::_sdrSensitivity }
+};
+
+const int numParams = sizeof(params) / sizeof(Param);
+
+enum ParamIndex {
+	_numLayers = 0, _layerWidth, _layerHeight, _inputFeedBackRadius
+};
+
+bool isInteger(int p) {
+	return p <= _inputFeedBackRadius || params[p]._intField != nullptr;
+}
+
+// Values an option may take: a list for grids, or a range [_min, _max] for random search
+struct Domain {
+	std::vector<float> _values;
+
+	bool _isRange;
+	float _min, _max;
+
+	// Given on the command line
+	bool _swept;
+
+	Domain()
+		: _isRange(false), _min(0.0f), _max(0.0f), _swept(false)
+	{}
+};
+
+// "a,b,c" or "min:max". Returns false if it does not parse
+bool parseDomain(const std::string &text, Domain &domain) {
+	size_t colon = text.find(':');
+
+	char* end;
+
+	if (colon != std::string::npos) {
+		domain._isRange = true;
+		domain._min = std::strtof(text.c_str(), &end);
+
+		if (end != text.c_str() + colon)
+			return false;
+
+		domain._max = std::strtof(text.c_str() + colon + 1, &end);
+
+		return *end == '\0' && domain._min <= domain._max;
+	}
+
+	std::istringstream fromText(text);
+
+	std::string value;
+
+	while (std::getline(fromText, value, ',')) {
+		domain._values.push_back(std::strtof(value.c_str(), &end));
+
+		if (value.empty() || *end != '\0')
+			return false;
+	}
+
+	return !domain._values.empty();
+}
+
+struct Trial {
+	float _values[numParams];
+};
+
+struct Result {
+	bool _ran;
+	bool _overBudget;
+
+	float _accuracy;
+
+	double _trainStepsPerSecond;
+	double _evalStepsPerSecond;
+
+	double _modelKilobytes;
+	double _seconds;
+
+	Result()
+		: _ran(false), _overBudget(false), _accuracy(0.0f), _trainStepsPerSecond(0.0), _evalStepsPerSecond(0.0), _modelKilobytes(0.0), _seconds(0.0)
+	{}
+};
+
+// Read only state every trial shares
+struct Corpus {
+	TextSource _source;
+
+	std::vector<unsigned char> _alphabet;
+
+	// Symbol index of every byte
+	int _symbolIndices[256];
+
+	int _inputsRoot;
+};
+
+void buildLayerDescs(const Trial &trial, std::vector<LayerDesc> &layerDescs) {
+	layerDescs.assign(std::max(1, static_cast<int>(trial._values[_numLayers])), LayerDesc());
+
+	for (int l = 0; l < layerDescs.size(); l++) {
+		layerDescs[l]._width = std::max(1, static_cast<int>(trial._values[_layerWidth]));
+		layerDescs[l]._height = std::max(1, static_cast<int>(trial._values[_layerHeight]));
+
+		for (int p = 0; p < numParams; p++) {
+			if (params[p]._intField != nullptr)
+				layerDescs[l].*params[p]._intField = static_cast<int>(std::round(trial._values[p]));
+			else if (params[p]._floatField != nullptr)
+				layerDescs[l].*params[p]._floatField = trial._values[p];
+		}
+	}
+}
+
+// Train on the first trainSteps symbols for epochs passes, then measure next symbol accuracy on the evalSteps after them without learning
+Result runTrial(const Trial &trial, const Corpus &corpus, int trainSteps, int evalSteps, int epochs, unsigned long long seed, size_t memoryBudget) {
+	Result result;
+
+	std::vector<LayerDesc> layerDescs;
+
+	buildLayerDescs(trial, layerDescs);
+
+	int inputFeedBackRadius = static_cast<int>(trial._values[_inputFeedBackRadius]);
+
+	result._modelKilobytes = PredictiveHierarchy::computeFootprint(corpus._inputsRoot, corpus._inputsRoot, inputFeedBackRadius, layerDescs).getTotal() / 1024.0;
+
+	if (memoryBudget > 0 && result._modelKilobytes * 1024.0 > memoryBudget) {
+		result._overBudget = true;
+
+		return result;
+	}
+
+	Clock::time_point trialStart = Clock::now();
+
+	std::mt19937 generator(seed);
+
+	PredictiveHierarchy ph;
+
+	// Trials already fill the cores, so each initializes on its own thread
+	ph.createRandom(corpus._inputsRoot, corpus._inputsRoot, inputFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, seed, 1);
+
+	const unsigned char* text = reinterpret_cast<const unsigned char*>(corpus._source.data());
+	size_t size = corpus._source.size();
+
+	int previous = 0;
+
+	// One hot, only the last symbol's input has to be cleared
+	auto setSymbol = [&](size_t position) {
+		ph.setInput(previous, 0.0f);
+
+		previous = corpus._symbolIndices[text[position % size]];
+
+		ph.setInput(previous, 1.0f);
+	};
+
+	Clock::time_point start = Clock::now();
+
+	for (int e = 0; e < epochs; e++)
+		for (int t = 0; t < trainSteps; t++) {
+			setSymbol(t);
+
+			ph.simStep(generator, true);
+		}
+
+	result._trainStepsPerSecond = static_cast<double>(epochs) * trainSteps / std::max(1e-9, std::chrono::duration<double>(Clock::now() - start).count());
+
+	start = Clock::now();
+
+	int correct = 0;
+
+	int numSymbols = corpus._alphabet.size();
+
+	for (int t = trainSteps; t < trainSteps + evalSteps; t++) {
+		setSymbol(t);
+
+		ph.simStep(generator, false);
+
+		int predicted = 0;
+
+		for (int i = 1; i < numSymbols; i++)
+			if (ph.getPrediction(i) > ph.getPrediction(predicted))
+				predicted = i;
+
+		if (predicted == corpus._symbolIndices[text[(t + 1) % size]])
+			correct++;
+	}
+
+	result._evalStepsPerSecond = evalSteps / std::max(1e-9, std::chrono::duration<double>(Clock::now() - start).count());
+
+	result._accuracy = static_cast<float>(correct) / std::max(1, evalSteps);
+	result._modelKilobytes = ph.getFootprint().getTotal() / 1024.0;
+	result._seconds = std::chrono::duration<double>(Clock::now() - trialStart).count();
+	result._ran = true;
+
+	return result;
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("-c", "--corpus", 1);
+	parser.addArgument("--train", 1);
+	parser.addArgument("--eval", 1);
+	parser.addArgument("--epochs", 1);
+	parser.addArgument("--random", 1);
+	parser.addArgument("--jobs", 1);
+	parser.addArgument("--budget", 1);
+	parser.addArgument("--seed", 1);
+	parser.addArgument("-o", "--out", 1);
+
+	for (int p = 0; p < numParams; p++)
+		parser.addArgument(std::string("--") + params[p]._name, 1);
+
+	parser.parse(argc, argv);
+
+	std::string corpusPath = parser.retrieve("corpus", "corpus.txt");
+	int numRandom = std::max(0, std::atoi(parser.retrieve("random", "0").c_str()));
+	int jobs = std::atoi(parser.retrieve("jobs", "0").c_str());
+	int epochs = std::max(1, std::atoi(parser.retrieve("epochs", "1").c_str()));
+	size_t memoryBudget = static_cast<size_t>(std::atof(parser.retrieve("budget", "0").c_str()) * 1024.0 * 1024.0);
+	unsigned long long seed = std::strtoull(parser.retrieve("seed", "1").c_str(), nullptr, 10);
+	std::string outPath = parser.retrieve("out", "sweep.csv");
+
+	if (jobs <= 0)
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+
+	// ---------------------------------- Shared Corpus ----------------------------------
+	// One mapping for every trial, pages are loaded once and shared
+	Corpus corpus;
+
+	if (!corpus._source.open(corpusPath) || corpus._source.size() < 2) {
+		std::cerr << "Could not open corpus " << corpusPath << std::endl;
+
+		return 1;
+	}
+
+	corpus._alphabet = corpus._source.scanAlphabet();
+
+	std::fill(corpus._symbolIndices, corpus._symbolIndices + 256, 0);
+
+	for (int i = 0; i < corpus._alphabet.size(); i++)
+		corpus._symbolIndices[corpus._alphabet[i]] = i;
+
+	corpus._inputsRoot = std::ceil(std::sqrt(static_cast<float>(corpus._alphabet.size())));
+
+	int trainSteps = std::max(1, std::atoi(parser.retrieve("train", std::to_string(std::min<size_t>(corpus._source.size() - 1, 20000))).c_str()));
+	int evalSteps = std::max(1, std::atoi(parser.retrieve("eval", "2000").c_str()));
+
+	// ---------------------------------- Trials ----------------------------------
+	Domain domains[numParams];
+
+	for (int p = 0; p < numParams; p++) {
+		std::string text = parser.retrieve(params[p]._name, "");
+
+		if (text.empty()) {
+			domains[p]._values.push_back(params[p]._default);
+
+			continue;
+		}
+
+		if (!parseDomain(text, domains[p])) {
+			std::cerr << "Could not parse --" << params[p]._name << " " << text << ", expected a,b,c or min:max" << std::endl;
+
+			return 1;
+		}
+
+		if (domains[p]._isRange && numRandom == 0) {
+			std::cerr << "--" << params[p]._name << " is a range, which only random search (--random) can sample" << std::endl;
+
+			return 1;
+		}
+
+		domains[p]._swept = true;
+	}
+
+	std::vector<Trial> trials;
+
+	if (numRandom > 0) {
+		// Ranges uniformly, lists by picking one value
+		std::mt19937 sweepGenerator(seed);
+
+		for (int i = 0; i < numRandom; i++) {
+			Trial trial;
+
+			for (int p = 0; p < numParams; p++) {
+				const Domain &d = domains[p];
+
+				if (d._isRange && isInteger(p))
+					trial._values[p] = std::uniform_int_distribution<int>(std::ceil(d._min), std::floor(d._max))(sweepGenerator);
+				else if (d._isRange)
+					trial._values[p] = std::uniform_real_distribution<float>(d._min, d._max)(sweepGenerator);
+				else
+					trial._values[p] = d._values[std::uniform_int_distribution<int>(0, d._values.size() - 1)(sweepGenerator)];
+			}
+
+			trials.push_back(trial);
+		}
+	}
+	else {
+		// Every combination, the last option varying fastest
+		std::vector<int> indices(numParams, 0);
+
+		for (;;) {
+			Trial trial;
+
+			for (int p = 0; p < numParams; p++)
+				trial._values[p] = domains[p]._values[indices[p]];
+
+			trials.push_back(trial);
+
+			int p = numParams - 1;
+
+			for (; p >= 0; p--) {
+				if (++indices[p] < domains[p]._values.size())
+					break;
+
+				indices[p] = 0;
+			}
+
+			if (p < 0)
+				break;
+		}
+	}
+
+	std::cout << "Corpus: " << corpusPath << " size: " << corpus._source.size() << " alphabet size: " << corpus._alphabet.size() << std::endl;
+	std::cout << "Sweep: " << trials.size() << " trials on " << jobs << " threads, train: " << trainSteps << " x " << epochs << " eval: " << evalSteps << std::endl;
+
+	// ---------------------------------- Run ----------------------------------
+	// Workers take the next trial as they finish, trials differ a lot in cost
+	std::vector<Result> results(trials.size());
+
+	std::atomic<int> nextTrial(0);
+
+	std::mutex printMutex;
+
+	int numFinished = 0;
+
+	auto work = [&]() {
+		for (int i = nextTrial++; i < trials.size(); i = nextTrial++) {
+			results[i] = runTrial(trials[i], corpus, trainSteps, evalSteps, epochs, seed + i, memoryBudget);
+
+			std::lock_guard<std::mutex> lock(printMutex);
+
+			std::cerr << "[" << ++numFinished << "/" << trials.size() << "] trial " << i;
+
+			if (results[i]._overBudget)
+				std::cerr << " over budget (" << results[i]._modelKilobytes << " KB)" << std::endl;
+			else
+				std::cerr << " accuracy " << results[i]._accuracy << " in " << results[i]._seconds << " s" << std::endl;
+		}
+	};
+
+	std::vector<std::thread> workers;
+
+	for (int t = 1; t < std::min<int>(jobs, trials.size()); t++)
+		workers.push_back(std::thread(work));
+
+	work();
+
+	for (int t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	// ---------------------------------- Results ----------------------------------
+	// Steps per second are measured with the other trials running, compare them within one sweep
+	std::ofstream toResults(outPath);
+
+	if (!toResults.is_open()) {
+		std::cerr << "Could not write " << outPath << std::endl;
+
+		return 1;
+	}
+
+	toResults << "trial";
+
+	for (int p = 0; p < numParams; p++)
+		if (p <= _inputFeedBackRadius || domains[p]._swept)
+			toResults << "," << params[p]._name;
+
+	toResults << ",status,accuracy,train_steps_per_sec,eval_steps_per_sec,model_kb,seconds\n";
+
+	for (int i = 0; i < trials.size(); i++) {
+		const Result &r = results[i];
+
+		toResults << i;
+
+		for (int p = 0; p < numParams; p++)
+			if (p <= _inputFeedBackRadius || domains[p]._swept)
+				toResults << "," << trials[i]._values[p];
+
+		toResults << "," << (r._overBudget ? "over_budget" : "ok") << "," << r._accuracy << "," << r._trainStepsPerSecond << "," << r._evalStepsPerSecond
+			<< "," << r._modelKilobytes << "," << r._seconds << "\n";
+	}
+
+	// Best first
+	std::vector<int> order(trials.size());
+
+	for (int i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return results[a]._accuracy > results[b]._accuracy; });
+
+	std::cout << std::setw(6) << "trial" << std::setw(10) << "accuracy" << std::setw(12) << "train/s" << std::setw(12) << "model KB" << std::endl;
+
+	for (int i = 0; i < std::min<int>(order.size(), 10); i++) {
+		const Result &r = results[order[i]];
+
+		if (!r._ran)
+			continue;
+
+		std::cout << std::setw(6) << order[i] << std::fixed << std::setprecision(4) << std::setw(10) << r._accuracy
+			<< std::setprecision(1) << std::setw(12) << r._trainStepsPerSecond << std::setw(12) << r._modelKilobytes << std::endl;
+	}
+
+	std::cout << "Results: " << outPath << std::endl;
+
+	return 0;
+}
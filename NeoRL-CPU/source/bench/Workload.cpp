@@ -0,0 +1,476 @@
+// End to end PredictiveHierarchy benchmark on synthetic, seeded sequences: a repeating pattern, Markov text and
+// noisy store-like sales series. Each workload is trained, evaluated without learning and then sampled from,
+// and speed and prediction quality are reported together as "workload.metric value" lines that diff cleanly between builds
+
+#include <neo/PredictiveHierarchy.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "../libs/argparse.hpp"
+
+#include <sys/resource.h>
+
+using namespace neo;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Workload {
+	std::string _name;
+
+	int _inputWidth, _inputHeight;
+
+	// One frame of inputs per step
+	std::vector<std::vector<float> > _frames;
+
+	// Symbol per step for discrete workloads, empty for continuous ones
+	int _numSymbols;
+	std::vector<int> _symbols;
+
+	// Most likely successor of every symbol, to report the best accuracy any predictor can reach
+	std::vector<int> _bestSuccessors;
+
+	// Number of continuous series
+	int _numSeries;
+
+	Workload()
+		: _inputWidth(0), _inputHeight(0), _numSymbols(0), _numSeries(0)
+	{}
+};
+
+void setAlphabet(Workload &w, int numSymbols) {
+	w._numSymbols = numSymbols;
+	w._inputWidth = w._inputHeight = std::ceil(std::sqrt(static_cast<float>(numSymbols)));
+}
+
+void addSymbol(Workload &w, int symbol) {
+	std::vector<float> frame(w._inputWidth * w._inputHeight, 0.0f);
+
+	frame[symbol] = 1.0f;
+
+	w._frames.push_back(frame);
+	w._symbols.push_back(symbol);
+}
+
+// A fixed random pattern of symbols, repeated
+Workload periodic(int steps, std::mt19937 &generator) {
+	Workload w;
+	w._name = "periodic";
+
+	setAlphabet(w, 16);
+
+	std::uniform_int_distribution<int> symbolDist(0, w._numSymbols - 1);
+
+	std::vector<int> pattern(12);
+
+	for (int i = 0; i < pattern.size(); i++)
+		pattern[i] = symbolDist(generator);
+
+	w._bestSuccessors.assign(w._numSymbols, -1);
+
+	for (int t = 0; t < steps; t++)
+		addSymbol(w, pattern[t % pattern.size()]);
+
+	return w;
+}
+
+// First order Markov chain where every symbol has a few successors, one of them dominant
+Workload markovText(int steps, std::mt19937 &generator) {
+	Workload w;
+	w._name = "markov_text";
+
+	setAlphabet(w, 27);
+
+	std::uniform_int_distribution<int> symbolDist(0, w._numSymbols - 1);
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+	const int numSuccessors = 3;
+
+	std::vector<std::vector<int> > successors(w._numSymbols, std::vector<int>(numSuccessors));
+	std::vector<std::vector<float> > probabilities(w._numSymbols, std::vector<float>(numSuccessors));
+
+	w._bestSuccessors.resize(w._numSymbols);
+
+	for (int s = 0; s < w._numSymbols; s++) {
+		float total = 0.0f;
+
+		for (int i = 0; i < numSuccessors; i++) {
+			successors[s][i] = symbolDist(generator);
+			probabilities[s][i] = (i == 0 ? 3.0f : 0.0f) + dist01(generator);
+
+			total += probabilities[s][i];
+		}
+
+		for (int i = 0; i < numSuccessors; i++)
+			probabilities[s][i] /= total;
+
+		w._bestSuccessors[s] = successors[s][0];
+	}
+
+	int symbol = 0;
+
+	for (int t = 0; t < steps; t++) {
+		addSymbol(w, symbol);
+
+		float r = dist01(generator);
+
+		int next = numSuccessors - 1;
+
+		for (int i = 0; i < numSuccessors - 1; i++) {
+			if (r < probabilities[symbol][i]) {
+				next = i;
+
+				break;
+			}
+
+			r -= probabilities[symbol][i];
+		}
+
+		symbol = successors[symbol][next];
+	}
+
+	return w;
+}
+
+// Daily sales of several stores: weekly and monthly seasonality, a trend, promotions and noise, scaled into [0, 1]
+Workload storeSales(int steps, std::mt19937 &generator) {
+	Workload w;
+	w._name = "store_sales";
+
+	w._numSeries = 16;
+	w._inputWidth = w._inputHeight = 4;
+
+	const float pi = 3.14159265f;
+
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+	std::normal_distribution<float> noiseDist(0.0f, 0.03f);
+
+	std::vector<float> phases(w._numSeries), trends(w._numSeries), levels(w._numSeries);
+
+	for (int s = 0; s < w._numSeries; s++) {
+		phases[s] = dist01(generator) * 2.0f * pi;
+		trends[s] = (dist01(generator) - 0.5f) * 0.2f;
+		levels[s] = 0.3f + dist01(generator) * 0.3f;
+	}
+
+	for (int t = 0; t < steps; t++) {
+		std::vector<float> frame(w._numSeries);
+
+		bool promotion = (t / 7) % 4 == 0;
+
+		for (int s = 0; s < w._numSeries; s++) {
+			float value = levels[s] + 0.15f * std::sin(2.0f * pi * t / 7.0f + phases[s]) + 0.05f * std::sin(2.0f * pi * t / 30.4f)
+				+ trends[s] * t / steps + (promotion ? 0.1f : 0.0f) + noiseDist(generator);
+
+			frame[s] = std::min(1.0f, std::max(0.0f, value));
+		}
+
+		w._frames.push_back(frame);
+	}
+
+	return w;
+}
+
+struct Latencies {
+	std::vector<float> _micros;
+	double _seconds;
+
+	Latencies()
+		: _seconds(0.0)
+	{}
+
+	float percentile(float p) const {
+		std::vector<float> sorted = _micros;
+
+		std::sort(sorted.begin(), sorted.end());
+
+		int index = std::min<int>(sorted.size() - 1, std::ceil(p / 100.0f * sorted.size()) - 1);
+
+		return sorted.empty() ? 0.0f : sorted[std::max(0, index)];
+	}
+};
+
+struct Quality {
+	// Discrete
+	int _correct;
+	int _bestCorrect;
+
+	// Continuous
+	double _absoluteError;
+	double _persistenceError;
+
+	int _count;
+
+	Quality()
+		: _correct(0), _bestCorrect(0), _absoluteError(0.0), _persistenceError(0.0), _count(0)
+	{}
+};
+
+int predictedSymbol(const PredictiveHierarchy &ph, int numSymbols) {
+	int best = 0;
+
+	for (int i = 1; i < numSymbols; i++)
+		if (ph.getPrediction(i) > ph.getPrediction(best))
+			best = i;
+
+	return best;
+}
+
+void setFrame(PredictiveHierarchy &ph, const std::vector<float> &frame) {
+	for (int i = 0; i < frame.size(); i++)
+		ph.setInput(i, frame[i]);
+}
+
+// Score the prediction made after step t against frame t + 1
+void score(const PredictiveHierarchy &ph, const Workload &w, int t, Quality &q) {
+	if (t + 1 >= w._frames.size())
+		return;
+
+	if (w._numSymbols > 0) {
+		int symbol = w._symbols[t];
+		int next = w._symbols[t + 1];
+
+		if (predictedSymbol(ph, w._numSymbols) == next)
+			q._correct++;
+
+		if (w._bestSuccessors[symbol] < 0 || w._bestSuccessors[symbol] == next)
+			q._bestCorrect++;
+	}
+	else {
+		for (int s = 0; s < w._numSeries; s++) {
+			q._absoluteError += std::abs(ph.getPrediction(s) - w._frames[t + 1][s]);
+			q._persistenceError += std::abs(w._frames[t][s] - w._frames[t + 1][s]);
+		}
+	}
+
+	q._count++;
+}
+
+void printMetric(const std::string &workload, const std::string &metric, double value) {
+	std::cout << workload << "." << metric << " " << std::fixed << std::setprecision(4) << value << std::endl;
+}
+
+void printLatencies(const std::string &workload, const std::string &phase, const Latencies &l) {
+	printMetric(workload, phase + "_steps_per_sec", l._micros.size() / std::max(l._seconds, 1e-9));
+	printMetric(workload, phase + "_p50_us", l.percentile(50.0f));
+	printMetric(workload, phase + "_p99_us", l.percentile(99.0f));
+}
+
+// High water mark of the whole process, so it covers the workloads run before too
+long peakRSSKilobytes() {
+	rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_maxrss;
+}
+
+void run(const Workload &w, int trainSteps, int evalSteps, int sampleSteps, const std::vector<PredictiveHierarchy::LayerDesc> &layerDescs, unsigned int seed, bool profile) {
+	long peakBefore = peakRSSKilobytes();
+
+	std::mt19937 generator(seed);
+
+	PredictiveHierarchy ph;
+
+	ph.createRandom(w._inputWidth, w._inputHeight, 8, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+
+	StepProfiler profiler;
+
+	// Hardware counters for the profile where the environment allows them
+	PerfCounters perfCounters;
+
+	if (profile) {
+		ph.setProfiler(&profiler);
+
+		if (perfCounters.open())
+			profiler.setCounters(&perfCounters);
+		else
+			std::cerr << "Hardware counters not available (" << perfCounters.getError() << "), profiling wall time only" << std::endl;
+	}
+
+	Latencies train, eval, sample;
+	Quality quality;
+
+	// Train
+	Clock::time_point phaseStart = Clock::now();
+
+	for (int t = 0; t < trainSteps; t++) {
+		Clock::time_point start = Clock::now();
+
+		setFrame(ph, w._frames[t]);
+
+		ph.simStep(generator, true);
+
+		train._micros.push_back(std::chrono::duration<float, std::micro>(Clock::now() - start).count());
+	}
+
+	train._seconds = std::chrono::duration<double>(Clock::now() - phaseStart).count();
+
+	// Model health over training
+	PredictiveHierarchy::Stats stats = ph.getStats();
+
+	for (int l = 0; l < stats._layers.size(); l++) {
+		const PredictiveHierarchy::LayerStats &layer = stats._layers[l];
+
+		std::string prefix = "layer" + std::to_string(l) + "_";
+
+		printMetric(w._name, prefix + "sparsity", layer._sparsity);
+		printMetric(w._name, prefix + "target_sparsity", layer._targetSparsity);
+
+		if (!layer._spikesPerIteration.empty()) {
+			printMetric(w._name, prefix + "spikes_first_iter", layer._spikesPerIteration.front());
+			printMetric(w._name, prefix + "spikes_last_iter", layer._spikesPerIteration.back());
+		}
+
+		printMetric(w._name, prefix + "mean_threshold", layer._meanThreshold);
+		printMetric(w._name, prefix + "prediction_mse", layer._predictionError.getMean());
+		printMetric(w._name, prefix + "reward_mean", layer._rewards.getMean());
+		printMetric(w._name, prefix + "reward_std", layer._rewards.getStdDev());
+	}
+
+	printMetric(w._name, "input_prediction_mse", stats._inputPredictionError.getMean());
+
+	// Evaluate on the continuation, without learning
+	phaseStart = Clock::now();
+
+	for (int t = trainSteps; t < trainSteps + evalSteps; t++) {
+		Clock::time_point start = Clock::now();
+
+		setFrame(ph, w._frames[t]);
+
+		ph.simStep(generator, false);
+
+		eval._micros.push_back(std::chrono::duration<float, std::micro>(Clock::now() - start).count());
+
+		score(ph, w, t, quality);
+	}
+
+	eval._seconds = std::chrono::duration<double>(Clock::now() - phaseStart).count();
+
+	// Sample by feeding predictions back in
+	phaseStart = Clock::now();
+
+	for (int t = 0; t < sampleSteps; t++) {
+		Clock::time_point start = Clock::now();
+
+		if (w._numSymbols > 0) {
+			int symbol = predictedSymbol(ph, w._numSymbols);
+
+			for (int i = 0; i < w._inputWidth * w._inputHeight; i++)
+				ph.setInput(i, i == symbol ? 1.0f : 0.0f);
+		}
+		else {
+			for (int s = 0; s < w._numSeries; s++)
+				ph.setInput(s, ph.getPrediction(s));
+		}
+
+		ph.simStepGenerate(generator, 0.05f);
+
+		sample._micros.push_back(std::chrono::duration<float, std::micro>(Clock::now() - start).count());
+	}
+
+	sample._seconds = std::chrono::duration<double>(Clock::now() - phaseStart).count();
+
+	printLatencies(w._name, "train", train);
+	printLatencies(w._name, "eval", eval);
+	printLatencies(w._name, "sample", sample);
+
+	if (w._numSymbols > 0) {
+		printMetric(w._name, "accuracy", static_cast<double>(quality._correct) / std::max(1, quality._count));
+		printMetric(w._name, "best_possible_accuracy", static_cast<double>(quality._bestCorrect) / std::max(1, quality._count));
+	}
+	else {
+		printMetric(w._name, "mae", quality._absoluteError / std::max(1, quality._count * w._numSeries));
+		printMetric(w._name, "persistence_mae", quality._persistenceError / std::max(1, quality._count * w._numSeries));
+	}
+
+	printMetric(w._name, "model_kb", ph.getFootprint().getTotal() / 1024.0);
+	// How far this workload raised the process peak. 0 when an earlier workload peaked higher, run it alone (--workload) for its own peak
+	long peakAfter = peakRSSKilobytes();
+
+	printMetric(w._name, "process_peak_rss_kb", peakAfter);
+	printMetric(w._name, "peak_rss_growth_kb", peakAfter - peakBefore);
+
+	// On stderr so the report stays diffable
+	if (profile) {
+		std::cerr << w._name << " phases over all steps" << std::endl;
+
+		profiler.print(std::cerr);
+	}
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--workload", 1);
+	parser.addArgument("--train", 1);
+	parser.addArgument("--eval", 1);
+	parser.addArgument("--sample", 1);
+	parser.addArgument("--layers", 1);
+	parser.addArgument("--size", 1);
+	parser.addArgument("--seed", 1);
+	parser.addArgument("--profile", 1);
+	parser.addArgument("--trace", 1);
+
+	parser.parse(argc, argv);
+
+	std::string filter = parser.retrieve("workload", "");
+	int trainSteps = std::max(1, std::atoi(parser.retrieve("train", "2000").c_str()));
+	int evalSteps = std::max(2, std::atoi(parser.retrieve("eval", "500").c_str()));
+	int sampleSteps = std::max(1, std::atoi(parser.retrieve("sample", "200").c_str()));
+	int numLayers = std::max(1, std::atoi(parser.retrieve("layers", "2").c_str()));
+	int size = std::max(2, std::atoi(parser.retrieve("size", "16").c_str()));
+	unsigned int seed = std::atoi(parser.retrieve("seed", "1").c_str());
+	bool profile = std::atoi(parser.retrieve("profile", "0").c_str()) != 0;
+	std::string tracePath = parser.retrieve("trace", "");
+
+	std::vector<PredictiveHierarchy::LayerDesc> layerDescs(numLayers);
+
+	for (int l = 0; l < numLayers; l++) {
+		layerDescs[l]._width = size;
+		layerDescs[l]._height = size;
+	}
+
+	// The sequences depend on the seed only, not on the model settings
+	std::mt19937 generator(seed);
+
+	int steps = trainSteps + evalSteps;
+
+	std::vector<Workload> workloads;
+
+	workloads.push_back(periodic(steps, generator));
+	workloads.push_back(markovText(steps, generator));
+	workloads.push_back(storeSales(steps, generator));
+
+	printMetric("config", "train_steps", trainSteps);
+	printMetric("config", "eval_steps", evalSteps);
+	printMetric("config", "sample_steps", sampleSteps);
+	printMetric("config", "layers", numLayers);
+	printMetric("config", "size", size);
+	printMetric("config", "seed", seed);
+
+	// Chrome trace of the whole run, the rings keep the most recent events
+	if (!tracePath.empty())
+		Tracer::start();
+
+	for (int i = 0; i < workloads.size(); i++)
+		if (filter.empty() || workloads[i]._name.find(filter) != std::string::npos)
+			run(workloads[i], trainSteps, evalSteps, sampleSteps, layerDescs, seed, profile);
+
+	if (!tracePath.empty()) {
+		Tracer::stop();
+
+		if (!Tracer::write(tracePath))
+			std::cerr << "Could not write the trace to " << tracePath << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,339 @@
+// Compiles a hierarchy configuration that never changes at run time into C++. Reads a layer configuration (see Kaggle.layers)
+// and writes a translation unit implementing codegen/FixedHierarchy.h for it: the library's sparse coder kernels instantiated with
+// each layer's radii and grid widths as constants (SparseCoder::kernelsFor, GridStencils), run by PredictiveHierarchy::simStep. The build runs it on NEO_FIXED_CONFIG and links the result into NeoRL-FixedStep.
+//
+// Configuration lines, # starts a comment:
+//   input <width> <height> <feedBackRadius>    input grid and the feed back radius of its prediction
+//   init <minWeight> <maxWeight> <minInhibition> <maxInhibition> <threshold>    initialisation of create, optional
+//   layer <width> <height> [<field>=<value> ...]    one per layer, bottom first, LayerDesc fields named without the underscore
+
+#include <neo/PredictiveHierarchy.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../libs/argparse.hpp"
+
+using namespace neo;
+
+typedef PredictiveHierarchy::LayerDesc LayerDesc;
+
+struct Config {
+	std::string _name;
+
+	int _inputWidth, _inputHeight, _inputFeedBackRadius;
+
+	float _initMinWeight, _initMaxWeight;
+	float _initMinInhibition, _initMaxInhibition;
+	float _initThreshold;
+
+	std::vector<LayerDesc> _layerDescs;
+
+	Config()
+		: _inputWidth(0), _inputHeight(0), _inputFeedBackRadius(0),
+		_initMinWeight(-0.01f), _initMaxWeight(0.01f), _initMinInhibition(0.01f), _initMaxInhibition(0.05f), _initThreshold(0.1f)
+	{}
+};
+
+// LayerDesc fields a layer line can set, one of the two members is used
+struct Field {
+	const char* _name;
+
+	int LayerDesc::*_int;
+	float LayerDesc::*_float;
+};
+
+const Field fields[] = {
+	{ "receptiveRadius", &LayerDesc::_receptiveRadius, nullptr },
+	{ "recurrentRadius", &LayerDesc::_recurrentRadius, nullptr },
+	{ "lateralRadius", &LayerDesc::_lateralRadius, nullptr },
+	{ "predictiveRadius", &LayerDesc::_predictiveRadius, nullptr },
+	{ "feedBackRadius", &LayerDesc::_feedBackRadius, nullptr },
+	{ "learnFeedForward", nullptr, &LayerDesc::_learnFeedForward },
+	{ "learnRecurrent", nullptr, &LayerDesc::_learnRecurrent },
+	{ "learnLateral", nullptr, &LayerDesc::_learnLateral },
+	{ "learnFeedBack", nullptr, &LayerDesc::_learnFeedBack },
+	{ "learnPrediction", nullptr, &LayerDesc::_learnPrediction },
+	{ "sdrIter", &LayerDesc::_sdrIter, nullptr },
+	{ "sdrLeak", nullptr, &LayerDesc::_sdrLeak },
+	{ "sdrLambda", nullptr, &LayerDesc::_sdrLambda },
+	{ "sdrHiddenDecay", nullptr, &LayerDesc::_sdrHiddenDecay },
+	{ "sdrWeightDecay", nullptr, &LayerDesc::_sdrWeightDecay },
+	{ "sdrMaxWeightDelta", nullptr, &LayerDesc::_sdrMaxWeightDelta },
+	{ "sdrSparsity", nullptr, &LayerDesc::_sdrSparsity },
+	{ "sdrLearnThreshold", nullptr, &LayerDesc::_sdrLearnThreshold },
+	{ "sdrBaselineDecay", nullptr, &LayerDesc::_sdrBaselineDecay },
+	{ "sdrSensitivity", nullptr, &LayerDesc::_sdrSensitivity }
+};
+
+const int numFields = sizeof(fields) / sizeof(fields[0]);
+
+bool fail(const Config &config, int line, const std::string &message) {
+	std::cerr << config._name << ":" << line << ": " << message << std::endl;
+
+	return false;
+}
+
+bool setField(LayerDesc &ld, const std::string &assignment) {
+	size_t equals = assignment.find('=');
+
+	if (equals == std::string::npos)
+		return false;
+
+	std::string name = assignment.substr(0, equals);
+	std::string value = assignment.substr(equals + 1);
+
+	char* end = nullptr;
+
+	for (int f = 0; f < numFields; f++) {
+		if (name != fields[f]._name)
+			continue;
+
+		if (fields[f]._int != nullptr)
+			ld.*fields[f]._int = std::strtol(value.c_str(), &end, 10);
+		else
+			ld.*fields[f]._float = std::strtof(value.c_str(), &end);
+
+		return !value.empty() && *end == '\0';
+	}
+
+	return false;
+}
+
+bool readConfig(const std::string &path, Config &config) {
+	std::ifstream is(path.c_str());
+
+	config._name = path.substr(path.find_last_of("/\\") + 1);
+
+	if (!is.is_open())
+		return fail(config, 0, "cannot open");
+
+	std::string text;
+
+	for (int line = 1; std::getline(is, text); line++) {
+		text = text.substr(0, text.find('#'));
+
+		std::istringstream tokens(text);
+
+		std::string keyword;
+
+		if (!(tokens >> keyword))
+			continue;
+
+		if (keyword == "input") {
+			if (!(tokens >> config._inputWidth >> config._inputHeight >> config._inputFeedBackRadius) || config._inputWidth <= 0 || config._inputHeight <= 0 || config._inputFeedBackRadius < 0)
+				return fail(config, line, "expected input <width> <height> <feedBackRadius>");
+		}
+		else if (keyword == "init") {
+			if (!(tokens >> config._initMinWeight >> config._initMaxWeight >> config._initMinInhibition >> config._initMaxInhibition >> config._initThreshold))
+				return fail(config, line, "expected init <minWeight> <maxWeight> <minInhibition> <maxInhibition> <threshold>");
+		}
+		else if (keyword == "layer") {
+			LayerDesc ld;
+
+			if (!(tokens >> ld._width >> ld._height) || ld._width <= 0 || ld._height <= 0)
+				return fail(config, line, "expected layer <width> <height> [<field>=<value> ...]");
+
+			std::string assignment;
+
+			while (tokens >> assignment)
+				if (!setField(ld, assignment))
+					return fail(config, line, "unknown field or bad value in " + assignment);
+
+			if (ld._sdrIter < 1 || ld._receptiveRadius < 0 || ld._recurrentRadius < -1 || ld._lateralRadius < 0 || ld._predictiveRadius < 0 || ld._feedBackRadius < 0)
+				return fail(config, line, "radii must not be negative (recurrent -1 for none) and sdrIter at least 1");
+
+			config._layerDescs.push_back(ld);
+		}
+		else
+			return fail(config, line, "unknown keyword " + keyword);
+	}
+
+	if (config._inputWidth == 0)
+		return fail(config, 0, "no input line");
+
+	if (config._layerDescs.empty())
+		return fail(config, 0, "no layer lines");
+
+	// Connection indices are 16 bit
+	int numVisible = config._inputWidth * config._inputHeight;
+
+	for (int l = 0; l < config._layerDescs.size(); l++) {
+		const LayerDesc &ld = config._layerDescs[l];
+
+		if (numVisible > 65536 || ld._width * ld._height > 65536)
+			return fail(config, 0, "layer " + std::to_string(l) + " is too large for 16 bit connection indices");
+
+		numVisible = ld._width * ld._height;
+	}
+
+	return true;
+}
+
+// Shortest float literal that reads back as value
+std::string literal(float value) {
+	char buffer[32];
+
+	for (int precision = 6; precision <= 9; precision++) {
+		std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+
+		if (std::strtof(buffer, nullptr) == value)
+			break;
+	}
+
+	std::string s(buffer);
+
+	if (s.find_first_of(".e") == std::string::npos)
+		s += ".0";
+
+	return s + "f";
+}
+
+void writeUnit(std::ostream &os, const Config &config) {
+	const std::vector<LayerDesc> &layerDescs = config._layerDescs;
+
+	int numLayers = layerDescs.size();
+	int numInputs = config._inputWidth * config._inputHeight;
+
+	os << "// Generated by NeoRL-Codegen from " << config._name << ", do not edit. The build regenerates it when the configuration changes\n";
+	os << "//   input " << config._inputWidth << "x" << config._inputHeight << ", feed back radius " << config._inputFeedBackRadius << "\n";
+
+	for (int l = 0; l < numLayers; l++)
+		os << "//   layer " << l << " " << layerDescs[l]._width << "x" << layerDescs[l]._height << ", radii " << layerDescs[l]._receptiveRadius << "/" << layerDescs[l]._recurrentRadius << "/" << layerDescs[l]._lateralRadius
+			<< ", predictive " << layerDescs[l]._predictiveRadius << ", feed back " << layerDescs[l]._feedBackRadius << ", " << layerDescs[l]._sdrIter << " settle iterations\n";
+
+	os << "\n#include <codegen/FixedHierarchy.h>\n";
+	os << "#include <neo/SparseCoderKernels.h>\n\n";
+	os << "using namespace neo;\n\n";
+	os << "namespace {\n";
+	os << "\t// The library's sparse coder kernels, with each layer's radii and grid widths compiled into the stencil visits\n";
+
+	for (int l = 0; l < numLayers; l++) {
+		const LayerDesc &ld = layerDescs[l];
+
+		int visibleWidth = l == 0 ? config._inputWidth : layerDescs[l - 1]._width;
+
+		os << "\tconst SparseCoder::KernelTable layer" << l << "Kernels = SparseCoder::kernelsFor<GridStencils<" << ld._receptiveRadius << ", " << ld._recurrentRadius << ", " << ld._lateralRadius
+			<< ", " << visibleWidth << ", " << ld._width << "> >();\n";
+	}
+
+	os << "}\n\n";
+
+	os << "namespace generated {\n";
+	os << "\tconst char* getConfigName() {\n";
+	os << "\t\treturn \"" << config._name << "\";\n";
+	os << "\t}\n\n";
+	os << "\tint getInputWidth() {\n\t\treturn " << config._inputWidth << ";\n\t}\n\n";
+	os << "\tint getInputHeight() {\n\t\treturn " << config._inputHeight << ";\n\t}\n\n";
+	os << "\tint getInputFeedBackRadius() {\n\t\treturn " << config._inputFeedBackRadius << ";\n\t}\n\n";
+
+	os << "\tstd::vector<PredictiveHierarchy::LayerDesc> getLayerDescs() {\n";
+	os << "\t\tstd::vector<PredictiveHierarchy::LayerDesc> layerDescs(" << numLayers << ");\n";
+
+	for (int l = 0; l < numLayers; l++) {
+		os << "\n\t\tlayerDescs[" << l << "]._width = " << layerDescs[l]._width << ";\n";
+		os << "\t\tlayerDescs[" << l << "]._height = " << layerDescs[l]._height << ";\n";
+
+		for (int f = 0; f < numFields; f++) {
+			os << "\t\tlayerDescs[" << l << "]._" << fields[f]._name << " = ";
+
+			if (fields[f]._int != nullptr)
+				os << layerDescs[l].*fields[f]._int;
+			else
+				os << literal(layerDescs[l].*fields[f]._float);
+
+			os << ";\n";
+		}
+	}
+
+	os << "\n\t\treturn layerDescs;\n";
+	os << "\t}\n\n";
+
+	os << "\tvoid create(PredictiveHierarchy &h, unsigned long long seed, int numThreads) {\n";
+	os << "\t\th.createRandom(" << config._inputWidth << ", " << config._inputHeight << ", " << config._inputFeedBackRadius << ", getLayerDescs(), "
+		<< literal(config._initMinWeight) << ", " << literal(config._initMaxWeight) << ", " << literal(config._initMinInhibition) << ", " << literal(config._initMaxInhibition) << ", " << literal(config._initThreshold) << ", seed, numThreads);\n";
+	os << "\t}\n\n";
+
+	os << "\tbool matches(const PredictiveHierarchy &h) {\n";
+	os << "\t\tconst std::vector<PredictiveHierarchy::LayerDesc> &layerDescs = h.getLayerDescs();\n\n";
+	os << "\t\tif (layerDescs.size() != " << numLayers << " || h.getInputPredictionNodes().size() != " << numInputs
+		<< " || h.getLayer(0)._sdr.getVisibleWidth() != " << config._inputWidth << " || h.getLayer(0)._sdr.getVisibleHeight() != " << config._inputHeight << ")\n";
+	os << "\t\t\treturn false;\n";
+
+	// Every field, so only the configuration itself matches
+	for (int l = 0; l < numLayers; l++) {
+		const LayerDesc &ld = layerDescs[l];
+
+		std::string d = "layerDescs[" + std::to_string(l) + "].";
+
+		os << "\n\t\tif (" << d << "_width != " << ld._width << " || " << d << "_height != " << ld._height;
+
+		for (int f = 0; f < numFields; f++) {
+			os << (f % 3 == 0 ? "\n\t\t\t|| " : " || ") << d << "_" << fields[f]._name << " != ";
+
+			if (fields[f]._int != nullptr)
+				os << ld.*fields[f]._int;
+			else
+				os << literal(ld.*fields[f]._float);
+		}
+
+		os << ")\n";
+		os << "\t\t\treturn false;\n";
+	}
+
+	os << "\n\t\treturn true;\n";
+	os << "\t}\n\n";
+
+	os << "\tvoid simStep(PredictiveHierarchy &h, PredictiveHierarchy::State &state, std::mt19937 &generator, bool learn) {\n";
+	os << "\t\t// Only layers not on them yet are written, so copies sharing them keep their kernels\n";
+
+	for (int l = 0; l < numLayers; l++) {
+		os << "\t\tif (h.getLayer(" << l << ")._sdr.getKernels() != &layer" << l << "Kernels)\n";
+		os << "\t\t\th.setKernels(" << l << ", &layer" << l << "Kernels);\n\n";
+	}
+
+	os << "\t\th.simStep(state, generator, learn);\n";
+	os << "\t}\n";
+	os << "}\n";
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--config", 1);
+	parser.addArgument("--out", 1);
+
+	parser.parse(argc, argv);
+
+	std::string configPath = parser.retrieve("config", "");
+	std::string outPath = parser.retrieve("out", "");
+
+	if (configPath.empty() || outPath.empty()) {
+		std::cerr << "Usage: NeoRL-Codegen --config <file.layers> --out <file.cpp>" << std::endl;
+
+		return 1;
+	}
+
+	Config config;
+
+	if (!readConfig(configPath, config))
+		return 1;
+
+	std::ofstream os(outPath.c_str(), std::ios::binary);
+
+	writeUnit(os, config);
+
+	if (!os) {
+		std::cerr << "Cannot write " << outPath << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <neo/PredictiveHierarchy.h>
+
+// What a translation unit generated by NeoRL-Codegen from a layer configuration (*.layers) provides. A program links exactly one
+namespace generated {
+	// Name of the configuration the unit was generated from
+	const char* getConfigName();
+
+	int getInputWidth();
+	int getInputHeight();
+	int getInputFeedBackRadius();
+
+	// The configuration's layer descriptions, bottom first
+	std::vector<neo::PredictiveHierarchy::LayerDesc> getLayerDescs();
+
+	// createRandom with the configuration
+	void create(neo::PredictiveHierarchy &h, unsigned long long seed, int numThreads = 0);
+
+	// Whether h has the structure and step parameters the unit was generated for. simStep assumes it does
+	bool matches(const neo::PredictiveHierarchy &h);
+
+	// PredictiveHierarchy::simStep on sparse coder kernels compiled for the configuration's radii and grid widths, which it
+	// installs in the layers of h that are not on them yet (PredictiveHierarchy::setKernels). Same results, profiled and traced alike
+	void simStep(neo::PredictiveHierarchy &h, neo::PredictiveHierarchy::State &state, std::mt19937 &generator, bool learn = true);
+}
@@ -0,0 +1,134 @@
+// Steps the hierarchy NeoRL-Codegen compiled in (NEO_FIXED_CONFIG) with its generated simStep, next to a copy of it on the generic
+// PredictiveHierarchy::simStep, on the same seeded inputs. Reports whether both predict bit for bit the same and the time per step of each
+
+#include <codegen/FixedHierarchy.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "../libs/argparse.hpp"
+
+using namespace neo;
+
+typedef std::chrono::steady_clock Clock;
+
+// Two soft blobs circling the input grid
+void makeFrame(int t, int width, int height, std::vector<float> &frame) {
+	frame.resize(width * height);
+
+	float radius = std::min(width, height) * 0.15f;
+
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			float value = 0.0f;
+
+			for (int b = 0; b < 2; b++) {
+				float angle = t * 0.1f * (b + 1) + b * 3.14159f;
+
+				float cx = width * (0.5f + 0.3f * std::cos(angle));
+				float cy = height * (0.5f + 0.3f * std::sin(angle));
+
+				float d = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+
+				value = std::max(value, 1.0f - d / radius);
+			}
+
+			frame[x + y * width] = value;
+		}
+}
+
+bool samePredictions(const PredictiveHierarchy::State &a, const PredictiveHierarchy::State &b) {
+	if (a._inputPredictionStates != b._inputPredictionStates)
+		return false;
+
+	for (int l = 0; l < a._predictionStates.size(); l++)
+		if (a._predictionStates[l] != b._predictionStates[l] || a._sdrStates[l]._hiddenStates != b._sdrStates[l]._hiddenStates)
+			return false;
+
+	return true;
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--steps", 1);
+	parser.addArgument("--learn", 1);
+	parser.addArgument("--seed", 1);
+
+	parser.parse(argc, argv);
+
+	int steps = std::max(1, std::atoi(parser.retrieve("steps", "20").c_str()));
+	bool learn = std::atoi(parser.retrieve("learn", "1").c_str()) != 0;
+	unsigned long long seed = std::strtoull(parser.retrieve("seed", "1").c_str(), nullptr, 10);
+
+	PredictiveHierarchy fixed;
+
+	generated::create(fixed, seed, 1);
+
+	if (!generated::matches(fixed)) {
+		std::cerr << "The generated step does not match the hierarchy it created" << std::endl;
+
+		return 1;
+	}
+
+	// Same weights, stepped by the library
+	PredictiveHierarchy generic = fixed;
+
+	int width = generated::getInputWidth();
+	int height = generated::getInputHeight();
+
+	std::cout << "Configuration " << generated::getConfigName() << ": input " << width << "x" << height << ", " << fixed.getLayerDescs().size() << " layers, " << fixed.getFootprint().getTotal() / 1024 << " KB" << std::endl;
+
+	std::mt19937 fixedGenerator(seed);
+	std::mt19937 genericGenerator(seed);
+
+	std::vector<float> frame;
+
+	double fixedSeconds = 0.0;
+	double genericSeconds = 0.0;
+
+	int firstDifference = -1;
+
+	for (int t = 0; t < steps; t++) {
+		makeFrame(t, width, height, frame);
+
+		std::copy(frame.begin(), frame.end(), fixed.getState()._sdrStates.front()._visibleInputs.begin());
+		std::copy(frame.begin(), frame.end(), generic.getState()._sdrStates.front()._visibleInputs.begin());
+
+		Clock::time_point start = Clock::now();
+
+		generated::simStep(fixed, fixed.getState(), fixedGenerator, learn);
+
+		fixedSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		start = Clock::now();
+
+		generic.simStep(genericGenerator, learn);
+
+		genericSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (firstDifference == -1 && !samePredictions(fixed.getState(), generic.getState()))
+			firstDifference = t;
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Generated " << fixedSeconds * 1000.0 / steps << " ms/step" << std::endl;
+	std::cout << "Generic   " << genericSeconds * 1000.0 / steps << " ms/step" << std::endl;
+
+	if (firstDifference != -1) {
+		std::cout << "States first differ at step " << firstDifference << std::endl;
+
+		return 1;
+	}
+
+	std::cout << "States and predictions identical in all " << steps << " steps" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include "CsvReader.h"
+
+#include <cstring>
+#include <algorithm>
+
+bool CsvReader::open(const std::string &path, bool hasHeader) {
+	_fields.clear();
+	_header.clear();
+	_row = 0;
+
+	if (!_file.open(path))
+		return false;
+
+	_file.adviseSequential();
+
+	_position = _file.data();
+	_end = _file.data() + _file.size();
+
+	if (hasHeader) {
+		if (!nextRow())
+			return false;
+
+		for (int i = 0; i < _fields.size(); i++)
+			_header.push_back(_fields[i].str());
+
+		_row = 0;
+	}
+
+	return true;
+}
+
+bool CsvReader::nextRow() {
+	while (_position < _end) {
+		const char* lineEnd = static_cast<const char*>(std::memchr(_position, '\n', _end - _position));
+
+		if (lineEnd == nullptr)
+			lineEnd = _end;
+
+		const char* begin = _position;
+		const char* end = lineEnd;
+
+		_position = lineEnd < _end ? lineEnd + 1 : _end;
+
+		if (end > begin && end[-1] == '\r')
+			end--;
+
+		if (begin == end)
+			continue;
+
+		_fields.clear();
+
+		const char* fieldBegin = begin;
+
+		for (;;) {
+			const char* fieldEnd = static_cast<const char*>(std::memchr(fieldBegin, ',', end - fieldBegin));
+
+			if (fieldEnd == nullptr)
+				fieldEnd = end;
+
+			Field field = { fieldBegin, fieldEnd };
+
+			// Strip quotes
+			if (fieldEnd - fieldBegin >= 2 && fieldBegin[0] == '"' && fieldEnd[-1] == '"') {
+				field._begin++;
+				field._end--;
+			}
+
+			_fields.push_back(field);
+
+			if (fieldEnd == end)
+				break;
+
+			fieldBegin = fieldEnd + 1;
+		}
+
+		_row++;
+
+		return true;
+	}
+
+	return false;
+}
+
+int CsvReader::findColumn(const std::string &name) const {
+	for (int i = 0; i < _header.size(); i++)
+		if (_header[i] == name)
+			return i;
+
+	return -1;
+}
+
+size_t CsvReader::estimateRows() const {
+	if (_fields.empty())
+		return 0;
+
+	// Rows are at least as long as their separators and one character per field
+	size_t minRowLength = 2 * _fields.size();
+
+	return (_end - _position) / minRowLength + 1;
+}
+
+bool CsvReader::parseInt(const Field &field, int &value) {
+	const char* c = field._begin;
+
+	bool negative = false;
+
+	if (c < field._end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+
+		c++;
+	}
+
+	if (c == field._end)
+		return false;
+
+	int result = 0;
+
+	const char* digitsBegin = c;
+
+	for (; c < field._end && *c >= '0' && *c <= '9'; c++)
+		result = result * 10 + (*c - '0');
+
+	if (c == digitsBegin)
+		return false;
+
+	if (c < field._end && *c == '.') {
+		for (c++; c < field._end && *c == '0'; c++);
+	}
+
+	if (c != field._end)
+		return false;
+
+	value = negative ? -result : result;
+
+	return true;
+}
+
+bool CsvReader::parseDate(const Field &field, int &year, int &month, int &day) {
+	const char* c = field._begin;
+
+	if (field._end - c != 10 || c[4] != '-' || c[7] != '-')
+		return false;
+
+	for (int i = 0; i < 10; i++)
+		if (i != 4 && i != 7 && (c[i] < '0' || c[i] > '9'))
+			return false;
+
+	year = (c[0] - '0') * 1000 + (c[1] - '0') * 100 + (c[2] - '0') * 10 + (c[3] - '0');
+	month = (c[5] - '0') * 10 + (c[6] - '0');
+	day = (c[8] - '0') * 10 + (c[9] - '0');
+
+	return month >= 1 && month <= 12 && day >= 1 && day <= 31;
+}
+
+int CsvReader::daysFromCivil(int year, int month, int day) {
+	// Howard Hinnant's days_from_civil
+	year -= month <= 2;
+
+	int era = (year >= 0 ? year : year - 399) / 400;
+	int yearOfEra = year - era * 400;
+	int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+	return era * 146097 + dayOfEra - 719468;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+
+// Zero copy CSV reader over a memory mapped file. Fields point into the mapping and stay valid while the reader is open.
+// Handles \n and \r\n line ends and double quoted fields without separators or quotes inside them
+class CsvReader {
+public:
+	struct Field {
+		const char* _begin;
+		const char* _end;
+
+		bool empty() const {
+			return _begin == _end;
+		}
+
+		std::string str() const {
+			return std::string(_begin, _end);
+		}
+	};
+
+private:
+	MappedFile _file;
+
+	const char* _position;
+	const char* _end;
+
+	std::vector<Field> _fields;
+	std::vector<std::string> _header;
+
+	size_t _row;
+
+public:
+	CsvReader()
+		: _position(nullptr), _end(nullptr), _row(0)
+	{}
+
+	// Returns false if the file could not be opened or a header was expected and is missing
+	bool open(const std::string &path, bool hasHeader = true);
+
+	// Split the next non empty line into fields, false at the end of the file
+	bool nextRow();
+
+	int getNumFields() const {
+		return _fields.size();
+	}
+
+	const Field &getField(int index) const {
+		return _fields[index];
+	}
+
+	// Data rows read so far
+	size_t getRow() const {
+		return _row;
+	}
+
+	// Column of a header name, -1 if there is none
+	int findColumn(const std::string &name) const;
+
+	// Upper bound on the data rows from the file size and the current row length, for reserving
+	size_t estimateRows() const;
+
+	// Optional sign and digits. A fractional part of zeros ("1.0") is accepted. Returns false if the field holds anything else
+	static bool parseInt(const Field &field, int &value);
+
+	// YYYY-MM-DD
+	static bool parseDate(const Field &field, int &year, int &month, int &day);
+
+	// Days since 1970-01-01 of a proleptic Gregorian date
+	static int daysFromCivil(int year, int month, int day);
+};
@@ -0,0 +1,208 @@
+#include "FrameCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+using namespace FrameCacheFormat;
+
+bool FrameCacheWriter::create(const std::string &path, Format format, int frameSize, uint64_t key) {
+	if (format == _symbols && frameSize > 256)
+		return false;
+
+	_path = path;
+
+	std::memcpy(_header._magic, "NEOF", 4);
+	_header._version = _version;
+	_header._format = format;
+	_header._frameSize = frameSize;
+	_header._numFrames = 0;
+	_header._key = key;
+
+	_toFile.open(path + ".tmp", std::ios::binary | std::ios::trunc);
+
+	if (!_toFile.is_open())
+		return false;
+
+	// Placeholder, rewritten with the frame count by finish
+	_toFile.write(reinterpret_cast<const char*>(&_header), sizeof(Header));
+
+	return _toFile.good();
+}
+
+void FrameCacheWriter::write(const float* frame) {
+	if (_header._format == _dense)
+		_toFile.write(reinterpret_cast<const char*>(frame), _header._frameSize * sizeof(float));
+	else {
+		_indices.clear();
+		_values.clear();
+
+		for (uint32_t i = 0; i < _header._frameSize; i++)
+			if (frame[i] != 0.0f) {
+				_indices.push_back(i);
+				_values.push_back(frame[i]);
+			}
+
+		uint32_t count = _indices.size();
+
+		_toFile.write(reinterpret_cast<const char*>(&count), sizeof(uint32_t));
+		_toFile.write(reinterpret_cast<const char*>(_indices.data()), count * sizeof(uint32_t));
+		_toFile.write(reinterpret_cast<const char*>(_values.data()), count * sizeof(float));
+	}
+
+	_header._numFrames++;
+}
+
+void FrameCacheWriter::writeSymbol(int index) {
+	unsigned char symbol = static_cast<unsigned char>(index);
+
+	_toFile.write(reinterpret_cast<const char*>(&symbol), 1);
+
+	_header._numFrames++;
+}
+
+bool FrameCacheWriter::finish() {
+	std::string tmpPath = _path + ".tmp";
+
+	_toFile.seekp(0);
+	_toFile.write(reinterpret_cast<const char*>(&_header), sizeof(Header));
+	_toFile.close();
+
+	if (_toFile.fail() || std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+void FrameCache::Frame::copyTo(float* frame, int frameSize) const {
+	if (_values == nullptr) {
+		std::fill(frame, frame + frameSize, 0.0f);
+
+		frame[_symbol] = 1.0f;
+
+		return;
+	}
+
+	if (_indices == nullptr) {
+		std::copy(_values, _values + frameSize, frame);
+
+		return;
+	}
+
+	std::fill(frame, frame + frameSize, 0.0f);
+
+	for (int i = 0; i < _count; i++)
+		frame[_indices[i]] = _values[i];
+}
+
+bool FrameCache::open(const std::string &path, uint64_t key, int frameSize) {
+	if (!_file.open(path))
+		return false;
+
+	if (_file.size() < sizeof(Header)) {
+		_file.close();
+
+		return false;
+	}
+
+	std::memcpy(&_header, _file.data(), sizeof(Header));
+
+	bool valid = std::memcmp(_header._magic, "NEOF", 4) == 0 && _header._version == _version
+		&& _header._key == key && _header._frameSize == static_cast<uint32_t>(frameSize);
+
+	if (valid && _header._format == _dense)
+		valid = _file.size() == sizeof(Header) + _header._numFrames * _header._frameSize * sizeof(float);
+	else if (valid && _header._format == _symbols)
+		valid = _header._frameSize <= 256 && _file.size() == sizeof(Header) + _header._numFrames;
+	else if (valid)
+		valid = _header._format == _sparse;
+
+	if (!valid) {
+		_file.close();
+
+		return false;
+	}
+
+	_file.adviseSequential();
+
+	rewind();
+
+	return true;
+}
+
+bool FrameCache::next(Frame &frame) {
+	if (_frame >= _header._numFrames)
+		return false;
+
+	const char* data = _file.data();
+
+	if (_header._format == _dense) {
+		frame._values = reinterpret_cast<const float*>(data + _position);
+		frame._indices = nullptr;
+		frame._count = _header._frameSize;
+
+		_position += _header._frameSize * sizeof(float);
+	}
+	else if (_header._format == _symbols) {
+		frame._values = nullptr;
+		frame._indices = nullptr;
+		frame._count = 1;
+		frame._symbol = static_cast<unsigned char>(data[_position]);
+
+		if (frame._symbol >= static_cast<int>(_header._frameSize))
+			return false;
+
+		_position++;
+	}
+	else {
+		if (_position + sizeof(uint32_t) > _file.size())
+			return false;
+
+		uint32_t count;
+
+		std::memcpy(&count, data + _position, sizeof(uint32_t));
+
+		size_t end = _position + sizeof(uint32_t) + count * (sizeof(uint32_t) + sizeof(float));
+
+		if (count > _header._frameSize || end > _file.size())
+			return false;
+
+		frame._indices = reinterpret_cast<const uint32_t*>(data + _position + sizeof(uint32_t));
+		frame._values = reinterpret_cast<const float*>(frame._indices + count);
+		frame._count = count;
+
+		for (uint32_t i = 0; i < count; i++)
+			if (frame._indices[i] >= _header._frameSize)
+				return false;
+
+		_position = end;
+	}
+
+	_frame++;
+
+	return true;
+}
+
+uint64_t FrameCache::fileKey(const std::string &path) {
+	struct stat info;
+
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+
+	return mixKey(mixKey(0, info.st_size), info.st_mtime);
+}
+
+uint64_t FrameCache::mixKey(uint64_t key, uint64_t value) {
+	// SplitMix64 finalizer over the running key
+	uint64_t z = key ^ (value + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2));
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+	return z ^ (z >> 31);
+}
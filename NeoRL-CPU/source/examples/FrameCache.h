@@ -0,0 +1,125 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+// Input frames encoded once and stored in a binary file, so later epochs and runs stream them back from a memory mapping
+// instead of parsing and encoding the source again. The file is a Header followed by the frames:
+// dense frames are frameSize floats, sparse frames a uint32 count followed by count uint32 indices and count float values,
+// symbol frames (one hot, frameSize at most 256) the one byte index of their single 1
+namespace FrameCacheFormat {
+	enum Format {
+		_dense = 0, _sparse = 1, _symbols = 2
+	};
+
+	struct Header {
+		char _magic[4]; // "NEOF"
+		uint32_t _version;
+		uint32_t _format;
+		uint32_t _frameSize;
+		uint64_t _numFrames;
+
+		// Identifies the source and encoding the frames were made from, see FrameCache::fileKey
+		uint64_t _key;
+	};
+
+	const uint32_t _version = 1;
+}
+
+// Writes a cache to path + ".tmp" and renames it into place when finished, so a cache that exists is always complete
+class FrameCacheWriter {
+private:
+	std::string _path;
+
+	std::ofstream _toFile;
+
+	FrameCacheFormat::Header _header;
+
+	std::vector<uint32_t> _indices;
+	std::vector<float> _values;
+
+public:
+	// Returns false if the file could not be created
+	bool create(const std::string &path, FrameCacheFormat::Format format, int frameSize, uint64_t key);
+
+	// Append frameSize values. Sparse caches keep the non zero ones. Not for symbol caches
+	void write(const float* frame);
+
+	// Append the frame that is 1 at index and 0 elsewhere. Symbol caches only
+	void writeSymbol(int index);
+
+	// Write the header and move the file into place. Returns false on any write error, the partial file is removed
+	bool finish();
+};
+
+class FrameCache {
+public:
+	// Points into the mapping, valid until the cache is closed
+	struct Frame {
+		// Dense: frameSize values. Sparse: _count values at _indices. Symbol: both nullptr, a 1 at _symbol
+		const float* _values;
+		const uint32_t* _indices;
+		int _count;
+
+		int _symbol;
+
+		// Expand into frameSize values
+		void copyTo(float* frame, int frameSize) const;
+	};
+
+private:
+	MappedFile _file;
+
+	FrameCacheFormat::Header _header;
+
+	size_t _position;
+	uint64_t _frame;
+
+public:
+	FrameCache()
+		: _position(0), _frame(0)
+	{}
+
+	// Returns false if there is no cache at path, or it is corrupt or was made from something else (other key or frame size).
+	// The caller should then build it again with FrameCacheWriter
+	bool open(const std::string &path, uint64_t key, int frameSize);
+
+	void close() {
+		_file.close();
+	}
+
+	bool isOpen() const {
+		return _file.data() != nullptr;
+	}
+
+	// Next frame of the current pass, false at the end (or at a corrupt sparse frame)
+	bool next(Frame &frame);
+
+	// Start the next pass
+	void rewind() {
+		_position = sizeof(FrameCacheFormat::Header);
+		_frame = 0;
+	}
+
+	uint64_t getNumFrames() const {
+		return _header._numFrames;
+	}
+
+	int getFrameSize() const {
+		return _header._frameSize;
+	}
+
+	FrameCacheFormat::Format getFormat() const {
+		return static_cast<FrameCacheFormat::Format>(_header._format);
+	}
+
+	// Key of a source file from its size and modification time, cheap enough to check on every run
+	static uint64_t fileKey(const std::string &path);
+
+	// Fold an encoding parameter into a key
+	static uint64_t mixKey(uint64_t key, uint64_t value);
+};
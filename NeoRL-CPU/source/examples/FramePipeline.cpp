@@ -0,0 +1,101 @@
+#include "FramePipeline.h"
+
+#include <chrono>
+#include <algorithm>
+
+void FramePipeline::backOff(int &spins) {
+	if (++spins < 64)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void FramePipeline::run() {
+	size_t size = _slots.size();
+
+	int spins = 0;
+
+	while (!_stop.load(std::memory_order_relaxed)) {
+		size_t produced = _produced.load(std::memory_order_relaxed);
+
+		// Full, wait for the consumer to release a slot
+		if (produced - _consumed.load(std::memory_order_acquire) == size) {
+			backOff(spins);
+
+			continue;
+		}
+
+		spins = 0;
+
+		if (!_produce(_slots[produced % size]))
+			break;
+
+		_produced.store(produced + 1, std::memory_order_release);
+	}
+
+	_finished.store(true, std::memory_order_release);
+}
+
+void FramePipeline::start(int frameSize, int prefetch, const Producer &produce) {
+	stop();
+
+	_produce = produce;
+
+	_slots.assign(std::max(1, prefetch), std::vector<float>(frameSize, 0.0f));
+
+	_produced = 0;
+	_consumed = 0;
+	_finished = false;
+	_stop = false;
+
+	_prefetching = prefetch > 0;
+	_frontReady = false;
+
+	if (_prefetching)
+		_thread = std::thread(&FramePipeline::run, this);
+}
+
+std::vector<float>* FramePipeline::front() {
+	if (!_prefetching) {
+		if (!_frontReady) {
+			if (!_produce(_slots.front()))
+				return nullptr;
+
+			_frontReady = true;
+		}
+
+		return &_slots.front();
+	}
+
+	size_t consumed = _consumed.load(std::memory_order_relaxed);
+
+	int spins = 0;
+
+	for (;;) {
+		if (_produced.load(std::memory_order_acquire) != consumed)
+			return &_slots[consumed % _slots.size()];
+
+		// The producer may have published a last frame before finishing
+		if (_finished.load(std::memory_order_acquire) && _produced.load(std::memory_order_acquire) == consumed)
+			return nullptr;
+
+		backOff(spins);
+	}
+}
+
+void FramePipeline::pop() {
+	if (!_prefetching) {
+		_frontReady = false;
+
+		return;
+	}
+
+	_consumed.store(_consumed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void FramePipeline::stop() {
+	_stop = true;
+
+	if (_thread.joinable())
+		_thread.join();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+// Produces input frames on a background thread ahead of the model thread, through a lock free single producer single consumer ring.
+// The consumer swaps the front frame into the hierarchy (PredictiveHierarchy::swapInputs) and pops it, the buffer it gets in exchange
+// goes back to the producer to be refilled, so frames are never copied and steady state stepping does not allocate.
+// The producer waits while the ring is full (back pressure), the consumer while it is empty
+class FramePipeline {
+public:
+	// Fills frame (frameSize values, holding whatever an earlier frame left) with the next frame. Returns false when there are no more
+	typedef std::function<bool(std::vector<float> &frame)> Producer;
+
+private:
+	Producer _produce;
+
+	std::vector<std::vector<float> > _slots;
+
+	// Frames produced and consumed so far, each written by one side only. Padded onto separate cache lines
+	char _padding0[64];
+	std::atomic<size_t> _produced;
+	char _padding1[64];
+	std::atomic<size_t> _consumed;
+	char _padding2[64];
+
+	std::atomic<bool> _finished;
+	std::atomic<bool> _stop;
+
+	std::thread _thread;
+
+	// Without prefetching frames are produced in front on the calling thread
+	bool _prefetching;
+	bool _frontReady;
+
+	void run();
+
+	// Yield a while, then sleep, so a long wait does not keep a core busy
+	static void backOff(int &spins);
+
+public:
+	FramePipeline()
+		: _produced(0), _consumed(0), _finished(false), _stop(false), _prefetching(false), _frontReady(false)
+	{}
+
+	~FramePipeline() {
+		stop();
+	}
+
+	FramePipeline(const FramePipeline &) = delete;
+	FramePipeline &operator=(const FramePipeline &) = delete;
+
+	// Stops a previous run and starts producing frames of frameSize values, up to prefetch ahead of the consumer.
+	// prefetch 0 produces every frame on the consumer thread when it is asked for
+	void start(int frameSize, int prefetch, const Producer &produce);
+
+	// Next frame, waits while the producer is behind. nullptr once the producer has finished and every frame was consumed
+	std::vector<float>* front();
+
+	// Release the front frame
+	void pop();
+
+	// Stop the producer, frames not consumed yet are dropped
+	void stop();
+};
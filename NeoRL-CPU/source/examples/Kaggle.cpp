@@ -1,283 +1,475 @@
-#include "Settings.h"
-
-#if EXAMPLE_SELECTION == EXAMPLE_KAGGLE
-
-#include <neo/PredictiveHierarchy.h>
-
-#include <time.h>
-#include <iostream>
-#include <random>
-#include <fstream>
-#include <cmath>
-#include <string>
-#include <sstream>
-
-#include <unordered_map>
-#include <unordered_set>
-
-#include <algorithm>
-#include <memory>
-
-#include <assert.h>
-
-class Entry {
-public:
-	int _id;
-	int _store;
-	int _dayOfWeek;
-	int _year, _month, _day;
-	int _sales;
-	int _customers;
-	bool _open;
-	bool _promo;
-	bool _stateHoliday_public, _stateHoliday_easter, _stateHoliday_christmas;
-	bool _schoolHoliday;
-
-	bool operator<(const Entry &other) {
-		if (_year < other._year)
-			return true;
-		else if (_year > other._year)
-			return false;
-		else {
-			if (_month < other._month)
-				return true;
-			else if (_month > other._month)
-				return false;
-			else {
-				if (_day < other._day)
-					return true;
-				else if (_day > other._day)
-					return false;
-				else
-					return false;
-			}
-		}
-
-		return false;
-	}
-};
-
-bool compareEntryDates(const std::unique_ptr<Entry> &lhs, const std::unique_ptr<Entry> &rhs) {
-	return (*lhs) < (*rhs);
-}
-
-void loadData(const std::string &fileNameTrain, const std::string &fileNameTest, std::vector<std::unique_ptr<Entry>> &entries) {
-	// Load training data (id is -1)
-	{
-		std::ifstream fromTrain(fileNameTrain);
-
-		std::string line = "";
-
-		// Skip first line
-		std::getline(fromTrain, line);
-
-		do {
-			Entry e;
-
-			e._id = -1;
-
-			std::getline(fromTrain, line);
-
-			if (line == "")
-				break;
-
-			// Get data
-			std::vector<std::string> data;
-
-			std::istringstream fromLine(line);
-
-			std::vector<std::string> strVals;
-
-			do {
-				std::string strVal;
-				std::getline(fromLine, strVal, ',');
-
-				if (strVal == "")
-					break;
-
-				strVals.push_back(strVal);
-
-			} while (fromLine.good() && !fromLine.eof());
-
-			assert(strVals.size() == 9);
-
-			// Convert
-			e._store = std::stoi(strVals[0]);
-			e._dayOfWeek = std::stoi(strVals[1]);
-
-			std::istringstream fromDate(strVals[2]);
-
-			std::string datePart;
-
-			std::getline(fromDate, datePart, '-');
-			e._year = std::stoi(datePart);
-
-			std::getline(fromDate, datePart, '-');
-			e._month = std::stoi(datePart);
-
-			std::getline(fromDate, datePart, '-');
-			e._day = std::stoi(datePart);
-
-			e._sales = std::stoi(strVals[3]);
-			e._customers = std::stoi(strVals[4]);
-			e._open = std::stoi(strVals[5]);
-			e._promo = std::stoi(strVals[6]);
-
-			std::string holiday = strVals[7].substr(1, 1);
-
-			e._stateHoliday_public = holiday == "a";
-			e._stateHoliday_easter = holiday == "b";
-			e._stateHoliday_christmas = holiday == "c";
-
-			e._schoolHoliday = std::stoi(strVals[8].substr(1, 1));
-
-			entries.push_back(std::make_unique<Entry>(e));
-		} while (fromTrain.good() && !fromTrain.eof());
-	}
-
-	// Load test data
-	{
-		std::ifstream fromTest(fileNameTest);
-
-		std::string line = "";
-
-		// Skip first line
-		std::getline(fromTest, line);
-
-		do {
-			Entry e;
-
-			std::getline(fromTest, line);
-
-			if (line == "")
-				break;
-
-			// Get data
-			std::vector<std::string> data;
-
-			std::istringstream fromLine(line);
-
-			std::vector<std::string> strVals;
-
-			do {
-				std::string strVal;
-				std::getline(fromLine, strVal, ',');
-
-				if (strVal == "")
-					break;
-
-				strVals.push_back(strVal);
-
-			} while (fromLine.good() && !fromLine.eof());
-
-			assert(strVals.size() == 9);
-
-			// Convert
-			e._id = std::stoi(strVals[0]);
-			e._store = std::stoi(strVals[1]);
-			e._dayOfWeek = std::stoi(strVals[2]);
-
-			std::istringstream fromDate(strVals[3]);
-
-			std::string datePart;
-
-			std::getline(fromDate, datePart, '-');
-			e._year = std::stoi(datePart);
-
-			std::getline(fromDate, datePart, '-');
-			e._month = std::stoi(datePart);
-
-			std::getline(fromDate, datePart, '-');
-			e._day = std::stoi(datePart);
-
-			e._sales = std::stoi(strVals[4]);
-			e._customers = std::stoi(strVals[5]);
-			e._open = std::stoi(strVals[6]);
-			e._promo = std::stoi(strVals[7]);
-
-			std::string holiday = strVals[8].substr(1, 1);
-
-			e._stateHoliday_public = holiday == "a";
-			e._stateHoliday_easter = holiday == "b";
-			e._stateHoliday_christmas = holiday == "c";
-
-			e._schoolHoliday = std::stoi(strVals[9].substr(1, 1));
-
-			entries.push_back(std::make_unique<Entry>(e));
-		} while (fromTest.good() && !fromTest.eof());
-	}
-}
-
-int main() {
-	std::mt19937 generator(time(nullptr));
-
-	std::vector<std::unique_ptr<Entry>> entries;
-
-	loadData("train/train.csv", "test/test.csv", entries);
-
-	// Sort into time series (interleaved with test set)
-	std::stable_sort(entries.begin(), entries.end());
-
-	// Meta data
-	std::unordered_set<int> stores;
-	
-	int maxSales = 0;
-	int minSales = 9999999;
-
-	int maxCustomers = 0;
-	int minCustomers = 9999999;
-
-	// Transforms
-	for (int i = 0; i < entries.size(); i++) {
-		if (stores.find(entries[i]->_store) == stores.end())
-			stores.insert(entries[i]->_store);
-
-		maxSales = std::max(maxSales, entries[i]->_sales);
-		minSales = std::min(minSales, entries[i]->_sales);
-
-		maxCustomers = std::max(maxCustomers, entries[i]->_customers);
-		minCustomers = std::min(minCustomers, entries[i]->_customers);
-	}
-
-	const int valuesPerStore = 12;
-
-	int numInputs = valuesPerStore * stores.size();
-
-	int dim = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(numInputs))));
-	
-	// Create model
-	std::vector<neo::PredictiveHierarchy::LayerDesc> layerDescs(3);
-
-	layerDescs[0]._width = 32;
-	layerDescs[0]._height = 32;
-
-	layerDescs[1]._width = 24;
-	layerDescs[1]._height = 24;
-
-	layerDescs[2]._width = 16;
-	layerDescs[2]._height = 16;
-
-	neo::PredictiveHierarchy ph;
-
-	ph.createRandom(dim, dim, 16, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
-
-	for (int it = 0; it < 4; it++) {
-		// Go through series one day at a time
-		for (int i = 0; i < entries.size(); i += stores.size()) {
-			int inde
-			int inputIndex = 0;
-
-			for (int s = 0; s < stores.size(); s++) {
-				ph.setInput(inputIndex++, entries[)
-			}
-			// If is test data, run off of own predictions with learning turned off
-
-			// For each store
-			
-		}
-	}
-
-	return 0;
-}
-
-#endif
+#include "Settings.h"
+
+#if EXAMPLE_SELECTION == EXAMPLE_KAGGLE
+
+#include <neo/PredictiveHierarchy.h>
+
+#include "CsvReader.h"
+#include "FrameCache.h"
+#include "FramePipeline.h"
+
+#include "../libs/argparse.hpp"
+
+#include <time.h>
+#include <iostream>
+#include <random>
+#include <fstream>
+#include <cmath>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+
+#include <algorithm>
+
+// One row of the Rossmann store sales data, stored by value in one contiguous vector
+struct Entry {
+	int _id; // -1 for training rows
+	int _store;
+	int _date; // Days since 1970-01-01
+	int _dayOfWeek;
+	int _year, _month, _day;
+	int _sales;
+	int _customers;
+	bool _open;
+	bool _promo;
+	bool _stateHoliday_public, _stateHoliday_easter, _stateHoliday_christmas;
+	bool _schoolHoliday;
+};
+
+// Appends the rows of a train (isTest = false) or test CSV. Columns are found by their header names,
+// so the train and test layouts (which differ) both work. Returns false and reports the row on a malformed file
+bool loadEntries(const std::string &path, bool isTest, std::vector<Entry> &entries) {
+	CsvReader reader;
+
+	if (!reader.open(path)) {
+		std::cerr << "Could not open " << path << std::endl;
+
+		return false;
+	}
+
+	int columnId = reader.findColumn("Id");
+	int columnStore = reader.findColumn("Store");
+	int columnDayOfWeek = reader.findColumn("DayOfWeek");
+	int columnDate = reader.findColumn("Date");
+	int columnSales = reader.findColumn("Sales");
+	int columnCustomers = reader.findColumn("Customers");
+	int columnOpen = reader.findColumn("Open");
+	int columnPromo = reader.findColumn("Promo");
+	int columnStateHoliday = reader.findColumn("StateHoliday");
+	int columnSchoolHoliday = reader.findColumn("SchoolHoliday");
+
+	if (columnStore < 0 || columnDayOfWeek < 0 || columnDate < 0 || columnOpen < 0 || columnPromo < 0 || columnStateHoliday < 0 || columnSchoolHoliday < 0
+		|| (isTest ? columnId < 0 : columnSales < 0 || columnCustomers < 0)) {
+		std::cerr << path << ": missing columns" << std::endl;
+
+		return false;
+	}
+
+	int numColumns = std::max({ columnId, columnStore, columnDayOfWeek, columnDate, columnSales, columnCustomers, columnOpen, columnPromo, columnStateHoliday, columnSchoolHoliday }) + 1;
+
+	bool first = true;
+
+	while (reader.nextRow()) {
+		if (first) {
+			entries.reserve(entries.size() + reader.estimateRows());
+
+			first = false;
+		}
+
+		if (reader.getNumFields() < numColumns) {
+			std::cerr << path << ": row " << reader.getRow() << " has " << reader.getNumFields() << " fields" << std::endl;
+
+			return false;
+		}
+
+		Entry e;
+
+		e._id = -1;
+		e._sales = 0;
+		e._customers = 0;
+
+		int open = 1;
+		int promo;
+		int schoolHoliday;
+
+		// The test set leaves Open empty for a few rows, those are assumed open
+		bool valid = CsvReader::parseInt(reader.getField(columnStore), e._store)
+			&& CsvReader::parseInt(reader.getField(columnDayOfWeek), e._dayOfWeek)
+			&& CsvReader::parseDate(reader.getField(columnDate), e._year, e._month, e._day)
+			&& (reader.getField(columnOpen).empty() || CsvReader::parseInt(reader.getField(columnOpen), open))
+			&& CsvReader::parseInt(reader.getField(columnPromo), promo)
+			&& CsvReader::parseInt(reader.getField(columnSchoolHoliday), schoolHoliday);
+
+		if (isTest)
+			valid = valid && CsvReader::parseInt(reader.getField(columnId), e._id);
+		else
+			valid = valid && CsvReader::parseInt(reader.getField(columnSales), e._sales)
+				&& CsvReader::parseInt(reader.getField(columnCustomers), e._customers);
+
+		if (!valid || e._store < 0) {
+			std::cerr << path << ": row " << reader.getRow() << " is malformed" << std::endl;
+
+			return false;
+		}
+
+		e._date = CsvReader::daysFromCivil(e._year, e._month, e._day);
+		e._open = open != 0;
+		e._promo = promo != 0;
+
+		const CsvReader::Field &holiday = reader.getField(columnStateHoliday);
+
+		char h = holiday.empty() ? '0' : *holiday._begin;
+
+		e._stateHoliday_public = h == 'a';
+		e._stateHoliday_easter = h == 'b';
+		e._stateHoliday_christmas = h == 'c';
+
+		e._schoolHoliday = schoolHoliday != 0;
+
+		entries.push_back(e);
+	}
+
+	return true;
+}
+
+const int valuesPerStore = 12;
+
+// Part of the frame cache key, raise it whenever encodeStore or encodeDay change what they write
+const int encodingVersion = 1;
+
+// Inputs of one store for one day, all in [0, 1]. Sales and customers come in separately, so the
+// test days can feed back predictions in their place
+void encodeStore(const Entry* e, float sales, float customers, float* values) {
+	values[0] = sales;
+	values[1] = customers;
+
+	if (e == nullptr) {
+		// No row for this store on this day
+		std::fill(values + 2, values + valuesPerStore, 0.0f);
+
+		return;
+	}
+
+	values[2] = e->_open ? 1.0f : 0.0f;
+	values[3] = e->_promo ? 1.0f : 0.0f;
+	values[4] = e->_stateHoliday_public ? 1.0f : 0.0f;
+	values[5] = e->_stateHoliday_easter ? 1.0f : 0.0f;
+	values[6] = e->_stateHoliday_christmas ? 1.0f : 0.0f;
+	values[7] = e->_schoolHoliday ? 1.0f : 0.0f;
+	values[8] = (e->_dayOfWeek - 1) / 6.0f;
+	values[9] = (e->_month - 1) / 11.0f;
+	values[10] = (e->_day - 1) / 30.0f;
+	values[11] = 1.0f;
+}
+
+struct Scaling {
+	int _minSales;
+	float _salesScale;
+
+	int _minCustomers;
+	float _customersScale;
+};
+
+// Frame of a training day, row holds the entry index of every store (-1 for none)
+void encodeDay(const std::vector<Entry> &entries, const int* row, int numStores, const Scaling &scaling, float* frame) {
+	for (int s = 0; s < numStores; s++) {
+		const Entry* e = row[s] == -1 ? nullptr : &entries[row[s]];
+
+		if (e == nullptr)
+			encodeStore(nullptr, 0.0f, 0.0f, frame + s * valuesPerStore);
+		else
+			encodeStore(e, (e->_sales - scaling._minSales) * scaling._salesScale, (e->_customers - scaling._minCustomers) * scaling._customersScale, frame + s * valuesPerStore);
+	}
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--train", 1);
+	parser.addArgument("--test", 1);
+	parser.addArgument("-o", "--out", 1);
+	parser.addArgument("-e", "--epochs", 1);
+	parser.addArgument("-s", "--seed", 1);
+	parser.addArgument("--cache", 1);
+	parser.addArgument("--prefetch", 1);
+
+	parser.parse(argc, argv);
+
+	std::string trainPath = parser.retrieve("train", "train/train.csv");
+	std::string testPath = parser.retrieve("test", "test/test.csv");
+	std::string outPath = parser.retrieve("out", "submission.csv");
+	std::string cachePath = parser.retrieve("cache", trainPath + ".frames");
+
+	int epochs = std::atoi(parser.retrieve("epochs", "4").c_str());
+	int prefetch = std::atoi(parser.retrieve("prefetch", "4").c_str());
+
+	unsigned int seed = std::atoi(parser.retrieve("seed", std::to_string(time(nullptr))).c_str());
+
+	std::mt19937 generator(seed);
+
+	// Training rows first, then test rows
+	std::vector<Entry> entries;
+
+	std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+	if (!loadEntries(trainPath, false, entries))
+		return 1;
+
+	size_t numTrain = entries.size();
+
+	if (!loadEntries(testPath, true, entries))
+		return 1;
+
+	double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+	std::cout << "Loaded " << numTrain << " training and " << entries.size() - numTrain << " test rows in " << loadSeconds * 1000.0 << " ms" << std::endl;
+
+	if (numTrain == 0) {
+		std::cerr << "No training rows" << std::endl;
+
+		return 1;
+	}
+
+	// Meta data
+	int maxStore = 0;
+
+	int firstDay = entries.front()._date;
+	int lastDay = firstDay;
+	int lastTrainDay = firstDay;
+
+	int maxSales = 0;
+	int minSales = 9999999;
+
+	int maxCustomers = 0;
+	int minCustomers = 9999999;
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		const Entry &e = entries[i];
+
+		maxStore = std::max(maxStore, e._store);
+
+		firstDay = std::min(firstDay, e._date);
+		lastDay = std::max(lastDay, e._date);
+
+		if (e._id == -1) {
+			lastTrainDay = std::max(lastTrainDay, e._date);
+
+			maxSales = std::max(maxSales, e._sales);
+			minSales = std::min(minSales, e._sales);
+
+			maxCustomers = std::max(maxCustomers, e._customers);
+			minCustomers = std::min(minCustomers, e._customers);
+		}
+	}
+
+	// Dense store indices
+	std::vector<int> storeIndices(maxStore + 1, -1);
+
+	int numStores = 0;
+
+	for (size_t i = 0; i < entries.size(); i++)
+		if (storeIndices[entries[i]._store] == -1)
+			storeIndices[entries[i]._store] = numStores++;
+
+	// Day by store grid of entry indices replaces sorting, stepping walks it in time order
+	int numDays = lastDay - firstDay + 1;
+
+	std::vector<int> grid(static_cast<size_t>(numDays) * numStores, -1);
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		const Entry &e = entries[i];
+
+		if (e._id != -1 && e._date <= lastTrainDay) {
+			std::cerr << "Test row " << e._id << " overlaps the training days" << std::endl;
+
+			return 1;
+		}
+
+		grid[static_cast<size_t>(e._date - firstDay) * numStores + storeIndices[e._store]] = i;
+	}
+
+	Scaling scaling;
+
+	scaling._minSales = minSales;
+	scaling._salesScale = 1.0f / std::max(1, maxSales - minSales);
+	scaling._minCustomers = minCustomers;
+	scaling._customersScale = 1.0f / std::max(1, maxCustomers - minCustomers);
+
+	int numInputs = valuesPerStore * numStores;
+
+	int dim = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(numInputs))));
+
+	// Create model
+	std::vector<neo::PredictiveHierarchy::LayerDesc> layerDescs(3);
+
+	layerDescs[0]._width = 32;
+	layerDescs[0]._height = 32;
+
+	layerDescs[1]._width = 24;
+	layerDescs[1]._height = 24;
+
+	layerDescs[2]._width = 16;
+	layerDescs[2]._height = 16;
+
+	neo::PredictiveHierarchy ph;
+
+	ph.createRandom(dim, dim, 16, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, seed);
+
+	int numTrainDays = lastTrainDay - firstDay + 1;
+
+	// Training days are encoded by the first epoch and written as they go, later epochs and runs stream them back.
+	// Rebuilt when either file or the encoding changes (the test rows add stores), "none" disables it
+	FrameCache frames;
+	FrameCacheWriter writer;
+
+	bool writing = false;
+
+	int frameSize = ph.getLayer(0)._sdr.getNumVisible();
+
+	uint64_t cacheKey = FrameCache::mixKey(FrameCache::fileKey(trainPath), FrameCache::fileKey(testPath));
+
+	const int encoding[7] = { encodingVersion, valuesPerStore, numStores, minSales, maxSales, minCustomers, maxCustomers };
+
+	for (int i = 0; i < 7; i++)
+		cacheKey = FrameCache::mixKey(cacheKey, encoding[i]);
+
+	if (cachePath != "none" && !frames.open(cachePath, cacheKey, numInputs)) {
+		writing = writer.create(cachePath, FrameCacheFormat::_dense, numInputs, cacheKey);
+
+		if (!writing)
+			std::cerr << "Could not write frame cache " << cachePath << ", encoding every epoch" << std::endl;
+	}
+
+	// Days are read or encoded up to prefetch steps ahead on a separate thread and handed to the hierarchy without copying
+	FramePipeline pipeline;
+
+	int day = 0;
+
+	FramePipeline::Producer produce = [&](std::vector<float> &inputs) -> bool {
+		if (day >= numTrainDays)
+			return false;
+
+		FrameCache::Frame cached;
+
+		if (frames.isOpen() && frames.next(cached))
+			std::copy(cached._values, cached._values + numInputs, inputs.begin());
+		else {
+			encodeDay(entries, &grid[static_cast<size_t>(day) * numStores], numStores, scaling, inputs.data());
+
+			if (writing)
+				writer.write(inputs.data());
+		}
+
+		day++;
+
+		return true;
+	};
+
+	for (int it = 0; it < epochs; it++) {
+		// Root mean square percentage error of the next day predictions (the competition metric), over open days with sales
+		double errorSum = 0.0;
+		long errorCount = 0;
+
+		if (frames.isOpen())
+			frames.rewind();
+
+		day = 0;
+
+		// Go through series one day at a time
+		pipeline.start(frameSize, prefetch, produce);
+
+		while (std::vector<float>* inputs = pipeline.front()) {
+			for (int s = 0; s < numStores; s++) {
+				const float* store = inputs->data() + s * valuesPerStore;
+
+				float sales = store[0] / scaling._salesScale + minSales;
+
+				// Known, open and sold something
+				if (store[11] > 0.0f && store[2] > 0.0f && sales >= 1.0f) {
+					float predicted = std::min(1.0f, std::max(0.0f, ph.getPrediction(s * valuesPerStore))) / scaling._salesScale + minSales;
+					float relative = (sales - predicted) / sales;
+
+					errorSum += relative * relative;
+					errorCount++;
+				}
+			}
+
+			if (!ph.swapInputs(*inputs)) {
+				std::cerr << "Frame of " << inputs->size() << " values for " << frameSize << " inputs" << std::endl;
+
+				return 1;
+			}
+
+			pipeline.pop();
+
+			ph.simStep(generator);
+		}
+
+		std::cout << "Epoch " << it << " RMSPE " << std::sqrt(errorSum / std::max(1L, errorCount)) << std::endl;
+
+		// The producer is done with the writer once it is joined
+		pipeline.stop();
+
+		if (writing) {
+			writing = false;
+
+			if (!writer.finish() || !frames.open(cachePath, cacheKey, numInputs))
+				std::cerr << "Could not write frame cache " << cachePath << ", encoding every epoch" << std::endl;
+		}
+	}
+
+	// Test days run off of own predictions with learning turned off
+	std::vector<std::pair<int, float> > predictions;
+
+	predictions.reserve(entries.size() - numTrain);
+
+	std::vector<float> frame(frameSize, 0.0f);
+
+	for (int d = numTrainDays; d < numDays; d++) {
+		const int* row = &grid[static_cast<size_t>(d) * numStores];
+
+		for (int s = 0; s < numStores; s++) {
+			const Entry* e = row[s] == -1 ? nullptr : &entries[row[s]];
+
+			float sales = std::min(1.0f, std::max(0.0f, ph.getPrediction(s * valuesPerStore + 0)));
+			float customers = std::min(1.0f, std::max(0.0f, ph.getPrediction(s * valuesPerStore + 1)));
+
+			if (e != nullptr && !e->_open)
+				sales = customers = 0.0f;
+
+			if (e != nullptr)
+				predictions.push_back(std::make_pair(e->_id, e->_open ? sales / scaling._salesScale + minSales : 0.0f));
+
+			encodeStore(e, sales, customers, frame.data() + s * valuesPerStore);
+		}
+
+		if (!ph.swapInputs(frame)) {
+			std::cerr << "Frame of " << frame.size() << " values for " << frameSize << " inputs" << std::endl;
+
+			return 1;
+		}
+
+		ph.simStep(generator, false);
+	}
+
+	std::sort(predictions.begin(), predictions.end());
+
+	std::ofstream toSubmission(outPath);
+
+	if (!toSubmission.is_open()) {
+		std::cerr << "Could not write " << outPath << std::endl;
+
+		return 1;
+	}
+
+	toSubmission << "Id,Sales\n";
+
+	for (size_t i = 0; i < predictions.size(); i++)
+		toSubmission << predictions[i].first << "," << predictions[i].second << "\n";
+
+	std::cout << "Wrote " << predictions.size() << " predictions to " << outPath << std::endl;
+
+	return 0;
+}
+
+#endif
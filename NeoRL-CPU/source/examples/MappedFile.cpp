@@ -0,0 +1,95 @@
+#include "MappedFile.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string &path) {
+	close();
+
+#ifdef MAPPED_FILE_POSIX
+	int fd = ::open(path.c_str(), O_RDONLY);
+
+	if (fd == -1)
+		return false;
+
+	struct stat info;
+
+	// Only regular files have a size to map, pipes and devices report 0
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+		_size = info.st_size;
+
+		// Empty files can not be mapped, but are valid
+		if (_size == 0) {
+			::close(fd);
+
+			_data = "";
+
+			return true;
+		}
+
+		void* mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		// The mapping keeps the file alive
+		::close(fd);
+
+		if (mapping != MAP_FAILED) {
+			_data = static_cast<const char*>(mapping);
+			_mapped = true;
+
+			return true;
+		}
+	}
+	else
+		::close(fd);
+#endif
+
+	// Read it whole
+	std::ifstream fromFile(path, std::ios::binary);
+
+	if (!fromFile.is_open())
+		return false;
+
+	fromFile.seekg(0, std::ios::end);
+
+	std::streamoff size = fromFile.tellg();
+
+	// Not seekable (a pipe) or failed
+	if (size < 0)
+		return false;
+
+	_buffer.resize(static_cast<size_t>(size));
+	fromFile.seekg(0);
+	fromFile.read(_buffer.data(), _buffer.size());
+
+	_data = _buffer.data();
+	_size = _buffer.size();
+
+	return static_cast<bool>(fromFile);
+}
+
+void MappedFile::close() {
+#ifdef MAPPED_FILE_POSIX
+	if (_mapped)
+		munmap(const_cast<char*>(_data), _size);
+#endif
+
+	std::vector<char>().swap(_buffer);
+
+	_data = nullptr;
+	_size = 0;
+	_mapped = false;
+}
+
+void MappedFile::adviseSequential() {
+#ifdef MAPPED_FILE_POSIX
+	if (_mapped)
+		madvise(const_cast<char*>(_data), _size, MADV_SEQUENTIAL);
+#endif
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Read only view of a whole file. Memory mapped where the platform allows it, so pages are only brought in as they are read
+// and nothing is copied; elsewhere the file is read into memory
+class MappedFile {
+private:
+	const char* _data;
+	size_t _size;
+
+	bool _mapped;
+
+	// Fallback storage when the file could not be mapped
+	std::vector<char> _buffer;
+
+public:
+	MappedFile()
+		: _data(nullptr), _size(0), _mapped(false)
+	{}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Returns false if the file could not be opened
+	bool open(const std::string &path);
+
+	void close();
+
+	// Tell the OS the file will be read front to back, so it reads ahead and drops pages behind
+	void adviseSequential();
+
+	const char* data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	bool isMapped() const {
+		return _mapped;
+	}
+};
@@ -1,7 +1,7 @@
-#pragma once
-
-#define EXAMPLE_TEXT_PREDICTION 0
-#define EXAMPLE_KAGGLE 1
-
-// Change this line to select the example
+#pragma once
+
+#define EXAMPLE_TEXT_PREDICTION 0
+#define EXAMPLE_KAGGLE 1
+
+// Change this line to select the example
 #define EXAMPLE_SELECTION EXAMPLE_KAGGLE
\ No newline at end of file
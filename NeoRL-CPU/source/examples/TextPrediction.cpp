@@ -1,232 +1,419 @@
-#include "Settings.h"
-
-#if EXAMPLE_SELECTION == EXAMPLE_TEXT_PREDICTION
-
-#include <neo/PredictiveHierarchy.h>
-
-#include "../libs/argparse.hpp"
-
-#include <time.h>
-#include <iostream>
-#include <random>
-#include <fstream>
-#include <cmath>
-
-#include <unordered_map>
-#include <unordered_set>
-
-#include <algorithm>
-
-class VectorCodec {
-private:
-	std::unordered_set<char> alphabet;
-	char tableStoI[256];
-	char tableItoS[256];
-public:
-	int N;
-	int nSymbols;
-	std::vector<float> vector;
-	char symbol;
-	int symIndex;
-	
-	VectorCodec(std::string corpus, int vecLength = 0) {
-		for (int i = 0; i < corpus.length(); i++) {
-			alphabet.emplace(corpus[i]);
-		}
-		nSymbols = alphabet.size();
-				
-		if (vecLength == 0) { //auto
-			N = nSymbols;
-		} else {
-			N = vecLength;
-		}
-		vector.resize(N, 0.0f);
-		
-		for (int i = 0; i < 256; i++) { tableStoI[i] = 0; tableItoS[i] = 0; }
-		
-		int index = 0;
-		for (auto itr = alphabet.begin(); itr != alphabet.end(); ++itr) {
-			tableStoI[*itr] = index;
-			tableItoS[index] = *itr;
-			index++;
-		}
-		
-		symbol = 0;
-		symIndex = 0;
-	}
-	
-	void encode() {
-		for (int i = 0; i < vector.size(); i++) {
-			vector[i] = 0.0f;
-		}
-		vector[tableStoI[symbol]] = 1.0f;
-	};
-	
-	void decode() {
-		int maxIndex = 0;
-		for (int i = 0; i < N; i++) {
-			if (vector[i] > vector[maxIndex])
-				maxIndex = i;
-		}
-		symbol = tableItoS[maxIndex];
-		symIndex = maxIndex;
-	};
-	
-	char getRandomSymbol(std::mt19937& generator) {
-		return tableItoS[generator() % nSymbols];
-	}
-};
-
-void train(neo::PredictiveHierarchy& ph, std::mt19937& generator,
-           std::string& test, int epochs, VectorCodec& textcodec) {
-	
-    for (size_t k = 0; k < epochs; k++) {
-        for (size_t i = 0; i < test.length(); i++) {
-            textcodec.symbol = test[i];
-            textcodec.encode();
-            
-			for (int j = 0; j < textcodec.N; j++) {
-                ph.setInput(j, textcodec.vector[j]);
-            }
-
-            ph.simStep(generator);
-			
-			for (int j = 0; j < textcodec.N; j++) {
-                textcodec.vector[j] = ph.getPrediction(j);
-            }
-			
-			textcodec.decode();
-			
-            char predChar = textcodec.symbol;
-
-            std::cout << predChar;
-        }
-        std::cout << "\n";
-    }
-}
-
-void sample(neo::PredictiveHierarchy& ph, std::mt19937& generator,
-           char seed, int nSamples, VectorCodec& textcodec, float seedNoise = 0.5, float predNoise = 0.05) {
-    
-	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
-	
-	textcodec.symbol = seed;
-	textcodec.encode();
-	
-	for (int j = 0; j < textcodec.N; j++) {
-        ph.setInput(j, textcodec.vector[j] + dist01(generator)*seedNoise);
-    }
-    ph.simStep(generator, false);
-    
-    std::cout << "seed: " << seed << " i: " << textcodec.symIndex << " sample: \"";
-    
-    for (size_t i = 1; i < nSamples; i++) {
-
-		for (int j = 0; j < textcodec.N; j++) {
-			textcodec.vector[j] = ph.getPrediction(j);
-		}
-        
-		textcodec.decode();
-			
-		char predChar = textcodec.symbol;
-        
-		std::cout << predChar;
-		
-        for (int j = 0; j < textcodec.N; j++) {
-            ph.setInput(j, ph.getPrediction(j) + dist01(generator)*predNoise);
-        }
-        
-        ph.simStep(generator, false);
-    }
-    
-    std::cout << "\"" << std::endl;
-}
-
-int main(int argc, const char** argv) {
-	
-    // Load the command line config
-    
-    ArgumentParser parser;
-        
-    parser.addArgument("-e", "--epochs", 1);
-    parser.addArgument("-s", "--seed", 1);
-    parser.addArgument("-l", "--layers", 1);
-    parser.addArgument("-S", "--samples", 1);
-    parser.addArgument("-c", "--corpus", 1);
-    parser.addArgument("--nlayers", 1);
-    parser.addArgument("--ifbradius", 1);
-    parser.addArgument("--lw", 1);
-    parser.addArgument("--lh", 1);
-    parser.addArgument("--ssize", 1);
-    parser.addArgument("--sseednoise", 1);
-    parser.addArgument("--sprednoise", 1);
-    
-    parser.parse(argc, argv);
-    
-	// RNG
-    unsigned int seed = std::atoi(parser.retrieve("seed", std::to_string(time(nullptr))).c_str());
-	std::mt19937 generator(seed);
-
-	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
-    
-	// ---------------------------------- Load the Corpus ----------------------------------
-	std::string corpusPath = parser.retrieve("corpus", "corpus.txt");
-	std::ifstream fromFile(corpusPath);
-
-	fromFile.seekg(0, std::ios::end);
-	size_t size = fromFile.tellg();
-	std::string test(size, ' ');
-	fromFile.seekg(0);
-	fromFile.read(&test[0], size);
-	
-	// ---------------------------------- Find Character Set ----------------------------------
-	
-	VectorCodec textcodec(test);
-	int numInputs = textcodec.N;
-	int inputsRoot = std::ceil(std::sqrt(static_cast<float>(numInputs)));
-	
-	// ---------------------------------- Create Hierarchy ----------------------------------
-	
-	// Fill out layer descriptions
-	int nLayers = std::atoi(parser.retrieve("nlayers", "3").c_str());
-	int layerW = std::atoi(parser.retrieve("lw", "16").c_str());
-	int layerH = std::atoi(parser.retrieve("lh", "16").c_str());
-	int inFeedBackRadius = std::atoi(parser.retrieve("ifbradius", "16").c_str());
-	
-	std::vector<neo::PredictiveHierarchy::LayerDesc> layerDescs(nLayers);
-	
-	for (int i = 0; i < nLayers; i++) {
-		layerDescs[i]._width = layerW;
-		layerDescs[i]._height = layerH;
-	}
-	
-	neo::PredictiveHierarchy ph;
-	
-	ph.createRandom(inputsRoot, inputsRoot, inFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
-	
-	// ---------------------------------- Iterate Over Corpus ----------------------------------
-    int numEpochs = std::atoi(parser.retrieve("epochs", "10").c_str());
-    int numSamples = std::atoi(parser.retrieve("samples", "10").c_str());
-    int sampleSize = std::atoi(parser.retrieve("ssize", std::to_string(test.length())).c_str());
-    float sampleSeedNoise = std::atof(parser.retrieve("sseednoise", "0.5").c_str());
-    float samplePredNoise = std::atof(parser.retrieve("sprednoise", "0.05").c_str());
-    
-    std::cout << "NeoRL text prediction experiment" << std::endl;
-    std::cout << "Corpus: " << corpusPath << " size: " << test.length() << " alphabet size: " << textcodec.nSymbols << std::endl;
-    std::cout << "Model: nLayers: " << nLayers << " layerW: " << layerW << " layerH: " << layerH << " inFeedbackRadius: " << inFeedBackRadius 
-			  << " input: " << inputsRoot << "x" << inputsRoot << std::endl;
-	std::cout << "Training: epochs: " << numEpochs << std::endl;
-	std::cout << "Sampling: samples: " << numSamples << " size: " << sampleSize << " seed noise: " << sampleSeedNoise << " pred noise " << samplePredNoise << std::endl;    
-    std::cout << "--[ Start training ]--" << std::endl;
-    
-    train(ph, generator, test, numEpochs, textcodec);
-    
-    std::cout << "--[ Start sampling ]--" << std::endl;
-    for (int i = 0; i < numSamples; i++) {
-        sample(ph, generator, textcodec.getRandomSymbol(generator), sampleSize, textcodec, sampleSeedNoise, samplePredNoise);
-    }
-    
-	return 0;
-}
-
-#endif
+#include "Settings.h"
+
+#if EXAMPLE_SELECTION == EXAMPLE_TEXT_PREDICTION
+
+#include <neo/PredictiveHierarchy.h>
+#include <neo/HogwildTrainer.h>
+
+#include "TextSource.h"
+#include "FrameCache.h"
+#include "FramePipeline.h"
+
+#include "../libs/argparse.hpp"
+
+#include <time.h>
+#include <iostream>
+#include <random>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+
+#include <unordered_map>
+
+#include <algorithm>
+
+class VectorCodec {
+private:
+	std::vector<unsigned char> alphabet;
+	int tableStoI[256];
+	char tableItoS[256];
+public:
+	int N;
+	int nSymbols;
+	std::vector<float> vector;
+	char symbol;
+	int symIndex;
+	
+	// Symbols outside the alphabet encode as its first symbol
+	VectorCodec(const std::vector<unsigned char>& symbols, int vecLength = 0) {
+		alphabet = symbols;
+		nSymbols = alphabet.size();
+				
+		if (vecLength == 0) { //auto
+			N = nSymbols;
+		} else {
+			N = vecLength;
+		}
+		vector.resize(N, 0.0f);
+		
+		for (int i = 0; i < 256; i++) { tableStoI[i] = 0; tableItoS[i] = 0; }
+		
+		for (int index = 0; index < nSymbols; index++) {
+			tableStoI[alphabet[index]] = index;
+			tableItoS[index] = alphabet[index];
+		}
+		
+		symbol = 0;
+		symIndex = 0;
+	}
+	
+	void encode() {
+		for (int i = 0; i < vector.size(); i++) {
+			vector[i] = 0.0f;
+		}
+		symIndex = tableStoI[static_cast<unsigned char>(symbol)];
+		vector[symIndex] = 1.0f;
+	};
+	
+	void decode() {
+		int maxIndex = 0;
+		for (int i = 0; i < N; i++) {
+			if (vector[i] > vector[maxIndex])
+				maxIndex = i;
+		}
+		symbol = tableItoS[maxIndex];
+		symIndex = maxIndex;
+	};
+	
+	char getRandomSymbol(std::mt19937& generator) {
+		return tableItoS[generator() % nSymbols];
+	}
+};
+
+// Streams the encoded frames from frames once it is open, otherwise encodes the source. Without a cache yet the first epoch
+// writes one to cachePath as it encodes (a byte per symbol), later epochs and runs stream it back. Empty cachePath encodes every epoch.
+// Frames are read and encoded up to prefetch steps ahead on a separate thread (0 for inline) and handed to the hierarchy without copying
+void train(neo::PredictiveHierarchy& ph, std::mt19937& generator,
+           TextSource& source, FrameCache& frames, const std::string& cachePath, uint64_t cacheKey, int epochs, VectorCodec& textcodec, int prefetch) {
+	
+	// The producer encodes with its own codec, textcodec decodes the predictions
+	VectorCodec encoder = textcodec;
+
+	FramePipeline pipeline;
+
+	FrameCacheWriter writer;
+
+	bool writing = false;
+
+	if (!frames.isOpen() && !cachePath.empty()) {
+		writing = writer.create(cachePath, FrameCacheFormat::_symbols, encoder.N, cacheKey);
+
+		if (!writing)
+			std::cerr << "Could not write frame cache " << cachePath << ", encoding every epoch" << std::endl;
+	}
+
+	FramePipeline::Producer produce = [&](std::vector<float>& inputs) -> bool {
+		if (frames.isOpen()) {
+			FrameCache::Frame frame;
+
+			if (!frames.next(frame))
+				return false;
+
+			frame.copyTo(inputs.data(), encoder.N);
+		}
+		else {
+			char symbol;
+
+			if (!source.next(symbol))
+				return false;
+
+			encoder.symbol = symbol;
+			encoder.encode();
+
+			if (writing)
+				writer.writeSymbol(encoder.symIndex);
+
+			std::copy(encoder.vector.begin(), encoder.vector.end(), inputs.begin());
+		}
+
+		return true;
+	};
+
+	int numInputs = ph.getLayer(0)._sdr.getNumVisible();
+
+    for (size_t k = 0; k < epochs; k++) {
+        if (frames.isOpen())
+            frames.rewind();
+        else
+            source.rewind();
+
+        pipeline.start(numInputs, prefetch, produce);
+
+        while (std::vector<float>* inputs = pipeline.front()) {
+            if (!ph.swapInputs(*inputs)) {
+                std::cerr << "Frame of " << inputs->size() << " values for " << numInputs << " inputs" << std::endl;
+
+                return;
+            }
+
+            pipeline.pop();
+
+            ph.simStep(generator);
+			
+			for (int j = 0; j < textcodec.N; j++) {
+                textcodec.vector[j] = ph.getPrediction(j);
+            }
+			
+			textcodec.decode();
+			
+            char predChar = textcodec.symbol;
+
+            std::cout << predChar;
+        }
+        std::cout << "\n";
+
+        // The producer is done with the writer once it is joined
+        pipeline.stop();
+
+        if (writing) {
+            writing = false;
+
+            if (!writer.finish() || !frames.open(cachePath, cacheKey, encoder.N))
+                std::cerr << "Could not write frame cache " << cachePath << ", encoding every epoch" << std::endl;
+        }
+    }
+}
+
+// Trains with numWorkers threads on contiguous segments of the corpus, sharing the weights (Hogwild). Reports the next symbol
+// accuracy per epoch instead of the predicted text, which would interleave
+void trainHogwild(neo::PredictiveHierarchy& ph, const TextSource& source, const std::vector<unsigned char>& alphabet,
+           int epochs, int numWorkers, int syncInterval, unsigned int seed) {
+
+	int symbolIndices[256] = { 0 };
+
+	for (int i = 0; i < alphabet.size(); i++)
+		symbolIndices[alphabet[i]] = i;
+
+	const unsigned char* text = reinterpret_cast<const unsigned char*>(source.data());
+
+	neo::HogwildTrainer trainer;
+
+	trainer.create(&ph, numWorkers, seed, syncInterval);
+
+	size_t segmentSize = (source.size() + numWorkers - 1) / numWorkers;
+
+	// Per worker: position in its segment, last symbol set and correct predictions
+	std::vector<size_t> positions(numWorkers);
+	std::vector<int> previous(numWorkers);
+	std::vector<long> correct(numWorkers);
+
+	int numSymbols = alphabet.size();
+
+	neo::HogwildTrainer::Feeder feed = [&](int worker, neo::PredictiveHierarchy::State& state) -> bool {
+		size_t position = worker * segmentSize + positions[worker];
+
+		if (positions[worker] >= segmentSize || position >= source.size())
+			return false;
+
+		int symbol = symbolIndices[text[position]];
+
+		if (positions[worker] > 0) {
+			int predicted = 0;
+
+			for (int i = 1; i < numSymbols; i++)
+				if (neo::PredictiveHierarchy::getPrediction(state, i) > neo::PredictiveHierarchy::getPrediction(state, predicted))
+					predicted = i;
+
+			if (predicted == symbol)
+				correct[worker]++;
+		}
+
+		neo::PredictiveHierarchy::setInput(state, previous[worker], 0.0f);
+		neo::PredictiveHierarchy::setInput(state, symbol, 1.0f);
+
+		previous[worker] = symbol;
+		positions[worker]++;
+
+		return true;
+	};
+
+	for (int k = 0; k < epochs; k++) {
+		std::fill(positions.begin(), positions.end(), 0);
+		std::fill(correct.begin(), correct.end(), 0);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		long steps = trainer.train(feed);
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		long totalCorrect = 0;
+
+		for (int w = 0; w < numWorkers; w++)
+			totalCorrect += correct[w];
+
+		std::cout << "epoch: " << k << " accuracy: " << static_cast<double>(totalCorrect) / std::max(1L, steps - numWorkers)
+			<< " steps/s: " << steps / std::max(1e-9, seconds) << std::endl;
+	}
+}
+
+void sample(neo::PredictiveHierarchy& ph, std::mt19937& generator,
+           char seed, int nSamples, VectorCodec& textcodec, float seedNoise = 0.5, float predNoise = 0.05) {
+    
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+	
+	textcodec.symbol = seed;
+	textcodec.encode();
+	
+	for (int j = 0; j < textcodec.N; j++) {
+        ph.setInput(j, textcodec.vector[j] + dist01(generator)*seedNoise);
+    }
+    ph.simStep(generator, false);
+    
+    std::cout << "seed: " << seed << " i: " << textcodec.symIndex << " sample: \"";
+    
+    for (size_t i = 1; i < nSamples; i++) {
+
+		for (int j = 0; j < textcodec.N; j++) {
+			textcodec.vector[j] = ph.getPrediction(j);
+		}
+        
+		textcodec.decode();
+			
+		char predChar = textcodec.symbol;
+        
+		std::cout << predChar;
+		
+        for (int j = 0; j < textcodec.N; j++) {
+            ph.setInput(j, ph.getPrediction(j) + dist01(generator)*predNoise);
+        }
+        
+        ph.simStep(generator, false);
+    }
+    
+    std::cout << "\"" << std::endl;
+}
+
+int main(int argc, const char** argv) {
+	
+    // Load the command line config
+    
+    ArgumentParser parser;
+        
+    parser.addArgument("-e", "--epochs", 1);
+    parser.addArgument("-s", "--seed", 1);
+    parser.addArgument("-l", "--layers", 1);
+    parser.addArgument("-S", "--samples", 1);
+    parser.addArgument("-c", "--corpus", 1);
+    parser.addArgument("--nlayers", 1);
+    parser.addArgument("--ifbradius", 1);
+    parser.addArgument("--lw", 1);
+    parser.addArgument("--lh", 1);
+    parser.addArgument("--ssize", 1);
+    parser.addArgument("--sseednoise", 1);
+    parser.addArgument("--sprednoise", 1);
+    parser.addArgument("--alphabetscan", 1);
+    parser.addArgument("--cache", 1);
+    parser.addArgument("--prefetch", 1);
+    parser.addArgument("--workers", 1);
+    parser.addArgument("--sync", 1);
+    
+    parser.parse(argc, argv);
+    
+	// RNG
+    unsigned int seed = std::atoi(parser.retrieve("seed", std::to_string(time(nullptr))).c_str());
+	std::mt19937 generator(seed);
+
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+    
+	// ---------------------------------- Open the Corpus ----------------------------------
+	// Memory mapped and streamed, never held in memory as a whole
+	std::string corpusPath = parser.retrieve("corpus", "corpus.txt");
+	TextSource source;
+
+	if (!source.open(corpusPath)) {
+		std::cerr << "Could not open corpus " << corpusPath << std::endl;
+
+		return 1;
+	}
+	
+	// ---------------------------------- Find Character Set ----------------------------------
+	// The whole corpus by default (0), it is read in full by the first epoch anyway. A bounded prefix starts faster on huge corpora
+	size_t alphabetScan = std::strtoull(parser.retrieve("alphabetscan", "0").c_str(), nullptr, 10);
+	
+	std::vector<unsigned char> alphabet = source.scanAlphabet(alphabetScan);
+
+	if (alphabet.empty()) {
+		std::cerr << "Corpus " << corpusPath << " is empty" << std::endl;
+
+		return 1;
+	}
+
+	if (alphabetScan != 0 && alphabetScan < source.size())
+		std::cerr << "Alphabet scanned from the first " << alphabetScan << " of " << source.size() << " bytes, symbols first seen later encode as '"
+			<< alphabet.front() << "'" << std::endl;
+
+	VectorCodec textcodec(alphabet);
+	int numInputs = textcodec.N;
+	int inputsRoot = std::ceil(std::sqrt(static_cast<float>(numInputs)));
+	
+	// ---------------------------------- Frame Cache ----------------------------------
+	// Written by the first epoch, later epochs and runs stream the frames back. Rebuilt when the corpus or alphabet changes, "none" disables it
+	std::string cachePath = parser.retrieve("cache", corpusPath + ".frames");
+
+	if (cachePath == "none")
+		cachePath.clear();
+
+	uint64_t cacheKey = FrameCache::fileKey(corpusPath);
+
+	for (int i = 0; i < alphabet.size(); i++)
+		cacheKey = FrameCache::mixKey(cacheKey, alphabet[i]);
+
+	FrameCache frames;
+
+	if (!cachePath.empty())
+		frames.open(cachePath, cacheKey, textcodec.N);
+	
+	// ---------------------------------- Create Hierarchy ----------------------------------
+	
+	// Fill out layer descriptions
+	int nLayers = std::atoi(parser.retrieve("nlayers", "3").c_str());
+	int layerW = std::atoi(parser.retrieve("lw", "16").c_str());
+	int layerH = std::atoi(parser.retrieve("lh", "16").c_str());
+	int inFeedBackRadius = std::atoi(parser.retrieve("ifbradius", "16").c_str());
+	
+	std::vector<neo::PredictiveHierarchy::LayerDesc> layerDescs(nLayers);
+	
+	for (int i = 0; i < nLayers; i++) {
+		layerDescs[i]._width = layerW;
+		layerDescs[i]._height = layerH;
+	}
+	
+	neo::PredictiveHierarchy ph;
+	
+	ph.createRandom(inputsRoot, inputsRoot, inFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, generator);
+	
+	// ---------------------------------- Iterate Over Corpus ----------------------------------
+    int numEpochs = std::atoi(parser.retrieve("epochs", "10").c_str());
+    int numSamples = std::atoi(parser.retrieve("samples", "10").c_str());
+    int sampleSize = std::atoi(parser.retrieve("ssize", std::to_string(std::min<size_t>(source.size(), 65536))).c_str());
+    float sampleSeedNoise = std::atof(parser.retrieve("sseednoise", "0.5").c_str());
+    float samplePredNoise = std::atof(parser.retrieve("sprednoise", "0.05").c_str());
+    int prefetch = std::atoi(parser.retrieve("prefetch", "4").c_str());
+    int numWorkers = std::max(1, std::atoi(parser.retrieve("workers", "1").c_str()));
+    int syncInterval = std::atoi(parser.retrieve("sync", "0").c_str());
+    
+    std::cout << "NeoRL text prediction experiment" << std::endl;
+    std::cout << "Corpus: " << corpusPath << " size: " << source.size() << " alphabet size: " << textcodec.nSymbols << std::endl;
+    std::cout << "Frame cache: " << (cachePath.empty() ? std::string("off") : frames.isOpen() ? cachePath + " frames: " + std::to_string(frames.getNumFrames()) : cachePath + " written by the first epoch") << std::endl;
+    std::cout << "Model: nLayers: " << nLayers << " layerW: " << layerW << " layerH: " << layerH << " inFeedbackRadius: " << inFeedBackRadius 
+			  << " input: " << inputsRoot << "x" << inputsRoot << std::endl;
+	std::cout << "Training: epochs: " << numEpochs << " prefetch: " << prefetch << " workers: " << numWorkers << " sync: " << syncInterval << std::endl;
+	std::cout << "Sampling: samples: " << numSamples << " size: " << sampleSize << " seed noise: " << sampleSeedNoise << " pred noise " << samplePredNoise << std::endl;    
+    std::cout << "--[ Start training ]--" << std::endl;
+    
+    if (numWorkers > 1)
+        trainHogwild(ph, source, alphabet, numEpochs, numWorkers, syncInterval, seed);
+    else
+        train(ph, generator, source, frames, cachePath, cacheKey, numEpochs, textcodec, prefetch);
+    
+    std::cout << "--[ Start sampling ]--" << std::endl;
+    for (int i = 0; i < numSamples; i++) {
+        sample(ph, generator, textcodec.getRandomSymbol(generator), sampleSize, textcodec, sampleSeedNoise, samplePredNoise);
+    }
+    
+	return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "TextSource.h"
+
+#include <stdint.h>
+#include <algorithm>
+
+bool TextSource::open(const std::string &path) {
+	_position = 0;
+
+	if (!_file.open(path))
+		return false;
+
+	_file.adviseSequential();
+
+	return true;
+}
+
+std::vector<unsigned char> TextSource::scanAlphabet(size_t scanBytes) const {
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(_file.data());
+
+	size_t size = scanBytes == 0 ? _file.size() : std::min(scanBytes, _file.size());
+
+	// Four interleaved histograms, so runs of the same byte do not serialize on one counter
+	std::vector<uint64_t> counts(4 * 256, 0);
+
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4) {
+		counts[data[i + 0]]++;
+		counts[256 + data[i + 1]]++;
+		counts[512 + data[i + 2]]++;
+		counts[768 + data[i + 3]]++;
+	}
+
+	for (; i < size; i++)
+		counts[data[i]]++;
+
+	std::vector<unsigned char> alphabet;
+
+	for (int s = 0; s < 256; s++)
+		if (counts[s] + counts[256 + s] + counts[512 + s] + counts[768 + s] > 0)
+			alphabet.push_back(static_cast<unsigned char>(s));
+
+	return alphabet;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <vector>
+
+// Streams the symbols of a text file of any size from a memory mapping, one pass (epoch) at a time
+class TextSource {
+private:
+	MappedFile _file;
+
+	size_t _position;
+
+public:
+	TextSource()
+		: _position(0)
+	{}
+
+	// Returns false if the file could not be opened
+	bool open(const std::string &path);
+
+	// Symbols (bytes) occurring in the first scanBytes bytes, 0 for the whole file, in byte order.
+	// A bounded scan can miss symbols that only occur later, those would all encode as one symbol
+	std::vector<unsigned char> scanAlphabet(size_t scanBytes = 0) const;
+
+	// Next symbol of the current pass, false at the end of the file
+	bool next(char &symbol) {
+		if (_position >= _file.size())
+			return false;
+
+		symbol = _file.data()[_position++];
+
+		return true;
+	}
+
+	// Start the next pass
+	void rewind() {
+		_position = 0;
+	}
+
+	size_t getPosition() const {
+		return _position;
+	}
+
+	size_t size() const {
+		return _file.size();
+	}
+
+	// The whole text, read only, so several readers can share one mapping with their own positions
+	const char* data() const {
+		return _file.data();
+	}
+};
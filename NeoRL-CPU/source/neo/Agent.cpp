@@ -1,284 +1,872 @@
-#include "Agent.h"
-
-#include <algorithm>
-
-using namespace neo;
-
-void Agent::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
-
-	_layerDescs = layerDescs;
-
-	_layers.resize(_layerDescs.size());
-
-	int widthPrev = inputWidth;
-	int heightPrev = inputHeight;
-
-	for (int l = 0; l < _layerDescs.size(); l++) {
-		_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._recurrentRadius, _layerDescs[l]._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
-
-		_layers[l]._predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
-
-		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
-		int predictiveSize = std::pow(_layerDescs[l]._predictiveRadius * 2 + 1, 2);
-
-		float hiddenToNextHiddenWidth = 1.0f;
-		float hiddenToNextHiddenHeight = 1.0f;
-
-		if (l < _layers.size() - 1) {
-			hiddenToNextHiddenWidth = static_cast<float>(_layerDescs[l + 1]._width) / static_cast<float>(_layerDescs[l]._width);
-			hiddenToNextHiddenHeight = static_cast<float>(_layerDescs[l + 1]._height) / static_cast<float>(_layerDescs[l]._height);
-		}
-
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			p._bias._weight = weightDist(generator);
-
-			int hx = pi % _layerDescs[l]._width;
-			int hy = pi / _layerDescs[l]._width;
-
-			// Feed Back
-			if (l < _layers.size() - 1) {
-				p._feedBackConnections.reserve(feedBackSize);
-
-				int centerX = std::round(hx * hiddenToNextHiddenWidth);
-				int centerY = std::round(hy * hiddenToNextHiddenHeight);
-
-				for (int dx = -_layerDescs[l]._feedBackRadius; dx <= _layerDescs[l]._feedBackRadius; dx++)
-					for (int dy = -_layerDescs[l]._feedBackRadius; dy <= _layerDescs[l]._feedBackRadius; dy++) {
-						int hox = centerX + dx;
-						int hoy = centerY + dy;
-
-						if (hox >= 0 && hox < _layerDescs[l + 1]._width && hoy >= 0 && hoy < _layerDescs[l + 1]._height) {
-							int hio = hox + hoy * _layerDescs[l + 1]._width;
-
-							Connection c;
-
-							c._weight = weightDist(generator);
-							c._index = hio;
-
-							p._feedBackConnections.push_back(c);
-						}
-					}
-
-				p._feedBackConnections.shrink_to_fit();
-			}
-
-			// Predictive
-			p._predictiveConnections.reserve(feedBackSize);
-
-			for (int dx = -_layerDescs[l]._predictiveRadius; dx <= _layerDescs[l]._predictiveRadius; dx++)
-				for (int dy = -_layerDescs[l]._predictiveRadius; dy <= _layerDescs[l]._predictiveRadius; dy++) {
-					int hox = hx + dx;
-					int hoy = hy + dy;
-
-					if (hox >= 0 && hox < _layerDescs[l]._width && hoy >= 0 && hoy < _layerDescs[l]._height) {
-						int hio = hox + hoy * _layerDescs[l]._width;
-
-						Connection c;
-
-						c._weight = weightDist(generator);
-						c._index = hio;
-
-						p._predictiveConnections.push_back(c);
-					}
-				}
-
-			p._predictiveConnections.shrink_to_fit();
-
-			p._column.createRandom(p._predictiveConnections.size() + p._feedBackConnections.size() * 2, _numColumnActions, _layerDescs[l]._cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
-		}
-
-		widthPrev = _layerDescs[l]._width;
-		heightPrev = _layerDescs[l]._height;
-	}
-
-	_inputPredictionNodes.resize(inputWidth * inputHeight);
-
-	float inputToNextHiddenWidth = static_cast<float>(_layerDescs.front()._width) / static_cast<float>(inputWidth);
-	float inputToNextHiddenHeight = static_cast<float>(_layerDescs.front()._height) / static_cast<float>(inputHeight);
-
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		p._bias._weight = weightDist(generator);
-
-		int hx = pi % inputWidth;
-		int hy = pi / inputWidth;
-
-		int feedBackSize = std::pow(inputFeedBackRadius * 2 + 1, 2);
-
-		// Feed Back
-		p._feedBackConnections.reserve(feedBackSize);
-
-		int centerX = std::round(hx * inputToNextHiddenWidth);
-		int centerY = std::round(hy * inputToNextHiddenHeight);
-
-		for (int dx = -inputFeedBackRadius; dx <= inputFeedBackRadius; dx++)
-			for (int dy = -inputFeedBackRadius; dy <= inputFeedBackRadius; dy++) {
-				int hox = centerX + dx;
-				int hoy = centerY + dy;
-
-				if (hox >= 0 && hox < _layerDescs.front()._width && hoy >= 0 && hoy < _layerDescs.front()._height) {
-					int hio = hox + hoy * _layerDescs.front()._width;
-
-					Connection c;
-
-					c._weight = weightDist(generator);
-					c._index = hio;
-
-					p._feedBackConnections.push_back(c);
-				}
-			}
-
-		p._feedBackConnections.shrink_to_fit();
-
-		p._column.createRandom(p._feedBackConnections.size() * 2, _numColumnActions, _cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
-	}
-}
-
-void Agent::simStep(float reward, std::mt19937 &generator, bool learn) {
-	// Feature extraction
-	for (int l = 0; l < _layers.size(); l++) {
-		_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, generator);
-
-		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++) {
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i) * _layers[l]._predictionNodes[i]._column.getAction(_attention));
-			}
-		}
-	}
-
-	// Prediction
-	for (int l = _layers.size() - 1; l >= 0; l--) {
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			int colInputIndex = 0;
-
-			if (l < _layers.size() - 1) {
-				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
-					p._column.setState(colInputIndex++, _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._column.getAction(_signal));
-					p._column.setState(colInputIndex++, _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state);
-				}
-			}
-
-			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				p._column.setState(colInputIndex++, _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index));
-
-			// Update column
-			p._column.simStep(reward, _layerDescs[l]._columnSparsity, _layerDescs[l]._columnGamma,
-				_layerDescs[l]._columnIter, _layerDescs[l]._columnLeak,
-				_layerDescs[l]._columnFeedForwardAlpha, _layerDescs[l]._columnLateralAlpha, _layerDescs[l]._columnThresholdAlpha,
-				_layerDescs[l]._columnQAlpha, _layerDescs[l]._columnActionAlpha,
-				_layerDescs[l]._columnGammaLambda,
-				_layerDescs[l]._columnExplorationStdDev, _layerDescs[l]._columnExplorationBreakChance, generator);
-
-			// Learn
-			if (learn) {
-				float predictionError = p._column.getAction(_learnPrediction) * (_layers[l]._sdr.getHiddenState(pi) - p._statePrev);
-
-				if (l < _layers.size() - 1) {
-					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-						p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
-				}
-
-				// Predictive
-				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-					p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
-			}
-
-			float activation = 0.0f;
-
-			// Feed Back
-			if (l < _layers.size() - 1) {
-				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
-			}
-
-			// Predictive
-			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
-
-			p._activation = activation;
-
-			p._state = std::min(1.0f, std::max(0.0f, p._activation));
-		}
-	}
-
-	// Get first layer prediction
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		int colInputIndex = 0;
-
-		for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
-			p._column.setState(colInputIndex++, _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._column.getAction(_signal));
-			p._column.setState(colInputIndex++, _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state);
-		}
-
-		// Update column
-		p._column.simStep(reward, _columnSparsity, _columnGamma,
-			_columnIter, _columnLeak,
-			_columnFeedForwardAlpha, _columnLateralAlpha, _columnThresholdAlpha,
-			_columnQAlpha, _columnActionAlpha,
-			_columnGammaLambda,
-			_columnExplorationStdDev, _columnExplorationBreakChance, generator);
-
-		// Learn
-		if (learn) {
-			float predictionError = p._column.getAction(_learnPrediction) * (_layers.front()._sdr.getVisibleState(pi) - p._statePrev);
-
-			for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-				p._feedBackConnections[ci]._weight += _learnInputFeedBack * predictionError * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
-		}
-
-		float activation = 0.0f;
-
-		// Feed Back
-		for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-			activation += p._feedBackConnections[ci]._weight * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state;
-
-		p._activation = activation;
-
-		p._state = p._activation;
-	}
-
-	for (int l = 0; l < _layers.size(); l++) {
-		std::vector<float> rewards(_layers[l]._predictionNodes.size());
-
-		if (learn) {
-			for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-				PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-				float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
-
-				float error2 = predictionError * predictionError;
-
-				rewards[pi] = sigmoid(_layerDescs[l]._sdrSensitivity * (error2 - p._baseline));
-
-				p._baseline = (1.0f - _layerDescs[l]._sdrBaselineDecay) * p._baseline + _layerDescs[l]._sdrBaselineDecay * error2;
-			}
-
-			_layers[l]._sdr.learn(rewards, _layerDescs[l]._sdrLambda, _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._sdrLearnThreshold, _layerDescs[l]._sdrSparsity, _layerDescs[l]._sdrWeightDecay, _layerDescs[l]._sdrMaxWeightDelta); //attentions[l], 
-		}
-
-		_layers[l]._sdr.stepEnd();
-
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			p._statePrev = p._state;
-			p._activationPrev = p._activation;
-		}
-	}
-
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		p._statePrev = p._state;
-		p._activationPrev = p._activation;
-	}
+#include "Agent.h"
+
+#include "CounterRNG.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void Agent::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
+
+	_layerDescs = layerDescs;
+
+	_layers.resize(_layerDescs.size());
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	for (int l = 0; l < _layerDescs.size(); l++) {
+		_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._recurrentRadius, _layerDescs[l]._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+		_layers[l]._sdr.initState(_layers[l]._sdrState);
+
+		_layers[l]._predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
+
+		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
+		int predictiveSize = std::pow(_layerDescs[l]._predictiveRadius * 2 + 1, 2);
+
+		float hiddenToNextHiddenWidth = 1.0f;
+		float hiddenToNextHiddenHeight = 1.0f;
+
+		if (l < _layers.size() - 1) {
+			hiddenToNextHiddenWidth = static_cast<float>(_layerDescs[l + 1]._width) / static_cast<float>(_layerDescs[l]._width);
+			hiddenToNextHiddenHeight = static_cast<float>(_layerDescs[l + 1]._height) / static_cast<float>(_layerDescs[l]._height);
+		}
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			p._bias._weight = weightDist(generator);
+
+			int hx = pi % _layerDescs[l]._width;
+			int hy = pi / _layerDescs[l]._width;
+
+			// Feed Back
+			if (l < _layers.size() - 1) {
+				p._feedBackConnections.reserve(feedBackSize);
+
+				int centerX = std::round(hx * hiddenToNextHiddenWidth);
+				int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+				for (int dx = -_layerDescs[l]._feedBackRadius; dx <= _layerDescs[l]._feedBackRadius; dx++)
+					for (int dy = -_layerDescs[l]._feedBackRadius; dy <= _layerDescs[l]._feedBackRadius; dy++) {
+						int hox = centerX + dx;
+						int hoy = centerY + dy;
+
+						if (hox >= 0 && hox < _layerDescs[l + 1]._width && hoy >= 0 && hoy < _layerDescs[l + 1]._height) {
+							int hio = hox + hoy * _layerDescs[l + 1]._width;
+
+							Connection c;
+
+							c._weight = weightDist(generator);
+							c._index = hio;
+
+							p._feedBackConnections.push_back(c);
+						}
+					}
+
+				p._feedBackConnections.shrink_to_fit();
+			}
+
+			// Predictive
+			p._predictiveConnections.reserve(feedBackSize);
+
+			for (int dx = -_layerDescs[l]._predictiveRadius; dx <= _layerDescs[l]._predictiveRadius; dx++)
+				for (int dy = -_layerDescs[l]._predictiveRadius; dy <= _layerDescs[l]._predictiveRadius; dy++) {
+					int hox = hx + dx;
+					int hoy = hy + dy;
+
+					if (hox >= 0 && hox < _layerDescs[l]._width && hoy >= 0 && hoy < _layerDescs[l]._height) {
+						int hio = hox + hoy * _layerDescs[l]._width;
+
+						Connection c;
+
+						c._weight = weightDist(generator);
+						c._index = hio;
+
+						p._predictiveConnections.push_back(c);
+					}
+				}
+
+			p._predictiveConnections.shrink_to_fit();
+
+			p._column.createRandom(p._predictiveConnections.size() + p._feedBackConnections.size() * 2, _numColumnActions, _layerDescs[l]._cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+		}
+
+		widthPrev = _layerDescs[l]._width;
+		heightPrev = _layerDescs[l]._height;
+	}
+
+	_inputPredictionNodes.resize(inputWidth * inputHeight);
+
+	float inputToNextHiddenWidth = static_cast<float>(_layerDescs.front()._width) / static_cast<float>(inputWidth);
+	float inputToNextHiddenHeight = static_cast<float>(_layerDescs.front()._height) / static_cast<float>(inputHeight);
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		p._bias._weight = weightDist(generator);
+
+		int hx = pi % inputWidth;
+		int hy = pi / inputWidth;
+
+		int feedBackSize = std::pow(inputFeedBackRadius * 2 + 1, 2);
+
+		// Feed Back
+		p._feedBackConnections.reserve(feedBackSize);
+
+		int centerX = std::round(hx * inputToNextHiddenWidth);
+		int centerY = std::round(hy * inputToNextHiddenHeight);
+
+		for (int dx = -inputFeedBackRadius; dx <= inputFeedBackRadius; dx++)
+			for (int dy = -inputFeedBackRadius; dy <= inputFeedBackRadius; dy++) {
+				int hox = centerX + dx;
+				int hoy = centerY + dy;
+
+				if (hox >= 0 && hox < _layerDescs.front()._width && hoy >= 0 && hoy < _layerDescs.front()._height) {
+					int hio = hox + hoy * _layerDescs.front()._width;
+
+					Connection c;
+
+					c._weight = weightDist(generator);
+					c._index = hio;
+
+					p._feedBackConnections.push_back(c);
+				}
+			}
+
+		p._feedBackConnections.shrink_to_fit();
+
+		p._column.createRandom(p._feedBackConnections.size() * 2, _numColumnActions, _cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+	}
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+}
+
+void Agent::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, int numThreads) {
+	_layerDescs = layerDescs;
+
+	_layers.clear();
+	_layers.resize(_layerDescs.size());
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	// Five streams per layer: sparse coder seed, biases, feed back, predictive, column seeds
+	for (int l = 0; l < _layerDescs.size(); l++) {
+		const LayerDesc &desc = _layerDescs[l];
+
+		_layers[l]._sdr.createRandom(widthPrev, heightPrev, desc._width, desc._height, desc._receptiveRadius, desc._recurrentRadius, desc._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, CounterRNG(seed, l * 5).bits(0), numThreads);
+		_layers[l]._sdr.initState(_layers[l]._sdrState);
+
+		_layers[l]._predictionNodes.resize(desc._width * desc._height);
+
+		CounterRNG biasRNG(seed, l * 5 + 1);
+		CounterRNG feedBackRNG(seed, l * 5 + 2);
+		CounterRNG predictiveRNG(seed, l * 5 + 3);
+		CounterRNG columnRNG(seed, l * 5 + 4);
+
+		bool hasNext = l < _layers.size() - 1;
+
+		int nextWidth = hasNext ? _layerDescs[l + 1]._width : 0;
+		int nextHeight = hasNext ? _layerDescs[l + 1]._height : 0;
+
+		float hiddenToNextHiddenWidth = hasNext ? static_cast<float>(nextWidth) / static_cast<float>(desc._width) : 1.0f;
+		float hiddenToNextHiddenHeight = hasNext ? static_cast<float>(nextHeight) / static_cast<float>(desc._height) : 1.0f;
+
+		// Columns make nodes heavy, split finely
+		parallelFor(_layers[l]._predictionNodes.size(), numThreads, [&](int begin, int end) {
+			for (int pi = begin; pi < end; pi++) {
+				PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+				p._bias._weight = biasRNG.uniform(pi, initMinWeight, initMaxWeight);
+
+				int hx = pi % desc._width;
+				int hy = pi / desc._width;
+
+				// Feed Back
+				if (hasNext) {
+					int centerX = std::round(hx * hiddenToNextHiddenWidth);
+					int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+					int ci = 0;
+
+					p._feedBackConnections.resize(clippedSpan(centerX, desc._feedBackRadius, nextWidth) * clippedSpan(centerY, desc._feedBackRadius, nextHeight));
+
+					for (int hox = std::max(0, centerX - desc._feedBackRadius); hox <= std::min(nextWidth - 1, centerX + desc._feedBackRadius); hox++)
+						for (int hoy = std::max(0, centerY - desc._feedBackRadius); hoy <= std::min(nextHeight - 1, centerY + desc._feedBackRadius); hoy++) {
+							p._feedBackConnections[ci]._index = hox + hoy * nextWidth;
+							p._feedBackConnections[ci]._weight = feedBackRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+							ci++;
+						}
+				}
+
+				// Predictive
+				int ci = 0;
+
+				p._predictiveConnections.resize(clippedSpan(hx, desc._predictiveRadius, desc._width) * clippedSpan(hy, desc._predictiveRadius, desc._height));
+
+				for (int hox = std::max(0, hx - desc._predictiveRadius); hox <= std::min(desc._width - 1, hx + desc._predictiveRadius); hox++)
+					for (int hoy = std::max(0, hy - desc._predictiveRadius); hoy <= std::min(desc._height - 1, hy + desc._predictiveRadius); hoy++) {
+						p._predictiveConnections[ci]._index = hox + hoy * desc._width;
+						p._predictiveConnections[ci]._weight = predictiveRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+						ci++;
+					}
+
+				p._column.createRandom(p._predictiveConnections.size() + p._feedBackConnections.size() * 2, _numColumnActions, desc._cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, columnRNG.bits(pi));
+			}
+		}, 4);
+
+		widthPrev = desc._width;
+		heightPrev = desc._height;
+	}
+
+	_inputPredictionNodes.clear();
+	_inputPredictionNodes.resize(inputWidth * inputHeight);
+
+	int firstWidth = _layerDescs.front()._width;
+	int firstHeight = _layerDescs.front()._height;
+
+	float inputToNextHiddenWidth = static_cast<float>(firstWidth) / static_cast<float>(inputWidth);
+	float inputToNextHiddenHeight = static_cast<float>(firstHeight) / static_cast<float>(inputHeight);
+
+	CounterRNG biasRNG(seed, _layers.size() * 5);
+	CounterRNG feedBackRNG(seed, _layers.size() * 5 + 1);
+	CounterRNG columnRNG(seed, _layers.size() * 5 + 2);
+
+	parallelFor(_inputPredictionNodes.size(), numThreads, [&](int begin, int end) {
+		for (int pi = begin; pi < end; pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			p._bias._weight = biasRNG.uniform(pi, initMinWeight, initMaxWeight);
+
+			int centerX = std::round((pi % inputWidth) * inputToNextHiddenWidth);
+			int centerY = std::round((pi / inputWidth) * inputToNextHiddenHeight);
+
+			int ci = 0;
+
+			p._feedBackConnections.resize(clippedSpan(centerX, inputFeedBackRadius, firstWidth) * clippedSpan(centerY, inputFeedBackRadius, firstHeight));
+
+			for (int hox = std::max(0, centerX - inputFeedBackRadius); hox <= std::min(firstWidth - 1, centerX + inputFeedBackRadius); hox++)
+				for (int hoy = std::max(0, centerY - inputFeedBackRadius); hoy <= std::min(firstHeight - 1, centerY + inputFeedBackRadius); hoy++) {
+					p._feedBackConnections[ci]._index = hox + hoy * firstWidth;
+					p._feedBackConnections[ci]._weight = feedBackRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+					ci++;
+				}
+
+			p._column.createRandom(p._feedBackConnections.size() * 2, _numColumnActions, _cellsPerColumn, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, columnRNG.bits(pi));
+		}
+	}, 4);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+}
+
+bool Agent::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator,
+	size_t memoryBudget, Footprint* footprint)
+{
+	Footprint required = computeFootprint(inputWidth, inputHeight, inputFeedBackRadius, layerDescs);
+
+	if (footprint != nullptr)
+		*footprint = required;
+
+	if (required.getTotal() > memoryBudget)
+		return false;
+
+	createRandom(inputWidth, inputHeight, inputFeedBackRadius, layerDescs, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+
+	return true;
+}
+
+Footprint Agent::computeFootprint(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, int updateInterval, std::vector<Footprint>* layerFootprints) const {
+	int numLayers = layerDescs.size();
+
+	Footprint total;
+
+	total._structure = numLayers * (sizeof(LayerDesc) + sizeof(Layer));
+
+	if (layerFootprints != nullptr)
+		layerFootprints->assign(numLayers, Footprint());
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	for (int l = 0; l < numLayers; l++) {
+		const LayerDesc &desc = layerDescs[l];
+
+		int numHidden = desc._width * desc._height;
+
+		Footprint layer = SparseCoder::computeFootprint(widthPrev, heightPrev, desc._width, desc._height, desc._receptiveRadius, desc._recurrentRadius, desc._lateralRadius, updateInterval);
+
+		layer += SparseCoder::computeStateFootprint(widthPrev * heightPrev, numHidden, desc._sdrIter);
+
+		// Prediction nodes, centers as in createRandom
+		float hiddenToNextHiddenWidth = 1.0f;
+		float hiddenToNextHiddenHeight = 1.0f;
+
+		if (l < numLayers - 1) {
+			hiddenToNextHiddenWidth = static_cast<float>(layerDescs[l + 1]._width) / static_cast<float>(desc._width);
+			hiddenToNextHiddenHeight = static_cast<float>(layerDescs[l + 1]._height) / static_cast<float>(desc._height);
+		}
+
+		for (int pi = 0; pi < numHidden; pi++) {
+			int hx = pi % desc._width;
+			int hy = pi / desc._width;
+
+			int numFeedBack = 0;
+
+			if (l < numLayers - 1) {
+				int centerX = std::round(hx * hiddenToNextHiddenWidth);
+				int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+				numFeedBack = clippedSpan(centerX, desc._feedBackRadius, layerDescs[l + 1]._width) * clippedSpan(centerY, desc._feedBackRadius, layerDescs[l + 1]._height);
+			}
+
+			int numPredictive = clippedSpan(hx, desc._predictiveRadius, desc._width) * clippedSpan(hy, desc._predictiveRadius, desc._height);
+
+			layer._weights += (numFeedBack + numPredictive) * sizeof(Connection);
+
+			if (updateInterval > 1)
+				layer._deltas += (numFeedBack + numPredictive) * sizeof(float);
+
+			layer += Column::computeFootprint(numPredictive + numFeedBack * 2, _numColumnActions, desc._cellsPerColumn, desc._columnIter, updateInterval);
+		}
+
+		layer._structure += numHidden * sizeof(PredictionNode);
+
+		if (layerFootprints != nullptr)
+			(*layerFootprints)[l] = layer;
+
+		total += layer;
+
+		widthPrev = desc._width;
+		heightPrev = desc._height;
+	}
+
+	// Input prediction
+	int numInputs = inputWidth * inputHeight;
+
+	if (numLayers > 0) {
+		float inputToNextHiddenWidth = static_cast<float>(layerDescs.front()._width) / static_cast<float>(inputWidth);
+		float inputToNextHiddenHeight = static_cast<float>(layerDescs.front()._height) / static_cast<float>(inputHeight);
+
+		for (int pi = 0; pi < numInputs; pi++) {
+			int centerX = std::round((pi % inputWidth) * inputToNextHiddenWidth);
+			int centerY = std::round((pi / inputWidth) * inputToNextHiddenHeight);
+
+			int numFeedBack = clippedSpan(centerX, inputFeedBackRadius, layerDescs.front()._width) * clippedSpan(centerY, inputFeedBackRadius, layerDescs.front()._height);
+
+			total._weights += numFeedBack * sizeof(Connection);
+
+			if (updateInterval > 1)
+				total._deltas += numFeedBack * sizeof(float);
+
+			total += Column::computeFootprint(numFeedBack * 2, _numColumnActions, _cellsPerColumn, _columnIter, updateInterval);
+		}
+	}
+
+	total._structure += numInputs * sizeof(InputPredictionNode);
+
+	return total;
+}
+
+Footprint Agent::getFootprint(std::vector<Footprint>* layerFootprints) const {
+	Footprint total;
+
+	total._structure = vectorBytes(_layerDescs) + vectorBytes(_layers);
+
+	if (layerFootprints != nullptr)
+		layerFootprints->assign(_layers.size(), Footprint());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		Footprint layer = _layers[l]._sdr.getFootprint();
+
+		layer += SparseCoder::getStateFootprint(_layers[l]._sdrState);
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			const PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			layer._weights += vectorBytes(p._feedBackConnections) + vectorBytes(p._predictiveConnections);
+			layer._deltas += vectorBytes(p._feedBackDeltas) + vectorBytes(p._predictiveDeltas);
+
+			layer += p._column.getFootprint();
+		}
+
+		layer._structure += vectorBytes(_layers[l]._predictionNodes);
+
+		if (layerFootprints != nullptr)
+			(*layerFootprints)[l] = layer;
+
+		total += layer;
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		const InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		total._weights += vectorBytes(p._feedBackConnections);
+		total._deltas += vectorBytes(p._feedBackDeltas);
+
+		total += p._column.getFootprint();
+	}
+
+	total._structure += vectorBytes(_inputPredictionNodes);
+
+	return total;
+}
+
+void Agent::save(std::ostream &os) const {
+	TraceScope scope("save");
+
+	const char magic[4] = { 'N', 'E', 'O', 'A' };
+	int version = 3;
+	int numLayers = _layers.size();
+
+	os.write(magic, sizeof(magic));
+	os.write(reinterpret_cast<const char*>(&version), sizeof(int));
+	os.write(reinterpret_cast<const char*>(&numLayers), sizeof(int));
+	os.write(reinterpret_cast<const char*>(_layerDescs.data()), numLayers * sizeof(LayerDesc));
+
+	// First layer column parameters
+	os.write(reinterpret_cast<const char*>(&_cellsPerColumn), sizeof(int));
+	os.write(reinterpret_cast<const char*>(&_columnIter), sizeof(int));
+
+	const float params[12] = { _columnSparsity, _columnLeak, _columnGamma, _columnGammaLambda,
+		_columnFeedForwardAlpha, _columnLateralAlpha, _columnThresholdAlpha, _columnQAlpha, _columnActionAlpha,
+		_columnExplorationStdDev, _columnExplorationBreakChance, _learnInputFeedBack };
+
+	os.write(reinterpret_cast<const char*>(params), sizeof(params));
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sdr.save(os);
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			const PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			os.write(reinterpret_cast<const char*>(&p._bias._weight), sizeof(float));
+			os.write(reinterpret_cast<const char*>(&p._baseline), sizeof(float));
+
+			const std::vector<Connection> *connections[2] = { &p._feedBackConnections, &p._predictiveConnections };
+
+			for (int i = 0; i < 2; i++) {
+				int numConnections = connections[i]->size();
+
+				os.write(reinterpret_cast<const char*>(&numConnections), sizeof(int));
+
+				for (int ci = 0; ci < numConnections; ci++) {
+					os.write(reinterpret_cast<const char*>(&(*connections[i])[ci]._index), sizeof(unsigned short));
+					os.write(reinterpret_cast<const char*>(&(*connections[i])[ci]._weight), sizeof(float));
+				}
+			}
+
+			p._column.save(os);
+		}
+	}
+
+	int numInputs = _inputPredictionNodes.size();
+
+	os.write(reinterpret_cast<const char*>(&numInputs), sizeof(int));
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		const InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		int numConnections = p._feedBackConnections.size();
+
+		os.write(reinterpret_cast<const char*>(&p._bias._weight), sizeof(float));
+		os.write(reinterpret_cast<const char*>(&numConnections), sizeof(int));
+
+		for (int ci = 0; ci < numConnections; ci++) {
+			os.write(reinterpret_cast<const char*>(&p._feedBackConnections[ci]._index), sizeof(unsigned short));
+			os.write(reinterpret_cast<const char*>(&p._feedBackConnections[ci]._weight), sizeof(float));
+		}
+
+		p._column.save(os);
+	}
+}
+
+bool Agent::load(std::istream &is) {
+	char magic[4];
+	int version, numLayers;
+
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&version), sizeof(int));
+	is.read(reinterpret_cast<char*>(&numLayers), sizeof(int));
+
+	if (!is || magic[0] != 'N' || magic[1] != 'E' || magic[2] != 'O' || magic[3] != 'A' || version != 3 || numLayers < 1)
+		return false;
+
+	_layerDescs.resize(numLayers);
+	_layers.clear();
+	_layers.resize(numLayers);
+
+	is.read(reinterpret_cast<char*>(_layerDescs.data()), numLayers * sizeof(LayerDesc));
+
+	is.read(reinterpret_cast<char*>(&_cellsPerColumn), sizeof(int));
+	is.read(reinterpret_cast<char*>(&_columnIter), sizeof(int));
+
+	float params[12];
+
+	is.read(reinterpret_cast<char*>(params), sizeof(params));
+
+	_columnSparsity = params[0];
+	_columnLeak = params[1];
+	_columnGamma = params[2];
+	_columnGammaLambda = params[3];
+	_columnFeedForwardAlpha = params[4];
+	_columnLateralAlpha = params[5];
+	_columnThresholdAlpha = params[6];
+	_columnQAlpha = params[7];
+	_columnActionAlpha = params[8];
+	_columnExplorationStdDev = params[9];
+	_columnExplorationBreakChance = params[10];
+	_learnInputFeedBack = params[11];
+
+	for (int l = 0; l < _layers.size(); l++) {
+		if (!_layers[l]._sdr.load(is))
+			return false;
+
+		_layers[l]._sdr.initState(_layers[l]._sdrState);
+
+		_layers[l]._predictionNodes.resize(_layers[l]._sdr.getNumHidden());
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			is.read(reinterpret_cast<char*>(&p._bias._weight), sizeof(float));
+			is.read(reinterpret_cast<char*>(&p._baseline), sizeof(float));
+
+			std::vector<Connection> *connections[2] = { &p._feedBackConnections, &p._predictiveConnections };
+
+			for (int i = 0; i < 2; i++) {
+				int numConnections = 0;
+
+				is.read(reinterpret_cast<char*>(&numConnections), sizeof(int));
+
+				if (!is || numConnections < 0)
+					return false;
+
+				connections[i]->resize(numConnections);
+
+				for (int ci = 0; ci < numConnections; ci++) {
+					is.read(reinterpret_cast<char*>(&(*connections[i])[ci]._index), sizeof(unsigned short));
+					is.read(reinterpret_cast<char*>(&(*connections[i])[ci]._weight), sizeof(float));
+				}
+			}
+
+			if (!p._column.load(is))
+				return false;
+		}
+	}
+
+	int numInputs = 0;
+
+	is.read(reinterpret_cast<char*>(&numInputs), sizeof(int));
+
+	if (!is || numInputs != _layers.front()._sdr.getNumVisible())
+		return false;
+
+	_inputPredictionNodes.clear();
+	_inputPredictionNodes.resize(numInputs);
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		int numConnections = 0;
+
+		is.read(reinterpret_cast<char*>(&p._bias._weight), sizeof(float));
+		is.read(reinterpret_cast<char*>(&numConnections), sizeof(int));
+
+		if (!is || numConnections < 0)
+			return false;
+
+		p._feedBackConnections.resize(numConnections);
+
+		for (int ci = 0; ci < numConnections; ci++) {
+			is.read(reinterpret_cast<char*>(&p._feedBackConnections[ci]._index), sizeof(unsigned short));
+			is.read(reinterpret_cast<char*>(&p._feedBackConnections[ci]._weight), sizeof(float));
+		}
+
+		if (!p._column.load(is))
+			return false;
+	}
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+
+	return true;
+}
+
+void Agent::simStep(float reward, std::mt19937 &generator, bool learn) {
+	bool defer = learn && _updateInterval > 1;
+
+	if (_profiler != nullptr)
+		_profiler->beginStep();
+
+	// Feature extraction
+	for (int l = 0; l < _layers.size(); l++) {
+		ProfileScope scope(_profiler, StepProfiler::_features, l);
+
+		_layers[l]._sdr.activate(_layers[l]._sdrState, _layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, generator);
+
+		// Set inputs for next layer if there is one
+		if (l < _layers.size() - 1) {
+			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++) {
+				_layers[l + 1]._sdrState._visibleInputs[i] = _layers[l]._sdrState._hiddenStates[i] * _layers[l]._predictionNodes[i]._column.getAction(_attention);
+			}
+		}
+	}
+
+	// Prediction, including the columns and their learning
+	for (int l = _layers.size() - 1; l >= 0; l--) {
+		ProfileScope scope(_profiler, StepProfiler::_prediction, l);
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			int colInputIndex = 0;
+
+			if (l < _layers.size() - 1) {
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+					p._column.setState(colInputIndex++, _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._column.getAction(_signal));
+					p._column.setState(colInputIndex++, _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state);
+				}
+			}
+
+			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+				p._column.setState(colInputIndex++, _layers[l]._sdrState._hiddenStates[p._predictiveConnections[ci]._index]);
+
+			// Update column
+			p._column.simStep(reward, _layerDescs[l]._columnSparsity, _layerDescs[l]._columnGamma,
+				_layerDescs[l]._columnIter, _layerDescs[l]._columnLeak,
+				_layerDescs[l]._columnFeedForwardAlpha, _layerDescs[l]._columnLateralAlpha, _layerDescs[l]._columnThresholdAlpha,
+				_layerDescs[l]._columnQAlpha, _layerDescs[l]._columnActionAlpha,
+				_layerDescs[l]._columnGammaLambda,
+				_layerDescs[l]._columnExplorationStdDev, _layerDescs[l]._columnExplorationBreakChance, generator);
+
+			// Learn
+			if (learn) {
+				float predictionError = p._column.getAction(_learnPrediction) * (_layers[l]._sdrState._hiddenStates[pi] - p._statePrev);
+
+				if (l < _layers.size() - 1) {
+					for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+						float delta = _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
+
+						if (defer)
+							p._feedBackDeltas[ci] += delta;
+						else
+							p._feedBackConnections[ci]._weight += delta;
+					}
+				}
+
+				// Predictive
+				for (int ci = 0; ci < p._predictiveConnections.size(); ci++) {
+					float delta = _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdrState._hiddenStatesPrev[p._predictiveConnections[ci]._index];
+
+					if (defer)
+						p._predictiveDeltas[ci] += delta;
+					else
+						p._predictiveConnections[ci]._weight += delta;
+				}
+			}
+
+			float activation = 0.0f;
+
+			// Feed Back
+			if (l < _layers.size() - 1) {
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
+			}
+
+			// Predictive
+			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdrState._hiddenStates[p._predictiveConnections[ci]._index];
+
+			p._activation = activation;
+
+			p._state = std::min(1.0f, std::max(0.0f, p._activation));
+		}
+	}
+
+	// Get first layer prediction
+	{
+		ProfileScope scope(_profiler, StepProfiler::_inputPrediction, -1);
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			int colInputIndex = 0;
+
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+				p._column.setState(colInputIndex++, _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._column.getAction(_signal));
+				p._column.setState(colInputIndex++, _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state);
+			}
+
+			// Update column
+			p._column.simStep(reward, _columnSparsity, _columnGamma,
+				_columnIter, _columnLeak,
+				_columnFeedForwardAlpha, _columnLateralAlpha, _columnThresholdAlpha,
+				_columnQAlpha, _columnActionAlpha,
+				_columnGammaLambda,
+				_columnExplorationStdDev, _columnExplorationBreakChance, generator);
+
+			// Learn
+			if (learn) {
+				float predictionError = p._column.getAction(_learnPrediction) * (_layers.front()._sdrState._visibleInputs[pi] - p._statePrev);
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+					float delta = _learnInputFeedBack * predictionError * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
+
+					if (defer)
+						p._feedBackDeltas[ci] += delta;
+					else
+						p._feedBackConnections[ci]._weight += delta;
+				}
+			}
+
+			float activation = 0.0f;
+
+			// Feed Back
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+				activation += p._feedBackConnections[ci]._weight * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state;
+
+			p._activation = activation;
+
+			p._state = p._activation;
+		}
+	}
+
+	for (int l = 0; l < _layers.size(); l++) {
+		std::vector<float> rewards(_layers[l]._predictionNodes.size());
+
+		if (learn) {
+			{
+				ProfileScope scope(_profiler, StepProfiler::_rewards, l);
+
+				for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+					PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+					float predictionError = _layers[l]._sdrState._hiddenStates[pi] - p._statePrev;
+
+					float error2 = predictionError * predictionError;
+
+					rewards[pi] = sigmoid(_layerDescs[l]._sdrSensitivity * (error2 - p._baseline));
+
+					p._baseline = (1.0f - _layerDescs[l]._sdrBaselineDecay) * p._baseline + _layerDescs[l]._sdrBaselineDecay * error2;
+				}
+			}
+
+			ProfileScope scope(_profiler, StepProfiler::_learnFeatures, l);
+
+			_layers[l]._sdr.learn(_layers[l]._sdrState, rewards, _layerDescs[l]._sdrLambda, _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._sdrLearnThreshold, _layerDescs[l]._sdrSparsity, _layerDescs[l]._sdrWeightDecay, _layerDescs[l]._sdrMaxWeightDelta); //attentions[l], 
+		}
+
+		ProfileScope scope(_profiler, StepProfiler::_stepEnd, l);
+
+		_layers[l]._sdr.stepEnd(_layers[l]._sdrState);
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			p._statePrev = p._state;
+			p._activationPrev = p._activation;
+		}
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		p._statePrev = p._state;
+		p._activationPrev = p._activation;
+	}
+
+	// Sparse coders and columns flush themselves at the same interval
+	if (defer && ++_updatesPending >= _updateInterval)
+		applyPredictionUpdates();
+}
+
+void Agent::setUpdateInterval(int interval) {
+	interval = std::max(1, interval);
+
+	if (_updatesPending > 0)
+		applyUpdates();
+
+	_updateInterval = interval;
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sdr.setUpdateInterval(interval);
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+			PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+			p._column.setUpdateInterval(interval);
+
+			if (_updateInterval > 1) {
+				p._feedBackDeltas.assign(p._feedBackConnections.size(), 0.0f);
+				p._predictiveDeltas.assign(p._predictiveConnections.size(), 0.0f);
+			}
+			else {
+				std::vector<float>().swap(p._feedBackDeltas);
+				std::vector<float>().swap(p._predictiveDeltas);
+			}
+		}
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		p._column.setUpdateInterval(interval);
+
+		if (_updateInterval > 1)
+			p._feedBackDeltas.assign(p._feedBackConnections.size(), 0.0f);
+		else
+			std::vector<float>().swap(p._feedBackDeltas);
+	}
+}
+
+void Agent::applyUpdates() {
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sdr.applyUpdates();
+
+		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++)
+			_layers[l]._predictionNodes[pi]._column.applyUpdates();
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++)
+		_inputPredictionNodes[pi]._column.applyUpdates();
+
+	applyPredictionUpdates();
+}
+
+void Agent::applyPredictionUpdates() {
+	if (_updateInterval > 1) {
+		for (int l = 0; l < _layers.size(); l++)
+			for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
+				PredictionNode &p = _layers[l]._predictionNodes[pi];
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+					p._feedBackConnections[ci]._weight += p._feedBackDeltas[ci];
+					p._feedBackDeltas[ci] = 0.0f;
+				}
+
+				for (int ci = 0; ci < p._predictiveConnections.size(); ci++) {
+					p._predictiveConnections[ci]._weight += p._predictiveDeltas[ci];
+					p._predictiveDeltas[ci] = 0.0f;
+				}
+			}
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+				p._feedBackConnections[ci]._weight += p._feedBackDeltas[ci];
+				p._feedBackDeltas[ci] = 0.0f;
+			}
+		}
+	}
+
+	_updatesPending = 0;
 }
\ No newline at end of file
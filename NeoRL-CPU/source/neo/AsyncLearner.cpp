@@ -0,0 +1,159 @@
+#include "AsyncLearner.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void AsyncLearner::start(PredictiveHierarchy *ph, int maxPending, int publishInterval) {
+	stop();
+
+	_ph = ph;
+
+	_learner = *ph;
+	_learner.setProfiler(nullptr);
+
+	_traces = PredictiveHierarchy::State();
+	_traces._sdrStates.resize(_ph->getNumLayers());
+
+	_pending.clear();
+	_pending.resize(std::max(1, maxPending));
+
+	for (int i = 0; i < _pending.size(); i++)
+		_ph->initState(_pending[i]);
+
+	_first = 0;
+	_numPending = 0;
+	_publishInterval = std::max(1, publishInterval);
+	_numDropped = 0;
+	_stop = false;
+
+	_thread = std::thread(&AsyncLearner::run, this);
+}
+
+void AsyncLearner::stop() {
+	if (!_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stop = true;
+	}
+
+	_pendingChanged.notify_all();
+
+	_thread.join();
+}
+
+void AsyncLearner::simStep(PredictiveHierarchy::State &state, std::mt19937 &generator) {
+	{
+		std::lock_guard<std::mutex> lock(_weightsMutex);
+
+		_ph->infer(state, generator);
+	}
+
+	int slot = -1;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_numPending < _pending.size())
+			slot = (_first + _numPending) % _pending.size();
+		else
+			_numDropped++;
+	}
+
+	if (slot != -1) {
+		// The learner never touches a free slot, so copy outside of the lock
+		_pending[slot] = state;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_numPending++;
+		}
+
+		_pendingChanged.notify_all();
+	}
+
+	std::lock_guard<std::mutex> lock(_weightsMutex);
+
+	_ph->stepEnd(state);
+}
+
+void AsyncLearner::wait() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_pendingChanged.wait(lock, [this] { return _numPending == 0; });
+}
+
+int AsyncLearner::getNumPending() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _numPending;
+}
+
+long AsyncLearner::getNumDropped() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _numDropped;
+}
+
+void AsyncLearner::run() {
+	// Batches learned since the last publish
+	int unpublished = 0;
+
+	while (true) {
+		int first, count;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_pendingChanged.wait(lock, [this] { return _stop || _numPending > 0; });
+
+			// Drain the queue before stopping
+			if (_numPending == 0)
+				return;
+
+			first = _first;
+			count = _numPending;
+		}
+
+		// Everything queued so far is one batch, its slots stay taken until it is learned (and published, if it is)
+		for (int i = 0; i < count; i++) {
+			PredictiveHierarchy::State &state = _pending[(first + i) % _pending.size()];
+
+			PredictiveHierarchy::swapTraces(state, _traces);
+
+			_learner.learn(state);
+
+			PredictiveHierarchy::swapTraces(state, _traces);
+		}
+
+		bool publish;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			// Nothing else queued means the learner is about to idle, and wait returns on an empty queue, so publish then as well
+			publish = ++unpublished >= _publishInterval || _numPending == count;
+		}
+
+		if (publish) {
+			std::lock_guard<std::mutex> lock(_weightsMutex);
+
+			_ph->copyWeights(_learner);
+
+			unpublished = 0;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_first = (_first + count) % _pending.size();
+			_numPending -= count;
+		}
+
+		_pendingChanged.notify_all();
+	}
+}
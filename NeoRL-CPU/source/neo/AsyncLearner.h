@@ -0,0 +1,91 @@
+#pragma once
+
+#include "PredictiveHierarchy.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace neo {
+	// Runs the learning half of PredictiveHierarchy::simStep on a background thread.
+	// simStep only does inference and queues a copy of the resulting state, the learner then updates the weights from it.
+	// The learner works on its own copy of the hierarchy and publishes its weights into the stepped one under a lock that
+	// inference also holds, after every publishInterval batches of queued states and whenever the queue runs empty.
+	// Inference thus always sees the weights of a whole number of learned steps, at most (publishInterval + 1) * maxPending
+	// steps old, and never waits for learning: a step that finds the queue full is inferred but not learned.
+	// A publish shares the learner's layers with the stepped hierarchy, so the learner's next learn copies every layer
+	// it writes (all of them) before changing it. Each publish thus costs a copy of the sparse coder weights on the learner
+	// thread, plus a copy of the input prediction weights under the lock. A larger publishInterval spreads that over more steps
+	class AsyncLearner {
+	private:
+		PredictiveHierarchy *_ph;
+
+		// Where learning happens, without the profiler of _ph
+		PredictiveHierarchy _learner;
+
+		// Eligibility traces of the stream, carried by the learner from one queued state to the next
+		PredictiveHierarchy::State _traces;
+
+		// Ring of queued states, reused so that steady state stepping does not allocate
+		std::vector<PredictiveHierarchy::State> _pending;
+
+		int _first;
+		int _numPending;
+
+		int _publishInterval;
+
+		// Steps that found the queue full
+		long _numDropped;
+
+		bool _stop;
+
+		std::thread _thread;
+		std::mutex _mutex;
+		std::condition_variable _pendingChanged;
+
+		// Held by every step on _ph and by publishing into it
+		std::mutex _weightsMutex;
+
+		void run();
+
+	public:
+		AsyncLearner()
+			: _ph(nullptr), _first(0), _numPending(0), _publishInterval(1), _numDropped(0), _stop(false)
+		{}
+
+		~AsyncLearner() {
+			stop();
+		}
+
+		// Start learning for ph in the background. ph must not be stepped or changed by anyone else until stop,
+		// its weights are overwritten by every publish
+		void start(PredictiveHierarchy *ph, int maxPending = 1, int publishInterval = 1);
+
+		// Finish all queued learning, publish it and join the learner thread
+		void stop();
+
+		// Step the hierarchy's own state without waiting for learning
+		void simStep(std::mt19937 &generator) {
+			simStep(_ph->getState(), generator);
+		}
+
+		// Never waits for learning. If maxPending steps are still waiting to be learned, this one is not queued
+		void simStep(PredictiveHierarchy::State &state, std::mt19937 &generator);
+
+		// Block until all queued steps have been learned and published
+		void wait();
+
+		int getNumPending();
+
+		// Steps since start that were not learned because the queue was full
+		long getNumDropped();
+
+		int getMaxPending() const {
+			return _pending.size();
+		}
+
+		int getPublishInterval() const {
+			return _publishInterval;
+		}
+	};
+}
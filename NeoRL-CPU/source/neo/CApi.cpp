@@ -0,0 +1,260 @@
+#include "CApi.h"
+
+#include "PredictiveHierarchy.h"
+#include "Agent.h"
+
+#include <fstream>
+#include <memory>
+#include <algorithm>
+
+using namespace neo;
+
+struct NeoHierarchy {
+	PredictiveHierarchy _ph;
+
+	std::mt19937 _generator;
+};
+
+struct NeoAgent {
+	Agent _agent;
+
+	std::mt19937 _generator;
+};
+
+namespace {
+	const int _inputFeedBackRadius = 8;
+
+	// Connection indices are unsigned shorts, so no grid a layer reads or writes can have more cells
+	bool validGrid(int width, int height) {
+		return width >= 1 && height >= 1 && width <= 65536 / height;
+	}
+
+	template<class Desc>
+	bool layerDescsFrom(int inputWidth, int inputHeight, int numLayers, const int *layerSizes, std::vector<Desc> &layerDescs) {
+		if (!validGrid(inputWidth, inputHeight) || numLayers < 1 || layerSizes == nullptr)
+			return false;
+
+		layerDescs.resize(numLayers);
+
+		for (int l = 0; l < numLayers; l++) {
+			layerDescs[l]._width = layerSizes[l * 2 + 0];
+			layerDescs[l]._height = layerSizes[l * 2 + 1];
+
+			if (!validGrid(layerDescs[l]._width, layerDescs[l]._height))
+				return false;
+		}
+
+		return true;
+	}
+}
+
+NeoHierarchy *neoHierarchyCreate(int inputWidth, int inputHeight, int numLayers, const int *layerSizes, unsigned int seed) {
+	try {
+		std::vector<PredictiveHierarchy::LayerDesc> layerDescs;
+
+		if (!layerDescsFrom(inputWidth, inputHeight, numLayers, layerSizes, layerDescs))
+			return nullptr;
+
+		// Freed if creating throws, every entry point returns a failure instead of letting exceptions into C
+		std::unique_ptr<NeoHierarchy> h(new NeoHierarchy());
+
+		h->_generator.seed(seed);
+		h->_ph.createRandom(inputWidth, inputHeight, _inputFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, static_cast<unsigned long long>(seed));
+
+		return h.release();
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+unsigned long long neoHierarchyFootprint(int inputWidth, int inputHeight, int numLayers, const int *layerSizes) {
+	try {
+		std::vector<PredictiveHierarchy::LayerDesc> layerDescs;
+
+		if (!layerDescsFrom(inputWidth, inputHeight, numLayers, layerSizes, layerDescs))
+			return 0;
+
+		return PredictiveHierarchy::computeFootprint(inputWidth, inputHeight, _inputFeedBackRadius, layerDescs).getTotal();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+NeoHierarchy *neoHierarchyLoad(const char *path, unsigned int seed) {
+	try {
+		std::ifstream fromFile(path, std::ios::binary);
+
+		std::unique_ptr<NeoHierarchy> h(new NeoHierarchy());
+
+		if (!fromFile.is_open() || !h->_ph.load(fromFile)) {
+			return nullptr;
+		}
+
+		h->_generator.seed(seed);
+
+		return h.release();
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+int neoHierarchySave(NeoHierarchy *hierarchy, const char *path) {
+	try {
+		std::ofstream toFile(path, std::ios::binary);
+
+		hierarchy->_ph.applyUpdates();
+		hierarchy->_ph.save(toFile);
+
+		return toFile.good();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+void neoHierarchyFree(NeoHierarchy *hierarchy) {
+	delete hierarchy;
+}
+
+int neoHierarchyGetNumInputs(const NeoHierarchy *hierarchy) {
+	try {
+		return hierarchy->_ph.getLayer(0)._sdr.getNumVisible();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+int neoHierarchyStep(NeoHierarchy *hierarchy, const float *inputs, float *predictions, int learn) {
+	try {
+		PredictiveHierarchy::State &state = hierarchy->_ph.getState();
+
+		// The inputs have to stay in the state since learning compares against them next step, so this is the one copy
+		std::vector<float> &visibleInputs = state._sdrStates.front()._visibleInputs;
+
+		std::copy(inputs, inputs + visibleInputs.size(), visibleInputs.begin());
+
+		hierarchy->_ph.simStep(hierarchy->_generator, learn != 0);
+
+		if (predictions != nullptr)
+			std::copy(state._inputPredictionStates.begin(), state._inputPredictionStates.end(), predictions);
+
+		return 1;
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+int neoHierarchyReset(NeoHierarchy *hierarchy) {
+	try {
+		hierarchy->_ph.initState(hierarchy->_ph.getState());
+
+		return 1;
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+NeoAgent *neoAgentCreate(int inputWidth, int inputHeight, int numLayers, const int *layerSizes, unsigned int seed) {
+	try {
+		std::vector<Agent::LayerDesc> layerDescs;
+
+		if (!layerDescsFrom(inputWidth, inputHeight, numLayers, layerSizes, layerDescs))
+			return nullptr;
+
+		std::unique_ptr<NeoAgent> a(new NeoAgent());
+
+		a->_generator.seed(seed);
+		a->_agent.createRandom(inputWidth, inputHeight, _inputFeedBackRadius, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, static_cast<unsigned long long>(seed));
+
+		return a.release();
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+unsigned long long neoAgentFootprint(int inputWidth, int inputHeight, int numLayers, const int *layerSizes) {
+	try {
+		std::vector<Agent::LayerDesc> layerDescs;
+
+		if (!layerDescsFrom(inputWidth, inputHeight, numLayers, layerSizes, layerDescs))
+			return 0;
+
+		return Agent().computeFootprint(inputWidth, inputHeight, _inputFeedBackRadius, layerDescs).getTotal();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+NeoAgent *neoAgentLoad(const char *path, unsigned int seed) {
+	try {
+		std::ifstream fromFile(path, std::ios::binary);
+
+		std::unique_ptr<NeoAgent> a(new NeoAgent());
+
+		if (!fromFile.is_open() || !a->_agent.load(fromFile)) {
+			return nullptr;
+		}
+
+		a->_generator.seed(seed);
+
+		return a.release();
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+int neoAgentSave(NeoAgent *agent, const char *path) {
+	try {
+		std::ofstream toFile(path, std::ios::binary);
+
+		agent->_agent.applyUpdates();
+		agent->_agent.save(toFile);
+
+		return toFile.good();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+void neoAgentFree(NeoAgent *agent) {
+	delete agent;
+}
+
+int neoAgentGetNumInputs(const NeoAgent *agent) {
+	try {
+		return agent->_agent.getLayers().front()._sdr.getNumVisible();
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+int neoAgentStep(NeoAgent *agent, const float *inputs, float reward, float *predictions, int learn) {
+	try {
+		int numInputs = neoAgentGetNumInputs(agent);
+
+		for (int i = 0; i < numInputs; i++)
+			agent->_agent.setInput(i, inputs[i]);
+
+		agent->_agent.simStep(reward, agent->_generator, learn != 0);
+
+		if (predictions != nullptr)
+			for (int i = 0; i < numInputs; i++)
+				predictions[i] = agent->_agent.getPrediction(i);
+
+		return 1;
+	}
+	catch (...) {
+		return 0;
+	}
+}
\ No newline at end of file
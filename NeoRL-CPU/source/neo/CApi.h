@@ -0,0 +1,68 @@
+#pragma once
+
+// C interface to PredictiveHierarchy and Agent, for calling the models in-process from other languages.
+// Handles are opaque and not thread safe, use one per thread or lock around them.
+// Functions returning int return nonzero on success. No exception leaves the interface, allocation failures are reported as failures
+
+// Building the library defines NEO_EXPORTS, linking the static one NEO_STATIC (set by the neo CMake target)
+#if defined(NEO_STATIC)
+#define NEO_API
+#elif defined(_WIN32)
+#if defined(NEO_EXPORTS)
+#define NEO_API __declspec(dllexport)
+#else
+#define NEO_API __declspec(dllimport)
+#endif
+#else
+#define NEO_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct NeoHierarchy NeoHierarchy;
+typedef struct NeoAgent NeoAgent;
+
+// Layer sizes are numLayers (width, height) pairs, all other layer parameters take their defaults. Returns NULL on bad arguments,
+// including an input or layer of more than 65536 cells (connection indices are 16 bit)
+NEO_API NeoHierarchy *neoHierarchyCreate(int inputWidth, int inputHeight, int numLayers, const int *layerSizes, unsigned int seed);
+
+// Heap bytes neoHierarchyCreate would allocate with these arguments, without allocating. 0 on bad arguments
+NEO_API unsigned long long neoHierarchyFootprint(int inputWidth, int inputHeight, int numLayers, const int *layerSizes);
+
+// Returns NULL if the file does not hold a hierarchy
+NEO_API NeoHierarchy *neoHierarchyLoad(const char *path, unsigned int seed);
+
+NEO_API int neoHierarchySave(NeoHierarchy *hierarchy, const char *path);
+
+NEO_API void neoHierarchyFree(NeoHierarchy *hierarchy);
+
+NEO_API int neoHierarchyGetNumInputs(const NeoHierarchy *hierarchy);
+
+// Read getNumInputs floats from inputs, step, and write as many predictions for the next step to predictions (may be NULL).
+// The inputs are copied into the model's state before the step and the predictions copied out after it, the buffers
+// belong to the caller and are not retained after the call
+NEO_API int neoHierarchyStep(NeoHierarchy *hierarchy, const float *inputs, float *predictions, int learn);
+
+// Clear the recurrent state, weights are kept
+NEO_API int neoHierarchyReset(NeoHierarchy *hierarchy);
+
+NEO_API NeoAgent *neoAgentCreate(int inputWidth, int inputHeight, int numLayers, const int *layerSizes, unsigned int seed);
+
+NEO_API unsigned long long neoAgentFootprint(int inputWidth, int inputHeight, int numLayers, const int *layerSizes);
+
+NEO_API NeoAgent *neoAgentLoad(const char *path, unsigned int seed);
+
+NEO_API int neoAgentSave(NeoAgent *agent, const char *path);
+
+NEO_API void neoAgentFree(NeoAgent *agent);
+
+NEO_API int neoAgentGetNumInputs(const NeoAgent *agent);
+
+// As neoHierarchyStep, with the reward for the previous step's actions
+NEO_API int neoAgentStep(NeoAgent *agent, const float *inputs, float reward, float *predictions, int learn);
+
+#ifdef __cplusplus
+}
+#endif
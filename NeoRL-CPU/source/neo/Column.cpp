@@ -1,169 +1,474 @@
-#include "Column.h"
-
-#include <algorithm>
-
-using namespace neo;
-
-void Column::createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
-	std::uniform_real_distribution<float> inhibitionDist(initMinInhibition, initMaxInhibition);
-
-	_numStates = numStates;
-
-	_inputs.assign(numStates, 0.0f);
-	_reconstructionError.assign(_inputs.size(), 0.0f);
-
-	_cells.resize(numCells);
-
-	_actions.resize(numActions);
-
-	_qConnections.resize(numCells);
-
-	for (int i = 0; i < numCells; i++) {
-		_cells[i]._feedForwardConnections.resize(_inputs.size());
-
-		_cells[i]._lateralConnections.resize(numCells);
-
-		_cells[i]._threshold = initThreshold;
-
-		for (int j = 0; j < _inputs.size(); j++)
-			_cells[i]._feedForwardConnections[j]._weight = weightDist(generator);
-
-		for (int j = 0; j < numCells; j++)
-			_cells[i]._lateralConnections[j]._weight = inhibitionDist(generator);
-
-		_qConnections[i]._weight = weightDist(generator);
-	}
-
-	for (int i = 0; i < _actions.size(); i++) {
-		_actions[i]._connections.resize(_cells.size());
-
-		for (int k = 0; k < _cells.size(); k++)
-			_actions[i]._connections[k]._weight = weightDist(generator);
-	}
-}
-
-void Column::simStep(float reward, float sparsity, float gamma, int iter, float leak, float feedForwardAlpha, float lateralAlpha, float thresholdAlpha, float qAlpha, float actionAlpha, float gammaLambda, float explorationStdDev, float explorationBreakChance, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
-	std::normal_distribution<float> pertDist(0.0f, explorationStdDev);
-
-	// Clear activations and states
-	for (int i = 0; i < _cells.size(); i++) {
-		_cells[i]._activation = 0.0f;
-		_cells[i]._state = 0.0f;
-	}
-
-	float counter = 0.0f;
-
-	for (int it = 0; it < iter; it++) {
-		// Activate
-		for (int i = 0; i < _cells.size(); i++) {
-			float excitation = 0.0f;
-
-			for (int j = 0; j < _inputs.size(); j++)
-				excitation += _cells[i]._feedForwardConnections[j]._weight * _reconstructionError[j];
-
-			float inhibition = 0.0f;
-
-			for (int j = 0; j < _cells.size(); j++)
-				inhibition += _cells[i]._lateralConnections[j]._weight * _cells[j]._spikePrev;
-
-			float activation = (1.0f - leak) * _cells[i]._activation + excitation - inhibition;
-
-			if (activation > _cells[i]._threshold) {
-				activation = 0.0f;
-
-				_cells[i]._spike = 1.0f;
-			}
-			else
-				_cells[i]._spike = 0.0f;
-
-			_cells[i]._state += _cells[i]._spike;
-
-			_cells[i]._activation = activation;
-		}
-
-		// Double buffer update
-		for (int i = 0; i < _cells.size(); i++)
-			_cells[i]._spikePrev = _cells[i]._spike;
-
-		counter += 1.0f;
-
-		float multiplier = 1.0f / counter;
-
-		// Reconstruct
-		for (int i = 0; i < _inputs.size(); i++) {
-			float recon = 0.0f;
-
-			for (int j = 0; j < _cells.size(); j++)
-				recon += _cells[j]._spike * multiplier * _cells[j]._feedForwardConnections[i]._weight;
-
-			_reconstructionError[i] = _inputs[i] - recon;
-		}
-	}
-
-	float multiplier = 1.0f / counter;
-
-	for (int j = 0; j < _cells.size(); j++)
-		_cells[j]._state *= multiplier;
-
-	// Forwards
-	float q = 0.0f;
-
-	for (int k = 0; k < _cells.size(); k++)
-		q += _qConnections[k]._weight * _cells[k]._state;
-
-	for (int a = 0; a < _actions.size(); a++) {
-		float sum = 0.0f;
-
-		for (int k = 0; k < _cells.size(); k++)
-			sum += _actions[a]._connections[k]._weight * _cells[k]._state;
-
-		_actions[a]._state = sigmoid(sum);
-	}
-
-	// Exploration
-	for (int a = 0; a < _actions.size(); a++) {
-		if (dist01(generator) < explorationBreakChance)
-			_actions[a]._exploratoryState = dist01(generator);
-		else
-			_actions[a]._exploratoryState = std::min(1.0f, std::max(0.0f, _actions[a]._state + pertDist(generator)));
-	}
-
-	float tdError = reward + gamma * q - _prevValue;
-	float qAlphaTdError = qAlpha * tdError;
-	float actionAlphaTdError = actionAlpha * tdError;
-	float surprise = tdError * tdError;
-
-	// Update weights
-	for (int k = 0; k < _cells.size(); k++) {
-		_qConnections[k]._weight += qAlphaTdError * _qConnections[k]._trace;
-
-		_qConnections[k]._trace = _qConnections[k]._trace * gammaLambda + _cells[k]._state;
-	}
-
-	for (int a = 0; a < _actions.size(); a++) {
-		for (int i = 0; i < _cells.size(); i++) {
-			_actions[a]._connections[i]._weight += actionAlphaTdError * _actions[a]._connections[i]._trace;
-
-			_actions[a]._connections[i]._trace = _actions[a]._connections[i]._trace * gammaLambda + (_actions[a]._exploratoryState - _actions[a]._state) * _cells[i]._state;
-		}
-	}
-
-	float sparsitySquared = sparsity * sparsity;
-
-	for (int i = 0; i < _cells.size(); i++) {
-		// Learn SDRs
-		if (_cells[i]._state > 0.0f) {
-			for (int j = 0; j < _inputs.size(); j++)
-				_cells[i]._feedForwardConnections[j]._weight += feedForwardAlpha * _cells[i]._state * _reconstructionError[j];
-		}
-
-		for (int j = 0; j < _cells.size(); j++)
-			_cells[i]._lateralConnections[j]._weight = std::max(0.0f, _cells[i]._lateralConnections[j]._weight + lateralAlpha * (_cells[i]._state * _cells[j]._state - sparsitySquared));
-
-		_cells[i]._threshold += thresholdAlpha * (_cells[i]._state - sparsity);
-	}
-
-	_prevValue = q;
+#include "Column.h"
+
+#include "CounterRNG.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void Column::createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
+	std::uniform_real_distribution<float> inhibitionDist(initMinInhibition, initMaxInhibition);
+
+	_numStates = numStates;
+
+	_inputs.assign(numStates, 0.0f);
+	_reconstructionError.assign(_inputs.size(), 0.0f);
+
+	_cells.clear();
+	_cells.resize(numCells);
+
+	_actions.clear();
+	_actions.resize(numActions);
+
+	_qConnections.resize(numCells);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	std::vector<float>().swap(_qDeltas);
+
+	_stats = Stats();
+
+	for (int i = 0; i < numCells; i++) {
+		_cells[i]._feedForwardConnections.resize(_inputs.size());
+
+		_cells[i]._lateralConnections.resize(numCells);
+
+		_cells[i]._threshold = initThreshold;
+
+		for (int j = 0; j < _inputs.size(); j++)
+			_cells[i]._feedForwardConnections[j]._weight = weightDist(generator);
+
+		for (int j = 0; j < numCells; j++)
+			_cells[i]._lateralConnections[j]._weight = inhibitionDist(generator);
+
+		_qConnections[i]._weight = weightDist(generator);
+	}
+
+	for (int i = 0; i < _actions.size(); i++) {
+		_actions[i]._connections.resize(_cells.size());
+
+		for (int k = 0; k < _cells.size(); k++)
+			_actions[i]._connections[k]._weight = weightDist(generator);
+	}
+}
+
+void Column::createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed) {
+	CounterRNG feedForwardRNG(seed, 0);
+	CounterRNG lateralRNG(seed, 1);
+	CounterRNG qRNG(seed, 2);
+	CounterRNG actionRNG(seed, 3);
+
+	_numStates = numStates;
+
+	_inputs.assign(numStates, 0.0f);
+	_reconstructionError.assign(_inputs.size(), 0.0f);
+
+	_cells.clear();
+	_cells.resize(numCells);
+
+	_actions.clear();
+	_actions.resize(numActions);
+
+	_qConnections.resize(numCells);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	std::vector<float>().swap(_qDeltas);
+
+	_stats = Stats();
+
+	for (int i = 0; i < numCells; i++) {
+		_cells[i]._feedForwardConnections.resize(_inputs.size());
+
+		_cells[i]._lateralConnections.resize(numCells);
+
+		_cells[i]._threshold = initThreshold;
+
+		for (int j = 0; j < _inputs.size(); j++)
+			_cells[i]._feedForwardConnections[j]._weight = feedForwardRNG.uniform(CounterRNG::counter(i, j), initMinWeight, initMaxWeight);
+
+		for (int j = 0; j < numCells; j++)
+			_cells[i]._lateralConnections[j]._weight = lateralRNG.uniform(CounterRNG::counter(i, j), initMinInhibition, initMaxInhibition);
+
+		_qConnections[i]._weight = qRNG.uniform(i, initMinWeight, initMaxWeight);
+	}
+
+	for (int a = 0; a < _actions.size(); a++) {
+		_actions[a]._connections.resize(_cells.size());
+
+		for (int k = 0; k < _cells.size(); k++)
+			_actions[a]._connections[k]._weight = actionRNG.uniform(CounterRNG::counter(a, k), initMinWeight, initMaxWeight);
+	}
+}
+
+void Column::simStep(float reward, float sparsity, float gamma, int iter, float leak, float feedForwardAlpha, float lateralAlpha, float thresholdAlpha, float qAlpha, float actionAlpha, float gammaLambda, float explorationStdDev, float explorationBreakChance, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+	std::normal_distribution<float> pertDist(0.0f, explorationStdDev);
+
+	// Clear activations and states
+	for (int i = 0; i < _cells.size(); i++) {
+		_cells[i]._activation = 0.0f;
+		_cells[i]._state = 0.0f;
+	}
+
+	float counter = 0.0f;
+
+	_stats._settle.begin(iter);
+
+	for (int it = 0; it < iter; it++) {
+		float spikes = 0.0f;
+
+		// Activate
+		for (int i = 0; i < _cells.size(); i++) {
+			float excitation = 0.0f;
+
+			for (int j = 0; j < _inputs.size(); j++)
+				excitation += _cells[i]._feedForwardConnections[j]._weight * _reconstructionError[j];
+
+			float inhibition = 0.0f;
+
+			for (int j = 0; j < _cells.size(); j++)
+				inhibition += _cells[i]._lateralConnections[j]._weight * _cells[j]._spikePrev;
+
+			float activation = (1.0f - leak) * _cells[i]._activation + excitation - inhibition;
+
+			if (activation > _cells[i]._threshold) {
+				activation = 0.0f;
+
+				_cells[i]._spike = 1.0f;
+			}
+			else
+				_cells[i]._spike = 0.0f;
+
+			_cells[i]._state += _cells[i]._spike;
+
+			_cells[i]._activation = activation;
+
+			spikes += _cells[i]._spike;
+		}
+
+		_stats._settle._spikesPerIteration[it] += spikes;
+
+		// Double buffer update
+		for (int i = 0; i < _cells.size(); i++)
+			_cells[i]._spikePrev = _cells[i]._spike;
+
+		counter += 1.0f;
+
+		float multiplier = 1.0f / counter;
+
+		// Reconstruct
+		for (int i = 0; i < _inputs.size(); i++) {
+			float recon = 0.0f;
+
+			for (int j = 0; j < _cells.size(); j++)
+				recon += _cells[j]._spike * multiplier * _cells[j]._feedForwardConnections[i]._weight;
+
+			_reconstructionError[i] = _inputs[i] - recon;
+		}
+	}
+
+	float multiplier = 1.0f / counter;
+
+	int active = 0;
+
+	for (int j = 0; j < _cells.size(); j++) {
+		_cells[j]._state *= multiplier;
+
+		active += _cells[j]._state > 0.0f;
+	}
+
+	_stats._settle._activations++;
+	_stats._settle._activeSum += static_cast<double>(active) / std::max<int>(1, _cells.size());
+
+	// Forwards
+	float q = 0.0f;
+
+	for (int k = 0; k < _cells.size(); k++)
+		q += _qConnections[k]._weight * _cells[k]._state;
+
+	for (int a = 0; a < _actions.size(); a++) {
+		float sum = 0.0f;
+
+		for (int k = 0; k < _cells.size(); k++)
+			sum += _actions[a]._connections[k]._weight * _cells[k]._state;
+
+		_actions[a]._state = sigmoid(sum);
+	}
+
+	// Exploration
+	for (int a = 0; a < _actions.size(); a++) {
+		if (dist01(generator) < explorationBreakChance)
+			_actions[a]._exploratoryState = dist01(generator);
+		else
+			_actions[a]._exploratoryState = std::min(1.0f, std::max(0.0f, _actions[a]._state + pertDist(generator)));
+	}
+
+	float tdError = reward + gamma * q - _prevValue;
+	float qAlphaTdError = qAlpha * tdError;
+	float actionAlphaTdError = actionAlpha * tdError;
+	float surprise = tdError * tdError;
+
+	_stats._rewards.add(reward);
+	_stats._tdErrors.add(tdError);
+
+	bool defer = _updateInterval > 1;
+
+	// Update weights
+	for (int k = 0; k < _cells.size(); k++) {
+		if (defer)
+			_qDeltas[k] += qAlphaTdError * _qConnections[k]._trace;
+		else
+			_qConnections[k]._weight += qAlphaTdError * _qConnections[k]._trace;
+
+		_qConnections[k]._trace = _qConnections[k]._trace * gammaLambda + _cells[k]._state;
+	}
+
+	for (int a = 0; a < _actions.size(); a++) {
+		for (int i = 0; i < _cells.size(); i++) {
+			if (defer)
+				_actions[a]._deltas[i] += actionAlphaTdError * _actions[a]._connections[i]._trace;
+			else
+				_actions[a]._connections[i]._weight += actionAlphaTdError * _actions[a]._connections[i]._trace;
+
+			_actions[a]._connections[i]._trace = _actions[a]._connections[i]._trace * gammaLambda + (_actions[a]._exploratoryState - _actions[a]._state) * _cells[i]._state;
+		}
+	}
+
+	float sparsitySquared = sparsity * sparsity;
+
+	double thresholdSum = 0.0;
+
+	for (int i = 0; i < _cells.size(); i++) {
+		thresholdSum += _cells[i]._threshold;
+
+		// Learn SDRs
+		if (_cells[i]._state > 0.0f) {
+			if (defer) {
+				for (int j = 0; j < _inputs.size(); j++)
+					_cells[i]._feedForwardDeltas[j] += feedForwardAlpha * _cells[i]._state * _reconstructionError[j];
+			}
+			else {
+				for (int j = 0; j < _inputs.size(); j++)
+					_cells[i]._feedForwardConnections[j]._weight += feedForwardAlpha * _cells[i]._state * _reconstructionError[j];
+			}
+		}
+
+		if (defer) {
+			for (int j = 0; j < _cells.size(); j++)
+				_cells[i]._lateralDeltas[j] += lateralAlpha * (_cells[i]._state * _cells[j]._state - sparsitySquared);
+
+			_cells[i]._thresholdDelta += thresholdAlpha * (_cells[i]._state - sparsity);
+		}
+		else {
+			for (int j = 0; j < _cells.size(); j++)
+				_cells[i]._lateralConnections[j]._weight = std::max(0.0f, _cells[i]._lateralConnections[j]._weight + lateralAlpha * (_cells[i]._state * _cells[j]._state - sparsitySquared));
+
+			_cells[i]._threshold += thresholdAlpha * (_cells[i]._state - sparsity);
+		}
+	}
+
+	_stats._meanThreshold = thresholdSum / std::max<int>(1, _cells.size());
+
+	_prevValue = q;
+
+	if (defer && ++_updatesPending >= _updateInterval)
+		applyUpdates();
+}
+
+Footprint Column::computeFootprint(int numStates, int numActions, int numCells, int iter, int updateInterval) {
+	Footprint footprint;
+
+	// Feed forward and lateral per cell, value and actions
+	size_t numConnections = static_cast<size_t>(numCells) * (numStates + numCells) + numCells + static_cast<size_t>(numActions) * numCells;
+
+	footprint._weights = numConnections * (sizeof(Connection) - sizeof(float));
+	footprint._traces = numConnections * sizeof(float);
+
+	if (updateInterval > 1)
+		footprint._deltas = numConnections * sizeof(float);
+
+	// Inputs and reconstruction errors
+	footprint._state = 2 * numStates * sizeof(float) + iter * sizeof(double);
+
+	footprint._structure = numCells * sizeof(Cell) + numActions * sizeof(Action);
+
+	return footprint;
+}
+
+Footprint Column::getFootprint() const {
+	Footprint footprint;
+
+	size_t numConnections = _qConnections.capacity();
+
+	for (int i = 0; i < _cells.size(); i++) {
+		numConnections += _cells[i]._feedForwardConnections.capacity() + _cells[i]._lateralConnections.capacity();
+
+		footprint._deltas += vectorBytes(_cells[i]._feedForwardDeltas) + vectorBytes(_cells[i]._lateralDeltas);
+	}
+
+	for (int a = 0; a < _actions.size(); a++) {
+		numConnections += _actions[a]._connections.capacity();
+
+		footprint._deltas += vectorBytes(_actions[a]._deltas);
+	}
+
+	footprint._weights = numConnections * (sizeof(Connection) - sizeof(float));
+	footprint._traces = numConnections * sizeof(float);
+	footprint._deltas += vectorBytes(_qDeltas);
+
+	footprint._state = vectorBytes(_inputs) + vectorBytes(_reconstructionError) + vectorBytes(_stats._settle._spikesPerIteration);
+
+	footprint._structure = vectorBytes(_cells) + vectorBytes(_actions);
+
+	return footprint;
+}
+
+// Traces are activity, only the weights are stored
+void Column::saveWeights(std::ostream &os, const std::vector<Connection> &connections) {
+	for (int ci = 0; ci < connections.size(); ci++)
+		os.write(reinterpret_cast<const char*>(&connections[ci]._weight), sizeof(float));
+}
+
+void Column::loadWeights(std::istream &is, std::vector<Connection> &connections) {
+	for (int ci = 0; ci < connections.size(); ci++) {
+		is.read(reinterpret_cast<char*>(&connections[ci]._weight), sizeof(float));
+
+		connections[ci]._trace = 0.0f;
+	}
+}
+
+void Column::save(std::ostream &os) const {
+	int dims[3] = { static_cast<int>(_inputs.size()), static_cast<int>(_cells.size()), static_cast<int>(_actions.size()) };
+
+	os.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+
+	for (int i = 0; i < _cells.size(); i++) {
+		os.write(reinterpret_cast<const char*>(&_cells[i]._threshold), sizeof(float));
+
+		saveWeights(os, _cells[i]._feedForwardConnections);
+		saveWeights(os, _cells[i]._lateralConnections);
+	}
+
+	saveWeights(os, _qConnections);
+
+	for (int a = 0; a < _actions.size(); a++)
+		saveWeights(os, _actions[a]._connections);
+}
+
+bool Column::load(std::istream &is) {
+	int dims[3];
+
+	is.read(reinterpret_cast<char*>(dims), sizeof(dims));
+
+	if (!is || dims[0] < 0 || dims[1] < 0 || dims[2] < 0)
+		return false;
+
+	_numStates = dims[0];
+
+	_inputs.assign(dims[0], 0.0f);
+	_reconstructionError.assign(dims[0], 0.0f);
+
+	_cells.clear();
+	_cells.resize(dims[1]);
+
+	_actions.clear();
+	_actions.resize(dims[2]);
+
+	_qConnections.resize(dims[1]);
+
+	for (int i = 0; i < _cells.size(); i++) {
+		_cells[i]._feedForwardConnections.resize(_inputs.size());
+		_cells[i]._lateralConnections.resize(_cells.size());
+
+		is.read(reinterpret_cast<char*>(&_cells[i]._threshold), sizeof(float));
+
+		loadWeights(is, _cells[i]._feedForwardConnections);
+		loadWeights(is, _cells[i]._lateralConnections);
+	}
+
+	loadWeights(is, _qConnections);
+
+	for (int a = 0; a < _actions.size(); a++) {
+		_actions[a]._connections.resize(_cells.size());
+
+		loadWeights(is, _actions[a]._connections);
+	}
+
+	_prevValue = 0.0f;
+	_averageSurprise = 0.0f;
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	std::vector<float>().swap(_qDeltas);
+
+	_stats = Stats();
+
+	return static_cast<bool>(is);
+}
+
+void Column::setUpdateInterval(int interval) {
+	interval = std::max(1, interval);
+
+	if (_updatesPending > 0)
+		applyUpdates();
+
+	_updateInterval = interval;
+
+	if (_updateInterval > 1) {
+		for (int i = 0; i < _cells.size(); i++) {
+			_cells[i]._feedForwardDeltas.assign(_inputs.size(), 0.0f);
+			_cells[i]._lateralDeltas.assign(_cells.size(), 0.0f);
+			_cells[i]._thresholdDelta = 0.0f;
+		}
+
+		for (int a = 0; a < _actions.size(); a++)
+			_actions[a]._deltas.assign(_cells.size(), 0.0f);
+
+		_qDeltas.assign(_cells.size(), 0.0f);
+	}
+	else {
+		for (int i = 0; i < _cells.size(); i++) {
+			std::vector<float>().swap(_cells[i]._feedForwardDeltas);
+			std::vector<float>().swap(_cells[i]._lateralDeltas);
+		}
+
+		for (int a = 0; a < _actions.size(); a++)
+			std::vector<float>().swap(_actions[a]._deltas);
+
+		std::vector<float>().swap(_qDeltas);
+	}
+}
+
+void Column::applyUpdates() {
+	if (_updateInterval > 1) {
+		for (int k = 0; k < _cells.size(); k++) {
+			_qConnections[k]._weight += _qDeltas[k];
+			_qDeltas[k] = 0.0f;
+		}
+
+		for (int a = 0; a < _actions.size(); a++)
+			for (int i = 0; i < _cells.size(); i++) {
+				_actions[a]._connections[i]._weight += _actions[a]._deltas[i];
+				_actions[a]._deltas[i] = 0.0f;
+			}
+
+		for (int i = 0; i < _cells.size(); i++) {
+			for (int j = 0; j < _inputs.size(); j++) {
+				_cells[i]._feedForwardConnections[j]._weight += _cells[i]._feedForwardDeltas[j];
+				_cells[i]._feedForwardDeltas[j] = 0.0f;
+			}
+
+			for (int j = 0; j < _cells.size(); j++) {
+				_cells[i]._lateralConnections[j]._weight = std::max(0.0f, _cells[i]._lateralConnections[j]._weight + _cells[i]._lateralDeltas[j]);
+				_cells[i]._lateralDeltas[j] = 0.0f;
+			}
+
+			_cells[i]._threshold += _cells[i]._thresholdDelta;
+			_cells[i]._thresholdDelta = 0.0f;
+		}
+	}
+
+	_updatesPending = 0;
 }
\ No newline at end of file
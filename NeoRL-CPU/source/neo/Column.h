@@ -1,105 +1,172 @@
-#pragma once
-
-#include <vector>
-#include <random>
-
-namespace neo {
-	class Column {
-	private:
-		struct Connection {
-			float _weight;
-			float _trace;
-
-			Connection()
-				: _trace(0.0f)
-			{}
-		};
-
-		struct Cell {
-			std::vector<Connection> _feedForwardConnections;
-			std::vector<Connection> _lateralConnections;
-
-			float _threshold;
-
-			float _activation;
-
-			float _spike;
-			float _spikePrev;
-
-			float _state;
-
-			Cell()
-				: _spikePrev(0.0f)
-			{}
-		};
-
-		struct Action {
-			float _state;
-			float _statePrev;
-			float _exploratoryState;
-			float _error;
-
-			std::vector<Connection> _connections;
-
-			Action()
-				: _state(0.0f), _statePrev(0.0f), _exploratoryState(0.0f)
-			{}
-		};
-
-		std::vector<float> _inputs;
-		std::vector<float> _reconstructionError;
-		std::vector<Cell> _cells;
-		std::vector<Connection> _qConnections;
-		std::vector<Action> _actions;
-
-		int _numStates;
-
-		float _prevValue;
-		float _averageSurprise;
-
-	public:
-		static float relu(float x, float leak) {
-			return x > 0.0f ? x : x * leak;
-		}
-
-		static float relud(float x, float leak) {
-			return x > 0.0f ? 1.0f : leak;
-		}
-
-		static float sigmoid(float x) {
-			return 1.0f / (1.0f + std::exp(-x));
-		}
-
-		Column()
-			: _prevValue(0.0f), _averageSurprise(0.0f)
-		{}
-
-		void createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
-
-		void simStep(float reward, float sparsity, float gamma, int iter, float leak, float feedForwardAlpha, float lateralAlpha, float thresholdAlpha, float qAlpha, float actionAlpha, float gammaLambda, float explorationStdDev, float explorationBreakChance, std::mt19937 &generator);
-
-		void setState(int index, float value) {
-			_inputs[index] = value;
-		}
-
-		float getAction(int index) const {
-			return _actions[index]._exploratoryState;
-		}
-
-		int getNumStates() const {
-			return _inputs.size();
-		}
-
-		int getNumActions() const {
-			return _actions.size();
-		}
-
-		int getNumCells() const {
-			return _cells.size();
-		}
-
-		float getCellState(int index) const {
-			return _cells[index]._state;
-		}
-	};
+#pragma once
+
+#include <vector>
+#include <random>
+#include <iostream>
+
+#include "ModelStats.h"
+#include "Footprint.h"
+
+namespace neo {
+	class Column {
+	public:
+		// Kept up by simStep
+		struct Stats {
+			SettleStats _settle;
+
+			RunningStat _rewards;
+			RunningStat _tdErrors;
+
+			// Mean cell threshold going into the last update
+			float _meanThreshold;
+
+			Stats()
+				: _meanThreshold(0.0f)
+			{}
+		};
+
+	private:
+		struct Connection {
+			float _weight;
+			float _trace;
+
+			Connection()
+				: _trace(0.0f)
+			{}
+		};
+
+		struct Cell {
+			std::vector<Connection> _feedForwardConnections;
+			std::vector<Connection> _lateralConnections;
+
+			float _threshold;
+
+			float _activation;
+
+			float _spike;
+			float _spikePrev;
+
+			float _state;
+
+			// Pending updates, only allocated when updates are deferred
+			std::vector<float> _feedForwardDeltas;
+			std::vector<float> _lateralDeltas;
+
+			float _thresholdDelta;
+
+			Cell()
+				: _spikePrev(0.0f), _thresholdDelta(0.0f)
+			{}
+		};
+
+		struct Action {
+			float _state;
+			float _statePrev;
+			float _exploratoryState;
+			float _error;
+
+			std::vector<Connection> _connections;
+
+			std::vector<float> _deltas;
+
+			Action()
+				: _state(0.0f), _statePrev(0.0f), _exploratoryState(0.0f)
+			{}
+		};
+
+		std::vector<float> _inputs;
+		std::vector<float> _reconstructionError;
+		std::vector<Cell> _cells;
+		std::vector<Connection> _qConnections;
+		std::vector<Action> _actions;
+
+		std::vector<float> _qDeltas;
+
+		int _numStates;
+
+		float _prevValue;
+		float _averageSurprise;
+
+		int _updateInterval;
+		int _updatesPending;
+
+		Stats _stats;
+
+		static void saveWeights(std::ostream &os, const std::vector<Connection> &connections);
+		static void loadWeights(std::istream &is, std::vector<Connection> &connections);
+
+	public:
+		static float relu(float x, float leak) {
+			return x > 0.0f ? x : x * leak;
+		}
+
+		static float relud(float x, float leak) {
+			return x > 0.0f ? 1.0f : leak;
+		}
+
+		static float sigmoid(float x) {
+			return 1.0f / (1.0f + std::exp(-x));
+		}
+
+		Column()
+			: _prevValue(0.0f), _averageSurprise(0.0f), _updateInterval(1), _updatesPending(0)
+		{}
+
+		void createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
+
+		// Weights drawn from a counter based generator, depending only on seed. Single threaded, Agent fills its columns in parallel
+		void createRandom(int numStates, int numActions, int numCells, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed);
+
+		void simStep(float reward, float sparsity, float gamma, int iter, float leak, float feedForwardAlpha, float lateralAlpha, float thresholdAlpha, float qAlpha, float actionAlpha, float gammaLambda, float explorationStdDev, float explorationBreakChance, std::mt19937 &generator);
+
+		// Heap bytes of a column created with these sizes that has stepped with iter settle iterations, with what setUpdateInterval adds for the interval
+		static Footprint computeFootprint(int numStates, int numActions, int numCells, int iter, int updateInterval = 1);
+
+		// Measured from the allocations
+		Footprint getFootprint() const;
+
+		// Thresholds and weights, traces start cleared on load. Pending deferred updates are not included, apply them first
+		void save(std::ostream &os) const;
+
+		// Replace this column with one stored by save, activity cleared. Returns false on a read error
+		bool load(std::istream &is);
+
+		// Accumulate weight updates and only write them every interval steps (1 = write immediately)
+		void setUpdateInterval(int interval);
+
+		// Write all pending updates to the weights
+		void applyUpdates();
+
+		void setState(int index, float value) {
+			_inputs[index] = value;
+		}
+
+		float getAction(int index) const {
+			return _actions[index]._exploratoryState;
+		}
+
+		int getNumStates() const {
+			return _inputs.size();
+		}
+
+		int getNumActions() const {
+			return _actions.size();
+		}
+
+		int getNumCells() const {
+			return _cells.size();
+		}
+
+		float getCellState(int index) const {
+			return _cells[index]._state;
+		}
+
+		const Stats &getStats() const {
+			return _stats;
+		}
+
+		void resetStats() {
+			_stats = Stats();
+		}
+	};
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace neo {
+	// Counter based random numbers (SplitMix64 outputs addressed by index). A value depends only on the seed, stream and counter,
+	// so threads can fill any part of a model in any order and get the same weights as a single thread
+	class CounterRNG {
+	private:
+		uint64_t _key;
+
+	public:
+		static uint64_t mix(uint64_t x) {
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+			return x ^ (x >> 31);
+		}
+
+		CounterRNG(uint64_t seed, uint64_t stream)
+			: _key(mix(seed + 0x9e3779b97f4a7c15ull * (stream + 1)))
+		{}
+
+		uint64_t bits(uint64_t counter) const {
+			return mix(_key + 0x9e3779b97f4a7c15ull * (counter + 1));
+		}
+
+		// In [0, 1), 24 bits
+		float uniform(uint64_t counter) const {
+			return (bits(counter) >> 40) * (1.0f / 16777216.0f);
+		}
+
+		float uniform(uint64_t counter, float low, float high) const {
+			return low + (high - low) * uniform(counter);
+		}
+
+		// Counter of element index of node, for streams of per node arrays
+		static uint64_t counter(int node, int index) {
+			return (static_cast<uint64_t>(node) << 32) | static_cast<uint32_t>(index);
+		}
+	};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace neo {
+	// Heap bytes owned by a model, split by what they hold. Element storage only, allocator overhead and the
+	// temporaries of a step come on top. Computed footprints match the measured ones of a model that has stepped once
+	struct Footprint {
+		// Connection arrays: weights and indices
+		size_t _weights;
+
+		// Eligibility traces stored alongside the weights
+		size_t _traces;
+
+		// Pending updates, only allocated with an update interval above 1
+		size_t _deltas;
+
+		// Activity carried between steps and settle statistics, what a session costs
+		size_t _state;
+
+		// Node records (thresholds, biases, vector headers), layer records and learning statistics
+		size_t _structure;
+
+		Footprint()
+			: _weights(0), _traces(0), _deltas(0), _state(0), _structure(0)
+		{}
+
+		size_t getTotal() const {
+			return _weights + _traces + _deltas + _state + _structure;
+		}
+
+		Footprint &operator+=(const Footprint &other) {
+			_weights += other._weights;
+			_traces += other._traces;
+			_deltas += other._deltas;
+			_state += other._state;
+			_structure += other._structure;
+
+			return *this;
+		}
+	};
+
+	// Connections of a radius around center that fall inside [0, size), along one axis
+	inline int clippedSpan(int center, int radius, int size) {
+		return std::max(0, std::min(center + radius, size - 1) - std::max(center - radius, 0) + 1);
+	}
+
+	template<class T>
+	size_t vectorBytes(const std::vector<T> &v) {
+		return v.capacity() * sizeof(T);
+	}
+}
@@ -0,0 +1,106 @@
+#include "HogwildTrainer.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void HogwildTrainer::create(PredictiveHierarchy *ph, int numWorkers, unsigned long seed, int syncInterval) {
+	_ph = ph;
+	_syncInterval = std::max(0, syncInterval);
+
+	_states.clear();
+	_states.resize(std::max(1, numWorkers));
+
+	_generators.clear();
+
+	for (int w = 0; w < _states.size(); w++) {
+		_ph->initState(_states[w]);
+
+		_generators.push_back(std::mt19937(seed + w));
+	}
+}
+
+void HogwildTrainer::resetStates() {
+	for (int w = 0; w < _states.size(); w++)
+		_ph->initState(_states[w]);
+}
+
+void HogwildTrainer::arrive(bool leaving) {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (leaving)
+		_numActive--;
+	else
+		_numWaiting++;
+
+	if (_numWaiting > 0 && _numWaiting == _numActive) {
+		_numWaiting = 0;
+		_barrierGeneration++;
+
+		_released.notify_all();
+	}
+	else if (!leaving) {
+		long generation = _barrierGeneration;
+
+		_released.wait(lock, [this, generation] { return _barrierGeneration != generation; });
+	}
+}
+
+void HogwildTrainer::runWorker(int worker, const Feeder &feed, long* steps) {
+	PredictiveHierarchy::State &state = _states[worker];
+	std::mt19937 &generator = _generators[worker];
+
+	long step = 0;
+
+	while (feed(worker, state)) {
+		_ph->simStep(state, generator, true);
+
+		step++;
+
+		if (_syncInterval > 0 && step % _syncInterval == 0)
+			arrive(false);
+	}
+
+	if (_syncInterval > 0)
+		arrive(true);
+
+	*steps = step;
+}
+
+long HogwildTrainer::train(const Feeder &feed) {
+	StepProfiler* profiler = _ph->getProfiler();
+
+	_ph->setProfiler(nullptr);
+
+	// Workers learn straight into the weights. Deferred updates would have them add into the same deltas while one of them flushes,
+	// and count pending steps on a plain int. This also flushes what is pending, and gives ph layers of its own (copies of it may share them),
+	// so the workers never copy one on write at the same time
+	int updateInterval = _ph->getUpdateInterval();
+
+	_ph->setUpdateInterval(1);
+
+	_numActive = _states.size();
+	_numWaiting = 0;
+
+	std::vector<long> steps(_states.size(), 0);
+	std::vector<std::thread> threads;
+
+	for (int w = 1; w < _states.size(); w++)
+		threads.push_back(std::thread(&HogwildTrainer::runWorker, this, w, std::cref(feed), &steps[w]));
+
+	runWorker(0, feed, &steps[0]);
+
+	for (int t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	_ph->setUpdateInterval(updateInterval);
+
+	_ph->setProfiler(profiler);
+
+	long total = 0;
+
+	for (int w = 0; w < steps.size(); w++)
+		total += steps[w];
+
+	return total;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "PredictiveHierarchy.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace neo {
+	// Trains one PredictiveHierarchy on several input sequences at once, one worker thread per sequence (Hogwild).
+	// Every worker steps its own State and generator and learns straight into the shared weights without locking, so updates of
+	// different workers now and then overwrite each other, which the online learning rules tolerate. Thresholds and the learning
+	// statistics are shared the same way, the statistics are only approximate while workers run. Eligibility traces are in each worker's State
+	class HogwildTrainer {
+	public:
+		// Called on the worker's thread before each of its steps. Set the inputs of state for the next step (setInput(state, ...) or
+		// swapInputs(state, ...)), reading the predictions of the last step if needed. Return false when the worker's sequence has ended
+		typedef std::function<bool(int worker, PredictiveHierarchy::State &state)> Feeder;
+
+	private:
+		PredictiveHierarchy *_ph;
+
+		std::vector<PredictiveHierarchy::State> _states;
+		std::vector<std::mt19937> _generators;
+
+		int _syncInterval;
+
+		// Barrier over the workers still running
+		std::mutex _mutex;
+		std::condition_variable _released;
+		int _numActive;
+		int _numWaiting;
+		long _barrierGeneration;
+
+		void runWorker(int worker, const Feeder &feed, long* steps);
+
+		// Wait for the other running workers, or leave the barrier for good (leaving = true)
+		void arrive(bool leaving);
+
+	public:
+		HogwildTrainer()
+			: _ph(nullptr), _syncInterval(0), _numActive(0), _numWaiting(0), _barrierGeneration(0)
+		{}
+
+		// Prepare numWorkers states and generators (seeded seed, seed + 1, ...) for ph. With syncInterval > 0 workers wait for each other
+		// every syncInterval steps, so none runs far ahead of the others in its sequence
+		void create(PredictiveHierarchy *ph, int numWorkers, unsigned long seed, int syncInterval = 0);
+
+		// Run every worker until its feeder returns false, worker 0 on the calling thread. Returns the steps taken by all workers.
+		// ph must not be stepped by anyone else meanwhile. Its profiler (not thread safe) is detached while training, and it learns with
+		// update interval 1 (setUpdateInterval), both are restored afterwards
+		long train(const Feeder &feed);
+
+		// Clear the recurrent activity of every worker, e.g. when the sequences restart
+		void resetStates();
+
+		int getNumWorkers() const {
+			return _states.size();
+		}
+
+		PredictiveHierarchy::State &getState(int worker) {
+			return _states[worker];
+		}
+
+		int getSyncInterval() const {
+			return _syncInterval;
+		}
+	};
+}
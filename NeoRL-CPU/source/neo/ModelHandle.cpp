@@ -0,0 +1,64 @@
+#include "ModelHandle.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace neo;
+
+void ModelHandle::create(const PredictiveHierarchy &model, int publishInterval) {
+	_trainer = model;
+
+	_copies[0] = model;
+	_copies[1] = model;
+
+	// Readers on any number of threads would share the profiler, which is not thread safe
+	_copies[0].setProfiler(nullptr);
+	_copies[1].setProfiler(nullptr);
+
+	_published = 0;
+
+	_publishInterval = std::max(1, publishInterval);
+	_stepsSincePublish = 0;
+}
+
+ModelHandle::Pin ModelHandle::pin() const {
+	while (true) {
+		int index = _published;
+
+		_readers[index]++;
+
+		// Only keep the pin if the copy was not swapped out in the meantime, otherwise the publisher may already be writing it
+		if (_published == index)
+			return Pin(this, index);
+
+		_readers[index]--;
+	}
+}
+
+void ModelHandle::simStep(PredictiveHierarchy::State &state, std::mt19937 &generator) const {
+	Pin p = pin();
+
+	p->infer(state, generator);
+	p->stepEnd(state);
+}
+
+void ModelHandle::train(std::mt19937 &generator) {
+	_trainer.simStep(generator, true);
+
+	if (++_stepsSincePublish >= _publishInterval)
+		publish();
+}
+
+void ModelHandle::publish() {
+	int standby = 1 - _published;
+
+	// Grace period for readers still on the copy published before the current one
+	while (_readers[standby] != 0)
+		std::this_thread::yield();
+
+	_copies[standby].copyWeights(_trainer);
+
+	_published = standby;
+
+	_stepsSincePublish = 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "PredictiveHierarchy.h"
+
+#include <atomic>
+
+namespace neo {
+	// Serves a hierarchy that is being trained at the same time.
+	// The trainer learns on its own copy, and every publish interval the standby one of two read-only copies takes over the trainer's layers, then is swapped in atomically (RCU style).
+	// Layers are shared between the three until the trainer writes one, which copies it first, so layers that stop learning are held once.
+	// Readers pin the published copy without locking and step their own states on it, they never wait for the trainer. The copies do not profile
+	class ModelHandle {
+	public:
+		// Keeps a published copy alive while it is in use
+		class Pin {
+		private:
+			const ModelHandle *_handle;
+			int _index;
+
+		public:
+			Pin(const ModelHandle *handle, int index)
+				: _handle(handle), _index(index)
+			{}
+
+			Pin(Pin &&other)
+				: _handle(other._handle), _index(other._index)
+			{
+				other._handle = nullptr;
+			}
+
+			Pin(const Pin &) = delete;
+			Pin &operator=(const Pin &) = delete;
+
+			~Pin() {
+				if (_handle != nullptr)
+					_handle->_readers[_index]--;
+			}
+
+			const PredictiveHierarchy &get() const {
+				return _handle->_copies[_index];
+			}
+
+			const PredictiveHierarchy *operator->() const {
+				return &_handle->_copies[_index];
+			}
+		};
+
+	private:
+		PredictiveHierarchy _trainer;
+		PredictiveHierarchy _copies[2];
+
+		std::atomic<int> _published;
+
+		mutable std::atomic<int> _readers[2];
+
+		int _publishInterval;
+		int _stepsSincePublish;
+
+	public:
+		ModelHandle()
+			: _published(0), _publishInterval(1), _stepsSincePublish(0)
+		{
+			_readers[0] = 0;
+			_readers[1] = 0;
+		}
+
+		// Start serving model and training a copy of it, publishing every publishInterval training steps. Not thread safe
+		void create(const PredictiveHierarchy &model, int publishInterval);
+
+		// Pin the currently published copy, lock free
+		Pin pin() const;
+
+		// Size and clear a reader state
+		void initState(PredictiveHierarchy::State &state) const {
+			pin()->initState(state);
+		}
+
+		// Reader step on the published weights, no learning. May be called from any number of threads, each with its own state
+		void simStep(PredictiveHierarchy::State &state, std::mt19937 &generator) const;
+
+		// Trainer step with learning on the trainer's own state, publishes every publish interval. Only one thread may train
+		void train(std::mt19937 &generator);
+
+		// Copy what changed in the trainer into the standby copy and swap it in.
+		// Waits for readers that still hold the standby copy from the publish before last
+		void publish();
+
+		// Set trainer inputs and learning parameters through this
+		PredictiveHierarchy &getTrainer() {
+			return _trainer;
+		}
+
+		int getPublishInterval() const {
+			return _publishInterval;
+		}
+	};
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace neo {
+	// Count, mean, spread and range of a stream of values
+	struct RunningStat {
+		long _count;
+
+		double _sum;
+		double _sumSquares;
+
+		float _min;
+		float _max;
+
+		RunningStat() {
+			reset();
+		}
+
+		void reset() {
+			_count = 0;
+			_sum = 0.0;
+			_sumSquares = 0.0;
+			_min = 0.0f;
+			_max = 0.0f;
+		}
+
+		void add(float x) {
+			_min = _count == 0 ? x : std::min(_min, x);
+			_max = _count == 0 ? x : std::max(_max, x);
+
+			_count++;
+			_sum += x;
+			_sumSquares += static_cast<double>(x) * x;
+		}
+
+		double getMean() const {
+			return _count > 0 ? _sum / _count : 0.0;
+		}
+
+		double getStdDev() const {
+			if (_count == 0)
+				return 0.0;
+
+			double mean = getMean();
+
+			return std::sqrt(std::max(0.0, _sumSquares / _count - mean * mean));
+		}
+	};
+
+	// How a spiking layer settled, summed over activations
+	struct SettleStats {
+		long _activations;
+
+		// Fraction of units with a nonzero state after settling
+		double _activeSum;
+
+		// Spiking units, by settle iteration
+		std::vector<double> _spikesPerIteration;
+
+		SettleStats()
+			: _activations(0), _activeSum(0.0)
+		{}
+
+		void reset() {
+			_activations = 0;
+			_activeSum = 0.0;
+			_spikesPerIteration.clear();
+		}
+
+		// Called before settling, so the loop only has to add
+		void begin(int iter) {
+			if (_spikesPerIteration.size() < iter)
+				_spikesPerIteration.resize(iter, 0.0);
+		}
+
+		double getSparsity() const {
+			return _activations > 0 ? _activeSum / _activations : 0.0;
+		}
+
+		// Mean spikes in an iteration per activation
+		double getSpikes(int iteration) const {
+			return _activations > 0 && iteration < _spikesPerIteration.size() ? _spikesPerIteration[iteration] / _activations : 0.0;
+		}
+	};
+}
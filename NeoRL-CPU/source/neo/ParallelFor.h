@@ -0,0 +1,41 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace neo {
+	// Run body(begin, end) over contiguous ranges of [0, count), one per thread. numThreads 0 uses every hardware thread.
+	// Ranges are at least minPerThread long, so small counts run inline on the calling thread
+	template<class Body>
+	void parallelFor(int count, int numThreads, const Body &body, int minPerThread = 64) {
+		if (numThreads <= 0)
+			numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+		numThreads = std::max(1, std::min(numThreads, count / std::max(1, minPerThread)));
+
+		if (numThreads == 1) {
+			body(0, count);
+
+			return;
+		}
+
+		std::vector<std::thread> threads;
+
+		threads.reserve(numThreads - 1);
+
+		int perThread = (count + numThreads - 1) / numThreads;
+
+		for (int t = 1; t < numThreads; t++) {
+			int begin = std::min(count, t * perThread);
+			int end = std::min(count, begin + perThread);
+
+			threads.push_back(std::thread([&body, begin, end] { body(begin, end); }));
+		}
+
+		body(0, std::min(count, perThread));
+
+		for (int t = 0; t < threads.size(); t++)
+			threads[t].join();
+	}
+}
@@ -0,0 +1,143 @@
+#include "PerfCounters.h"
+
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace neo;
+
+namespace {
+#ifdef __linux__
+	int openEvent(uint32_t type, uint64_t config, int groupFd) {
+		perf_event_attr attr;
+
+		std::memset(&attr, 0, sizeof(attr));
+
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = groupFd == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		// This thread on any CPU
+		return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+	}
+#endif
+}
+
+PerfCounters::PerfCounters() {
+	for (int i = 0; i < _numCounters; i++) {
+		_fds[i] = -1;
+		_ids[i] = 0;
+	}
+}
+
+const char* PerfCounters::getCounterName(Counter counter) {
+	static const char* names[_numCounters] = { "cycles", "instructions", "llcReferences", "llcMisses" };
+
+	return names[counter];
+}
+
+bool PerfCounters::open() {
+	close();
+
+#ifdef __linux__
+	const uint64_t configs[_numCounters] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES };
+
+	for (int i = 0; i < _numCounters; i++) {
+		int fd = openEvent(PERF_TYPE_HARDWARE, configs[i], _fds[_cycles]);
+
+		if (fd == -1) {
+			// Without the leader there is no group
+			if (i == _cycles) {
+				_error = std::string("perf_event_open: ") + std::strerror(errno);
+
+				return false;
+			}
+
+			continue;
+		}
+
+		if (ioctl(fd, PERF_EVENT_IOC_ID, &_ids[i]) == -1) {
+			::close(fd);
+
+			if (i == _cycles) {
+				_error = std::string("PERF_EVENT_IOC_ID: ") + std::strerror(errno);
+
+				return false;
+			}
+
+			continue;
+		}
+
+		_fds[i] = fd;
+	}
+
+	ioctl(_fds[_cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(_fds[_cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	_error.clear();
+
+	return true;
+#else
+	_error = "hardware counters need Linux perf_event_open";
+
+	return false;
+#endif
+}
+
+void PerfCounters::close() {
+#ifdef __linux__
+	// Members before the leader
+	for (int i = _numCounters - 1; i >= 0; i--)
+		if (_fds[i] != -1)
+			::close(_fds[i]);
+#endif
+
+	for (int i = 0; i < _numCounters; i++) {
+		_fds[i] = -1;
+		_ids[i] = 0;
+	}
+}
+
+PerfCounters::Sample PerfCounters::read() const {
+	Sample sample;
+
+#ifdef __linux__
+	if (!isAvailable())
+		return sample;
+
+	// nr, time enabled, time running, then a value and id per counter
+	uint64_t buffer[3 + 2 * _numCounters];
+
+	ssize_t size = ::read(_fds[_cycles], buffer, sizeof(buffer));
+
+	if (size < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+		return sample;
+
+	uint64_t nr = buffer[0];
+	uint64_t enabled = buffer[1];
+	uint64_t running = buffer[2];
+
+	// Extrapolate when the group only ran part of the time
+	double scale = running > 0 && running < enabled ? static_cast<double>(enabled) / running : 1.0;
+
+	for (uint64_t j = 0; j < nr && j < _numCounters; j++)
+		for (int i = 0; i < _numCounters; i++)
+			if (_fds[i] != -1 && _ids[i] == buffer[4 + 2 * j]) {
+				sample._values[i] = static_cast<int64_t>(buffer[3 + 2 * j] * scale);
+
+				break;
+			}
+#endif
+
+	return sample;
+}
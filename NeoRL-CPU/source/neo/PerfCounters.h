@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+namespace neo {
+	// Hardware counters of the calling thread (user space only) through perf_event_open, read as one group so the values line up.
+	// open fails gracefully where counters are not available (non Linux, containers without perf access, perf_event_paranoid > 2, VMs without a PMU),
+	// after which every read returns zeros and isAvailable is false
+	class PerfCounters {
+	public:
+		enum Counter {
+			_cycles = 0, _instructions, _llcReferences, _llcMisses, _numCounters
+		};
+
+		struct Sample {
+			int64_t _values[_numCounters];
+
+			Sample() {
+				for (int i = 0; i < _numCounters; i++)
+					_values[i] = 0;
+			}
+
+			int64_t operator[](Counter counter) const {
+				return _values[counter];
+			}
+
+			Sample operator-(const Sample &other) const {
+				Sample delta;
+
+				for (int i = 0; i < _numCounters; i++)
+					delta._values[i] = _values[i] - other._values[i];
+
+				return delta;
+			}
+
+			Sample &operator+=(const Sample &other) {
+				for (int i = 0; i < _numCounters; i++)
+					_values[i] += other._values[i];
+
+				return *this;
+			}
+		};
+
+	private:
+		// File descriptors, the first is the group leader, -1 for counters that could not be opened
+		int _fds[_numCounters];
+
+		// Kernel ids of the opened counters, used to match the group read
+		uint64_t _ids[_numCounters];
+
+		std::string _error;
+
+	public:
+		PerfCounters();
+
+		~PerfCounters() {
+			close();
+		}
+
+		PerfCounters(const PerfCounters &) = delete;
+		PerfCounters &operator=(const PerfCounters &) = delete;
+
+		static const char* getCounterName(Counter counter);
+
+		// Opens counters for the calling thread. Needs at least cycles, the other counters are optional (check hasCounter).
+		// Returns false and sets getError if nothing could be opened
+		bool open();
+
+		void close();
+
+		bool isAvailable() const {
+			return _fds[_cycles] != -1;
+		}
+
+		bool hasCounter(Counter counter) const {
+			return _fds[counter] != -1;
+		}
+
+		// Why open failed
+		const std::string &getError() const {
+			return _error;
+		}
+
+		// Running totals, scaled up if the kernel had to multiplex the counters. Zeros when not available
+		Sample read() const;
+	};
+}
@@ -1,315 +1,1108 @@
-#include "PredictiveHierarchy.h"
-
-#include <algorithm>
-
-using namespace neo;
-
-void PredictiveHierarchy::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
-
-	_layerDescs = layerDescs;
-
-	_layers.resize(_layerDescs.size());
-
-	int widthPrev = inputWidth;
-	int heightPrev = inputHeight;
-
-	for (int l = 0; l < _layerDescs.size(); l++) {
-		_layers[l]._sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._recurrentRadius, _layerDescs[l]._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
-
-		_layers[l]._predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
-
-		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
-		int predictiveSize = std::pow(_layerDescs[l]._predictiveRadius * 2 + 1, 2);
-
-		float hiddenToNextHiddenWidth = 1.0f;
-		float hiddenToNextHiddenHeight = 1.0f;
-
-		if (l < _layers.size() - 1) {
-			hiddenToNextHiddenWidth = static_cast<float>(_layerDescs[l + 1]._width) / static_cast<float>(_layerDescs[l]._width);
-			hiddenToNextHiddenHeight = static_cast<float>(_layerDescs[l + 1]._height) / static_cast<float>(_layerDescs[l]._height);
-		}
-
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			p._bias._weight = weightDist(generator);
-
-			int hx = pi % _layerDescs[l]._width;
-			int hy = pi / _layerDescs[l]._width;
-
-			// Feed Back
-			if (l < _layers.size() - 1) {
-				p._feedBackConnections.reserve(feedBackSize);
-
-				int centerX = std::round(hx * hiddenToNextHiddenWidth);
-				int centerY = std::round(hy * hiddenToNextHiddenHeight);
-
-				for (int dx = -_layerDescs[l]._feedBackRadius; dx <= _layerDescs[l]._feedBackRadius; dx++)
-					for (int dy = -_layerDescs[l]._feedBackRadius; dy <= _layerDescs[l]._feedBackRadius; dy++) {
-						int hox = centerX + dx;
-						int hoy = centerY + dy;
-
-						if (hox >= 0 && hox < _layerDescs[l + 1]._width && hoy >= 0 && hoy < _layerDescs[l + 1]._height) {
-							int hio = hox + hoy * _layerDescs[l + 1]._width;
-
-							Connection c;
-
-							c._weight = weightDist(generator);
-							c._index = hio;
-
-							p._feedBackConnections.push_back(c);
-						}
-					}
-
-				p._feedBackConnections.shrink_to_fit();
-			}
-
-			// Predictive
-			p._predictiveConnections.reserve(feedBackSize);
-
-			for (int dx = -_layerDescs[l]._predictiveRadius; dx <= _layerDescs[l]._predictiveRadius; dx++)
-				for (int dy = -_layerDescs[l]._predictiveRadius; dy <= _layerDescs[l]._predictiveRadius; dy++) {
-					int hox = hx + dx;
-					int hoy = hy + dy;
-
-					if (hox >= 0 && hox < _layerDescs[l]._width && hoy >= 0 && hoy < _layerDescs[l]._height) {
-						int hio = hox + hoy * _layerDescs[l]._width;
-
-						Connection c;
-
-						c._weight = weightDist(generator);
-						c._index = hio;
-
-						p._predictiveConnections.push_back(c);
-					}
-				}
-
-			p._predictiveConnections.shrink_to_fit();
-		}
-
-		widthPrev = _layerDescs[l]._width;
-		heightPrev = _layerDescs[l]._height;
-	}
-
-	_inputPredictionNodes.resize(inputWidth * inputHeight);
-
-	float inputToNextHiddenWidth = static_cast<float>(_layerDescs.front()._width) / static_cast<float>(inputWidth);
-	float inputToNextHiddenHeight = static_cast<float>(_layerDescs.front()._height) / static_cast<float>(inputHeight);
-
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		p._bias._weight = weightDist(generator);
-
-		int hx = pi % inputWidth;
-		int hy = pi / inputWidth;
-
-		int feedBackSize = std::pow(inputFeedBackRadius * 2 + 1, 2);
-
-		// Feed Back
-		p._feedBackConnections.reserve(feedBackSize);
-
-		int centerX = std::round(hx * inputToNextHiddenWidth);
-		int centerY = std::round(hy * inputToNextHiddenHeight);
-
-		for (int dx = -inputFeedBackRadius; dx <= inputFeedBackRadius; dx++)
-			for (int dy = -inputFeedBackRadius; dy <= inputFeedBackRadius; dy++) {
-				int hox = centerX + dx;
-				int hoy = centerY + dy;
-
-				if (hox >= 0 && hox < _layerDescs.front()._width && hoy >= 0 && hoy < _layerDescs.front()._height) {
-					int hio = hox + hoy * _layerDescs.front()._width;
-
-					Connection c;
-
-					c._weight = weightDist(generator);
-					c._index = hio;
-
-					p._feedBackConnections.push_back(c);
-				}
-			}
-
-		p._feedBackConnections.shrink_to_fit();
-	}
-}
-
-void PredictiveHierarchy::simStep(std::mt19937 &generator, bool learn) {
-	// Feature extraction
-	for (int l = 0; l < _layers.size(); l++) {
-		_layers[l]._sdr.activate(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, generator);
-
-		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++) {
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
-			}
-		}
-	}
-
-	// Prediction
-	for (int l = _layers.size() - 1; l >= 0; l--) {
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			// Learn
-			if (learn) {	
-				float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
-
-				if (l < _layers.size() - 1) {
-					for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-						p._feedBackConnections[ci]._weight += _layerDescs[l]._learnFeedBack * predictionError * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
-				}
-
-				// Predictive
-				for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-					p._predictiveConnections[ci]._weight += _layerDescs[l]._learnPrediction * predictionError * _layers[l]._sdr.getHiddenStatePrev(p._predictiveConnections[ci]._index);
-			}
-
-			float activation = 0.0f;
-
-			// Feed Back
-			if (l < _layers.size() - 1) {
-				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
-			}
-
-			// Predictive
-			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
-
-			p._activation = activation;
-
-			p._state = std::min(1.0f, std::max(0.0f, p._activation));
-		}
-	}
-
-	// Get first layer prediction
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		// Learn
-		if (learn) {		
-			float predictionError = _layers.front()._sdr.getVisibleState(pi) - p._statePrev;
-
-			for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-				p._feedBackConnections[ci]._weight += _learnInputFeedBack * predictionError * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._statePrev;
-		}
-
-		float activation = 0.0f;
-
-		// Feed Back
-		for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-			activation += p._feedBackConnections[ci]._weight * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state;
-
-		p._activation = activation;
-
-		p._state = p._activation;
-	}
-
-	for (int l = 0; l < _layers.size(); l++) {
-		std::vector<float> rewards(_layers[l]._predictionNodes.size());
-
-		if (learn) {
-			for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-				PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-				float predictionError = _layers[l]._sdr.getHiddenState(pi) - p._statePrev;
-
-				float error2 = predictionError * predictionError;
-
-				rewards[pi] = sigmoid(_layerDescs[l]._sdrSensitivity * (error2 - p._baseline));
-
-				p._baseline = (1.0f - _layerDescs[l]._sdrBaselineDecay) * p._baseline + _layerDescs[l]._sdrBaselineDecay * error2;
-			}
-
-			_layers[l]._sdr.learn(rewards, _layerDescs[l]._sdrLambda, _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._sdrLearnThreshold, _layerDescs[l]._sdrSparsity, _layerDescs[l]._sdrWeightDecay, _layerDescs[l]._sdrMaxWeightDelta); //attentions[l], 
-		}
-
-		_layers[l]._sdr.stepEnd();
-
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			p._statePrev = p._state;
-			p._activationPrev = p._activation;
-		}
-	}
-
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		p._statePrev = p._state;
-		p._activationPrev = p._activation;
-	}
-}
-
-void PredictiveHierarchy::simStepGenerate(std::mt19937 &generator, float noise) {
-	// Feature extraction
-	for (int l = 0; l < _layers.size(); l++) {
-		_layers[l]._sdr.activateNoise(_layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, noise, generator);
-
-		// Set inputs for next layer if there is one
-		if (l < _layers.size() - 1) {
-			for (int i = 0; i < _layers[l]._sdr.getNumHidden(); i++) {
-				_layers[l + 1]._sdr.setVisibleState(i, _layers[l]._sdr.getHiddenState(i));
-			}
-		}
-	}
-
-	// Prediction
-	for (int l = _layers.size() - 1; l >= 0; l--) {
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			float activation = 0.0f;
-
-			// Feed Back
-			if (l < _layers.size() - 1) {
-				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-					activation += p._feedBackConnections[ci]._weight * _layers[l + 1]._predictionNodes[p._feedBackConnections[ci]._index]._state;
-			}
-
-			// Predictive
-			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
-				activation += p._predictiveConnections[ci]._weight * _layers[l]._sdr.getHiddenState(p._predictiveConnections[ci]._index);
-
-			p._activation = activation;
-
-			p._state = std::min(1.0f, std::max(0.0f, p._activation));
-		}
-	}
-
-	// Get first layer prediction
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		float activation = 0.0f;
-
-		// Feed Back
-		for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
-			activation += p._feedBackConnections[ci]._weight * _layers.front()._predictionNodes[p._feedBackConnections[ci]._index]._state;
-
-		p._activation = activation;
-
-		p._state = p._activation;
-	}
-
-	for (int l = 0; l < _layers.size(); l++) {
-		_layers[l]._sdr.stepEnd();
-
-		for (int pi = 0; pi < _layers[l]._predictionNodes.size(); pi++) {
-			PredictionNode &p = _layers[l]._predictionNodes[pi];
-
-			p._statePrev = p._state;
-			p._activationPrev = p._activation;
-		}
-	}
-
-	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
-		InputPredictionNode &p = _inputPredictionNodes[pi];
-
-		p._statePrev = p._state;
-		p._activationPrev = p._activation;
-	}
+#include "PredictiveHierarchy.h"
+
+#include "CounterRNG.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void PredictiveHierarchy::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
+
+	_layerDescs = layerDescs;
+
+	_layers.assign(_layerDescs.size(), nullptr);
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	for (int l = 0; l < _layerDescs.size(); l++) {
+		std::shared_ptr<Layer> layer = std::make_shared<Layer>();
+
+		_layers[l] = layer;
+
+		layer->_sdr.createRandom(widthPrev, heightPrev, _layerDescs[l]._width, _layerDescs[l]._height, _layerDescs[l]._receptiveRadius, _layerDescs[l]._recurrentRadius, _layerDescs[l]._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+
+		layer->_predictionNodes.resize(_layerDescs[l]._width * _layerDescs[l]._height);
+
+		int feedBackSize = std::pow(_layerDescs[l]._feedBackRadius * 2 + 1, 2);
+		int predictiveSize = std::pow(_layerDescs[l]._predictiveRadius * 2 + 1, 2);
+
+		float hiddenToNextHiddenWidth = 1.0f;
+		float hiddenToNextHiddenHeight = 1.0f;
+
+		if (l < _layers.size() - 1) {
+			hiddenToNextHiddenWidth = static_cast<float>(_layerDescs[l + 1]._width) / static_cast<float>(_layerDescs[l]._width);
+			hiddenToNextHiddenHeight = static_cast<float>(_layerDescs[l + 1]._height) / static_cast<float>(_layerDescs[l]._height);
+		}
+
+		for (int pi = 0; pi < layer->_predictionNodes.size(); pi++) {
+			PredictionNode &p = layer->_predictionNodes[pi];
+
+			p._bias._weight = weightDist(generator);
+
+			int hx = pi % _layerDescs[l]._width;
+			int hy = pi / _layerDescs[l]._width;
+
+			// Feed Back
+			if (l < _layers.size() - 1) {
+				p._feedBackConnections.reserve(feedBackSize);
+
+				int centerX = std::round(hx * hiddenToNextHiddenWidth);
+				int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+				for (int dx = -_layerDescs[l]._feedBackRadius; dx <= _layerDescs[l]._feedBackRadius; dx++)
+					for (int dy = -_layerDescs[l]._feedBackRadius; dy <= _layerDescs[l]._feedBackRadius; dy++) {
+						int hox = centerX + dx;
+						int hoy = centerY + dy;
+
+						if (hox >= 0 && hox < _layerDescs[l + 1]._width && hoy >= 0 && hoy < _layerDescs[l + 1]._height) {
+							int hio = hox + hoy * _layerDescs[l + 1]._width;
+
+							Connection c;
+
+							c._weight = weightDist(generator);
+							c._index = hio;
+
+							p._feedBackConnections.push_back(c);
+						}
+					}
+
+				p._feedBackConnections.shrink_to_fit();
+			}
+
+			// Predictive
+			p._predictiveConnections.reserve(feedBackSize);
+
+			for (int dx = -_layerDescs[l]._predictiveRadius; dx <= _layerDescs[l]._predictiveRadius; dx++)
+				for (int dy = -_layerDescs[l]._predictiveRadius; dy <= _layerDescs[l]._predictiveRadius; dy++) {
+					int hox = hx + dx;
+					int hoy = hy + dy;
+
+					if (hox >= 0 && hox < _layerDescs[l]._width && hoy >= 0 && hoy < _layerDescs[l]._height) {
+						int hio = hox + hoy * _layerDescs[l]._width;
+
+						Connection c;
+
+						c._weight = weightDist(generator);
+						c._index = hio;
+
+						p._predictiveConnections.push_back(c);
+					}
+				}
+
+			p._predictiveConnections.shrink_to_fit();
+		}
+
+		widthPrev = _layerDescs[l]._width;
+		heightPrev = _layerDescs[l]._height;
+	}
+
+	_inputPredictionNodes.resize(inputWidth * inputHeight);
+
+	float inputToNextHiddenWidth = static_cast<float>(_layerDescs.front()._width) / static_cast<float>(inputWidth);
+	float inputToNextHiddenHeight = static_cast<float>(_layerDescs.front()._height) / static_cast<float>(inputHeight);
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		p._bias._weight = weightDist(generator);
+
+		int hx = pi % inputWidth;
+		int hy = pi / inputWidth;
+
+		int feedBackSize = std::pow(inputFeedBackRadius * 2 + 1, 2);
+
+		// Feed Back
+		p._feedBackConnections.reserve(feedBackSize);
+
+		int centerX = std::round(hx * inputToNextHiddenWidth);
+		int centerY = std::round(hy * inputToNextHiddenHeight);
+
+		for (int dx = -inputFeedBackRadius; dx <= inputFeedBackRadius; dx++)
+			for (int dy = -inputFeedBackRadius; dy <= inputFeedBackRadius; dy++) {
+				int hox = centerX + dx;
+				int hoy = centerY + dy;
+
+				if (hox >= 0 && hox < _layerDescs.front()._width && hoy >= 0 && hoy < _layerDescs.front()._height) {
+					int hio = hox + hoy * _layerDescs.front()._width;
+
+					Connection c;
+
+					c._weight = weightDist(generator);
+					c._index = hio;
+
+					p._feedBackConnections.push_back(c);
+				}
+			}
+
+		p._feedBackConnections.shrink_to_fit();
+	}
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_predictionGeneration++;
+
+	initState(_state);
+
+	resetStats();
+}
+
+void PredictiveHierarchy::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, int numThreads) {
+	_layerDescs = layerDescs;
+
+	_layers.assign(_layerDescs.size(), nullptr);
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	// Four streams per layer: sparse coder seed, biases, feed back, predictive
+	for (int l = 0; l < _layerDescs.size(); l++) {
+		const LayerDesc &desc = _layerDescs[l];
+
+		std::shared_ptr<Layer> layer = std::make_shared<Layer>();
+
+		_layers[l] = layer;
+
+		layer->_sdr.createRandom(widthPrev, heightPrev, desc._width, desc._height, desc._receptiveRadius, desc._recurrentRadius, desc._lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, CounterRNG(seed, l * 4).bits(0), numThreads);
+
+		layer->_predictionNodes.resize(desc._width * desc._height);
+
+		CounterRNG biasRNG(seed, l * 4 + 1);
+		CounterRNG feedBackRNG(seed, l * 4 + 2);
+		CounterRNG predictiveRNG(seed, l * 4 + 3);
+
+		bool hasNext = l < _layers.size() - 1;
+
+		int nextWidth = hasNext ? _layerDescs[l + 1]._width : 0;
+		int nextHeight = hasNext ? _layerDescs[l + 1]._height : 0;
+
+		float hiddenToNextHiddenWidth = hasNext ? static_cast<float>(nextWidth) / static_cast<float>(desc._width) : 1.0f;
+		float hiddenToNextHiddenHeight = hasNext ? static_cast<float>(nextHeight) / static_cast<float>(desc._height) : 1.0f;
+
+		parallelFor(layer->_predictionNodes.size(), numThreads, [&](int begin, int end) {
+			for (int pi = begin; pi < end; pi++) {
+				PredictionNode &p = layer->_predictionNodes[pi];
+
+				p._bias._weight = biasRNG.uniform(pi, initMinWeight, initMaxWeight);
+
+				int hx = pi % desc._width;
+				int hy = pi / desc._width;
+
+				// Feed Back
+				if (hasNext) {
+					int centerX = std::round(hx * hiddenToNextHiddenWidth);
+					int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+					int ci = 0;
+
+					p._feedBackConnections.resize(clippedSpan(centerX, desc._feedBackRadius, nextWidth) * clippedSpan(centerY, desc._feedBackRadius, nextHeight));
+
+					for (int hox = std::max(0, centerX - desc._feedBackRadius); hox <= std::min(nextWidth - 1, centerX + desc._feedBackRadius); hox++)
+						for (int hoy = std::max(0, centerY - desc._feedBackRadius); hoy <= std::min(nextHeight - 1, centerY + desc._feedBackRadius); hoy++) {
+							p._feedBackConnections[ci]._index = hox + hoy * nextWidth;
+							p._feedBackConnections[ci]._weight = feedBackRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+							ci++;
+						}
+				}
+
+				// Predictive
+				int ci = 0;
+
+				p._predictiveConnections.resize(clippedSpan(hx, desc._predictiveRadius, desc._width) * clippedSpan(hy, desc._predictiveRadius, desc._height));
+
+				for (int hox = std::max(0, hx - desc._predictiveRadius); hox <= std::min(desc._width - 1, hx + desc._predictiveRadius); hox++)
+					for (int hoy = std::max(0, hy - desc._predictiveRadius); hoy <= std::min(desc._height - 1, hy + desc._predictiveRadius); hoy++) {
+						p._predictiveConnections[ci]._index = hox + hoy * desc._width;
+						p._predictiveConnections[ci]._weight = predictiveRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+						ci++;
+					}
+			}
+		});
+
+		widthPrev = desc._width;
+		heightPrev = desc._height;
+	}
+
+	_inputPredictionNodes.clear();
+	_inputPredictionNodes.resize(inputWidth * inputHeight);
+
+	int firstWidth = _layerDescs.front()._width;
+	int firstHeight = _layerDescs.front()._height;
+
+	float inputToNextHiddenWidth = static_cast<float>(firstWidth) / static_cast<float>(inputWidth);
+	float inputToNextHiddenHeight = static_cast<float>(firstHeight) / static_cast<float>(inputHeight);
+
+	CounterRNG biasRNG(seed, _layers.size() * 4);
+	CounterRNG feedBackRNG(seed, _layers.size() * 4 + 1);
+
+	parallelFor(_inputPredictionNodes.size(), numThreads, [&](int begin, int end) {
+		for (int pi = begin; pi < end; pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			p._bias._weight = biasRNG.uniform(pi, initMinWeight, initMaxWeight);
+
+			int centerX = std::round((pi % inputWidth) * inputToNextHiddenWidth);
+			int centerY = std::round((pi / inputWidth) * inputToNextHiddenHeight);
+
+			int ci = 0;
+
+			p._feedBackConnections.resize(clippedSpan(centerX, inputFeedBackRadius, firstWidth) * clippedSpan(centerY, inputFeedBackRadius, firstHeight));
+
+			for (int hox = std::max(0, centerX - inputFeedBackRadius); hox <= std::min(firstWidth - 1, centerX + inputFeedBackRadius); hox++)
+				for (int hoy = std::max(0, centerY - inputFeedBackRadius); hoy <= std::min(firstHeight - 1, centerY + inputFeedBackRadius); hoy++) {
+					p._feedBackConnections[ci]._index = hox + hoy * firstWidth;
+					p._feedBackConnections[ci]._weight = feedBackRNG.uniform(CounterRNG::counter(pi, ci), initMinWeight, initMaxWeight);
+
+					ci++;
+				}
+		}
+	});
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_predictionGeneration++;
+
+	initState(_state);
+
+	resetStats();
+}
+
+bool PredictiveHierarchy::createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator,
+	size_t memoryBudget, Footprint* footprint)
+{
+	Footprint required = computeFootprint(inputWidth, inputHeight, inputFeedBackRadius, layerDescs);
+
+	if (footprint != nullptr)
+		*footprint = required;
+
+	if (required.getTotal() > memoryBudget)
+		return false;
+
+	createRandom(inputWidth, inputHeight, inputFeedBackRadius, layerDescs, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, generator);
+
+	return true;
+}
+
+Footprint PredictiveHierarchy::computeFootprint(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, int updateInterval, std::vector<Footprint>* layerFootprints) {
+	int numLayers = layerDescs.size();
+
+	Footprint total;
+
+	total._structure = numLayers * (sizeof(LayerDesc) + sizeof(Layer) + sizeof(RunningStat));
+	total._state = numLayers * (sizeof(SparseCoder::State) + 2 * sizeof(std::vector<float>));
+
+	if (layerFootprints != nullptr)
+		layerFootprints->assign(numLayers, Footprint());
+
+	int widthPrev = inputWidth;
+	int heightPrev = inputHeight;
+
+	for (int l = 0; l < numLayers; l++) {
+		const LayerDesc &desc = layerDescs[l];
+
+		int numHidden = desc._width * desc._height;
+
+		Footprint layer = SparseCoder::computeFootprint(widthPrev, heightPrev, desc._width, desc._height, desc._receptiveRadius, desc._recurrentRadius, desc._lateralRadius, updateInterval);
+
+		layer += SparseCoder::computeStateFootprint(widthPrev * heightPrev, numHidden, desc._sdrIter);
+
+		// Prediction nodes, centers as in createRandom
+		float hiddenToNextHiddenWidth = 1.0f;
+		float hiddenToNextHiddenHeight = 1.0f;
+
+		if (l < numLayers - 1) {
+			hiddenToNextHiddenWidth = static_cast<float>(layerDescs[l + 1]._width) / static_cast<float>(desc._width);
+			hiddenToNextHiddenHeight = static_cast<float>(layerDescs[l + 1]._height) / static_cast<float>(desc._height);
+		}
+
+		size_t numConnections = 0;
+
+		for (int pi = 0; pi < numHidden; pi++) {
+			int hx = pi % desc._width;
+			int hy = pi / desc._width;
+
+			if (l < numLayers - 1) {
+				int centerX = std::round(hx * hiddenToNextHiddenWidth);
+				int centerY = std::round(hy * hiddenToNextHiddenHeight);
+
+				numConnections += clippedSpan(centerX, desc._feedBackRadius, layerDescs[l + 1]._width) * clippedSpan(centerY, desc._feedBackRadius, layerDescs[l + 1]._height);
+			}
+
+			numConnections += clippedSpan(hx, desc._predictiveRadius, desc._width) * clippedSpan(hy, desc._predictiveRadius, desc._height);
+		}
+
+		layer._weights += numConnections * sizeof(Connection);
+
+		if (updateInterval > 1)
+			layer._deltas += numConnections * sizeof(float);
+
+		layer._structure += numHidden * sizeof(PredictionNode);
+
+		// Prediction states and their previous values
+		layer._state += 2 * numHidden * sizeof(float);
+
+		if (layerFootprints != nullptr)
+			(*layerFootprints)[l] = layer;
+
+		total += layer;
+
+		widthPrev = desc._width;
+		heightPrev = desc._height;
+	}
+
+	// Input prediction
+	int numInputs = inputWidth * inputHeight;
+
+	if (numLayers > 0) {
+		float inputToNextHiddenWidth = static_cast<float>(layerDescs.front()._width) / static_cast<float>(inputWidth);
+		float inputToNextHiddenHeight = static_cast<float>(layerDescs.front()._height) / static_cast<float>(inputHeight);
+
+		size_t numConnections = 0;
+
+		for (int pi = 0; pi < numInputs; pi++) {
+			int centerX = std::round((pi % inputWidth) * inputToNextHiddenWidth);
+			int centerY = std::round((pi / inputWidth) * inputToNextHiddenHeight);
+
+			numConnections += clippedSpan(centerX, inputFeedBackRadius, layerDescs.front()._width) * clippedSpan(centerY, inputFeedBackRadius, layerDescs.front()._height);
+		}
+
+		total._weights += numConnections * sizeof(Connection);
+
+		if (updateInterval > 1)
+			total._deltas += numConnections * sizeof(float);
+	}
+
+	total._structure += numInputs * sizeof(InputPredictionNode);
+	total._state += 2 * numInputs * sizeof(float);
+
+	return total;
+}
+
+Footprint PredictiveHierarchy::getFootprint(std::vector<Footprint>* layerFootprints) const {
+	Footprint total = getStateFootprint(_state);
+
+	total._structure += vectorBytes(_layerDescs) + vectorBytes(_layers) + _layers.size() * sizeof(Layer) + vectorBytes(_predictionErrors);
+
+	if (layerFootprints != nullptr)
+		layerFootprints->assign(_layers.size(), Footprint());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		Footprint layer = _layers[l]->_sdr.getFootprint();
+
+		for (int pi = 0; pi < _layers[l]->_predictionNodes.size(); pi++) {
+			const PredictionNode &p = _layers[l]->_predictionNodes[pi];
+
+			layer._weights += vectorBytes(p._feedBackConnections) + vectorBytes(p._predictiveConnections);
+			layer._deltas += vectorBytes(p._feedBackDeltas) + vectorBytes(p._predictiveDeltas);
+		}
+
+		layer._structure += vectorBytes(_layers[l]->_predictionNodes);
+
+		total += layer;
+
+		if (layerFootprints != nullptr) {
+			// Attribute the layer's part of the state to it
+			if (l < _state._sdrStates.size()) {
+				layer += SparseCoder::getStateFootprint(_state._sdrStates[l]);
+
+				layer._state += vectorBytes(_state._predictionStates[l]) + vectorBytes(_state._predictionStatesPrev[l]);
+			}
+
+			(*layerFootprints)[l] = layer;
+		}
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		total._weights += vectorBytes(_inputPredictionNodes[pi]._feedBackConnections);
+		total._deltas += vectorBytes(_inputPredictionNodes[pi]._feedBackDeltas);
+	}
+
+	total._structure += vectorBytes(_inputPredictionNodes);
+
+	return total;
+}
+
+Footprint PredictiveHierarchy::getStateFootprint(const State &state) {
+	Footprint footprint;
+
+	footprint._state = vectorBytes(state._sdrStates) + vectorBytes(state._predictionStates) + vectorBytes(state._predictionStatesPrev)
+		+ vectorBytes(state._inputPredictionStates) + vectorBytes(state._inputPredictionStatesPrev);
+
+	for (int l = 0; l < state._sdrStates.size(); l++) {
+		footprint += SparseCoder::getStateFootprint(state._sdrStates[l]);
+
+		footprint._state += vectorBytes(state._predictionStates[l]) + vectorBytes(state._predictionStatesPrev[l]);
+	}
+
+	return footprint;
+}
+
+void PredictiveHierarchy::save(std::ostream &os) const {
+	TraceScope scope("save");
+
+	const char magic[4] = { 'N', 'E', 'O', 'H' };
+	int version = 2;
+	int numLayers = _layers.size();
+
+	os.write(magic, sizeof(magic));
+	os.write(reinterpret_cast<const char*>(&version), sizeof(int));
+	os.write(reinterpret_cast<const char*>(&numLayers), sizeof(int));
+	os.write(reinterpret_cast<const char*>(_layerDescs.data()), numLayers * sizeof(LayerDesc));
+	os.write(reinterpret_cast<const char*>(&_learnInputFeedBack), sizeof(float));
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]->_sdr.save(os);
+
+		for (int pi = 0; pi < _layers[l]->_predictionNodes.size(); pi++) {
+			const PredictionNode &p = _layers[l]->_predictionNodes[pi];
+
+			os.write(reinterpret_cast<const char*>(&p._bias._weight), sizeof(float));
+			os.write(reinterpret_cast<const char*>(&p._baseline), sizeof(float));
+
+			const std::vector<Connection> *connections[2] = { &p._feedBackConnections, &p._predictiveConnections };
+
+			for (int i = 0; i < 2; i++) {
+				int numConnections = connections[i]->size();
+
+				os.write(reinterpret_cast<const char*>(&numConnections), sizeof(int));
+
+				for (int ci = 0; ci < numConnections; ci++) {
+					os.write(reinterpret_cast<const char*>(&(*connections[i])[ci]._index), sizeof(unsigned short));
+					os.write(reinterpret_cast<const char*>(&(*connections[i])[ci]._weight), sizeof(float));
+				}
+			}
+		}
+	}
+
+	int numInputs = _inputPredictionNodes.size();
+
+	os.write(reinterpret_cast<const char*>(&numInputs), sizeof(int));
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		const InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		int numConnections = p._feedBackConnections.size();
+
+		os.write(reinterpret_cast<const char*>(&p._bias._weight), sizeof(float));
+		os.write(reinterpret_cast<const char*>(&numConnections), sizeof(int));
+
+		for (int ci = 0; ci < numConnections; ci++) {
+			os.write(reinterpret_cast<const char*>(&p._feedBackConnections[ci]._index), sizeof(unsigned short));
+			os.write(reinterpret_cast<const char*>(&p._feedBackConnections[ci]._weight), sizeof(float));
+		}
+	}
+}
+
+bool PredictiveHierarchy::load(std::istream &is) {
+	char magic[4];
+	int version, numLayers;
+
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&version), sizeof(int));
+	is.read(reinterpret_cast<char*>(&numLayers), sizeof(int));
+
+	if (!is || magic[0] != 'N' || magic[1] != 'E' || magic[2] != 'O' || magic[3] != 'H' || version != 2 || numLayers < 1)
+		return false;
+
+	// One at a time, so a bad count runs out of stream before it allocates much
+	_layerDescs.clear();
+
+	for (int l = 0; l < numLayers; l++) {
+		LayerDesc desc;
+
+		is.read(reinterpret_cast<char*>(&desc), sizeof(LayerDesc));
+
+		if (!is)
+			return false;
+
+		_layerDescs.push_back(desc);
+	}
+
+	is.read(reinterpret_cast<char*>(&_learnInputFeedBack), sizeof(float));
+
+	_layers.assign(numLayers, nullptr);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		const LayerDesc &desc = _layerDescs[l];
+
+		std::shared_ptr<Layer> layer = std::make_shared<Layer>();
+
+		_layers[l] = layer;
+
+		if (!layer->_sdr.load(is))
+			return false;
+
+		// The coder has to be the one the description and the layer below call for
+		const SparseCoder &sdr = layer->_sdr;
+
+		if (sdr.getHiddenWidth() != desc._width || sdr.getHiddenHeight() != desc._height
+			|| sdr.getReceptiveRadius() != desc._receptiveRadius || sdr.getRecurrentRadius() != desc._recurrentRadius || sdr.getLateralRadius() != desc._lateralRadius
+			|| (l > 0 && (sdr.getVisibleWidth() != _layerDescs[l - 1]._width || sdr.getVisibleHeight() != _layerDescs[l - 1]._height)))
+			return false;
+
+		if (desc._feedBackRadius < 0 || desc._predictiveRadius < 0)
+			return false;
+
+		// Feed back connections address the next layer's predictions, predictive connections this layer's states
+		int gridSizes[2] = { l < numLayers - 1 ? _layerDescs[l + 1]._width * _layerDescs[l + 1]._height : 0, sdr.getNumHidden() };
+		int radii[2] = { desc._feedBackRadius, desc._predictiveRadius };
+
+		layer->_predictionNodes.resize(layer->_sdr.getNumHidden());
+
+		for (int pi = 0; pi < layer->_predictionNodes.size(); pi++) {
+			PredictionNode &p = layer->_predictionNodes[pi];
+
+			is.read(reinterpret_cast<char*>(&p._bias._weight), sizeof(float));
+			is.read(reinterpret_cast<char*>(&p._baseline), sizeof(float));
+
+			std::vector<Connection> *connections[2] = { &p._feedBackConnections, &p._predictiveConnections };
+
+			for (int i = 0; i < 2; i++) {
+				int numConnections = 0;
+
+				is.read(reinterpret_cast<char*>(&numConnections), sizeof(int));
+
+				if (!is || numConnections < 0 || numConnections > std::min<long long>(gridSizes[i], (2LL * radii[i] + 1) * (2LL * radii[i] + 1)))
+					return false;
+
+				connections[i]->resize(numConnections);
+
+				for (int ci = 0; ci < numConnections; ci++) {
+					is.read(reinterpret_cast<char*>(&(*connections[i])[ci]._index), sizeof(unsigned short));
+					is.read(reinterpret_cast<char*>(&(*connections[i])[ci]._weight), sizeof(float));
+
+					if ((*connections[i])[ci]._index >= gridSizes[i])
+						return false;
+				}
+			}
+		}
+	}
+
+	int numInputs = 0;
+
+	is.read(reinterpret_cast<char*>(&numInputs), sizeof(int));
+
+	if (!is || numInputs != _layers.front()->_sdr.getNumVisible())
+		return false;
+
+	_inputPredictionNodes.clear();
+	_inputPredictionNodes.resize(numInputs);
+
+	// The input feed back radius is not stored, so only the first layer bounds these
+	int numFirst = _layers.front()->_sdr.getNumHidden();
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		int numConnections = 0;
+
+		is.read(reinterpret_cast<char*>(&p._bias._weight), sizeof(float));
+		is.read(reinterpret_cast<char*>(&numConnections), sizeof(int));
+
+		if (!is || numConnections < 0 || numConnections > numFirst)
+			return false;
+
+		p._feedBackConnections.resize(numConnections);
+
+		for (int ci = 0; ci < numConnections; ci++) {
+			is.read(reinterpret_cast<char*>(&p._feedBackConnections[ci]._index), sizeof(unsigned short));
+			is.read(reinterpret_cast<char*>(&p._feedBackConnections[ci]._weight), sizeof(float));
+
+			if (p._feedBackConnections[ci]._index >= numFirst)
+				return false;
+		}
+	}
+
+	if (!is)
+		return false;
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_predictionGeneration++;
+
+	initState(_state);
+
+	resetStats();
+
+	return true;
+}
+
+void PredictiveHierarchy::initState(State &state) const {
+	state._sdrStates.resize(_layers.size());
+	state._predictionStates.resize(_layers.size());
+	state._predictionStatesPrev.resize(_layers.size());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]->_sdr.initState(state._sdrStates[l]);
+
+		state._predictionStates[l].assign(_layers[l]->_predictionNodes.size(), 0.0f);
+		state._predictionStatesPrev[l].assign(_layers[l]->_predictionNodes.size(), 0.0f);
+	}
+
+	state._inputPredictionStates.assign(_inputPredictionNodes.size(), 0.0f);
+	state._inputPredictionStatesPrev.assign(_inputPredictionNodes.size(), 0.0f);
+}
+
+void PredictiveHierarchy::simStep(State &state, std::mt19937 &generator, bool learn) {
+	activateLayers(state, generator);
+
+	// Learning only reads the previous predictions, so it can run ahead of this step's predictions
+	if (learn)
+		this->learn(state);
+
+	predictLayers(state);
+
+	stepEnd(state);
+}
+
+void PredictiveHierarchy::simStepGenerate(State &state, std::mt19937 &generator, float noise) const {
+	activateLayersNoise(state, generator, noise);
+
+	predictLayers(state);
+
+	stepEnd(state);
+}
+
+void PredictiveHierarchy::infer(State &state, std::mt19937 &generator) const {
+	activateLayers(state, generator);
+
+	predictLayers(state);
+}
+
+void PredictiveHierarchy::simStepBatch(const std::vector<State*> &states, std::mt19937 &generator) const {
+	if (_profiler != nullptr)
+		_profiler->beginStep();
+
+	// Feature extraction
+	for (int l = 0; l < _layers.size(); l++) {
+		ProfileScope scope(_profiler, StepProfiler::_features, l);
+
+		for (int s = 0; s < states.size(); s++) {
+			State &state = *states[s];
+
+			_layers[l]->_sdr.activate(state._sdrStates[l], _layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, generator);
+
+			if (l < _layers.size() - 1)
+				state._sdrStates[l + 1]._visibleInputs = state._sdrStates[l]._hiddenStates;
+		}
+	}
+
+	for (int s = 0; s < states.size(); s++) {
+		predictLayers(*states[s]);
+
+		stepEnd(*states[s]);
+	}
+}
+
+void PredictiveHierarchy::activateLayers(State &state, std::mt19937 &generator) const {
+	if (_profiler != nullptr)
+		_profiler->beginStep();
+
+	// Feature extraction
+	for (int l = 0; l < _layers.size(); l++) {
+		ProfileScope scope(_profiler, StepProfiler::_features, l);
+
+		_layers[l]->_sdr.activate(state._sdrStates[l], _layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, generator);
+
+		// Set inputs for next layer if there is one
+		if (l < _layers.size() - 1)
+			state._sdrStates[l + 1]._visibleInputs = state._sdrStates[l]._hiddenStates;
+	}
+}
+
+void PredictiveHierarchy::activateLayersNoise(State &state, std::mt19937 &generator, float noise) const {
+	if (_profiler != nullptr)
+		_profiler->beginStep();
+
+	// Feature extraction
+	for (int l = 0; l < _layers.size(); l++) {
+		ProfileScope scope(_profiler, StepProfiler::_features, l);
+
+		_layers[l]->_sdr.activateNoise(state._sdrStates[l], _layerDescs[l]._sdrIter, _layerDescs[l]._sdrLeak, noise, generator);
+
+		// Set inputs for next layer if there is one
+		if (l < _layers.size() - 1)
+			state._sdrStates[l + 1]._visibleInputs = state._sdrStates[l]._hiddenStates;
+	}
+}
+
+void PredictiveHierarchy::predictLayers(State &state) const {
+	// Prediction
+	for (int l = _layers.size() - 1; l >= 0; l--) {
+		ProfileScope scope(_profiler, StepProfiler::_prediction, l);
+
+		const std::vector<float> &hiddenStates = state._sdrStates[l]._hiddenStates;
+
+		for (int pi = 0; pi < _layers[l]->_predictionNodes.size(); pi++) {
+			const PredictionNode &p = _layers[l]->_predictionNodes[pi];
+
+			float activation = 0.0f;
+
+			// Feed Back
+			if (l < _layers.size() - 1) {
+				const std::vector<float> &nextStates = state._predictionStates[l + 1];
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+					activation += p._feedBackConnections[ci]._weight * nextStates[p._feedBackConnections[ci]._index];
+			}
+
+			// Predictive
+			for (int ci = 0; ci < p._predictiveConnections.size(); ci++)
+				activation += p._predictiveConnections[ci]._weight * hiddenStates[p._predictiveConnections[ci]._index];
+
+			state._predictionStates[l][pi] = std::min(1.0f, std::max(0.0f, activation));
+		}
+	}
+
+	// Get first layer prediction
+	ProfileScope scope(_profiler, StepProfiler::_inputPrediction, -1);
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		const InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		float activation = 0.0f;
+
+		// Feed Back
+		for (int ci = 0; ci < p._feedBackConnections.size(); ci++)
+			activation += p._feedBackConnections[ci]._weight * state._predictionStates.front()[p._feedBackConnections[ci]._index];
+
+		state._inputPredictionStates[pi] = activation;
+	}
+}
+
+void PredictiveHierarchy::learn(State &state) {
+	bool defer = _updateInterval > 1;
+
+	// Prediction
+	for (int l = _layers.size() - 1; l >= 0; l--) {
+		ProfileScope scope(_profiler, StepProfiler::_learnPrediction, l);
+
+		const std::vector<float> &hiddenStates = state._sdrStates[l]._hiddenStates;
+		const std::vector<float> &hiddenStatesPrev = state._sdrStates[l]._hiddenStatesPrev;
+
+		double errorSum = 0.0;
+
+		Layer &layer = writeLayer(l);
+
+		for (int pi = 0; pi < layer._predictionNodes.size(); pi++) {
+			PredictionNode &p = layer._predictionNodes[pi];
+
+			float predictionError = hiddenStates[pi] - state._predictionStatesPrev[l][pi];
+
+			errorSum += predictionError * predictionError;
+
+			if (l < _layers.size() - 1) {
+				const std::vector<float> &nextStatesPrev = state._predictionStatesPrev[l + 1];
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+					float delta = _layerDescs[l]._learnFeedBack * predictionError * nextStatesPrev[p._feedBackConnections[ci]._index];
+
+					if (defer)
+						p._feedBackDeltas[ci] += delta;
+					else
+						p._feedBackConnections[ci]._weight += delta;
+				}
+			}
+
+			// Predictive
+			for (int ci = 0; ci < p._predictiveConnections.size(); ci++) {
+				float delta = _layerDescs[l]._learnPrediction * predictionError * hiddenStatesPrev[p._predictiveConnections[ci]._index];
+
+				if (defer)
+					p._predictiveDeltas[ci] += delta;
+				else
+					p._predictiveConnections[ci]._weight += delta;
+			}
+		}
+
+		_predictionErrors[l].add(errorSum / std::max<int>(1, layer._predictionNodes.size()));
+	}
+
+	// First layer prediction
+	{
+		ProfileScope scope(_profiler, StepProfiler::_learnInputPrediction, -1);
+
+		double errorSum = 0.0;
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			float predictionError = state._sdrStates.front()._visibleInputs[pi] - state._inputPredictionStatesPrev[pi];
+
+			errorSum += predictionError * predictionError;
+
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+				float delta = _learnInputFeedBack * predictionError * state._predictionStatesPrev.front()[p._feedBackConnections[ci]._index];
+
+				if (defer)
+					p._feedBackDeltas[ci] += delta;
+				else
+					p._feedBackConnections[ci]._weight += delta;
+			}
+		}
+
+		_inputPredictionError.add(errorSum / std::max<int>(1, _inputPredictionNodes.size()));
+	}
+
+	// Features
+	for (int l = 0; l < _layers.size(); l++) {
+		Layer &layer = writeLayer(l);
+
+		std::vector<float> rewards(layer._predictionNodes.size());
+
+		{
+			ProfileScope scope(_profiler, StepProfiler::_rewards, l);
+
+			for (int pi = 0; pi < layer._predictionNodes.size(); pi++) {
+				PredictionNode &p = layer._predictionNodes[pi];
+
+				float predictionError = state._sdrStates[l]._hiddenStates[pi] - state._predictionStatesPrev[l][pi];
+
+				float error2 = predictionError * predictionError;
+
+				rewards[pi] = sigmoid(_layerDescs[l]._sdrSensitivity * (error2 - p._baseline));
+
+				p._baseline = (1.0f - _layerDescs[l]._sdrBaselineDecay) * p._baseline + _layerDescs[l]._sdrBaselineDecay * error2;
+			}
+		}
+
+		ProfileScope scope(_profiler, StepProfiler::_learnFeatures, l);
+
+		layer._sdr.learn(state._sdrStates[l], rewards, _layerDescs[l]._sdrLambda, _layerDescs[l]._learnFeedForward, _layerDescs[l]._learnRecurrent, _layerDescs[l]._learnLateral, _layerDescs[l]._sdrLearnThreshold, _layerDescs[l]._sdrSparsity, _layerDescs[l]._sdrWeightDecay, _layerDescs[l]._sdrMaxWeightDelta);
+	}
+
+	// Sparse coders flush themselves at the same interval
+	if (!defer)
+		_predictionGeneration++;
+	else if (++_updatesPending >= _updateInterval)
+		applyPredictionUpdates();
+}
+
+void PredictiveHierarchy::stepEnd(State &state) const {
+	for (int l = 0; l < _layers.size(); l++) {
+		ProfileScope scope(_profiler, StepProfiler::_stepEnd, l);
+
+		_layers[l]->_sdr.stepEnd(state._sdrStates[l]);
+
+		state._predictionStatesPrev[l] = state._predictionStates[l];
+	}
+
+	state._inputPredictionStatesPrev = state._inputPredictionStates;
+}
+
+void PredictiveHierarchy::writeState(const State &state, std::ostream &os) const {
+	TraceScope scope("writeState");
+
+	const char magic[4] = { 'N', 'E', 'O', 'S' };
+	int version = 1;
+	int dims[3] = { static_cast<int>(_layers.size()), _layers.front()->_sdr.getVisibleWidth(), _layers.front()->_sdr.getVisibleHeight() };
+
+	os.write(magic, sizeof(magic));
+	os.write(reinterpret_cast<const char*>(&version), sizeof(int));
+	os.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]->_sdr.writeState(state._sdrStates[l], os);
+
+		os.write(reinterpret_cast<const char*>(state._predictionStatesPrev[l].data()), state._predictionStatesPrev[l].size() * sizeof(float));
+	}
+
+	os.write(reinterpret_cast<const char*>(state._inputPredictionStatesPrev.data()), state._inputPredictionStatesPrev.size() * sizeof(float));
+}
+
+bool PredictiveHierarchy::readState(State &state, std::istream &is) const {
+	char magic[4];
+	int version;
+	int dims[3];
+
+	is.read(magic, sizeof(magic));
+	is.read(reinterpret_cast<char*>(&version), sizeof(int));
+	is.read(reinterpret_cast<char*>(dims), sizeof(dims));
+
+	if (!is || magic[0] != 'N' || magic[1] != 'E' || magic[2] != 'O' || magic[3] != 'S' || version != 1
+		|| dims[0] != static_cast<int>(_layers.size()) || dims[1] != _layers.front()->_sdr.getVisibleWidth() || dims[2] != _layers.front()->_sdr.getVisibleHeight())
+		return false;
+
+	// state is only replaced once everything has been read
+	State read;
+
+	initState(read);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		if (!_layers[l]->_sdr.readState(read._sdrStates[l], is))
+			return false;
+
+		is.read(reinterpret_cast<char*>(read._predictionStatesPrev[l].data()), read._predictionStatesPrev[l].size() * sizeof(float));
+
+		// Between steps the current predictions equal the previous ones
+		read._predictionStates[l] = read._predictionStatesPrev[l];
+	}
+
+	is.read(reinterpret_cast<char*>(read._inputPredictionStatesPrev.data()), read._inputPredictionStatesPrev.size() * sizeof(float));
+
+	if (!is)
+		return false;
+
+	read._inputPredictionStates = read._inputPredictionStatesPrev;
+
+	std::swap(state, read);
+
+	return true;
+}
+
+void PredictiveHierarchy::setUpdateInterval(int interval) {
+	interval = std::max(1, interval);
+
+	if (_updatesPending > 0)
+		applyUpdates();
+
+	_updateInterval = interval;
+
+	for (int l = 0; l < _layers.size(); l++) {
+		Layer &layer = writeLayer(l);
+
+		layer._sdr.setUpdateInterval(interval);
+
+		for (int pi = 0; pi < layer._predictionNodes.size(); pi++) {
+			PredictionNode &p = layer._predictionNodes[pi];
+
+			if (_updateInterval > 1) {
+				p._feedBackDeltas.assign(p._feedBackConnections.size(), 0.0f);
+				p._predictiveDeltas.assign(p._predictiveConnections.size(), 0.0f);
+			}
+			else {
+				std::vector<float>().swap(p._feedBackDeltas);
+				std::vector<float>().swap(p._predictiveDeltas);
+			}
+		}
+	}
+
+	for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+		InputPredictionNode &p = _inputPredictionNodes[pi];
+
+		if (_updateInterval > 1)
+			p._feedBackDeltas.assign(p._feedBackConnections.size(), 0.0f);
+		else
+			std::vector<float>().swap(p._feedBackDeltas);
+	}
+}
+
+void PredictiveHierarchy::applyUpdates() {
+	for (int l = 0; l < _layers.size(); l++)
+		writeLayer(l)._sdr.applyUpdates();
+
+	applyPredictionUpdates();
+}
+
+void PredictiveHierarchy::applyPredictionUpdates() {
+	if (_updateInterval > 1 && _updatesPending > 0) {
+		for (int l = 0; l < _layers.size(); l++) {
+			Layer &layer = writeLayer(l);
+
+			for (int pi = 0; pi < layer._predictionNodes.size(); pi++) {
+				PredictionNode &p = layer._predictionNodes[pi];
+
+				for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+					p._feedBackConnections[ci]._weight += p._feedBackDeltas[ci];
+					p._feedBackDeltas[ci] = 0.0f;
+				}
+
+				for (int ci = 0; ci < p._predictiveConnections.size(); ci++) {
+					p._predictiveConnections[ci]._weight += p._predictiveDeltas[ci];
+					p._predictiveDeltas[ci] = 0.0f;
+				}
+			}
+		}
+
+		for (int pi = 0; pi < _inputPredictionNodes.size(); pi++) {
+			InputPredictionNode &p = _inputPredictionNodes[pi];
+
+			for (int ci = 0; ci < p._feedBackConnections.size(); ci++) {
+				p._feedBackConnections[ci]._weight += p._feedBackDeltas[ci];
+				p._feedBackDeltas[ci] = 0.0f;
+			}
+		}
+
+		_predictionGeneration++;
+	}
+
+	_updatesPending = 0;
+}
+
+PredictiveHierarchy::Stats PredictiveHierarchy::getStats(const State &state) const {
+	Stats stats;
+
+	stats._layers.resize(_layers.size());
+
+	for (int l = 0; l < _layers.size(); l++) {
+		LayerStats &layerStats = stats._layers[l];
+
+		const SettleStats &settle = state._sdrStates[l]._settleStats;
+		const SparseCoder::LearnStats &learn = _layers[l]->_sdr.getLearnStats();
+
+		layerStats._sparsity = settle.getSparsity();
+		layerStats._targetSparsity = _layerDescs[l]._sdrSparsity;
+
+		layerStats._spikesPerIteration.resize(settle._spikesPerIteration.size());
+
+		for (int it = 0; it < layerStats._spikesPerIteration.size(); it++)
+			layerStats._spikesPerIteration[it] = settle.getSpikes(it);
+
+		layerStats._meanThreshold = learn._meanThreshold;
+		layerStats._predictionError = _predictionErrors[l];
+		layerStats._rewards = learn._rewards;
+		layerStats._rewardHistogram = learn._rewardHistogram;
+		layerStats._activations = settle._activations;
+		layerStats._learnCalls = learn._learnCalls;
+	}
+
+	stats._inputPredictionError = _inputPredictionError;
+
+	return stats;
+}
+
+void PredictiveHierarchy::resetStats() {
+	for (int l = 0; l < _layers.size(); l++)
+		writeLayer(l)._sdr.resetLearnStats();
+
+	_predictionErrors.assign(_layers.size(), RunningStat());
+	_inputPredictionError.reset();
+}
+
+void PredictiveHierarchy::resetStats(State &state) {
+	for (int l = 0; l < state._sdrStates.size(); l++)
+		state._sdrStates[l]._settleStats.reset();
+}
+
+PredictiveHierarchy::Layer &PredictiveHierarchy::writeLayer(int l) {
+	// Copies still reading the shared layer keep it as it is
+	if (_layers[l].use_count() > 1)
+		_layers[l] = std::make_shared<Layer>(*_layers[l]);
+
+	return const_cast<Layer &>(*_layers[l]);
+}
+
+void PredictiveHierarchy::swapTraces(State &a, State &b) {
+	for (int l = 0; l < std::min(a._sdrStates.size(), b._sdrStates.size()); l++) {
+		a._sdrStates[l]._feedForwardTraces.swap(b._sdrStates[l]._feedForwardTraces);
+		a._sdrStates[l]._recurrentTraces.swap(b._sdrStates[l]._recurrentTraces);
+	}
+}
+
+void PredictiveHierarchy::copyWeights(const PredictiveHierarchy &source) {
+	_layerDescs = source._layerDescs;
+	_learnInputFeedBack = source._learnInputFeedBack;
+
+	// Whichever of the two writes a shared layer next copies it first
+	_layers = source._layers;
+
+	if (_predictionGeneration != source._predictionGeneration) {
+		_inputPredictionNodes = source._inputPredictionNodes;
+
+		_predictionGeneration = source._predictionGeneration;
+	}
 }
\ No newline at end of file
@@ -1,136 +1,339 @@
-#pragma once
-
-#include "SparseCoder.h"
-
-namespace neo {
-	class PredictiveHierarchy {
-	public:
-		struct Connection {
-			unsigned short _index;
-
-			float _weight;
-		};
-
-		struct LayerDesc {
-			int _width, _height;
-
-			int _receptiveRadius, _recurrentRadius, _lateralRadius, _predictiveRadius, _feedBackRadius;
-
-			float _learnFeedForward, _learnRecurrent, _learnLateral;
-
-			float _learnFeedBack, _learnPrediction;
-
-			int _sdrIter;
-			float _sdrLeak;
-			float _sdrLambda;
-			float _sdrHiddenDecay;
-			float _sdrWeightDecay;
-			float _sdrMaxWeightDelta;
-			float _sdrSparsity;
-			float _sdrLearnThreshold;
-			float _sdrBaselineDecay;
-			float _sdrSensitivity;
-
-			LayerDesc()
-				: _width(16), _height(16),
-				_receptiveRadius(4), _recurrentRadius(4), _lateralRadius(4), _predictiveRadius(4), _feedBackRadius(4),
-				_learnFeedForward(0.01f), _learnRecurrent(0.01f), _learnLateral(0.05f),
-				_learnFeedBack(0.1f), _learnPrediction(0.03f),
-				_sdrIter(30),
-				_sdrLeak(0.1f), _sdrLambda(0.95f), _sdrHiddenDecay(0.01f), _sdrWeightDecay(0.0f), _sdrMaxWeightDelta(0.5f),
-				_sdrSparsity(0.08f), _sdrLearnThreshold(0.01f),
-				_sdrBaselineDecay(0.01f),
-				_sdrSensitivity(6.0f)
-			{}
-		};
-
-		struct PredictionNode {
-			std::vector<Connection> _feedBackConnections;
-			std::vector<Connection> _predictiveConnections;
-
-			Connection _bias;
-
-			float _state;
-			float _statePrev;
-
-			float _activation;
-			float _activationPrev;
-
-			float _baseline;
-
-			PredictionNode()
-				: _state(0.0f), _statePrev(0.0f), _activation(0.0f), _activationPrev(0.0f), _baseline(0.0f)
-			{}
-		};
-
-		struct InputPredictionNode {
-			std::vector<Connection> _feedBackConnections;
-
-			Connection _bias;
-
-			float _state;
-			float _statePrev;
-
-			float _activation;
-			float _activationPrev;
-
-			InputPredictionNode()
-				: _state(0.0f), _statePrev(0.0f), _activation(0.0f), _activationPrev(0.0f)
-			{}
-		};
-
-		struct Layer {
-			SparseCoder _sdr;
-
-			std::vector<PredictionNode> _predictionNodes;
-		};
-
-		static float sigmoid(float x) {
-			return 1.0f / (1.0f + std::exp(-x));
-		}
-
-	private:
-		std::vector<LayerDesc> _layerDescs;
-		std::vector<Layer> _layers;
-
-		std::vector<InputPredictionNode> _inputPredictionNodes;
-
-
-	public:
-		float _learnInputFeedBack;
-
-		PredictiveHierarchy()
-			: _learnInputFeedBack(0.1f)
-		{}
-
-		void createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
-
-		void simStep(std::mt19937 &generator, bool learn = true);
-
-		void simStepGenerate(std::mt19937 &generator, float noise);
-
-		void setInput(int index, float value) {
-			_layers.front()._sdr.setVisibleState(index, value);
-		}
-
-		void setInput(int x, int y, float value) {
-			setInput(x + y * _layerDescs.front()._width, value);
-		}
-
-		float getPrediction(int index) const {
-			return _inputPredictionNodes[index]._state;
-		}
-
-		float getPrediction(int x, int y) const {
-			return getPrediction(x + y * _layers.front()._sdr.getVisibleWidth());
-		}
-
-		const std::vector<LayerDesc> &getLayerDescs() const {
-			return _layerDescs;
-		}
-
-		const std::vector<Layer> &getLayers() const {
-			return _layers;
-		}
-	};
+#pragma once
+
+#include "SparseCoder.h"
+#include "StepProfiler.h"
+
+#include <memory>
+
+namespace neo {
+	class PredictiveHierarchy {
+	public:
+		struct Connection {
+			unsigned short _index;
+
+			float _weight;
+		};
+
+		struct LayerDesc {
+			int _width, _height;
+
+			int _receptiveRadius, _recurrentRadius, _lateralRadius, _predictiveRadius, _feedBackRadius;
+
+			float _learnFeedForward, _learnRecurrent, _learnLateral;
+
+			float _learnFeedBack, _learnPrediction;
+
+			int _sdrIter;
+			float _sdrLeak;
+			float _sdrLambda;
+			float _sdrHiddenDecay;
+			float _sdrWeightDecay;
+			float _sdrMaxWeightDelta;
+			float _sdrSparsity;
+			float _sdrLearnThreshold;
+			float _sdrBaselineDecay;
+			float _sdrSensitivity;
+
+			LayerDesc()
+				: _width(16), _height(16),
+				_receptiveRadius(4), _recurrentRadius(4), _lateralRadius(4), _predictiveRadius(4), _feedBackRadius(4),
+				_learnFeedForward(0.01f), _learnRecurrent(0.01f), _learnLateral(0.05f),
+				_learnFeedBack(0.1f), _learnPrediction(0.03f),
+				_sdrIter(30),
+				_sdrLeak(0.1f), _sdrLambda(0.95f), _sdrHiddenDecay(0.01f), _sdrWeightDecay(0.0f), _sdrMaxWeightDelta(0.5f),
+				_sdrSparsity(0.08f), _sdrLearnThreshold(0.01f),
+				_sdrBaselineDecay(0.01f),
+				_sdrSensitivity(6.0f)
+			{}
+		};
+
+		struct PredictionNode {
+			std::vector<Connection> _feedBackConnections;
+			std::vector<Connection> _predictiveConnections;
+
+			Connection _bias;
+
+			float _baseline;
+
+			// Pending updates, only allocated when updates are deferred
+			std::vector<float> _feedBackDeltas;
+			std::vector<float> _predictiveDeltas;
+
+			PredictionNode()
+				: _baseline(0.0f)
+			{}
+		};
+
+		struct InputPredictionNode {
+			std::vector<Connection> _feedBackConnections;
+
+			Connection _bias;
+
+			// Pending updates, only allocated when updates are deferred
+			std::vector<float> _feedBackDeltas;
+		};
+
+		struct Layer {
+			SparseCoder _sdr;
+
+			std::vector<PredictionNode> _predictionNodes;
+		};
+
+		// Activity of one input stream through the hierarchy, everything simStep changes apart from the weights.
+		// Serves as a session: one hierarchy can step any number of states, concurrently as long as no step learns
+		struct State {
+			std::vector<SparseCoder::State> _sdrStates;
+
+			std::vector<std::vector<float> > _predictionStates;
+			std::vector<std::vector<float> > _predictionStatesPrev;
+
+			std::vector<float> _inputPredictionStates;
+			std::vector<float> _inputPredictionStatesPrev;
+		};
+
+		// Health of one layer, see getStats
+		struct LayerStats {
+			// Fraction of hidden nodes active after settling against _sdrSparsity
+			float _sparsity;
+			float _targetSparsity;
+
+			// Mean spiking nodes per settle iteration
+			std::vector<float> _spikesPerIteration;
+
+			float _meanThreshold;
+
+			// Mean squared prediction error of a learning step
+			RunningStat _predictionError;
+
+			// Rewards handed to the sparse coder, with their histogram over [0, 1]
+			RunningStat _rewards;
+			std::vector<long> _rewardHistogram;
+
+			long _activations;
+			long _learnCalls;
+		};
+
+		struct Stats {
+			std::vector<LayerStats> _layers;
+
+			RunningStat _inputPredictionError;
+		};
+
+		static float sigmoid(float x) {
+			return 1.0f / (1.0f + std::exp(-x));
+		}
+
+	private:
+		std::vector<LayerDesc> _layerDescs;
+
+		// Copies of a hierarchy share the layers neither of them has written since, see writeLayer
+		std::vector<std::shared_ptr<const Layer> > _layers;
+
+		std::vector<InputPredictionNode> _inputPredictionNodes;
+
+		State _state;
+
+		int _updateInterval;
+		int _updatesPending;
+
+		// Incremented whenever prediction weights are written
+		unsigned long _predictionGeneration;
+
+		StepProfiler *_profiler;
+
+		// Kept up by learn, per layer
+		std::vector<RunningStat> _predictionErrors;
+		RunningStat _inputPredictionError;
+
+		void activateLayers(State &state, std::mt19937 &generator) const;
+		void activateLayersNoise(State &state, std::mt19937 &generator, float noise) const;
+		void predictLayers(State &state) const;
+
+		void applyPredictionUpdates();
+
+		// Layer l for writing, copied first if it is shared with a copy of this hierarchy
+		Layer &writeLayer(int l);
+
+	public:
+		float _learnInputFeedBack;
+
+		PredictiveHierarchy()
+			: _updateInterval(1), _updatesPending(0), _predictionGeneration(0), _profiler(nullptr), _learnInputFeedBack(0.1f)
+		{}
+
+		void createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
+
+		// Same structure, weights drawn from a counter based generator and filled on numThreads threads (0 = all).
+		// The weights depend only on seed, not on the thread count, but differ from the std::mt19937 version
+		void createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, int numThreads = 0);
+
+		// Same as createRandom, but only if the model fits in memoryBudget bytes (see computeFootprint). Otherwise returns false
+		// before allocating anything and leaves this hierarchy as it was. footprint, if given, receives the computed footprint either way
+		bool createRandom(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator,
+			size_t memoryBudget, Footprint* footprint = nullptr);
+
+		// Heap bytes createRandom would allocate, including the built in state, once stepped. _state is also what every extra session costs.
+		// updateInterval adds the pending updates of setUpdateInterval. layerFootprints, if given, receives each layer's share
+		// (its sparse coder, prediction nodes and state), the rest of the total is the input prediction nodes and bookkeeping
+		static Footprint computeFootprint(int inputWidth, int inputHeight, int inputFeedBackRadius, const std::vector<LayerDesc> &layerDescs, int updateInterval = 1, std::vector<Footprint>* layerFootprints = nullptr);
+
+		// Measured from the allocations, same breakdown as computeFootprint
+		Footprint getFootprint(std::vector<Footprint>* layerFootprints = nullptr) const;
+
+		static Footprint getStateFootprint(const State &state);
+
+		// Structure, weights and learning parameters. Pending deferred updates are not included, apply them first
+		void save(std::ostream &os) const;
+
+		// Replace this hierarchy with one stored by save. Returns false if the stream does not hold a hierarchy,
+		// or one whose sizes, radii and connection indices do not fit together
+		bool load(std::istream &is);
+
+		// Size and clear a state for this hierarchy
+		void initState(State &state) const;
+
+		void simStep(std::mt19937 &generator, bool learn = true) {
+			simStep(_state, generator, learn);
+		}
+
+		// Without learning this only reads the hierarchy and may run from many threads, each on its own state
+		void simStep(State &state, std::mt19937 &generator, bool learn = true);
+
+		void simStepGenerate(std::mt19937 &generator, float noise) {
+			simStepGenerate(_state, generator, noise);
+		}
+
+		void simStepGenerate(State &state, std::mt19937 &generator, float noise) const;
+
+		// Feature extraction and prediction only, leaves the weights untouched. Follow with learn (optional) and stepEnd
+		void infer(State &state, std::mt19937 &generator) const;
+
+		// Infer and stepEnd for a batch of independent states. Runs layer by layer over the whole batch,
+		// so each layer's weights are brought into cache once per batch rather than once per state
+		void simStepBatch(const std::vector<State*> &states, std::mt19937 &generator) const;
+
+		// Learning half of a step, from a state that went through infer but not yet stepEnd. Can run on a copy of that state.
+		// Updates the sparse coders' eligibility traces in state, see swapTraces
+		void learn(State &state);
+
+		void stepEnd(State &state) const;
+
+		// Store a state compactly, only what carries over between steps. For evicting idle sessions
+		void writeState(const State &state, std::ostream &os) const;
+
+		// Restore a state stored by writeState of a hierarchy with the same structure. Returns false on a mismatch or a read error,
+		// leaving state as it was
+		bool readState(State &state, std::istream &is) const;
+
+		// Accumulate weight updates of all layers and only write them every interval learning steps (1 = write immediately)
+		void setUpdateInterval(int interval);
+
+		// Write all pending updates to the weights
+		void applyUpdates();
+
+		int getUpdateInterval() const {
+			return _updateInterval;
+		}
+
+		// Time every step phase into profiler (not owned), nullptr to stop. Copies of this hierarchy share it, only the thread owning it is timed
+		void setProfiler(StepProfiler *profiler) {
+			_profiler = profiler;
+		}
+
+		StepProfiler *getProfiler() const {
+			return _profiler;
+		}
+
+		// Snapshot of the counters kept as a side effect of stepping: activity from state (since it was last reset),
+		// learning from this hierarchy (since creation or resetStats)
+		Stats getStats(const State &state) const;
+
+		Stats getStats() const {
+			return getStats(_state);
+		}
+
+		// Clear the learning counters of this hierarchy and its sparse coders
+		void resetStats();
+
+		// Clear the activity counters of a state
+		static void resetStats(State &state);
+
+		// Exchange the sparse coders' eligibility traces of two states, e.g. to carry one stream's traces over copies of its states
+		static void swapTraces(State &a, State &b);
+
+		// Bring the weights in line with source, a hierarchy with the same structure (e.g. a copy of this one).
+		// Layers are shared with source instead of copied, the input prediction nodes only copied if they changed
+		void copyWeights(const PredictiveHierarchy &source);
+
+		// Run layer l's sparse coder on these kernels (SparseCoder::setKernels), e.g. ones NeoRL-Codegen instantiated for its grid.
+		// The layer is copied first if it is shared, so copies of this hierarchy keep theirs
+		void setKernels(int l, const SparseCoder::KernelTable* kernels) {
+			writeLayer(l)._sdr.setKernels(kernels);
+		}
+
+		void setInput(int index, float value) {
+			_state._sdrStates.front()._visibleInputs[index] = value;
+		}
+
+		void setInput(int x, int y, float value) {
+			setInput(x + y * _layerDescs.front()._width, value);
+		}
+
+		float getPrediction(int index) const {
+			return _state._inputPredictionStates[index];
+		}
+
+		float getPrediction(int x, int y) const {
+			return getPrediction(x + y * _layers.front()->_sdr.getVisibleWidth());
+		}
+
+		static void setInput(State &state, int index, float value) {
+			state._sdrStates.front()._visibleInputs[index] = value;
+		}
+
+		// Hand over a whole input frame without copying: inputs (getNumVisible values of the first layer) becomes the input buffer,
+		// and receives the previous one, which nothing reads once simStep has returned. Returns false, swapping nothing, if inputs has another size
+		bool swapInputs(std::vector<float> &inputs) {
+			return swapInputs(_state, inputs);
+		}
+
+		static bool swapInputs(State &state, std::vector<float> &inputs) {
+			std::vector<float> &visibleInputs = state._sdrStates.front()._visibleInputs;
+
+			if (inputs.size() != visibleInputs.size())
+				return false;
+
+			visibleInputs.swap(inputs);
+
+			return true;
+		}
+
+		static float getPrediction(const State &state, int index) {
+			return state._inputPredictionStates[index];
+		}
+
+		State &getState() {
+			return _state;
+		}
+
+		const State &getState() const {
+			return _state;
+		}
+
+		const std::vector<LayerDesc> &getLayerDescs() const {
+			return _layerDescs;
+		}
+
+		int getNumLayers() const {
+			return _layers.size();
+		}
+
+		const Layer &getLayer(int l) const {
+			return *_layers[l];
+		}
+
+		const std::vector<InputPredictionNode> &getInputPredictionNodes() const {
+			return _inputPredictionNodes;
+		}
+	};
 }
\ No newline at end of file
@@ -1,395 +1,808 @@
-#include "SparseCoder.h"
-
-#include <algorithm>
-
-using namespace neo;
-
-void SparseCoder::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
-	std::uniform_real_distribution<float> inhibitionDist(initMinInhibition, initMaxInhibition);
-
-	_visibleWidth = visibleWidth;
-	_visibleHeight = visibleHeight;
-	_hiddenWidth = hiddenWidth;
-	_hiddenHeight = hiddenHeight;
-
-	_receptiveRadius = receptiveRadius;
-	_recurrentRadius = recurrentRadius;
-
-	int numVisible = visibleWidth * visibleHeight;
-	int numHidden = hiddenWidth * hiddenHeight;
-	int receptiveSize = std::pow(receptiveRadius * 2 + 1, 2);
-	int recurrentSize = std::pow(recurrentRadius * 2 + 1, 2);
-	int lateralSize = std::pow(lateralRadius * 2 + 1, 2);
-
-	_visible.resize(numVisible);
-
-	_hidden.resize(numHidden);
-
-	float hiddenToVisibleWidth = static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth);
-	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
-
-	for (int hi = 0; hi < numHidden; hi++) {
-		int hx = hi % hiddenWidth;
-		int hy = hi / hiddenWidth;
-
-		int centerX = std::round(hx * hiddenToVisibleWidth);
-		int centerY = std::round(hy * hiddenToVisibleHeight);
-
-		_hidden[hi]._threshold = initThreshold;
-
-		// Receptive
-		_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
-
-		for (int dx = -receptiveRadius; dx <= receptiveRadius; dx++)
-			for (int dy = -receptiveRadius; dy <= receptiveRadius; dy++) {
-				int vx = centerX + dx;
-				int vy = centerY + dy;
-
-				if (vx >= 0 && vx < visibleWidth && vy >= 0 && vy < visibleHeight) {
-					int vi = vx + vy * visibleWidth;
-
-					Connection c;
-
-					c._weight = weightDist(generator);
-					c._index = vi;
-
-					_hidden[hi]._feedForwardConnections.push_back(c);
-				}
-			}
-
-		_hidden[hi]._feedForwardConnections.shrink_to_fit();
-
-		// Recurrent
-		if (recurrentRadius != -1) {
-			_hidden[hi]._recurrentConnections.reserve(recurrentSize);
-
-			for (int dx = -recurrentRadius; dx <= recurrentRadius; dx++)
-				for (int dy = -recurrentRadius; dy <= recurrentRadius; dy++) {
-					if (dx == 0 && dy == 0)
-						continue;
-
-					int hox = hx + dx;
-					int hoy = hy + dy;
-
-					if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
-						int hio = hox + hoy * hiddenWidth;
-
-						Connection c;
-
-						c._weight = weightDist(generator);
-						c._index = hio;
-
-						_hidden[hi]._recurrentConnections.push_back(c);
-					}
-				}
-
-			_hidden[hi]._recurrentConnections.shrink_to_fit();
-		}
-
-		_hidden[hi]._lateralConnections.reserve(recurrentSize);
-
-		for (int dx = -lateralRadius; dx <= lateralRadius; dx++)
-			for (int dy = -lateralRadius; dy <= lateralRadius; dy++) {
-				if (dx == 0 && dy == 0)
-					continue;
-
-				int hox = hx + dx;
-				int hoy = hy + dy;
-
-				if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
-					int hio = hox + hoy * hiddenWidth;
-
-					Connection c;
-
-					c._weight = inhibitionDist(generator);
-					c._index = hio;
-
-					_hidden[hi]._lateralConnections.push_back(c);
-				}
-			}
-
-		_hidden[hi]._lateralConnections.shrink_to_fit();
-	}
-}
-
-void SparseCoder::activate(int iter, float leak, std::mt19937 &generator) {
-	std::vector<float> visibleErrors(_visible.size());
-	std::vector<float> hiddenErrors(_hidden.size());
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		_hidden[hi]._activation = 0.0f;
-
-		_hidden[hi]._state = 0.0f;
-	}
-
-	float settleCounter = 0.0f;
-
-	for (int it = 0; it < iter; it++) {
-		for (int vi = 0; vi < _visible.size(); vi++)
-			visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
-
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
-
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float excitation = 0.0f;
-
-			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-				excitation += visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] * _hidden[hi]._feedForwardConnections[ci]._weight;
-
-			for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-				excitation += hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index] * _hidden[hi]._recurrentConnections[ci]._weight;
-
-			float inhibition = 0.0f;
-
-			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-				inhibition += _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev * _hidden[hi]._lateralConnections[ci]._weight;
-
-			_hidden[hi]._activation = (1.0f - leak) * _hidden[hi]._activation + excitation - inhibition;
-
-			if (_hidden[hi]._activation > _hidden[hi]._threshold) {
-				_hidden[hi]._activation = 0.0f;
-				_hidden[hi]._spike = 1.0f;
-			}
-			else
-				_hidden[hi]._spike = 0.0f;
-
-			_hidden[hi]._state += _hidden[hi]._spike;
-		}
-
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
-
-		settleCounter += 1.0f;
-
-		float multiplier = 1.0f / settleCounter;
-
-		reconstructFromStates(multiplier);
-	}
-
-	// Divide
-	float multiplier = 1.0f / settleCounter;
-
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._state *= multiplier;
-}
-
-void SparseCoder::activateNoise(int iter, float leak, float noise, std::mt19937 &generator) {
-	std::normal_distribution<float> noiseDist(0.0f, 1.0f);
-
-	std::vector<float> visibleErrors(_visible.size());
-	std::vector<float> hiddenErrors(_hidden.size());
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		_hidden[hi]._activation = 0.0f;
-
-		_hidden[hi]._state = 0.0f;
-	}
-
-	float settleCounter = 0.0f;
-
-	for (int it = 0; it < iter; it++) {
-		for (int vi = 0; vi < _visible.size(); vi++)
-			visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
-
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
-
-		for (int hi = 0; hi < _hidden.size(); hi++) {
-			float excitation = noiseDist(generator) * noise;
-
-			for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-				excitation += visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] * _hidden[hi]._feedForwardConnections[ci]._weight;
-
-			for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-				excitation += hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index] * _hidden[hi]._recurrentConnections[ci]._weight;
-
-			float inhibition = 0.0f;
-
-			for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-				inhibition += _hidden[_hidden[hi]._lateralConnections[ci]._index]._spikePrev * _hidden[hi]._lateralConnections[ci]._weight;
-
-			_hidden[hi]._activation = (1.0f - leak) * _hidden[hi]._activation + excitation - inhibition;
-
-			if (_hidden[hi]._activation > _hidden[hi]._threshold) {
-				_hidden[hi]._activation = 0.0f;
-				_hidden[hi]._spike = 1.0f;
-			}
-			else
-				_hidden[hi]._spike = 0.0f;
-
-			_hidden[hi]._state += _hidden[hi]._spike;
-		}
-
-		for (int hi = 0; hi < _hidden.size(); hi++)
-			_hidden[hi]._spikePrev = _hidden[hi]._spike;
-
-		settleCounter += 1.0f;
-
-		float multiplier = 1.0f / settleCounter;
-
-		reconstructFromStates(multiplier);
-	}
-
-	// Divide
-	float multiplier = 1.0f / settleCounter;
-
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._state *= multiplier;
-}
-
-void SparseCoder::reconstructFromStates(float multiplier) {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-	std::vector<float> hiddenDivs(_hidden.size(), 0.0f);
-
-	for (int vi = 0; vi < _visible.size(); vi++)
-		_visible[vi]._reconstruction = 0.0f;
-
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._reconstruction = 0.0f;
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-			_visible[_hidden[hi]._feedForwardConnections[ci]._index]._reconstruction += _hidden[hi]._feedForwardConnections[ci]._weight * _hidden[hi]._state * multiplier;
-
-		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-			_hidden[_hidden[hi]._recurrentConnections[ci]._index]._reconstruction += _hidden[hi]._recurrentConnections[ci]._weight * _hidden[hi]._state * multiplier;
-	}
-}
-
-void SparseCoder::reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible) {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-	std::vector<float> hiddenDivs(_hidden.size(), 0.0f);
-
-	reconVisible.clear();
-	reconVisible.assign(_visible.size(), 0.0f);
-
-	reconHidden.clear();
-	reconHidden.assign(_hidden.size(), 0.0f);
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-			reconVisible[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
-
-		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
-			reconHidden[_hidden[hi]._recurrentConnections[ci]._index] += _hidden[hi]._recurrentConnections[ci]._weight * states[hi];
-	}
-}
-
-void SparseCoder::reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) {
-	std::vector<float> visibleDivs(_visible.size(), 0.0f);
-
-	recon.clear();
-	recon.assign(_visible.size(), 0.0f);
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
-			recon[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
-	}
-}
-
-void SparseCoder::learn(float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
-
-	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
-
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float learn = _hidden[hi]._state;
-
-		//if (_hidden[hi]._activation != 0.0f)
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
-			float delta = learnFeedForward * learn * visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index] - weightDecay * _hidden[hi]._feedForwardConnections[ci]._weight;
-
-			_hidden[hi]._feedForwardConnections[ci]._weight += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
-		}
-
-		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++) {
-			float delta = learnRecurrent * learn * hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index] - weightDecay * _hidden[hi]._recurrentConnections[ci]._weight;
-
-			_hidden[hi]._recurrentConnections[ci]._weight += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
-		}
-
-		for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-			_hidden[hi]._lateralConnections[ci]._weight = std::max(0.0f, _hidden[hi]._lateralConnections[ci]._weight + learnLateral * (_hidden[hi]._state * _hidden[_hidden[hi]._lateralConnections[ci]._index]._state - sparsity * sparsity));
-
-
-		_hidden[hi]._threshold = std::max(0.0f, _hidden[hi]._threshold + (_hidden[hi]._state - sparsity) * learnThreshold);
-	}
-}
-
-void SparseCoder::learn(const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
-	std::vector<float> visibleErrors(_visible.size(), 0.0f);
-	std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
-
-	for (int vi = 0; vi < _visible.size(); vi++)
-		visibleErrors[vi] = _visible[vi]._input - _visible[vi]._reconstruction;
-
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		hiddenErrors[hi] = _hidden[hi]._statePrev - _hidden[hi]._reconstruction;
-
-	for (int hi = 0; hi < _hidden.size(); hi++) {
-		float learn = _hidden[hi]._state;
-
-		//if (_hidden[hi]._activation != 0.0f)
-		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
-			float delta = learnFeedForward * rewards[hi] * _hidden[hi]._feedForwardConnections[ci]._trace - weightDecay * _hidden[hi]._feedForwardConnections[ci]._weight;
-
-			_hidden[hi]._feedForwardConnections[ci]._weight += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
-
-			_hidden[hi]._feedForwardConnections[ci]._trace = lambda * _hidden[hi]._feedForwardConnections[ci]._trace + learn * visibleErrors[_hidden[hi]._feedForwardConnections[ci]._index];
-		}
-
-		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++) {
-			float delta = learnRecurrent * rewards[hi] * _hidden[hi]._recurrentConnections[ci]._trace - weightDecay * _hidden[hi]._recurrentConnections[ci]._weight;
-
-			_hidden[hi]._recurrentConnections[ci]._weight += std::min(maxWeightDelta, std::max(-maxWeightDelta, delta));
-
-			_hidden[hi]._recurrentConnections[ci]._trace = lambda * _hidden[hi]._recurrentConnections[ci]._trace + learn * hiddenErrors[_hidden[hi]._recurrentConnections[ci]._index];
-		}
-
-		for (int ci = 0; ci < _hidden[hi]._lateralConnections.size(); ci++)
-			_hidden[hi]._lateralConnections[ci]._weight = std::max(0.0f, _hidden[hi]._lateralConnections[ci]._weight + learnLateral * (_hidden[hi]._state * _hidden[_hidden[hi]._lateralConnections[ci]._index]._state - sparsity * sparsity));
-
-		_hidden[hi]._threshold = std::max(0.0f, _hidden[hi]._threshold + (_hidden[hi]._state - sparsity) * learnThreshold);
-	}
-}
-
-void SparseCoder::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
-	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth) / static_cast<float>(_hiddenWidth);
-	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight) / static_cast<float>(_hiddenHeight);
-
-	int dim = _receptiveRadius * 2 + 1;
-
-	rectangle.resize(dim * dim, 0.0f);
-
-	int hi = hx + hy * _hiddenWidth;
-
-	int centerX = std::round(hx * hiddenToVisibleWidth);
-	int centerY = std::round(hy * hiddenToVisibleHeight);
-
-	for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
-		int index = _hidden[hi]._feedForwardConnections[ci]._index;
-
-		int vx = index % _visibleWidth;
-		int vy = index / _visibleWidth;
-
-		int dx = vx - centerX;
-		int dy = vy - centerY;
-
-		int rx = dx + _receptiveRadius;
-		int ry = dy + _receptiveRadius;
-
-		rectangle[rx + ry * dim] = _hidden[hi]._feedForwardConnections[ci]._weight;
-	}
-}
-
-void SparseCoder::stepEnd() {
-	for (int hi = 0; hi < _hidden.size(); hi++)
-		_hidden[hi]._statePrev = _hidden[hi]._state;
+#include "SparseCoder.h"
+
+#include "SparseCoderKernels.h"
+#include "CounterRNG.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+namespace {
+	// Geometry and generators of createRandom with a seed, to build any node of the layer on its own
+	struct SeededLayer {
+		int _visibleWidth, _visibleHeight;
+		int _hiddenWidth, _hiddenHeight;
+		int _receptiveRadius, _recurrentRadius, _lateralRadius;
+		float _initMinWeight, _initMaxWeight;
+		float _initMinInhibition, _initMaxInhibition;
+		float _initThreshold;
+
+		float _hiddenToVisibleWidth, _hiddenToVisibleHeight;
+
+		CounterRNG _feedForwardRNG;
+		CounterRNG _recurrentRNG;
+		CounterRNG _lateralRNG;
+
+		SeededLayer(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed)
+			: _visibleWidth(visibleWidth), _visibleHeight(visibleHeight), _hiddenWidth(hiddenWidth), _hiddenHeight(hiddenHeight),
+			_receptiveRadius(receptiveRadius), _recurrentRadius(recurrentRadius), _lateralRadius(lateralRadius),
+			_initMinWeight(initMinWeight), _initMaxWeight(initMaxWeight), _initMinInhibition(initMinInhibition), _initMaxInhibition(initMaxInhibition), _initThreshold(initThreshold),
+			_hiddenToVisibleWidth(static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth)),
+			_hiddenToVisibleHeight(static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight)),
+			_feedForwardRNG(seed, 0), _recurrentRNG(seed, 1), _lateralRNG(seed, 2)
+		{}
+
+		// Node hi with indices into the whole layer
+		void initNode(SparseCoder::HiddenNode &h, int hi) const {
+			typedef SparseCoder::Connection Connection;
+
+			int hx = hi % _hiddenWidth;
+			int hy = hi / _hiddenWidth;
+
+			int centerX = std::round(hx * _hiddenToVisibleWidth);
+			int centerY = std::round(hy * _hiddenToVisibleHeight);
+
+			h._threshold = _initThreshold;
+
+			// Clip the stencils up front so every array is allocated once at its final size, same order as the serial version
+			int ci = 0;
+
+			h._feedForwardConnections.resize(clippedSpan(centerX, _receptiveRadius, _visibleWidth) * clippedSpan(centerY, _receptiveRadius, _visibleHeight));
+
+			for (int vx = std::max(0, centerX - _receptiveRadius); vx <= std::min(_visibleWidth - 1, centerX + _receptiveRadius); vx++)
+				for (int vy = std::max(0, centerY - _receptiveRadius); vy <= std::min(_visibleHeight - 1, centerY + _receptiveRadius); vy++) {
+					Connection &c = h._feedForwardConnections[ci];
+
+					c._index = vx + vy * _visibleWidth;
+					c._weight = _feedForwardRNG.uniform(CounterRNG::counter(hi, ci), _initMinWeight, _initMaxWeight);
+
+					ci++;
+				}
+
+			if (_recurrentRadius != -1) {
+				ci = 0;
+
+				h._recurrentConnections.resize(clippedSpan(hx, _recurrentRadius, _hiddenWidth) * clippedSpan(hy, _recurrentRadius, _hiddenHeight) - 1);
+
+				for (int hox = std::max(0, hx - _recurrentRadius); hox <= std::min(_hiddenWidth - 1, hx + _recurrentRadius); hox++)
+					for (int hoy = std::max(0, hy - _recurrentRadius); hoy <= std::min(_hiddenHeight - 1, hy + _recurrentRadius); hoy++) {
+						if (hox == hx && hoy == hy)
+							continue;
+
+						Connection &c = h._recurrentConnections[ci];
+
+						c._index = hox + hoy * _hiddenWidth;
+						c._weight = _recurrentRNG.uniform(CounterRNG::counter(hi, ci), _initMinWeight, _initMaxWeight);
+
+						ci++;
+					}
+			}
+
+			ci = 0;
+
+			h._lateralConnections.resize(clippedSpan(hx, _lateralRadius, _hiddenWidth) * clippedSpan(hy, _lateralRadius, _hiddenHeight) - 1);
+
+			for (int hox = std::max(0, hx - _lateralRadius); hox <= std::min(_hiddenWidth - 1, hx + _lateralRadius); hox++)
+				for (int hoy = std::max(0, hy - _lateralRadius); hoy <= std::min(_hiddenHeight - 1, hy + _lateralRadius); hoy++) {
+					if (hox == hx && hoy == hy)
+						continue;
+
+					Connection &c = h._lateralConnections[ci];
+
+					c._index = hox + hoy * _hiddenWidth;
+					c._weight = _lateralRNG.uniform(CounterRNG::counter(hi, ci), _initMinInhibition, _initMaxInhibition);
+
+					ci++;
+				}
+		}
+	};
+}
+
+void SparseCoder::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> weightDist(initMinWeight, initMaxWeight);
+	std::uniform_real_distribution<float> inhibitionDist(initMinInhibition, initMaxInhibition);
+
+	_visibleWidth = visibleWidth;
+	_visibleHeight = visibleHeight;
+	_hiddenWidth = hiddenWidth;
+	_hiddenHeight = hiddenHeight;
+
+	_receptiveRadius = receptiveRadius;
+	_recurrentRadius = recurrentRadius;
+	_lateralRadius = lateralRadius;
+
+	int numVisible = visibleWidth * visibleHeight;
+	int numHidden = hiddenWidth * hiddenHeight;
+	int receptiveSize = std::pow(receptiveRadius * 2 + 1, 2);
+	int recurrentSize = std::pow(recurrentRadius * 2 + 1, 2);
+	int lateralSize = std::pow(lateralRadius * 2 + 1, 2);
+
+	_hidden.clear();
+	_hidden.resize(numHidden);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_generation++;
+
+	_learnStats = LearnStats();
+
+	float hiddenToVisibleWidth = static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth);
+	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
+
+	for (int hi = 0; hi < numHidden; hi++) {
+		int hx = hi % hiddenWidth;
+		int hy = hi / hiddenWidth;
+
+		int centerX = std::round(hx * hiddenToVisibleWidth);
+		int centerY = std::round(hy * hiddenToVisibleHeight);
+
+		_hidden[hi]._threshold = initThreshold;
+
+		// Receptive
+		_hidden[hi]._feedForwardConnections.reserve(receptiveSize);
+
+		for (int dx = -receptiveRadius; dx <= receptiveRadius; dx++)
+			for (int dy = -receptiveRadius; dy <= receptiveRadius; dy++) {
+				int vx = centerX + dx;
+				int vy = centerY + dy;
+
+				if (vx >= 0 && vx < visibleWidth && vy >= 0 && vy < visibleHeight) {
+					int vi = vx + vy * visibleWidth;
+
+					Connection c;
+
+					c._weight = weightDist(generator);
+					c._index = vi;
+
+					_hidden[hi]._feedForwardConnections.push_back(c);
+				}
+			}
+
+		_hidden[hi]._feedForwardConnections.shrink_to_fit();
+
+		// Recurrent
+		if (recurrentRadius != -1) {
+			_hidden[hi]._recurrentConnections.reserve(recurrentSize);
+
+			for (int dx = -recurrentRadius; dx <= recurrentRadius; dx++)
+				for (int dy = -recurrentRadius; dy <= recurrentRadius; dy++) {
+					if (dx == 0 && dy == 0)
+						continue;
+
+					int hox = hx + dx;
+					int hoy = hy + dy;
+
+					if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
+						int hio = hox + hoy * hiddenWidth;
+
+						Connection c;
+
+						c._weight = weightDist(generator);
+						c._index = hio;
+
+						_hidden[hi]._recurrentConnections.push_back(c);
+					}
+				}
+
+			_hidden[hi]._recurrentConnections.shrink_to_fit();
+		}
+
+		_hidden[hi]._lateralConnections.reserve(recurrentSize);
+
+		for (int dx = -lateralRadius; dx <= lateralRadius; dx++)
+			for (int dy = -lateralRadius; dy <= lateralRadius; dy++) {
+				if (dx == 0 && dy == 0)
+					continue;
+
+				int hox = hx + dx;
+				int hoy = hy + dy;
+
+				if (hox >= 0 && hox < hiddenWidth && hoy >= 0 && hoy < hiddenHeight) {
+					int hio = hox + hoy * hiddenWidth;
+
+					Connection c;
+
+					c._weight = inhibitionDist(generator);
+					c._index = hio;
+
+					_hidden[hi]._lateralConnections.push_back(c);
+				}
+			}
+
+		_hidden[hi]._lateralConnections.shrink_to_fit();
+	}
+
+	selectKernels();
+	layoutTraces();
+}
+
+void SparseCoder::createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, int numThreads) {
+	_visibleWidth = visibleWidth;
+	_visibleHeight = visibleHeight;
+	_hiddenWidth = hiddenWidth;
+	_hiddenHeight = hiddenHeight;
+
+	_receptiveRadius = receptiveRadius;
+	_recurrentRadius = recurrentRadius;
+	_lateralRadius = lateralRadius;
+
+	int numHidden = hiddenWidth * hiddenHeight;
+
+	_hidden.clear();
+	_hidden.resize(numHidden);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_generation++;
+
+	_learnStats = LearnStats();
+
+	SeededLayer layer(visibleWidth, visibleHeight, hiddenWidth, hiddenHeight, receptiveRadius, recurrentRadius, lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, seed);
+
+	parallelFor(numHidden, numThreads, [&](int begin, int end) {
+		for (int hi = begin; hi < end; hi++)
+			layer.initNode(_hidden[hi], hi);
+	});
+
+	selectKernels();
+	layoutTraces();
+}
+
+void SparseCoder::createRandomStrip(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, const Strip &strip, int numThreads) {
+	_visibleWidth = visibleWidth;
+	_visibleHeight = strip._visibleEnd - strip._visibleBegin;
+	_hiddenWidth = hiddenWidth;
+	_hiddenHeight = strip._hiddenEnd - strip._hiddenBegin;
+
+	_receptiveRadius = receptiveRadius;
+	_recurrentRadius = recurrentRadius;
+	_lateralRadius = lateralRadius;
+
+	_hidden.clear();
+	_hidden.resize(_hiddenWidth * _hiddenHeight);
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_generation++;
+
+	_learnStats = LearnStats();
+
+	SeededLayer layer(visibleWidth, visibleHeight, hiddenWidth, hiddenHeight, receptiveRadius, recurrentRadius, lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, seed);
+
+	int ownedBegin = (strip._ownedBegin - strip._hiddenBegin) * hiddenWidth;
+	int ownedEnd = (strip._ownedEnd - strip._hiddenBegin) * hiddenWidth;
+
+	int visibleOffset = strip._visibleBegin * visibleWidth;
+	int hiddenOffset = strip._hiddenBegin * hiddenWidth;
+
+	for (int hi = 0; hi < _hidden.size(); hi++)
+		_hidden[hi]._threshold = initThreshold;
+
+	parallelFor(ownedEnd - ownedBegin, numThreads, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			HiddenNode &h = _hidden[ownedBegin + i];
+
+			layer.initNode(h, hiddenOffset + ownedBegin + i);
+
+			// computeStrips holds every row the stencils reach
+			for (int ci = 0; ci < h._feedForwardConnections.size(); ci++)
+				h._feedForwardConnections[ci]._index -= visibleOffset;
+
+			for (int ci = 0; ci < h._recurrentConnections.size(); ci++)
+				h._recurrentConnections[ci]._index -= hiddenOffset;
+
+			for (int ci = 0; ci < h._lateralConnections.size(); ci++)
+				h._lateralConnections[ci]._index -= hiddenOffset;
+		}
+	});
+
+	selectKernels();
+	layoutTraces();
+}
+
+bool SparseCoder::computeStrips(int visibleHeight, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, int numStrips, std::vector<Strip> &strips) {
+	if (numStrips < 1 || numStrips > hiddenHeight)
+		return false;
+
+	// Same centers as createRandom
+	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
+
+	// Rows of spikes and states read by lateral inhibition and recurrent errors
+	int halo = std::max(lateralRadius, recurrentRadius);
+
+	strips.resize(numStrips);
+
+	for (int i = 0; i < numStrips; i++) {
+		Strip &strip = strips[i];
+
+		strip._ownedBegin = i * hiddenHeight / numStrips;
+		strip._ownedEnd = (i + 1) * hiddenHeight / numStrips;
+
+		strip._hiddenBegin = std::max(0, strip._ownedBegin - halo);
+		strip._hiddenEnd = std::min(hiddenHeight, strip._ownedEnd + halo);
+
+		int firstCenter = std::round(strip._ownedBegin * hiddenToVisibleHeight);
+		int lastCenter = std::round((strip._ownedEnd - 1) * hiddenToVisibleHeight);
+
+		strip._visibleBegin = std::max(0, firstCenter - receptiveRadius);
+		strip._visibleEnd = std::min(visibleHeight, lastCenter + receptiveRadius + 1);
+	}
+
+	// Halos and reconstructions only add up if no row is shared by more than two neighbouring strips
+	for (int i = 0; i + 2 < numStrips; i++)
+		if (strips[i]._hiddenEnd > strips[i + 2]._hiddenBegin || strips[i]._visibleEnd > strips[i + 2]._visibleBegin)
+			return false;
+
+	return true;
+}
+
+Footprint SparseCoder::computeFootprint(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, int updateInterval) {
+	Footprint footprint;
+
+	int numHidden = hiddenWidth * hiddenHeight;
+
+	footprint._structure = numHidden * sizeof(HiddenNode) + LearnStats()._rewardHistogram.size() * sizeof(long);
+
+	// Same centers as createRandom
+	float hiddenToVisibleWidth = static_cast<float>(visibleWidth) / static_cast<float>(hiddenWidth);
+	float hiddenToVisibleHeight = static_cast<float>(visibleHeight) / static_cast<float>(hiddenHeight);
+
+	size_t numConnections = 0;
+	size_t numTraces = 0;
+
+	for (int hi = 0; hi < numHidden; hi++) {
+		int hx = hi % hiddenWidth;
+		int hy = hi / hiddenWidth;
+
+		int centerX = std::round(hx * hiddenToVisibleWidth);
+		int centerY = std::round(hy * hiddenToVisibleHeight);
+
+		numTraces += clippedSpan(centerX, receptiveRadius, visibleWidth) * clippedSpan(centerY, receptiveRadius, visibleHeight);
+
+		// Without the node itself
+		if (recurrentRadius != -1)
+			numTraces += clippedSpan(hx, recurrentRadius, hiddenWidth) * clippedSpan(hy, recurrentRadius, hiddenHeight) - 1;
+
+		numConnections += clippedSpan(hx, lateralRadius, hiddenWidth) * clippedSpan(hy, lateralRadius, hiddenHeight) - 1;
+	}
+
+	// Lateral connections have no traces
+	numConnections += numTraces;
+
+	footprint._structure += 2 * (numHidden + 1) * sizeof(int);
+	footprint._weights = numConnections * sizeof(Connection);
+
+	// Held by the state that learns with rewards
+	footprint._traces = numTraces * sizeof(float);
+
+	if (updateInterval > 1)
+		footprint._deltas = numConnections * sizeof(float);
+
+	return footprint;
+}
+
+Footprint SparseCoder::computeStateFootprint(int numVisible, int numHidden, int iter) {
+	Footprint footprint;
+
+	footprint._state = (2 * numVisible + 6 * numHidden) * sizeof(float) + iter * sizeof(double);
+
+	return footprint;
+}
+
+Footprint SparseCoder::getFootprint() const {
+	Footprint footprint;
+
+	footprint._structure = vectorBytes(_hidden) + vectorBytes(_learnStats._rewardHistogram) + vectorBytes(_feedForwardTraceOffsets) + vectorBytes(_recurrentTraceOffsets);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		const HiddenNode &h = _hidden[hi];
+
+		footprint._weights += vectorBytes(h._feedForwardConnections) + vectorBytes(h._recurrentConnections) + vectorBytes(h._lateralConnections);
+		footprint._deltas += vectorBytes(h._feedForwardDeltas) + vectorBytes(h._recurrentDeltas) + vectorBytes(h._lateralDeltas);
+	}
+
+	return footprint;
+}
+
+Footprint SparseCoder::getStateFootprint(const State &state) {
+	Footprint footprint;
+
+	footprint._state = vectorBytes(state._visibleInputs) + vectorBytes(state._visibleRecons)
+		+ vectorBytes(state._hiddenActivations) + vectorBytes(state._hiddenSpikes) + vectorBytes(state._hiddenSpikesPrev)
+		+ vectorBytes(state._hiddenStates) + vectorBytes(state._hiddenStatesPrev) + vectorBytes(state._hiddenRecons)
+		+ vectorBytes(state._settleStats._spikesPerIteration);
+
+	footprint._traces = vectorBytes(state._feedForwardTraces) + vectorBytes(state._recurrentTraces);
+
+	return footprint;
+}
+
+void SparseCoder::save(std::ostream &os) const {
+	int dims[7] = { _visibleWidth, _visibleHeight, _hiddenWidth, _hiddenHeight, _receptiveRadius, _recurrentRadius, _lateralRadius };
+
+	os.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		const HiddenNode &h = _hidden[hi];
+
+		os.write(reinterpret_cast<const char*>(&h._threshold), sizeof(float));
+
+		const std::vector<Connection> *connections[3] = { &h._feedForwardConnections, &h._recurrentConnections, &h._lateralConnections };
+
+		for (int i = 0; i < 3; i++) {
+			int numConnections = connections[i]->size();
+
+			os.write(reinterpret_cast<const char*>(&numConnections), sizeof(int));
+
+			for (int ci = 0; ci < numConnections; ci++) {
+				const Connection &c = (*connections[i])[ci];
+
+				os.write(reinterpret_cast<const char*>(&c._index), sizeof(unsigned short));
+				os.write(reinterpret_cast<const char*>(&c._weight), sizeof(float));
+			}
+		}
+	}
+}
+
+bool SparseCoder::load(std::istream &is) {
+	int dims[7];
+
+	is.read(reinterpret_cast<char*>(dims), sizeof(dims));
+
+	if (!is)
+		return false;
+
+	// Connection indices are unsigned shorts, so neither grid can have more cells than they address
+	for (int i = 0; i < 4; i += 2)
+		if (dims[i] < 1 || dims[i + 1] < 1 || dims[i] > 65536 / dims[i + 1])
+			return false;
+
+	if (dims[4] < 0 || dims[5] < -1 || dims[6] < 0 || dims[4] > 65536 || dims[5] > 65536 || dims[6] > 65536)
+		return false;
+
+	_visibleWidth = dims[0];
+	_visibleHeight = dims[1];
+	_hiddenWidth = dims[2];
+	_hiddenHeight = dims[3];
+	_receptiveRadius = dims[4];
+	_recurrentRadius = dims[5];
+	_lateralRadius = dims[6];
+
+	_hidden.clear();
+	_hidden.resize(_hiddenWidth * _hiddenHeight);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		HiddenNode &h = _hidden[hi];
+
+		is.read(reinterpret_cast<char*>(&h._threshold), sizeof(float));
+
+		std::vector<Connection> *connections[3] = { &h._feedForwardConnections, &h._recurrentConnections, &h._lateralConnections };
+
+		for (int i = 0; i < 3; i++) {
+			int numConnections = 0;
+
+			is.read(reinterpret_cast<char*>(&numConnections), sizeof(int));
+
+			if (!is)
+				return false;
+
+			// At most a full stencil inside the grid, without the node itself for the hidden ones
+			int radius = i == 0 ? _receptiveRadius : (i == 1 ? _recurrentRadius : _lateralRadius);
+			int gridSize = i == 0 ? getNumVisible() : getNumHidden();
+			int maxConnections = radius == -1 ? 0 : static_cast<int>(std::min<long long>(gridSize, (2LL * radius + 1) * (2LL * radius + 1)) - (i == 0 ? 0 : 1));
+
+			if (numConnections < 0 || numConnections > maxConnections)
+				return false;
+
+			connections[i]->resize(numConnections);
+
+			for (int ci = 0; ci < numConnections; ci++) {
+				Connection &c = (*connections[i])[ci];
+
+				is.read(reinterpret_cast<char*>(&c._index), sizeof(unsigned short));
+				is.read(reinterpret_cast<char*>(&c._weight), sizeof(float));
+
+				if (c._index >= gridSize)
+					return false;
+			}
+		}
+	}
+
+	// Both depend on the connections
+	selectKernels();
+	layoutTraces();
+
+	_updateInterval = 1;
+	_updatesPending = 0;
+	_generation++;
+
+	_learnStats = LearnStats();
+
+	return static_cast<bool>(is);
+}
+
+void SparseCoder::initState(State &state) const {
+	int numVisible = _visibleWidth * _visibleHeight;
+	int numHidden = _hidden.size();
+
+	state._visibleInputs.assign(numVisible, 0.0f);
+	state._visibleRecons.assign(numVisible, 0.0f);
+
+	state._hiddenActivations.assign(numHidden, 0.0f);
+	state._hiddenSpikes.assign(numHidden, 0.0f);
+	state._hiddenSpikesPrev.assign(numHidden, 0.0f);
+	state._hiddenStates.assign(numHidden, 0.0f);
+	state._hiddenStatesPrev.assign(numHidden, 0.0f);
+	state._hiddenRecons.assign(numHidden, 0.0f);
+
+	state._feedForwardTraces.clear();
+	state._recurrentTraces.clear();
+
+	state._settleStats.reset();
+}
+
+void SparseCoder::activate(State &state, int iter, float leak, std::mt19937 &generator) const {
+	activate(state, iter, leak, generator, std::function<void(State &)>());
+}
+
+void SparseCoder::activate(State &state, int iter, float leak, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const {
+	if (_kernels != nullptr)
+		(this->*_kernels->_activate)(state, iter, leak, 0.0f, generator, exchange);
+	else
+		settleKernel<false, StoredStencils>(state, iter, leak, 0.0f, generator, exchange);
+}
+
+void SparseCoder::activateNoise(State &state, int iter, float leak, float noise, std::mt19937 &generator) const {
+	if (_kernels != nullptr)
+		(this->*_kernels->_activateNoise)(state, iter, leak, noise, generator, std::function<void(State &)>());
+	else
+		settleKernel<true, StoredStencils>(state, iter, leak, noise, generator, std::function<void(State &)>());
+}
+
+void SparseCoder::reconstructFromStates(State &state, float multiplier) const {
+	if (_kernels != nullptr)
+		(this->*_kernels->_reconstructFromStates)(state, multiplier);
+	else
+		reconstructKernel<StoredStencils>(state, multiplier);
+}
+
+void SparseCoder::reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible) const {
+	reconVisible.clear();
+	reconVisible.assign(getNumVisible(), 0.0f);
+
+	reconHidden.clear();
+	reconHidden.assign(_hidden.size(), 0.0f);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
+			reconVisible[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
+
+		for (int ci = 0; ci < _hidden[hi]._recurrentConnections.size(); ci++)
+			reconHidden[_hidden[hi]._recurrentConnections[ci]._index] += _hidden[hi]._recurrentConnections[ci]._weight * states[hi];
+	}
+}
+
+void SparseCoder::reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) const {
+	recon.clear();
+	recon.assign(getNumVisible(), 0.0f);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++)
+			recon[_hidden[hi]._feedForwardConnections[ci]._index] += _hidden[hi]._feedForwardConnections[ci]._weight * states[hi];
+	}
+}
+
+void SparseCoder::learn(const State &state, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
+	if (_kernels != nullptr)
+		(this->*_kernels->_learn)(state, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity, weightDecay, maxWeightDelta);
+	else
+		learnKernel<StoredStencils>(state, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity, weightDecay, maxWeightDelta);
+}
+
+void SparseCoder::learn(State &state, const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
+	if (_kernels != nullptr)
+		(this->*_kernels->_learnRewards)(state, rewards, lambda, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity, weightDecay, maxWeightDelta);
+	else
+		learnRewardsKernel<StoredStencils>(state, rewards, lambda, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity, weightDecay, maxWeightDelta);
+}
+
+void SparseCoder::setFixedKernels(bool enabled) {
+	_fixedKernels = enabled;
+
+	selectKernels();
+}
+
+const SparseCoder::KernelTable* SparseCoder::findFixedKernels(int receptiveRadius, int recurrentRadius, int lateralRadius) {
+	static const int radii[] = { 4, 8, 12, 16 };
+
+	static const KernelTable fixed[] = {
+		kernelsFor<FixedStencils<4, 4, 4> >(),
+		kernelsFor<FixedStencils<8, 8, 8> >(),
+		kernelsFor<FixedStencils<12, 12, 12> >(),
+		kernelsFor<FixedStencils<16, 16, 16> >()
+	};
+
+	if (recurrentRadius != receptiveRadius || lateralRadius != receptiveRadius)
+		return nullptr;
+
+	for (int i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+		if (radii[i] == receptiveRadius)
+			return &fixed[i];
+
+	return nullptr;
+}
+
+void SparseCoder::selectKernels() {
+	_kernels = nullptr;
+
+	if (_fixedKernels)
+		_kernels = findFixedKernels(_receptiveRadius, _recurrentRadius, _lateralRadius);
+}
+
+void SparseCoder::layoutTraces() {
+	_feedForwardTraceOffsets.assign(_hidden.size() + 1, 0);
+	_recurrentTraceOffsets.assign(_hidden.size() + 1, 0);
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		_feedForwardTraceOffsets[hi + 1] = _feedForwardTraceOffsets[hi] + _hidden[hi]._feedForwardConnections.size();
+		_recurrentTraceOffsets[hi + 1] = _recurrentTraceOffsets[hi] + _hidden[hi]._recurrentConnections.size();
+	}
+}
+
+void SparseCoder::setUpdateInterval(int interval) {
+	interval = std::max(1, interval);
+
+	// Flush what was accumulated under the old interval
+	if (_updatesPending > 0)
+		applyUpdates();
+
+	_updateInterval = interval;
+
+	for (int hi = 0; hi < _hidden.size(); hi++) {
+		HiddenNode &h = _hidden[hi];
+
+		if (_updateInterval > 1) {
+			h._feedForwardDeltas.assign(h._feedForwardConnections.size(), 0.0f);
+			h._recurrentDeltas.assign(h._recurrentConnections.size(), 0.0f);
+			h._lateralDeltas.assign(h._lateralConnections.size(), 0.0f);
+		}
+		else {
+			std::vector<float>().swap(h._feedForwardDeltas);
+			std::vector<float>().swap(h._recurrentDeltas);
+			std::vector<float>().swap(h._lateralDeltas);
+		}
+
+		h._thresholdDelta = 0.0f;
+	}
+}
+
+void SparseCoder::applyUpdates() {
+	if (_updateInterval > 1 && _updatesPending > 0) {
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			HiddenNode &h = _hidden[hi];
+
+			for (int ci = 0; ci < h._feedForwardConnections.size(); ci++) {
+				h._feedForwardConnections[ci]._weight += h._feedForwardDeltas[ci];
+				h._feedForwardDeltas[ci] = 0.0f;
+			}
+
+			for (int ci = 0; ci < h._recurrentConnections.size(); ci++) {
+				h._recurrentConnections[ci]._weight += h._recurrentDeltas[ci];
+				h._recurrentDeltas[ci] = 0.0f;
+			}
+
+			for (int ci = 0; ci < h._lateralConnections.size(); ci++) {
+				h._lateralConnections[ci]._weight = std::max(0.0f, h._lateralConnections[ci]._weight + h._lateralDeltas[ci]);
+				h._lateralDeltas[ci] = 0.0f;
+			}
+
+			h._threshold = std::max(0.0f, h._threshold + h._thresholdDelta);
+			h._thresholdDelta = 0.0f;
+		}
+
+		_generation++;
+	}
+
+	_updatesPending = 0;
+}
+
+void SparseCoder::getVHWeights(int hx, int hy, std::vector<float> &rectangle) const {
+	float hiddenToVisibleWidth = static_cast<float>(_visibleWidth) / static_cast<float>(_hiddenWidth);
+	float hiddenToVisibleHeight = static_cast<float>(_visibleHeight) / static_cast<float>(_hiddenHeight);
+
+	int dim = _receptiveRadius * 2 + 1;
+
+	rectangle.resize(dim * dim, 0.0f);
+
+	int hi = hx + hy * _hiddenWidth;
+
+	int centerX = std::round(hx * hiddenToVisibleWidth);
+	int centerY = std::round(hy * hiddenToVisibleHeight);
+
+	for (int ci = 0; ci < _hidden[hi]._feedForwardConnections.size(); ci++) {
+		int index = _hidden[hi]._feedForwardConnections[ci]._index;
+
+		int vx = index % _visibleWidth;
+		int vy = index / _visibleWidth;
+
+		int dx = vx - centerX;
+		int dy = vy - centerY;
+
+		int rx = dx + _receptiveRadius;
+		int ry = dy + _receptiveRadius;
+
+		rectangle[rx + ry * dim] = _hidden[hi]._feedForwardConnections[ci]._weight;
+	}
+}
+
+void SparseCoder::stepEnd(State &state) const {
+	state._hiddenStatesPrev = state._hiddenStates;
+}
+
+void SparseCoder::writeState(const State &state, std::ostream &os) const {
+	int numVisible = state._visibleInputs.size();
+	int numHidden = state._hiddenStatesPrev.size();
+
+	os.write(reinterpret_cast<const char*>(&numVisible), sizeof(int));
+	os.write(reinterpret_cast<const char*>(&numHidden), sizeof(int));
+
+	os.write(reinterpret_cast<const char*>(state._visibleInputs.data()), numVisible * sizeof(float));
+	os.write(reinterpret_cast<const char*>(state._visibleRecons.data()), numVisible * sizeof(float));
+
+	os.write(reinterpret_cast<const char*>(state._hiddenSpikesPrev.data()), numHidden * sizeof(float));
+	os.write(reinterpret_cast<const char*>(state._hiddenStatesPrev.data()), numHidden * sizeof(float));
+	os.write(reinterpret_cast<const char*>(state._hiddenRecons.data()), numHidden * sizeof(float));
+
+	// Zero when the state never learned with rewards
+	int numTraces[2] = { static_cast<int>(state._feedForwardTraces.size()), static_cast<int>(state._recurrentTraces.size()) };
+
+	os.write(reinterpret_cast<const char*>(numTraces), sizeof(numTraces));
+	os.write(reinterpret_cast<const char*>(state._feedForwardTraces.data()), numTraces[0] * sizeof(float));
+	os.write(reinterpret_cast<const char*>(state._recurrentTraces.data()), numTraces[1] * sizeof(float));
+}
+
+bool SparseCoder::readState(State &state, std::istream &is) const {
+	int numVisible, numHidden;
+
+	is.read(reinterpret_cast<char*>(&numVisible), sizeof(int));
+	is.read(reinterpret_cast<char*>(&numHidden), sizeof(int));
+
+	if (!is || numVisible != getNumVisible() || numHidden != getNumHidden())
+		return false;
+
+	// state is only replaced once everything has been read
+	State read;
+
+	initState(read);
+
+	is.read(reinterpret_cast<char*>(read._visibleInputs.data()), numVisible * sizeof(float));
+	is.read(reinterpret_cast<char*>(read._visibleRecons.data()), numVisible * sizeof(float));
+
+	is.read(reinterpret_cast<char*>(read._hiddenSpikesPrev.data()), numHidden * sizeof(float));
+	is.read(reinterpret_cast<char*>(read._hiddenStatesPrev.data()), numHidden * sizeof(float));
+	is.read(reinterpret_cast<char*>(read._hiddenRecons.data()), numHidden * sizeof(float));
+
+	int numTraces[2];
+
+	is.read(reinterpret_cast<char*>(numTraces), sizeof(numTraces));
+
+	if (!is || (numTraces[0] != 0 && numTraces[0] != _feedForwardTraceOffsets.back()) || (numTraces[1] != 0 && numTraces[1] != _recurrentTraceOffsets.back()))
+		return false;
+
+	read._feedForwardTraces.resize(numTraces[0]);
+	read._recurrentTraces.resize(numTraces[1]);
+
+	is.read(reinterpret_cast<char*>(read._feedForwardTraces.data()), numTraces[0] * sizeof(float));
+	is.read(reinterpret_cast<char*>(read._recurrentTraces.data()), numTraces[1] * sizeof(float));
+
+	if (!is)
+		return false;
+
+	// Between steps the current states equal the previous ones
+	read._hiddenStates = read._hiddenStatesPrev;
+
+	std::swap(state, read);
+
+	return true;
 }
\ No newline at end of file
@@ -1,166 +1,320 @@
-#pragma once
-
-#include <vector>
-#include <random>
-
-namespace neo {
-	class SparseCoder {
-	public:
-		struct Connection {
-			unsigned short _index;
-
-			float _weight;
-
-			float _trace;
-
-			Connection()
-				: _trace(0.0f)
-			{}
-		};
-
-		struct HiddenNode {
-			std::vector<Connection> _feedForwardConnections;
-			std::vector<Connection> _recurrentConnections;
-			std::vector<Connection> _lateralConnections;
-
-			float _activation;
-			float _spike;
-			float _spikePrev;
-			float _state;
-			float _statePrev;
-			float _input;
-
-			float _reconstruction;
-
-			float _threshold;
-
-			HiddenNode()
-				: _activation(0.0f), _spike(0.0f), _spikePrev(0.0f),
-				_state(0.0f), _statePrev(0.0f), _reconstruction(0.0f), _input(0.0f), _threshold(1.0f)
-			{}
-		};
-
-		struct VisibleNode {
-			float _input;
-			float _reconstruction;
-
-			VisibleNode()
-				: _input(0.0f), _reconstruction(0.0f)
-			{}
-		};
-
-	private:
-		int _visibleWidth, _visibleHeight;
-		int _hiddenWidth, _hiddenHeight;
-		int _receptiveRadius;
-		int _recurrentRadius;
-
-		std::vector<VisibleNode> _visible;
-		std::vector<HiddenNode> _hidden;
-
-	public:
-		static float sigmoid(float x) {
-			return 1.0f / (1.0f + std::exp(-x));
-		}
-
-		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
-
-		void activate(int iter, float leak, std::mt19937 &generator);
-		void activateNoise(int iter, float leak, float noise, std::mt19937 &generator);
-
-		void reconstructFromStates(float multiplier);
-		void reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible);
-		void reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon);
-		void learn(float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta = 0.5f);
-		void learn(const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta = 0.5f);
-		void stepEnd();
-
-		void setVisibleState(int index, float value) {
-			_visible[index]._input = value;
-		}
-
-		void setVisibleState(int x, int y, float value) {
-			_visible[x + y * _visibleWidth]._input = value;
-		}
-
-		float getVisibleRecon(int index) const {
-			return _visible[index]._reconstruction;
-		}
-
-		float getVisibleRecon(int x, int y) const {
-			return _visible[x + y * _visibleWidth]._reconstruction;
-		}
-
-		float getVisibleState(int index) const {
-			return _visible[index]._input;
-		}
-
-		float getVisibleState(int x, int y) const {
-			return _visible[x + y * _visibleWidth]._input;
-		}
-
-		float getHiddenState(int index) const {
-			return _hidden[index]._state;
-		}
-
-		float getHiddenState(int x, int y) const {
-			return _hidden[x + y * _hiddenWidth]._state;
-		}
-
-		float getHiddenStatePrev(int index) const {
-			return _hidden[index]._statePrev;
-		}
-
-		float getHiddenStatePrev(int x, int y) const {
-			return _hidden[x + y * _hiddenWidth]._statePrev;
-		}
-
-		HiddenNode &getHiddenNode(int index) {
-			return _hidden[index];
-		}
-
-		HiddenNode &getHiddenNode(int x, int y) {
-			return _hidden[x + y * _hiddenWidth];
-		}
-
-		int getNumVisible() const {
-			return _visible.size();
-		}
-
-		int getNumHidden() const {
-			return _hidden.size();
-		}
-
-		int getVisibleWidth() const {
-			return _visibleWidth;
-		}
-
-		int getVisibleHeight() const {
-			return _visibleHeight;
-		}
-
-		int getHiddenWidth() const {
-			return _hiddenWidth;
-		}
-
-		int getHiddenHeight() const {
-			return _hiddenHeight;
-		}
-
-		int getReceptiveRadius() const {
-			return _receptiveRadius;
-		}
-
-		float getVHWeight(int hi, int ci) const {
-			return _hidden[hi]._feedForwardConnections[ci]._weight;
-		}
-
-		float getVHWeight(int hx, int hy, int ci) const {
-			return _hidden[hx + hy * _hiddenWidth]._feedForwardConnections[ci]._weight;
-		}
-
-		void getVHWeights(int hx, int hy, std::vector<float> &rectangle) const;
-
-		friend class HTSL;
-	};
+#pragma once
+
+#include <vector>
+#include <random>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+
+#include "ModelStats.h"
+#include "Footprint.h"
+
+namespace neo {
+	class SparseCoder {
+	public:
+		struct Connection {
+			unsigned short _index;
+
+			float _weight;
+		};
+
+		struct HiddenNode {
+			std::vector<Connection> _feedForwardConnections;
+			std::vector<Connection> _recurrentConnections;
+			std::vector<Connection> _lateralConnections;
+
+			float _threshold;
+
+			// Pending updates, only allocated when updates are deferred
+			std::vector<float> _feedForwardDeltas;
+			std::vector<float> _recurrentDeltas;
+			std::vector<float> _lateralDeltas;
+
+			float _thresholdDelta;
+
+			HiddenNode()
+				: _threshold(1.0f), _thresholdDelta(0.0f)
+			{}
+		};
+
+		// Activity of one input stream. Kept apart from the weights so it can be copied, queued or swapped cheaply
+		struct State {
+			std::vector<float> _visibleInputs;
+			std::vector<float> _visibleRecons;
+
+			std::vector<float> _hiddenActivations;
+			std::vector<float> _hiddenSpikes;
+			std::vector<float> _hiddenSpikesPrev;
+			std::vector<float> _hiddenStates;
+			std::vector<float> _hiddenStatesPrev;
+			std::vector<float> _hiddenRecons;
+
+			// Eligibility traces of learn with rewards, one per feed forward and recurrent connection in stencil order.
+			// Sized by the first learn with rewards, so states that are only activated do not carry them
+			std::vector<float> _feedForwardTraces;
+			std::vector<float> _recurrentTraces;
+
+			// Kept up by activate
+			SettleStats _settleStats;
+		};
+
+		// Rows of one horizontal strip of a layer split across shards (see computeStrips), all [begin, end)
+		struct Strip {
+			// Hidden rows whose nodes the strip computes
+			int _ownedBegin, _ownedEnd;
+
+			// Hidden rows it holds, the owned ones plus a halo of rows owned by its neighbours
+			int _hiddenBegin, _hiddenEnd;
+
+			// Visible rows its owned nodes see
+			int _visibleBegin, _visibleEnd;
+		};
+
+		// Kept up by learn
+		struct LearnStats {
+			long _learnCalls;
+
+			// Mean hidden threshold going into the last learn call, and the sparsity it aimed for
+			float _meanThreshold;
+			float _targetSparsity;
+
+			// Rewards of learn with rewards, and their histogram over [0, 1]
+			RunningStat _rewards;
+			std::vector<long> _rewardHistogram;
+
+			LearnStats()
+				: _learnCalls(0), _meanThreshold(0.0f), _targetSparsity(0.0f), _rewardHistogram(10, 0)
+			{}
+		};
+
+		// Settle, reconstruction and learning kernels instantiated for one stencil visitor, defined in SparseCoderKernels.h
+		struct KernelTable;
+
+	private:
+		int _visibleWidth, _visibleHeight;
+		int _hiddenWidth, _hiddenHeight;
+		int _receptiveRadius;
+		int _recurrentRadius;
+		int _lateralRadius;
+
+		std::vector<HiddenNode> _hidden;
+
+		// Where each node's connections start in the traces of a State, one more entry for the total
+		std::vector<int> _feedForwardTraceOffsets;
+		std::vector<int> _recurrentTraceOffsets;
+
+		// Kernels compiled for this coder's radii, nullptr for the generic ones, see setFixedKernels and setKernels
+		const KernelTable* _kernels;
+		bool _fixedKernels;
+
+		// Number of learn calls accumulated before weights are written
+		int _updateInterval;
+		int _updatesPending;
+
+		// Incremented whenever weights are written
+		unsigned long _generation;
+
+		LearnStats _learnStats;
+
+		// Kernels of activate, activateNoise, reconstructFromStates and the two learns, one instantiation per stencil visitor (Stencils.h)
+		template<bool Noise, typename Stencils>
+		void settleKernel(State &state, int iter, float leak, float noise, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const;
+
+		template<typename Stencils>
+		void reconstructKernel(State &state, float multiplier) const;
+
+		template<typename Stencils>
+		void learnKernel(const State &state, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta);
+
+		template<typename Stencils>
+		void learnRewardsKernel(State &state, const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta);
+
+		// Fixed radius kernels for these radii, nullptr if there are none
+		static const KernelTable* findFixedKernels(int receptiveRadius, int recurrentRadius, int lateralRadius);
+
+		// Point _kernels at the fixed radius kernels when they apply
+		void selectKernels();
+
+		// Fill the trace offsets from the current stencils
+		void layoutTraces();
+
+	public:
+		SparseCoder()
+			: _hiddenWidth(0), _hiddenHeight(0), _kernels(nullptr), _fixedKernels(true), _updateInterval(1), _updatesPending(0), _generation(0)
+		{}
+
+		static float sigmoid(float x) {
+			return 1.0f / (1.0f + std::exp(-x));
+		}
+
+		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, std::mt19937 &generator);
+
+		// Same structure, weights drawn from a counter based generator and filled on numThreads threads (0 = all).
+		// The weights depend only on seed, not on the thread count, but differ from the std::mt19937 version
+		void createRandom(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, int numThreads = 0);
+
+		// One strip of the layer createRandom with seed builds: the owned nodes get the same connections and weights as there,
+		// re-based onto the strip's rows, the halo nodes only hold activity and have no connections. Only the strip is allocated
+		void createRandomStrip(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed,
+			const Strip &strip, int numThreads = 0);
+
+		// Split the hidden rows into numStrips strips of near equal height. Returns false if a strip would need rows
+		// of shards other than its direct neighbours (too many strips for the radii)
+		static bool computeStrips(int visibleHeight, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, int numStrips, std::vector<Strip> &strips);
+
+		// Heap bytes createRandom would allocate with these dimensions, and what setUpdateInterval adds for the interval
+		static Footprint computeFootprint(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, int updateInterval = 1);
+
+		// Heap bytes of a State once it has been activated with iter settle iterations
+		static Footprint computeStateFootprint(int numVisible, int numHidden, int iter);
+
+		// Measured from the allocations
+		Footprint getFootprint() const;
+
+		static Footprint getStateFootprint(const State &state);
+
+		// Weights and thresholds. Pending deferred updates are not included, apply them first
+		void save(std::ostream &os) const;
+
+		// Replace this coder with one stored by save. Returns false on a read error, or sizes or indices a coder cannot have
+		bool load(std::istream &is);
+
+		// Size and clear a state for this coder
+		void initState(State &state) const;
+
+		void activate(State &state, int iter, float leak, std::mt19937 &generator) const;
+
+		// Same, calling exchange at the end of every settle iteration, once the reconstructions are done. A strip uses it
+		// to bring in its halo's spikes and states and its neighbours' shares of the reconstructions
+		void activate(State &state, int iter, float leak, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const;
+		void activateNoise(State &state, int iter, float leak, float noise, std::mt19937 &generator) const;
+
+		void reconstructFromStates(State &state, float multiplier) const;
+		void reconstruct(const std::vector<float> &states, std::vector<float> &reconHidden, std::vector<float> &reconVisible) const;
+		void reconstructFeedForward(const std::vector<float> &states, std::vector<float> &recon) const;
+		void learn(const State &state, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta = 0.5f);
+		// Keeps its eligibility traces in state, so every input stream learns from its own history
+		void learn(State &state, const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta = 0.5f);
+		void stepEnd(State &state) const;
+
+		// Store only what carries over between steps (reconstructions, previous spikes and states, visible inputs, traces)
+		void writeState(const State &state, std::ostream &os) const;
+
+		// Restore a state stored by writeState of a coder with the same dimensions. Returns false on a mismatch or a read error, leaving state as it was
+		bool readState(State &state, std::istream &is) const;
+
+		// Run coders whose three radii are equal and one of 4, 8, 12 or 16 on kernels compiled for that radius, which compute the
+		// indices of every full stencil instead of loading them and fall back to the stored ones at the border. Only those four
+		// all-equal cases are specialized, any other combination uses the generic kernels. The sums still run one connection at a
+		// time in stored order, they are not vectorized. Results are the same. On by default
+		void setFixedKernels(bool enabled);
+
+		// Whether the fixed radius kernels, or those of setKernels, are in use
+		bool usesFixedKernels() const {
+			return _kernels != nullptr;
+		}
+
+		// The kernels of a stencil visitor (Stencils.h), instantiated where SparseCoderKernels.h is included
+		template<typename Stencils>
+		static KernelTable kernelsFor();
+
+		// Run on kernels (not owned) instantiated for a visitor that fits this coder's radii and grid widths, until the next
+		// createRandom, load or setFixedKernels. nullptr for the generic ones. Results are the same
+		void setKernels(const KernelTable* kernels) {
+			_kernels = kernels;
+		}
+
+		const KernelTable* getKernels() const {
+			return _kernels;
+		}
+
+		// Whether there are fixed radius kernels for these radii, which a coder with them runs on
+		static bool hasFixedKernels(int receptiveRadius, int recurrentRadius, int lateralRadius) {
+			return findFixedKernels(receptiveRadius, recurrentRadius, lateralRadius) != nullptr;
+		}
+
+		// Accumulate weight updates and only write them every interval learn calls (1 = write immediately)
+		void setUpdateInterval(int interval);
+
+		// Write all pending updates to the weights
+		void applyUpdates();
+
+		int getUpdateInterval() const {
+			return _updateInterval;
+		}
+
+		int getUpdatesPending() const {
+			return _updatesPending;
+		}
+
+		unsigned long getGeneration() const {
+			return _generation;
+		}
+
+		const LearnStats &getLearnStats() const {
+			return _learnStats;
+		}
+
+		void resetLearnStats() {
+			_learnStats = LearnStats();
+		}
+
+		HiddenNode &getHiddenNode(int index) {
+			return _hidden[index];
+		}
+
+		HiddenNode &getHiddenNode(int x, int y) {
+			return _hidden[x + y * _hiddenWidth];
+		}
+
+		const HiddenNode &getHiddenNode(int index) const {
+			return _hidden[index];
+		}
+
+		int getNumVisible() const {
+			return _visibleWidth * _visibleHeight;
+		}
+
+		int getNumHidden() const {
+			return _hidden.size();
+		}
+
+		int getVisibleWidth() const {
+			return _visibleWidth;
+		}
+
+		int getVisibleHeight() const {
+			return _visibleHeight;
+		}
+
+		int getHiddenWidth() const {
+			return _hiddenWidth;
+		}
+
+		int getHiddenHeight() const {
+			return _hiddenHeight;
+		}
+
+		int getReceptiveRadius() const {
+			return _receptiveRadius;
+		}
+
+		int getRecurrentRadius() const {
+			return _recurrentRadius;
+		}
+
+		int getLateralRadius() const {
+			return _lateralRadius;
+		}
+
+		float getVHWeight(int hi, int ci) const {
+			return _hidden[hi]._feedForwardConnections[ci]._weight;
+		}
+
+		float getVHWeight(int hx, int hy, int ci) const {
+			return _hidden[hx + hy * _hiddenWidth]._feedForwardConnections[ci]._weight;
+		}
+
+		void getVHWeights(int hx, int hy, std::vector<float> &rectangle) const;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "SparseCoder.h"
+#include "Stencils.h"
+#include "Tracer.h"
+
+#include <algorithm>
+
+// Definitions of the SparseCoder kernel templates, for SparseCoder.cpp and for units that instantiate them with a stencil
+// visitor of their own (SparseCoder::kernelsFor, see NeoRL-Codegen)
+namespace neo {
+	// Kernels of one stencil visitor behind the public entry points
+	struct SparseCoder::KernelTable {
+		void (SparseCoder::*_activate)(State &state, int iter, float leak, float noise, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const;
+		void (SparseCoder::*_activateNoise)(State &state, int iter, float leak, float noise, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const;
+		void (SparseCoder::*_reconstructFromStates)(State &state, float multiplier) const;
+		void (SparseCoder::*_learn)(const State &state, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta);
+		void (SparseCoder::*_learnRewards)(State &state, const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta);
+	};
+
+	template<bool Noise, typename Stencils>
+	void SparseCoder::settleKernel(State &state, int iter, float leak, float noise, std::mt19937 &generator, const std::function<void(State &state)> &exchange) const {
+		Stencils stencils(*this);
+
+		std::normal_distribution<float> noiseDist(0.0f, 1.0f);
+
+		std::vector<float> visibleErrors(state._visibleInputs.size());
+		std::vector<float> hiddenErrors(_hidden.size());
+
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			state._hiddenActivations[hi] = 0.0f;
+
+			state._hiddenStates[hi] = 0.0f;
+		}
+
+		float settleCounter = 0.0f;
+
+		state._settleStats.begin(iter);
+
+		for (int it = 0; it < iter; it++) {
+			TraceScope scope("activateIteration", "iteration", it);
+
+			float spikes = 0.0f;
+
+			for (int vi = 0; vi < visibleErrors.size(); vi++)
+				visibleErrors[vi] = state._visibleInputs[vi] - state._visibleRecons[vi];
+
+			for (int hi = 0; hi < _hidden.size(); hi++)
+				hiddenErrors[hi] = state._hiddenStatesPrev[hi] - state._hiddenRecons[hi];
+
+			for (int hi = 0; hi < _hidden.size(); hi++) {
+				const HiddenNode &h = _hidden[hi];
+
+				float excitation = Noise ? noiseDist(generator) * noise : 0.0f;
+
+				stencils.feedForward(h._feedForwardConnections, [&](int ci, int index) {
+					excitation += visibleErrors[index] * h._feedForwardConnections[ci]._weight;
+				});
+
+				stencils.recurrent(h._recurrentConnections, [&](int ci, int index) {
+					excitation += hiddenErrors[index] * h._recurrentConnections[ci]._weight;
+				});
+
+				float inhibition = 0.0f;
+
+				stencils.lateral(h._lateralConnections, [&](int ci, int index) {
+					inhibition += state._hiddenSpikesPrev[index] * h._lateralConnections[ci]._weight;
+				});
+
+				state._hiddenActivations[hi] = (1.0f - leak) * state._hiddenActivations[hi] + excitation - inhibition;
+
+				if (state._hiddenActivations[hi] > h._threshold) {
+					state._hiddenActivations[hi] = 0.0f;
+					state._hiddenSpikes[hi] = 1.0f;
+				}
+				else
+					state._hiddenSpikes[hi] = 0.0f;
+
+				state._hiddenStates[hi] += state._hiddenSpikes[hi];
+
+				spikes += state._hiddenSpikes[hi];
+			}
+
+			state._settleStats._spikesPerIteration[it] += spikes;
+
+			for (int hi = 0; hi < _hidden.size(); hi++)
+				state._hiddenSpikesPrev[hi] = state._hiddenSpikes[hi];
+
+			settleCounter += 1.0f;
+
+			float multiplier = 1.0f / settleCounter;
+
+			reconstructKernel<Stencils>(state, multiplier);
+
+			if (exchange)
+				exchange(state);
+		}
+
+		// Divide
+		float multiplier = 1.0f / settleCounter;
+
+		int active = 0;
+
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			state._hiddenStates[hi] *= multiplier;
+
+			active += state._hiddenStates[hi] > 0.0f;
+		}
+
+		state._settleStats._activations++;
+		state._settleStats._activeSum += static_cast<double>(active) / std::max<int>(1, _hidden.size());
+	}
+
+	template<typename Stencils>
+	void SparseCoder::reconstructKernel(State &state, float multiplier) const {
+		Stencils stencils(*this);
+
+		for (int vi = 0; vi < state._visibleRecons.size(); vi++)
+			state._visibleRecons[vi] = 0.0f;
+
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			state._hiddenRecons[hi] = 0.0f;
+
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			const HiddenNode &h = _hidden[hi];
+
+			stencils.feedForward(h._feedForwardConnections, [&](int ci, int index) {
+				state._visibleRecons[index] += h._feedForwardConnections[ci]._weight * state._hiddenStates[hi] * multiplier;
+			});
+
+			stencils.recurrent(h._recurrentConnections, [&](int ci, int index) {
+				state._hiddenRecons[index] += h._recurrentConnections[ci]._weight * state._hiddenStates[hi] * multiplier;
+			});
+		}
+	}
+
+	template<typename Stencils>
+	void SparseCoder::learnKernel(const State &state, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
+		Stencils stencils(*this);
+
+		std::vector<float> visibleErrors(state._visibleInputs.size(), 0.0f);
+		std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+
+		for (int vi = 0; vi < visibleErrors.size(); vi++)
+			visibleErrors[vi] = state._visibleInputs[vi] - state._visibleRecons[vi];
+
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			hiddenErrors[hi] = state._hiddenStatesPrev[hi] - state._hiddenRecons[hi];
+
+		bool defer = _updateInterval > 1;
+
+		double thresholdSum = 0.0;
+
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			HiddenNode &h = _hidden[hi];
+
+			float learn = state._hiddenStates[hi];
+
+			thresholdSum += h._threshold;
+
+			stencils.feedForward(h._feedForwardConnections, [&](int ci, int index) {
+				float delta = std::min(maxWeightDelta, std::max(-maxWeightDelta, learnFeedForward * learn * visibleErrors[index] - weightDecay * h._feedForwardConnections[ci]._weight));
+
+				if (defer)
+					h._feedForwardDeltas[ci] += delta;
+				else
+					h._feedForwardConnections[ci]._weight += delta;
+			});
+
+			stencils.recurrent(h._recurrentConnections, [&](int ci, int index) {
+				float delta = std::min(maxWeightDelta, std::max(-maxWeightDelta, learnRecurrent * learn * hiddenErrors[index] - weightDecay * h._recurrentConnections[ci]._weight));
+
+				if (defer)
+					h._recurrentDeltas[ci] += delta;
+				else
+					h._recurrentConnections[ci]._weight += delta;
+			});
+
+			stencils.lateral(h._lateralConnections, [&](int ci, int index) {
+				float delta = learnLateral * (state._hiddenStates[hi] * state._hiddenStates[index] - sparsity * sparsity);
+
+				if (defer)
+					h._lateralDeltas[ci] += delta;
+				else
+					h._lateralConnections[ci]._weight = std::max(0.0f, h._lateralConnections[ci]._weight + delta);
+			});
+
+			if (defer)
+				h._thresholdDelta += (state._hiddenStates[hi] - sparsity) * learnThreshold;
+			else
+				h._threshold = std::max(0.0f, h._threshold + (state._hiddenStates[hi] - sparsity) * learnThreshold);
+		}
+
+		_learnStats._learnCalls++;
+		_learnStats._meanThreshold = thresholdSum / std::max<int>(1, _hidden.size());
+		_learnStats._targetSparsity = sparsity;
+
+		if (!defer)
+			_generation++;
+		else if (++_updatesPending >= _updateInterval)
+			applyUpdates();
+	}
+
+	template<typename Stencils>
+	void SparseCoder::learnRewardsKernel(State &state, const std::vector<float> &rewards, float lambda, float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay, float maxWeightDelta) {
+		Stencils stencils(*this);
+
+		// First learn of this state, or traces laid out for another coder
+		if (state._feedForwardTraces.size() != _feedForwardTraceOffsets.back())
+			state._feedForwardTraces.assign(_feedForwardTraceOffsets.back(), 0.0f);
+
+		if (state._recurrentTraces.size() != _recurrentTraceOffsets.back())
+			state._recurrentTraces.assign(_recurrentTraceOffsets.back(), 0.0f);
+
+		std::vector<float> visibleErrors(state._visibleInputs.size(), 0.0f);
+		std::vector<float> hiddenErrors(_hidden.size(), 0.0f);
+
+		for (int vi = 0; vi < visibleErrors.size(); vi++)
+			visibleErrors[vi] = state._visibleInputs[vi] - state._visibleRecons[vi];
+
+		for (int hi = 0; hi < _hidden.size(); hi++)
+			hiddenErrors[hi] = state._hiddenStatesPrev[hi] - state._hiddenRecons[hi];
+
+		bool defer = _updateInterval > 1;
+
+		double thresholdSum = 0.0;
+
+		int numBins = _learnStats._rewardHistogram.size();
+
+		for (int hi = 0; hi < _hidden.size(); hi++) {
+			HiddenNode &h = _hidden[hi];
+
+			float learn = state._hiddenStates[hi];
+
+			thresholdSum += h._threshold;
+
+			_learnStats._rewards.add(rewards[hi]);
+			_learnStats._rewardHistogram[std::min(numBins - 1, std::max(0, static_cast<int>(rewards[hi] * numBins)))]++;
+
+			float* feedForwardTraces = state._feedForwardTraces.data() + _feedForwardTraceOffsets[hi];
+			float* recurrentTraces = state._recurrentTraces.data() + _recurrentTraceOffsets[hi];
+
+			stencils.feedForward(h._feedForwardConnections, [&](int ci, int index) {
+				float delta = std::min(maxWeightDelta, std::max(-maxWeightDelta, learnFeedForward * rewards[hi] * feedForwardTraces[ci] - weightDecay * h._feedForwardConnections[ci]._weight));
+
+				if (defer)
+					h._feedForwardDeltas[ci] += delta;
+				else
+					h._feedForwardConnections[ci]._weight += delta;
+
+				feedForwardTraces[ci] = lambda * feedForwardTraces[ci] + learn * visibleErrors[index];
+			});
+
+			stencils.recurrent(h._recurrentConnections, [&](int ci, int index) {
+				float delta = std::min(maxWeightDelta, std::max(-maxWeightDelta, learnRecurrent * rewards[hi] * recurrentTraces[ci] - weightDecay * h._recurrentConnections[ci]._weight));
+
+				if (defer)
+					h._recurrentDeltas[ci] += delta;
+				else
+					h._recurrentConnections[ci]._weight += delta;
+
+				recurrentTraces[ci] = lambda * recurrentTraces[ci] + learn * hiddenErrors[index];
+			});
+
+			stencils.lateral(h._lateralConnections, [&](int ci, int index) {
+				float delta = learnLateral * (state._hiddenStates[hi] * state._hiddenStates[index] - sparsity * sparsity);
+
+				if (defer)
+					h._lateralDeltas[ci] += delta;
+				else
+					h._lateralConnections[ci]._weight = std::max(0.0f, h._lateralConnections[ci]._weight + delta);
+			});
+
+			if (defer)
+				h._thresholdDelta += (state._hiddenStates[hi] - sparsity) * learnThreshold;
+			else
+				h._threshold = std::max(0.0f, h._threshold + (state._hiddenStates[hi] - sparsity) * learnThreshold);
+		}
+
+		_learnStats._learnCalls++;
+		_learnStats._meanThreshold = thresholdSum / std::max<int>(1, _hidden.size());
+		_learnStats._targetSparsity = sparsity;
+
+		if (!defer)
+			_generation++;
+		else if (++_updatesPending >= _updateInterval)
+			applyUpdates();
+	}
+
+	template<typename Stencils>
+	SparseCoder::KernelTable SparseCoder::kernelsFor() {
+		KernelTable kernels = { &SparseCoder::settleKernel<false, Stencils>, &SparseCoder::settleKernel<true, Stencils>, &SparseCoder::reconstructKernel<Stencils>, &SparseCoder::learnKernel<Stencils>, &SparseCoder::learnRewardsKernel<Stencils> };
+
+		return kernels;
+	}
+}
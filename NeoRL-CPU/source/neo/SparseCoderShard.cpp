@@ -0,0 +1,291 @@
+#include "SparseCoderShard.h"
+
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SHARD_SOCKETS
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace neo;
+
+namespace {
+	// Rows both ranges cover, empty if end <= begin
+	void overlap(int begin0, int end0, int begin1, int end1, int &begin, int &end) {
+		begin = std::max(begin0, begin1);
+		end = std::min(end0, end1);
+	}
+
+	int rows(int begin, int end) {
+		return std::max(0, end - begin);
+	}
+}
+
+SparseCoderShard::~SparseCoderShard() {
+	for (int n = 0; n < _neighbors.size(); n++)
+		closeLink(_neighbors[n]._fd);
+}
+
+bool SparseCoderShard::createLinks(int numShards, std::vector<std::pair<int, int> > &links) {
+	links.clear();
+
+#ifdef SHARD_SOCKETS
+	for (int i = 0; i + 1 < numShards; i++) {
+		int fds[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+			for (int j = 0; j < links.size(); j++) {
+				closeLink(links[j].first);
+				closeLink(links[j].second);
+			}
+
+			links.clear();
+
+			return false;
+		}
+
+		links.push_back(std::make_pair(fds[0], fds[1]));
+	}
+
+	return true;
+#else
+	return numShards <= 1;
+#endif
+}
+
+void SparseCoderShard::closeLink(int fd) {
+#ifdef SHARD_SOCKETS
+	if (fd != -1)
+		::close(fd);
+#endif
+}
+
+void SparseCoderShard::create(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, const std::vector<SparseCoder::Strip> &strips, int index, int upLink, int downLink) {
+	_strip = strips[index];
+
+	_sdr.createRandomStrip(visibleWidth, visibleHeight, hiddenWidth, hiddenHeight, receptiveRadius, recurrentRadius, lateralRadius, initMinWeight, initMaxWeight, initMinInhibition, initMaxInhibition, initThreshold, seed, _strip);
+
+	_sdr.initState(_state);
+
+	for (int n = 0; n < _neighbors.size(); n++)
+		closeLink(_neighbors[n]._fd);
+
+	_neighbors.clear();
+
+	_failed = false;
+
+	int links[2] = { upLink, downLink };
+	int others[2] = { index - 1, index + 1 };
+
+	for (int i = 0; i < 2; i++) {
+		if (links[i] == -1)
+			continue;
+
+		Neighbor n;
+
+		n._fd = links[i];
+		n._strip = strips[others[i]];
+
+		int begin, end;
+
+		// Owned rows the other holds as halo (spikes and states), then the hidden and visible rows both reconstruct into
+		int sendSize = 0;
+		int receiveSize = 0;
+
+		overlap(_strip._ownedBegin, _strip._ownedEnd, n._strip._hiddenBegin, n._strip._hiddenEnd, begin, end);
+		sendSize += 2 * rows(begin, end) * hiddenWidth;
+
+		overlap(n._strip._ownedBegin, n._strip._ownedEnd, _strip._hiddenBegin, _strip._hiddenEnd, begin, end);
+		receiveSize += 2 * rows(begin, end) * hiddenWidth;
+
+		overlap(_strip._hiddenBegin, _strip._hiddenEnd, n._strip._hiddenBegin, n._strip._hiddenEnd, begin, end);
+		sendSize += rows(begin, end) * hiddenWidth;
+		receiveSize += rows(begin, end) * hiddenWidth;
+
+		overlap(_strip._visibleBegin, _strip._visibleEnd, n._strip._visibleBegin, n._strip._visibleEnd, begin, end);
+		sendSize += rows(begin, end) * visibleWidth;
+		receiveSize += rows(begin, end) * visibleWidth;
+
+		n._send.resize(sendSize);
+		n._receive.resize(receiveSize);
+
+#ifdef SHARD_SOCKETS
+		fcntl(n._fd, F_SETFL, fcntl(n._fd, F_GETFL) | O_NONBLOCK);
+#endif
+
+		_neighbors.push_back(n);
+	}
+}
+
+void SparseCoderShard::setInputs(const float* visibleInputs) {
+	int visibleWidth = _sdr.getVisibleWidth();
+
+	std::copy(visibleInputs + _strip._visibleBegin * visibleWidth, visibleInputs + _strip._visibleEnd * visibleWidth, _state._visibleInputs.begin());
+}
+
+bool SparseCoderShard::activate(int iter, float leak, std::mt19937 &generator) {
+	_sdr.activate(_state, iter, leak, generator, [this](SparseCoder::State &state) {
+		exchange(state);
+	});
+
+	return !_failed;
+}
+
+void SparseCoderShard::exchange(SparseCoder::State &state) {
+	if (_failed)
+		return;
+
+	int hiddenWidth = _sdr.getHiddenWidth();
+	int visibleWidth = _sdr.getVisibleWidth();
+
+	int hiddenOffset = _strip._hiddenBegin * hiddenWidth;
+	int visibleOffset = _strip._visibleBegin * visibleWidth;
+
+	// Pack every message before adding anything, so neighbours receive this strip's own share of the reconstructions
+	for (int i = 0; i < _neighbors.size(); i++) {
+		Neighbor &n = _neighbors[i];
+
+		float* p = n._send.data();
+
+		int begin, end;
+
+		overlap(_strip._ownedBegin, _strip._ownedEnd, n._strip._hiddenBegin, n._strip._hiddenEnd, begin, end);
+
+		for (int hi = begin * hiddenWidth; hi < end * hiddenWidth; hi++) {
+			*p++ = state._hiddenSpikes[hi - hiddenOffset];
+			*p++ = state._hiddenStates[hi - hiddenOffset];
+		}
+
+		overlap(_strip._hiddenBegin, _strip._hiddenEnd, n._strip._hiddenBegin, n._strip._hiddenEnd, begin, end);
+
+		for (int hi = begin * hiddenWidth; hi < end * hiddenWidth; hi++)
+			*p++ = state._hiddenRecons[hi - hiddenOffset];
+
+		overlap(_strip._visibleBegin, _strip._visibleEnd, n._strip._visibleBegin, n._strip._visibleEnd, begin, end);
+
+		for (int vi = begin * visibleWidth; vi < end * visibleWidth; vi++)
+			*p++ = state._visibleRecons[vi - visibleOffset];
+	}
+
+	if (!transfer()) {
+		_failed = true;
+
+		return;
+	}
+
+	for (int i = 0; i < _neighbors.size(); i++) {
+		Neighbor &n = _neighbors[i];
+
+		const float* p = n._receive.data();
+
+		int begin, end;
+
+		// activate copied the spikes already, the halo's must follow
+		overlap(n._strip._ownedBegin, n._strip._ownedEnd, _strip._hiddenBegin, _strip._hiddenEnd, begin, end);
+
+		for (int hi = begin * hiddenWidth; hi < end * hiddenWidth; hi++) {
+			state._hiddenSpikes[hi - hiddenOffset] = *p;
+			state._hiddenSpikesPrev[hi - hiddenOffset] = *p++;
+			state._hiddenStates[hi - hiddenOffset] = *p++;
+		}
+
+		overlap(_strip._hiddenBegin, _strip._hiddenEnd, n._strip._hiddenBegin, n._strip._hiddenEnd, begin, end);
+
+		for (int hi = begin * hiddenWidth; hi < end * hiddenWidth; hi++)
+			state._hiddenRecons[hi - hiddenOffset] += *p++;
+
+		overlap(_strip._visibleBegin, _strip._visibleEnd, n._strip._visibleBegin, n._strip._visibleEnd, begin, end);
+
+		for (int vi = begin * visibleWidth; vi < end * visibleWidth; vi++)
+			state._visibleRecons[vi - visibleOffset] += *p++;
+	}
+}
+
+bool SparseCoderShard::transfer() {
+#ifdef SHARD_SOCKETS
+	// Send and receive on both links at once, neither side can wait for the other to drain its socket first
+	size_t sent[2] = { 0, 0 };
+	size_t received[2] = { 0, 0 };
+
+	// A shard that died must fail the step, not kill its neighbours
+#ifdef MSG_NOSIGNAL
+	int sendFlags = MSG_NOSIGNAL;
+#else
+	int sendFlags = 0;
+#endif
+
+	for (;;) {
+		pollfd fds[2];
+
+		int numPending = 0;
+
+		for (int i = 0; i < _neighbors.size(); i++) {
+			Neighbor &n = _neighbors[i];
+
+			fds[i].fd = n._fd;
+			fds[i].events = 0;
+			fds[i].revents = 0;
+
+			if (sent[i] < n._send.size() * sizeof(float))
+				fds[i].events |= POLLOUT;
+
+			if (received[i] < n._receive.size() * sizeof(float))
+				fds[i].events |= POLLIN;
+
+			numPending += fds[i].events != 0;
+		}
+
+		if (numPending == 0)
+			return true;
+
+		if (poll(fds, _neighbors.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		for (int i = 0; i < _neighbors.size(); i++) {
+			Neighbor &n = _neighbors[i];
+
+			if (fds[i].events != 0 && (fds[i].revents & (POLLERR | POLLNVAL)))
+				return false;
+
+			if ((fds[i].events & POLLOUT) && (fds[i].revents & POLLOUT)) {
+				size_t size = n._send.size() * sizeof(float);
+
+				ssize_t count = ::send(n._fd, reinterpret_cast<const char*>(n._send.data()) + sent[i], size - sent[i], sendFlags);
+
+				if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					return false;
+
+				if (count > 0)
+					sent[i] += count;
+			}
+
+			if ((fds[i].events & POLLIN) && (fds[i].revents & (POLLIN | POLLHUP))) {
+				size_t size = n._receive.size() * sizeof(float);
+
+				ssize_t count = ::read(n._fd, reinterpret_cast<char*>(n._receive.data()) + received[i], size - received[i]);
+
+				// Closed by the other side
+				if (count == 0)
+					return false;
+
+				if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					return false;
+
+				if (count > 0)
+					received[i] += count;
+			}
+		}
+	}
+#else
+	return _neighbors.empty();
+#endif
+}
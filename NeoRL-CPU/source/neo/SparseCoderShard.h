@@ -0,0 +1,91 @@
+#pragma once
+
+#include "SparseCoder.h"
+
+#include <utility>
+
+namespace neo {
+	// One horizontal strip of a sparse coder layer split across processes (see SparseCoder::computeStrips). A shard builds
+	// only its own strip from the shared seed and, every settle iteration, swaps its boundary spikes and states and its share
+	// of the reconstructions with the shards above and below over local sockets. Owned nodes settle and learn on the same
+	// values as in the whole layer, only the summation order of reconstructions shared by two strips differs.
+	// This covers the sparse coder of one layer only: a PredictiveHierarchy can not be sharded, its prediction nodes, the feed back
+	// between layers and reward modulated learning (learn with rewards) all still need the whole layer in one process
+	class SparseCoderShard {
+	private:
+		struct Neighbor {
+			int _fd;
+
+			SparseCoder::Strip _strip;
+
+			std::vector<float> _send;
+			std::vector<float> _receive;
+		};
+
+		SparseCoder _sdr;
+		SparseCoder::State _state;
+
+		SparseCoder::Strip _strip;
+
+		std::vector<Neighbor> _neighbors;
+
+		// Set once a link failed, the shard's activity is meaningless from then on
+		bool _failed;
+
+		void exchange(SparseCoder::State &state);
+
+		bool transfer();
+
+	public:
+		SparseCoderShard()
+			: _failed(false)
+		{}
+
+		~SparseCoderShard();
+
+		// Connected local socket pairs between shard i and i + 1: links[i].first belongs to shard i, links[i].second to shard i + 1.
+		// Create them before forking the shards. Returns false if the platform has no local sockets
+		static bool createLinks(int numShards, std::vector<std::pair<int, int> > &links);
+
+		static void closeLink(int fd);
+
+		// Shard index of strips. upLink and downLink connect it to shards index - 1 and index + 1 (-1 for none) and are owned by the shard from here on
+		void create(int visibleWidth, int visibleHeight, int hiddenWidth, int hiddenHeight, int receptiveRadius, int recurrentRadius, int lateralRadius, float initMinWeight, float initMaxWeight, float initMinInhibition, float initMaxInhibition, float initThreshold, unsigned long long seed, const std::vector<SparseCoder::Strip> &strips, int index, int upLink, int downLink);
+
+		// Take the strip's rows of a whole visible frame
+		void setInputs(const float* visibleInputs);
+
+		// Settle together with the neighbours, all shards must call it in the same step. Returns false if a link failed
+		bool activate(int iter, float leak, std::mt19937 &generator);
+
+		// Learning only touches owned nodes' weights, so it needs no exchange
+		void learn(float learnFeedForward, float learnRecurrent, float learnLateral, float learnThreshold, float sparsity, float weightDecay) {
+			_sdr.learn(_state, learnFeedForward, learnRecurrent, learnLateral, learnThreshold, sparsity, weightDecay);
+		}
+
+		void stepEnd() {
+			_sdr.stepEnd(_state);
+		}
+
+		// Settled states of the owned rows, getNumOwned values in row order
+		const float* getOwnedStates() const {
+			return _state._hiddenStates.data() + (_strip._ownedBegin - _strip._hiddenBegin) * _sdr.getHiddenWidth();
+		}
+
+		int getNumOwned() const {
+			return (_strip._ownedEnd - _strip._ownedBegin) * _sdr.getHiddenWidth();
+		}
+
+		const SparseCoder::Strip &getStrip() const {
+			return _strip;
+		}
+
+		const SparseCoder &getSparseCoder() const {
+			return _sdr;
+		}
+
+		const SparseCoder::State &getState() const {
+			return _state;
+		}
+	};
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "SparseCoder.h"
+
+namespace neo {
+	// Connection visitors of the SparseCoder kernels: f(ci, index) for every connection of a stencil, in stored order.
+	// The kernels are written once against these and instantiated for each
+	class StoredStencils {
+	public:
+		// Everything is read from the connections, nothing from the coder
+		StoredStencils(const SparseCoder &)
+		{}
+
+		template<typename F>
+		void feedForward(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visit(connections, f);
+		}
+
+		template<typename F>
+		void recurrent(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visit(connections, f);
+		}
+
+		template<typename F>
+		void lateral(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visit(connections, f);
+		}
+
+		// Indices as stored, any radius
+		template<typename F>
+		static void visit(const std::vector<SparseCoder::Connection> &connections, F f) {
+			for (int ci = 0; ci < connections.size(); ci++)
+				f(ci, connections[ci]._index);
+		}
+	};
+
+	// f(ci, index) for every connection of a stencil of Radius, the center left out if SkipCenter, over a grid of this width.
+	// A full stencil is a square laid out column by column from its first connection, so its indices follow from that one and
+	// the width, with trip counts known at compile time. Stencils clipped at the border use the stored indices
+	template<int Radius, bool SkipCenter, typename F>
+	void visitFullStencil(const std::vector<SparseCoder::Connection> &connections, int width, F f) {
+		const int span = 2 * Radius + 1;
+
+		if (connections.empty() || connections.size() != span * span - (SkipCenter ? 1 : 0)) {
+			StoredStencils::visit(connections, f);
+
+			return;
+		}
+
+		int first = connections[0]._index;
+
+		int ci = 0;
+
+		for (int x = 0; x < span; x++)
+			for (int y = 0; y < span; y++) {
+				if (SkipCenter && x == Radius && y == Radius)
+					continue;
+
+				f(ci++, first + x + y * width);
+			}
+	}
+
+	// Stencils of a coder with these radii, full ones walked by visitFullStencil (see SparseCoder::setFixedKernels).
+	// Only equal radii of 4, 8, 12 and 16 are instantiated (SparseCoder::findFixedKernels).
+	// The visits are still scalar and in stored order, so the sums they feed are not vectorized
+	template<int ReceptiveRadius, int RecurrentRadius, int LateralRadius>
+	class FixedStencils {
+		static_assert(ReceptiveRadius > 0 && RecurrentRadius > 0 && LateralRadius > 0, "Fixed stencils need positive radii");
+
+	private:
+		int _visibleWidth, _hiddenWidth;
+
+	public:
+		FixedStencils(const SparseCoder &sc)
+			: _visibleWidth(sc.getVisibleWidth()), _hiddenWidth(sc.getHiddenWidth())
+		{}
+
+		template<typename F>
+		void feedForward(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<ReceptiveRadius, false>(connections, _visibleWidth, f);
+		}
+
+		template<typename F>
+		void recurrent(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<RecurrentRadius, true>(connections, _hiddenWidth, f);
+		}
+
+		template<typename F>
+		void lateral(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<LateralRadius, true>(connections, _hiddenWidth, f);
+		}
+	};
+
+	// FixedStencils with the grid widths compiled in as well, and any radii (recurrent -1 for none), for coders of one
+	// configuration. NeoRL-Codegen instantiates the kernels with them (SparseCoder::kernelsFor)
+	template<int ReceptiveRadius, int RecurrentRadius, int LateralRadius, int VisibleWidth, int HiddenWidth>
+	class GridStencils {
+	public:
+		GridStencils(const SparseCoder &)
+		{}
+
+		template<typename F>
+		void feedForward(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<ReceptiveRadius, false>(connections, VisibleWidth, f);
+		}
+
+		template<typename F>
+		void recurrent(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<RecurrentRadius, true>(connections, HiddenWidth, f);
+		}
+
+		template<typename F>
+		void lateral(const std::vector<SparseCoder::Connection> &connections, F f) const {
+			visitFullStencil<LateralRadius, true>(connections, HiddenWidth, f);
+		}
+	};
+}
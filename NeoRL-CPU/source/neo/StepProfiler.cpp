@@ -0,0 +1,123 @@
+#include "StepProfiler.h"
+
+#include <iomanip>
+#include <algorithm>
+
+using namespace neo;
+
+const char* StepProfiler::getPhaseName(Phase phase) {
+	static const char* names[_numPhases] = { "features", "prediction", "inputPrediction", "learnPrediction", "learnInputPrediction", "rewards", "learnFeatures", "stepEnd" };
+
+	return names[phase];
+}
+
+void StepProfiler::beginStep() {
+	if (!_enabled)
+		return;
+
+	std::thread::id none;
+
+	if (!_owner.compare_exchange_strong(none, std::this_thread::get_id()) && none != std::this_thread::get_id())
+		return;
+
+	for (int i = 0; i < _timings.size(); i++)
+		_timings[i]._step = 0.0;
+
+	_steps++;
+}
+
+void StepProfiler::add(Phase phase, int layer, double seconds, const PerfCounters::Sample &counters) {
+	int row = layer + 1;
+
+	// Grow to the deepest layer seen
+	if (row >= _numRows) {
+		std::vector<Timing> timings(_numPhases * (row + 1));
+
+		for (int p = 0; p < _numPhases; p++)
+			for (int r = 0; r < _numRows; r++)
+				timings[p * (row + 1) + r] = _timings[p * _numRows + r];
+
+		_timings = timings;
+		_numRows = row + 1;
+	}
+
+	Timing &t = _timings[phase * _numRows + row];
+
+	t._step += seconds;
+	t._total += seconds;
+	t._calls++;
+	t._counters += counters;
+}
+
+void StepProfiler::reset() {
+	_timings.clear();
+	_numRows = 0;
+	_steps = 0;
+
+	_owner = std::thread::id();
+}
+
+StepProfiler::Timing StepProfiler::getTiming(Phase phase, int layer) const {
+	int row = layer + 1;
+
+	if (row < 0 || row >= _numRows)
+		return Timing();
+
+	return _timings[phase * _numRows + row];
+}
+
+double StepProfiler::getTotal() const {
+	double total = 0.0;
+
+	for (int i = 0; i < _timings.size(); i++)
+		total += _timings[i]._total;
+
+	return total;
+}
+
+void StepProfiler::print(std::ostream &os) const {
+	double total = std::max(getTotal(), 1e-12);
+	long steps = std::max(1L, _steps);
+
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+
+	bool counters = getCounters() != nullptr;
+
+	os << std::left << std::setw(22) << "phase" << std::setw(7) << "layer" << std::right
+		<< std::setw(12) << "last ms" << std::setw(14) << "total ms" << std::setw(12) << "mean ms" << std::setw(9) << "share";
+
+	if (counters)
+		os << std::setw(12) << "Mcyc/step" << std::setw(7) << "IPC" << std::setw(14) << "LLC miss/step" << std::setw(11) << "LLC miss%";
+
+	os << std::endl;
+
+	for (int p = 0; p < _numPhases; p++)
+		for (int r = 0; r < _numRows; r++) {
+			const Timing &t = _timings[p * _numRows + r];
+
+			if (t._calls == 0)
+				continue;
+
+			os << std::left << std::setw(22) << getPhaseName(static_cast<Phase>(p)) << std::setw(7) << (r == 0 ? std::string("all") : std::to_string(r - 1)) << std::right
+				<< std::fixed << std::setprecision(3)
+				<< std::setw(12) << t._step * 1000.0 << std::setw(14) << t._total * 1000.0 << std::setw(12) << t._total * 1000.0 / steps
+				<< std::setw(8) << std::setprecision(1) << t._total / total * 100.0 << "%";
+
+			if (counters) {
+				double cycles = static_cast<double>(t._counters[PerfCounters::_cycles]);
+				double references = static_cast<double>(t._counters[PerfCounters::_llcReferences]);
+				double misses = static_cast<double>(t._counters[PerfCounters::_llcMisses]);
+
+				os << std::setprecision(3) << std::setw(12) << cycles * 1e-6 / steps
+					<< std::setprecision(2) << std::setw(7) << t._counters[PerfCounters::_instructions] / std::max(cycles, 1.0)
+					<< std::setprecision(0) << std::setw(14) << misses / steps
+					<< std::setprecision(1) << std::setw(10) << misses / std::max(references, 1.0) * 100.0 << "%";
+			}
+
+			os << std::endl;
+		}
+
+	os.flags(flags);
+	os.precision(precision);
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <atomic>
+#include <thread>
+
+#include "Tracer.h"
+#include "PerfCounters.h"
+
+namespace neo {
+	// Wall time spent in each phase of a step, per layer, for the last step and summed over all steps.
+	// Attach one to a PredictiveHierarchy or Agent with setProfiler. Not thread safe: the first thread to begin a step owns it until reset,
+	// scopes on other threads (batch workers, readers stepping their own states on a shared model) are not timed.
+	// With hardware counters attached (setCounters) every phase also sums cycles, instructions and LLC traffic.
+	// Define NEO_NO_PROFILING to compile the timing out altogether
+	class StepProfiler {
+	public:
+		enum Phase {
+			_features = 0, _prediction, _inputPrediction, _learnPrediction, _learnInputPrediction, _rewards, _learnFeatures, _stepEnd, _numPhases
+		};
+
+		struct Timing {
+			double _step;
+			double _total;
+			long _calls;
+
+			// Summed over all calls, zeros without counters
+			PerfCounters::Sample _counters;
+
+			Timing()
+				: _step(0.0), _total(0.0), _calls(0)
+			{}
+		};
+
+	private:
+		// Indexed by phase and layer + 1, so whole-hierarchy phases can use layer -1
+		std::vector<Timing> _timings;
+		int _numRows;
+
+		long _steps;
+
+		bool _enabled;
+
+		PerfCounters* _perfCounters;
+
+		// Default constructed (no thread) until the first beginStep
+		std::atomic<std::thread::id> _owner;
+
+	public:
+		StepProfiler()
+			: _numRows(0), _steps(0), _enabled(true), _perfCounters(nullptr), _owner(std::thread::id())
+		{}
+
+		static const char* getPhaseName(Phase phase);
+
+		void setEnabled(bool enabled) {
+			_enabled = enabled;
+		}
+
+		bool isEnabled() const {
+			return _enabled;
+		}
+
+		// Whether the calling thread may time into this profiler
+		bool isOwner() const {
+			return _owner.load(std::memory_order_relaxed) == std::this_thread::get_id();
+		}
+
+		// Counters opened on the profiled thread, or nullptr. Ignored when they are not available
+		void setCounters(PerfCounters* perfCounters) {
+			_perfCounters = perfCounters;
+		}
+
+		PerfCounters* getCounters() const {
+			return _perfCounters != nullptr && _perfCounters->isAvailable() ? _perfCounters : nullptr;
+		}
+
+		// Called by the model at the start of every step, clears the last step's timings. Takes ownership if no thread has it
+		void beginStep();
+
+		void add(Phase phase, int layer, double seconds, const PerfCounters::Sample &counters = PerfCounters::Sample());
+
+		// Clear everything, and release the owning thread
+		void reset();
+
+		// Layer -1 holds phases that cover the whole hierarchy (input prediction), all others are timed per layer
+		Timing getTiming(Phase phase, int layer) const;
+
+		int getNumLayers() const {
+			return _numRows - 1;
+		}
+
+		long getNumSteps() const {
+			return _steps;
+		}
+
+		// Total seconds over all phases and layers
+		double getTotal() const;
+
+		// One row per phase and layer that ran: last step, total and mean per step in milliseconds, and share of the total.
+		// With counters also mega cycles per step, instructions per cycle and LLC misses per step and per reference
+		void print(std::ostream &os) const;
+	};
+
+	// Times the enclosing scope into a profiler and records it as a trace event when the Tracer runs.
+	// Costs a null check and a flag load when neither is on, and two counter reads (syscalls) per scope with counters
+	class ProfileScope {
+#ifndef NEO_NO_PROFILING
+	private:
+		StepProfiler *_profiler;
+		StepProfiler::Phase _phase;
+		int _layer;
+
+		bool _tracing;
+
+		int64_t _start;
+
+		PerfCounters* _perfCounters;
+		PerfCounters::Sample _startCounters;
+
+	public:
+		ProfileScope(StepProfiler *profiler, StepProfiler::Phase phase, int layer)
+			: _profiler(profiler != nullptr && profiler->isEnabled() && profiler->isOwner() ? profiler : nullptr), _phase(phase), _layer(layer), _tracing(Tracer::isEnabled()),
+			_start(0), _perfCounters(_profiler != nullptr ? _profiler->getCounters() : nullptr)
+		{
+			if (_profiler != nullptr || _tracing)
+				_start = Tracer::now();
+
+			if (_perfCounters != nullptr)
+				_startCounters = _perfCounters->read();
+		}
+
+		~ProfileScope() {
+			if (_profiler == nullptr && !_tracing)
+				return;
+
+			PerfCounters::Sample counters;
+
+			if (_perfCounters != nullptr)
+				counters = _perfCounters->read() - _startCounters;
+
+			int64_t end = Tracer::now();
+
+			if (_profiler != nullptr)
+				_profiler->add(_phase, _layer, (end - _start) * 1e-9, counters);
+
+			if (_tracing)
+				Tracer::record(StepProfiler::getPhaseName(_phase), "layer", _layer, _start, end);
+		}
+#else
+	public:
+		ProfileScope(StepProfiler *profiler, StepProfiler::Phase phase, int layer)
+		{}
+#endif
+	};
+}
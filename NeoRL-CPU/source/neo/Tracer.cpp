@@ -0,0 +1,200 @@
+#include "Tracer.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace neo;
+
+namespace {
+	// Written by its own thread only, read when writing the trace
+	struct Ring {
+		std::vector<Tracer::Event> _events;
+		std::atomic<int64_t> _head;
+
+		int _threadId;
+
+		// Set under the registry lock when the thread is gone, the ring is freed by the next clear
+		bool _exited;
+
+		Ring(int size, int threadId)
+			: _events(size), _head(0), _threadId(threadId), _exited(false)
+		{}
+	};
+
+	struct Registry {
+		std::mutex _mutex;
+		std::vector<std::unique_ptr<Ring> > _rings;
+
+		int _eventsPerThread;
+
+		// Ids stay unique when rings are freed
+		int _nextThreadId;
+
+		std::chrono::steady_clock::time_point _epoch;
+
+		Registry()
+			: _eventsPerThread(1 << 16), _nextThreadId(1), _epoch(std::chrono::steady_clock::now())
+		{}
+	};
+
+	Registry &registry() {
+		static Registry r;
+
+		return r;
+	}
+
+	// Marks the thread's ring exited when the thread ends
+	struct ThreadRing {
+		Ring* _ring;
+
+		ThreadRing()
+			: _ring(nullptr)
+		{}
+
+		~ThreadRing() {
+			if (_ring == nullptr)
+				return;
+
+			Registry &r = registry();
+
+			std::lock_guard<std::mutex> lock(r._mutex);
+
+			_ring->_exited = true;
+		}
+	};
+
+	thread_local ThreadRing threadRing;
+
+	// Only the first event of a thread takes the lock
+	Ring* getThreadRing() {
+		if (threadRing._ring == nullptr) {
+			Registry &r = registry();
+
+			std::lock_guard<std::mutex> lock(r._mutex);
+
+			r._rings.push_back(std::unique_ptr<Ring>(new Ring(r._eventsPerThread, r._nextThreadId++)));
+
+			threadRing._ring = r._rings.back().get();
+		}
+
+		return threadRing._ring;
+	}
+}
+
+std::atomic<bool> Tracer::_enabled(false);
+
+void Tracer::start(int eventsPerThread) {
+	clear();
+
+	{
+		Registry &r = registry();
+
+		std::lock_guard<std::mutex> lock(r._mutex);
+
+		r._eventsPerThread = std::max(1, eventsPerThread);
+	}
+
+	_enabled = true;
+}
+
+void Tracer::clear() {
+	Registry &r = registry();
+
+	std::lock_guard<std::mutex> lock(r._mutex);
+
+	std::vector<std::unique_ptr<Ring> > live;
+
+	for (int i = 0; i < r._rings.size(); i++)
+		if (!r._rings[i]->_exited) {
+			r._rings[i]->_head = 0;
+
+			live.push_back(std::move(r._rings[i]));
+		}
+
+	r._rings.swap(live);
+}
+
+void Tracer::stop() {
+	_enabled = false;
+}
+
+int64_t Tracer::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry()._epoch).count();
+}
+
+void Tracer::record(const char* name, const char* argName, int arg, int64_t begin, int64_t end) {
+	Ring* ring = getThreadRing();
+
+	int64_t head = ring->_head.load(std::memory_order_relaxed);
+
+	Event &e = ring->_events[head % ring->_events.size()];
+
+	e._name = name;
+	e._argName = argName;
+	e._arg = arg;
+	e._begin = begin;
+	e._end = end;
+
+	ring->_head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::write(std::ostream &os) {
+	Registry &r = registry();
+
+	std::lock_guard<std::mutex> lock(r._mutex);
+
+	// Microseconds with nanosecond resolution
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+
+	os << std::fixed << std::setprecision(3);
+
+	os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	bool first = true;
+
+	for (int i = 0; i < r._rings.size(); i++) {
+		const Ring &ring = *r._rings[i];
+
+		os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring._threadId
+			<< ",\"args\":{\"name\":\"thread " << ring._threadId << "\"}}";
+
+		first = false;
+
+		int64_t head = ring._head.load(std::memory_order_acquire);
+		int64_t size = ring._events.size();
+
+		// Oldest surviving event first
+		for (int64_t j = std::max<int64_t>(0, head - size); j < head; j++) {
+			const Event &e = ring._events[j % size];
+
+			os << ",\n{\"name\":\"" << e._name << "\",\"cat\":\"neo\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring._threadId
+				<< ",\"ts\":" << e._begin * 0.001 << ",\"dur\":" << (e._end - e._begin) * 0.001;
+
+			if (e._argName != nullptr)
+				os << ",\"args\":{\"" << e._argName << "\":" << e._arg << "}";
+
+			os << "}";
+		}
+	}
+
+	os << "\n]}" << std::endl;
+
+	os.flags(flags);
+	os.precision(precision);
+}
+
+bool Tracer::write(const std::string &path) {
+	std::ofstream toFile(path);
+
+	if (!toFile.is_open())
+		return false;
+
+	write(toFile);
+
+	return toFile.good();
+}
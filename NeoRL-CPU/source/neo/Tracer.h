@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include <stdint.h>
+
+namespace neo {
+	// Process wide event tracer, written out as Chrome trace JSON (chrome://tracing, Perfetto).
+	// Every thread records into its own fixed size ring without locking, the oldest events are overwritten when it is full.
+	// Rings of exited threads are kept for write until the next clear or start.
+	// While stopped each trace point costs one relaxed atomic load. Define NEO_NO_TRACING to compile them out altogether
+	class Tracer {
+	public:
+		struct Event {
+			const char* _name;
+			const char* _argName;
+			int _arg;
+
+			// Nanoseconds since the tracer's epoch
+			int64_t _begin;
+			int64_t _end;
+		};
+
+	private:
+		static std::atomic<bool> _enabled;
+
+	public:
+		// Start recording, rings created from now on hold eventsPerThread events. Clears what was recorded before, call while traced threads are idle
+		static void start(int eventsPerThread = 1 << 16);
+
+		// Drop all recorded events and free the rings of threads that exited. Call while traced threads are idle
+		static void clear();
+
+		static void stop();
+
+		static bool isEnabled() {
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		static int64_t now();
+
+		// Append to the calling thread's ring
+		static void record(const char* name, const char* argName, int arg, int64_t begin, int64_t end);
+
+		// Write every thread's events as Chrome trace JSON. Call once the traced threads are idle,
+		// events recorded during the write may come out torn
+		static void write(std::ostream &os);
+
+		// Returns false if the file could not be written
+		static bool write(const std::string &path);
+	};
+
+	// Records the enclosing scope as one event. name and argName must outlive the tracer (string literals)
+	class TraceScope {
+#ifndef NEO_NO_TRACING
+	private:
+		const char* _name;
+		const char* _argName;
+		int _arg;
+
+		int64_t _begin;
+
+	public:
+		TraceScope(const char* name, const char* argName = nullptr, int arg = 0)
+			: _name(Tracer::isEnabled() ? name : nullptr), _argName(argName), _arg(arg), _begin(0)
+		{
+			if (_name != nullptr)
+				_begin = Tracer::now();
+		}
+
+		~TraceScope() {
+			if (_name != nullptr)
+				Tracer::record(_name, _argName, _arg, _begin, Tracer::now());
+		}
+#else
+	public:
+		TraceScope(const char* name, const char* argName = nullptr, int arg = 0)
+		{}
+#endif
+	};
+}
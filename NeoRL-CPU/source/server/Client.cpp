@@ -0,0 +1,192 @@
+// Load generator for NeoRL-Server. Each client thread holds its own connection and session and sends step requests back to back,
+// then the client side latencies and the server's own report are printed
+
+#include "Protocol.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "../libs/argparse.hpp"
+
+#include <sys/un.h>
+
+typedef std::chrono::steady_clock Clock;
+
+int connectTo(const std::string &socketPath) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+// Send a request and read the response into values (or text), false if the connection failed
+bool exchange(int fd, uint32_t type, uint32_t session, const std::vector<float> &inputs, ResponseHeader &response, std::vector<char> &payload) {
+	RequestHeader header;
+	header._type = type;
+	header._session = session;
+	header._numValues = inputs.size();
+
+	if (!writeFully(fd, &header, sizeof(RequestHeader)) || !writeFully(fd, inputs.data(), inputs.size() * sizeof(float)))
+		return false;
+
+	if (!readFully(fd, &response, sizeof(ResponseHeader)))
+		return false;
+
+	size_t payloadSize = 0;
+
+	if (type == _requestStep && response._status == _statusOk)
+		payloadSize = response._numValues * sizeof(float);
+	else if (type == _requestStats)
+		payloadSize = response._numValues;
+
+	payload.resize(payloadSize);
+
+	return readFully(fd, payload.data(), payloadSize);
+}
+
+void runClient(const std::string &socketPath, int client, int numInputs, int numRequests, std::vector<float>* latencies, int* failures) {
+	int fd = connectTo(socketPath);
+
+	std::vector<float> inputs(numInputs);
+	std::vector<char> payload;
+	ResponseHeader response;
+
+	if (fd >= 0 && (!exchange(fd, _requestOpen, 0, std::vector<float>(), response, payload) || response._status != _statusOk)) {
+		close(fd);
+
+		fd = -1;
+	}
+
+	if (fd < 0) {
+		*failures = numRequests;
+
+		return;
+	}
+
+	uint32_t session = response._numValues;
+
+	std::mt19937 generator(client);
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+	for (int r = 0; r < numRequests; r++) {
+		for (int i = 0; i < numInputs; i++)
+			inputs[i] = dist01(generator);
+
+		Clock::time_point start = Clock::now();
+
+		if (!exchange(fd, _requestStep, session, inputs, response, payload)) {
+			*failures += numRequests - r;
+
+			break;
+		}
+
+		latencies->push_back(std::chrono::duration<float, std::micro>(Clock::now() - start).count());
+
+		if (response._status != _statusOk)
+			(*failures)++;
+	}
+
+	exchange(fd, _requestClose, session, std::vector<float>(), response, payload);
+
+	close(fd);
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("--socket", 1);
+	parser.addArgument("--clients", 1);
+	parser.addArgument("--requests", 1);
+
+	parser.parse(argc, argv);
+
+	std::string socketPath = parser.retrieve("socket", "/tmp/neorl.sock");
+	int numClients = std::max(1, std::atoi(parser.retrieve("clients", "8").c_str()));
+	int numRequests = std::max(1, std::atoi(parser.retrieve("requests", "1000").c_str()));
+
+	int fd = connectTo(socketPath);
+
+	if (fd < 0) {
+		std::cerr << "Could not connect to " << socketPath << std::endl;
+
+		return 1;
+	}
+
+	ResponseHeader response;
+	std::vector<char> payload;
+
+	if (!exchange(fd, _requestInfo, 0, std::vector<float>(), response, payload)) {
+		std::cerr << "Server did not answer" << std::endl;
+
+		return 1;
+	}
+
+	int numInputs = response._numValues;
+
+	std::vector<std::vector<float>> latencies(numClients);
+	std::vector<int> failures(numClients, 0);
+	std::vector<std::thread> clients;
+
+	Clock::time_point start = Clock::now();
+
+	for (int c = 0; c < numClients; c++)
+		clients.push_back(std::thread(runClient, socketPath, c + 1, numInputs, numRequests, &latencies[c], &failures[c]));
+
+	for (int c = 0; c < numClients; c++)
+		clients[c].join();
+
+	float seconds = std::chrono::duration<float>(Clock::now() - start).count();
+
+	std::vector<float> all;
+	int numFailures = 0;
+
+	for (int c = 0; c < numClients; c++) {
+		all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+
+		numFailures += failures[c];
+	}
+
+	std::sort(all.begin(), all.end());
+
+	std::cout << "clients " << numClients << " requests " << all.size() << " failures " << numFailures << " requests_per_second " << all.size() / seconds << "\n";
+
+	if (!all.empty()) {
+		const float percentiles[5] = { 50.0f, 90.0f, 99.0f, 99.9f, 100.0f };
+
+		std::cout << "client_latency_us";
+
+		for (int i = 0; i < 5; i++) {
+			int index = std::min<int>(all.size() - 1, std::ceil(percentiles[i] / 100.0f * all.size()) - 1);
+
+			std::cout << " p" << percentiles[i] << " " << all[std::max(0, index)];
+		}
+
+		std::cout << "\n";
+	}
+
+	if (exchange(fd, _requestStats, 0, std::vector<float>(), response, payload))
+		std::cout << std::string(payload.begin(), payload.end());
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+// Wire format between NeoRL-Server and its clients, over a Unix domain stream socket in host byte order.
+// Every request is a RequestHeader followed by _numValues floats, every response a ResponseHeader followed by _numValues floats
+// (or _numValues bytes of text for a stats request)
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+enum RequestType {
+	// Set the session's inputs, step it and return its predictions
+	_requestStep = 1,
+
+	// Clear the session's recurrent state
+	_requestReset = 2,
+
+	// Return a text report of latencies and batch sizes
+	_requestStats = 3,
+
+	// Return the number of inputs the model expects (in _numValues, no payload)
+	_requestInfo = 4,
+
+	// Start a session with a fresh state and return the id the server issued for it (in _numValues, no payload)
+	_requestOpen = 5,
+
+	// End the session and drop its state
+	_requestClose = 6
+};
+
+enum ResponseStatus {
+	_statusOk = 0,
+	_statusBadRequest = 1,
+	_statusShuttingDown = 2,
+
+	// The request named a session the server did not issue or that was closed
+	_statusNoSession = 3
+};
+
+struct RequestHeader {
+	uint32_t _type;
+
+	// Id returned by an open request, for step, reset and close
+	uint32_t _session;
+	uint32_t _numValues;
+};
+
+struct ResponseHeader {
+	uint32_t _status;
+	uint32_t _numValues;
+};
+
+// Read or write exactly size bytes, false if the connection closed or failed
+inline bool readFully(int fd, void *data, size_t size) {
+	char *p = static_cast<char*>(data);
+
+	while (size > 0) {
+		ssize_t n = ::read(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+inline bool writeFully(int fd, const void *data, size_t size) {
+	const char *p = static_cast<const char*>(data);
+
+	while (size > 0) {
+		ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
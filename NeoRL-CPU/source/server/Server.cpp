@@ -0,0 +1,666 @@
+// Serves a PredictiveHierarchy to local processes over a Unix domain socket.
+// Clients open sessions, whose ids the server issues, and name one in every step. Requests that arrive together are batched into
+// one PredictiveHierarchy::simStepBatch call. A batch is started once it is full or the oldest request in it has waited for the latency cap.
+// At most --maxsessions sessions are kept in memory. A new one writes the least recently stepped out to --sessiondir,
+// and it is read back when its client steps it again. Sessions last until they are closed or the server exits
+
+#include <neo/PredictiveHierarchy.h>
+
+#include "Protocol.h"
+
+#include "../libs/argparse.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <signal.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Request {
+	RequestHeader _header;
+
+	// Inputs on the way in, predictions on the way out
+	std::vector<float> _values;
+
+	Clock::time_point _arrival;
+
+	uint32_t _status;
+	bool _done;
+
+	Request()
+		: _status(_statusOk), _done(false)
+	{}
+};
+
+class Server {
+private:
+	neo::PredictiveHierarchy _ph;
+
+	std::mt19937 _generator;
+
+	struct Session {
+		neo::PredictiveHierarchy::State _state;
+
+		// Position in _sessionOrder
+		std::list<uint32_t>::iterator _use;
+	};
+
+	// Only touched by the batching thread. _sessionOrder runs from least to most recently used,
+	// _spilled holds the evicted sessions, whose states are in files under _sessionDirectory
+	std::unordered_map<uint32_t, Session> _sessions;
+	std::list<uint32_t> _sessionOrder;
+	std::unordered_set<uint32_t> _spilled;
+
+	int _maxSessions;
+
+	std::string _sessionDirectory;
+
+	// Next id an open request is given, guarded by _mutex. 0 is never issued
+	uint32_t _nextSession;
+
+	std::deque<Request*> _queue;
+
+	int _maxBatch;
+	std::chrono::microseconds _latencyCap;
+
+	bool _stop;
+
+	std::mutex _mutex;
+	std::condition_variable _queueChanged;
+	std::condition_variable _completed;
+
+	// Statistics, guarded by _mutex
+	std::vector<float> _latencies;
+	int _latencyCursor;
+	long _numRequests;
+	long _numEvictions;
+	long _numRestores;
+	long _numLost;
+	std::vector<long> _batchSizes;
+
+	std::string sessionPath(uint32_t session) const {
+		return _sessionDirectory + "/session" + std::to_string(session) + ".state";
+	}
+
+	void process(const std::vector<Request*> &batch);
+
+public:
+	static const int _maxLatencySamples = 1 << 20;
+
+	Server()
+		: _maxSessions(4096), _nextSession(1), _maxBatch(32), _latencyCap(2000), _stop(false), _latencyCursor(0), _numRequests(0), _numEvictions(0), _numRestores(0), _numLost(0)
+	{}
+
+	// maxSessions is raised to maxBatch, a batch never evicts a session it steps. Evicted states are written to sessionDirectory, which must exist
+	void create(const neo::PredictiveHierarchy &ph, int maxBatch, int latencyCapMicroseconds, int maxSessions, const std::string &sessionDirectory, unsigned int seed);
+
+	int getNumInputs() const {
+		return _ph.getLayer(0)._sdr.getNumVisible();
+	}
+
+	// Queue a request and wait for the batching thread to complete it
+	void submit(Request &request);
+
+	// Batching thread
+	void run();
+
+	void stop();
+
+	std::string report();
+};
+
+void Server::create(const neo::PredictiveHierarchy &ph, int maxBatch, int latencyCapMicroseconds, int maxSessions, const std::string &sessionDirectory, unsigned int seed) {
+	_ph = ph;
+	_generator.seed(seed);
+
+	_maxBatch = std::max(1, maxBatch);
+	_maxSessions = std::max(_maxBatch, maxSessions);
+	_sessionDirectory = sessionDirectory;
+	_latencyCap = std::chrono::microseconds(latencyCapMicroseconds);
+
+	_batchSizes.assign(_maxBatch + 1, 0);
+}
+
+void Server::submit(Request &request) {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_stop) {
+		request._status = _statusShuttingDown;
+
+		return;
+	}
+
+	if (request._header._type == _requestOpen)
+		request._header._session = _nextSession++;
+
+	request._arrival = Clock::now();
+
+	_queue.push_back(&request);
+
+	_queueChanged.notify_all();
+
+	_completed.wait(lock, [&request] { return request._done; });
+}
+
+void Server::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (true) {
+		_queueChanged.wait(lock, [this] { return _stop || !_queue.empty(); });
+
+		if (_stop)
+			break;
+
+		// Give the batch until the oldest request's latency cap to fill up
+		Clock::time_point deadline = _queue.front()->_arrival + _latencyCap;
+
+		_queueChanged.wait_until(lock, deadline, [this] { return _stop || static_cast<int>(_queue.size()) >= _maxBatch; });
+
+		// A session can only be stepped once per batch, later requests for it wait for the next one
+		std::vector<Request*> batch;
+		std::unordered_set<uint32_t> batchSessions;
+
+		for (std::deque<Request*>::iterator it = _queue.begin(); it != _queue.end() && static_cast<int>(batch.size()) < _maxBatch;) {
+			if (batchSessions.count((*it)->_header._session) != 0) {
+				it++;
+
+				continue;
+			}
+
+			batchSessions.insert((*it)->_header._session);
+			batch.push_back(*it);
+
+			it = _queue.erase(it);
+		}
+
+		lock.unlock();
+
+		process(batch);
+
+		lock.lock();
+
+		Clock::time_point now = Clock::now();
+
+		for (int i = 0; i < batch.size(); i++) {
+			float latency = std::chrono::duration<float, std::micro>(now - batch[i]->_arrival).count();
+
+			if (_latencies.size() < _maxLatencySamples)
+				_latencies.push_back(latency);
+			else
+				_latencies[_latencyCursor] = latency;
+
+			_latencyCursor = (_latencyCursor + 1) % _maxLatencySamples;
+
+			batch[i]->_done = true;
+		}
+
+		_numRequests += batch.size();
+		_batchSizes[batch.size()]++;
+
+		_completed.notify_all();
+	}
+
+	// Fail whatever is left
+	for (int i = 0; i < _queue.size(); i++) {
+		_queue[i]->_status = _statusShuttingDown;
+		_queue[i]->_done = true;
+	}
+
+	_queue.clear();
+
+	_completed.notify_all();
+
+	// Sessions end with the server
+	for (std::unordered_set<uint32_t>::iterator it = _spilled.begin(); it != _spilled.end(); it++)
+		std::remove(sessionPath(*it).c_str());
+
+	_spilled.clear();
+}
+
+void Server::process(const std::vector<Request*> &batch) {
+	std::vector<neo::PredictiveHierarchy::State*> states;
+	std::vector<Request*> steps;
+
+	int numEvictions = 0;
+	int numRestores = 0;
+	int numLost = 0;
+
+	for (int i = 0; i < batch.size(); i++) {
+		Request &r = *batch[i];
+
+		uint32_t session = r._header._session;
+
+		std::unordered_map<uint32_t, Session>::iterator it = _sessions.find(session);
+
+		bool spilled = it == _sessions.end() && _spilled.count(session) != 0;
+
+		if (r._header._type == _requestClose) {
+			if (it != _sessions.end()) {
+				_sessionOrder.erase(it->second._use);
+				_sessions.erase(it);
+			}
+			else if (spilled) {
+				std::remove(sessionPath(session).c_str());
+
+				_spilled.erase(session);
+			}
+			else
+				r._status = _statusNoSession;
+
+			continue;
+		}
+
+		if (it == _sessions.end()) {
+			if (r._header._type != _requestOpen && !spilled) {
+				r._status = _statusNoSession;
+
+				continue;
+			}
+
+			// Sessions of this batch were moved to the back, so the front is never one of them
+			if (static_cast<int>(_sessions.size()) >= _maxSessions) {
+				uint32_t evicted = _sessionOrder.front();
+
+				// A state that cannot be written is lost, its client sees a fresh one next step
+				std::ofstream toFile(sessionPath(evicted), std::ios::binary);
+
+				_ph.writeState(_sessions[evicted]._state, toFile);
+
+				_spilled.insert(evicted);
+
+				_sessions.erase(evicted);
+				_sessionOrder.pop_front();
+
+				numEvictions++;
+			}
+
+			it = _sessions.insert(std::make_pair(session, Session())).first;
+
+			_ph.initState(it->second._state);
+
+			it->second._use = _sessionOrder.insert(_sessionOrder.end(), session);
+
+			if (spilled) {
+				std::ifstream fromFile(sessionPath(session), std::ios::binary);
+
+				// readState leaves the fresh state on a failed read
+				if (_ph.readState(it->second._state, fromFile))
+					numRestores++;
+				else
+					numLost++;
+
+				fromFile.close();
+
+				std::remove(sessionPath(session).c_str());
+
+				_spilled.erase(session);
+			}
+		}
+		else
+			_sessionOrder.splice(_sessionOrder.end(), _sessionOrder, it->second._use);
+
+		if (r._header._type == _requestOpen)
+			continue;
+
+		if (r._header._type == _requestReset) {
+			_ph.initState(it->second._state);
+
+			continue;
+		}
+
+		for (int j = 0; j < r._values.size(); j++)
+			neo::PredictiveHierarchy::setInput(it->second._state, j, r._values[j]);
+
+		states.push_back(&it->second._state);
+		steps.push_back(&r);
+	}
+
+	if (numEvictions > 0 || numRestores > 0 || numLost > 0) {
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_numEvictions += numEvictions;
+		_numRestores += numRestores;
+		_numLost += numLost;
+	}
+
+	if (!states.empty())
+		_ph.simStepBatch(states, _generator);
+
+	for (int i = 0; i < steps.size(); i++)
+		for (int j = 0; j < steps[i]->_values.size(); j++)
+			steps[i]->_values[j] = neo::PredictiveHierarchy::getPrediction(*states[i], j);
+}
+
+void Server::stop() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_stop = true;
+
+	_queueChanged.notify_all();
+}
+
+std::string Server::report() {
+	std::vector<float> latencies;
+	std::vector<long> batchSizes;
+	long numRequests, numEvictions, numRestores, numLost;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		latencies = _latencies;
+		batchSizes = _batchSizes;
+		numRequests = _numRequests;
+		numEvictions = _numEvictions;
+		numRestores = _numRestores;
+		numLost = _numLost;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	std::ostringstream os;
+
+	os << "requests " << numRequests << " max_batch " << _maxBatch << " latency_cap_us " << _latencyCap.count() << "\n";
+	os << "max_sessions " << _maxSessions << " evictions " << numEvictions << " restores " << numRestores << " lost " << numLost << "\n";
+
+	if (!latencies.empty()) {
+		const float percentiles[5] = { 50.0f, 90.0f, 99.0f, 99.9f, 100.0f };
+
+		os << "latency_us";
+
+		for (int i = 0; i < 5; i++) {
+			int index = std::min<int>(latencies.size() - 1, std::ceil(percentiles[i] / 100.0f * latencies.size()) - 1);
+
+			os << " p" << percentiles[i] << " " << latencies[std::max(0, index)];
+		}
+
+		os << "\n";
+	}
+
+	os << "batch_size count\n";
+
+	for (int i = 1; i < batchSizes.size(); i++)
+		if (batchSizes[i] > 0)
+			os << i << " " << batchSizes[i] << "\n";
+
+	return os.str();
+}
+
+// A client connection and the thread serving it. main owns the socket and closes it once the thread is joined
+struct Connection {
+	int _fd;
+	std::thread _thread;
+
+	// Set by the thread when it is about to return
+	std::atomic<bool> _finished;
+
+	Connection(int fd)
+		: _fd(fd), _finished(false)
+	{}
+};
+
+void serveConnection(Server* server, Connection* connection) {
+	int fd = connection->_fd;
+
+	RequestHeader header;
+
+	while (readFully(fd, &header, sizeof(RequestHeader))) {
+		ResponseHeader response;
+		response._status = _statusOk;
+		response._numValues = 0;
+
+		// Refuse payloads that could not be a model's input instead of allocating them
+		if (header._numValues > (1 << 24))
+			break;
+
+		Request request;
+		request._header = header;
+		request._values.resize(header._numValues);
+
+		if (!readFully(fd, request._values.data(), request._values.size() * sizeof(float)))
+			break;
+
+		std::string text;
+
+		switch (header._type) {
+		case _requestStep:
+			if (static_cast<int>(request._values.size()) != server->getNumInputs()) {
+				response._status = _statusBadRequest;
+
+				break;
+			}
+
+			server->submit(request);
+
+			response._status = request._status;
+
+			if (response._status == _statusOk)
+				response._numValues = request._values.size();
+
+			break;
+
+		case _requestReset:
+		case _requestClose:
+			server->submit(request);
+
+			response._status = request._status;
+
+			break;
+
+		case _requestOpen:
+			server->submit(request);
+
+			response._status = request._status;
+
+			if (response._status == _statusOk)
+				response._numValues = request._header._session;
+
+			break;
+
+		case _requestStats:
+			text = server->report();
+
+			response._numValues = text.size();
+
+			break;
+
+		case _requestInfo:
+			response._numValues = server->getNumInputs();
+
+			break;
+
+		default:
+			response._status = _statusBadRequest;
+		}
+
+		if (!writeFully(fd, &response, sizeof(ResponseHeader)))
+			break;
+
+		if (header._type == _requestStep && response._numValues > 0 && !writeFully(fd, request._values.data(), request._values.size() * sizeof(float)))
+			break;
+
+		if (header._type == _requestStats && !writeFully(fd, text.data(), text.size()))
+			break;
+	}
+
+	connection->_finished = true;
+}
+
+volatile sig_atomic_t quit = 0;
+
+void onSignal(int) {
+	quit = 1;
+}
+
+// Remove a socket file left at path, refusing anything else that is there. True if the path is free
+bool removeSocket(const std::string &path) {
+	struct stat info;
+
+	if (lstat(path.c_str(), &info) != 0)
+		return errno == ENOENT;
+
+	return S_ISSOCK(info.st_mode) && unlink(path.c_str()) == 0;
+}
+
+int main(int argc, const char** argv) {
+	ArgumentParser parser;
+
+	parser.addArgument("-m", "--model", 1);
+	parser.addArgument("--socket", 1);
+	parser.addArgument("--maxbatch", 1);
+	parser.addArgument("--latencycap", 1);
+	parser.addArgument("--maxsessions", 1);
+	parser.addArgument("--sessiondir", 1);
+	parser.addArgument("--seed", 1);
+	parser.addArgument("--inputsize", 1);
+
+	parser.parse(argc, argv);
+
+	std::string socketPath = parser.retrieve("socket", "/tmp/neorl.sock");
+	int maxBatch = std::atoi(parser.retrieve("maxbatch", "32").c_str());
+	int latencyCap = std::atoi(parser.retrieve("latencycap", "2000").c_str());
+	int maxSessions = std::atoi(parser.retrieve("maxsessions", "4096").c_str());
+	std::string sessionDirectory = parser.retrieve("sessiondir", "/tmp/neorl-sessions");
+	unsigned int seed = std::atoi(parser.retrieve("seed", "0").c_str());
+
+	neo::PredictiveHierarchy ph;
+
+	std::string modelPath = parser.retrieve("model", "");
+
+	if (!modelPath.empty()) {
+		std::ifstream fromFile(modelPath, std::ios::binary);
+
+		if (!ph.load(fromFile)) {
+			std::cerr << "Could not load a model from " << modelPath << std::endl;
+
+			return 1;
+		}
+	}
+	else {
+		// Untrained model, enough to exercise the server locally
+		int inputSize = std::atoi(parser.retrieve("inputsize", "8").c_str());
+
+		std::vector<neo::PredictiveHierarchy::LayerDesc> layerDescs(3);
+
+		ph.createRandom(inputSize, inputSize, 8, layerDescs, -0.01f, 0.01f, 0.01f, 0.05f, 0.1f, static_cast<unsigned long long>(seed));
+
+		std::cout << "No model given, serving a random " << inputSize << "x" << inputSize << " input model" << std::endl;
+	}
+
+	if (mkdir(sessionDirectory.c_str(), 0700) != 0 && errno != EEXIST) {
+		std::cerr << "Could not create the session directory " << sessionDirectory << ": " << std::strerror(errno) << std::endl;
+
+		return 1;
+	}
+
+	Server server;
+
+	server.create(ph, maxBatch, latencyCap, maxSessions, sessionDirectory, seed);
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path too long: " << socketPath << std::endl;
+
+		return 1;
+	}
+
+	std::strcpy(address.sun_path, socketPath.c_str());
+
+	if (!removeSocket(socketPath)) {
+		std::cerr << socketPath << " exists and is not a socket that can be removed" << std::endl;
+
+		return 1;
+	}
+
+	if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 128) != 0) {
+		std::cerr << "Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	std::thread batcher(&Server::run, &server);
+
+	std::cout << "Serving " << server.getNumInputs() << " inputs on " << socketPath << ", max batch " << maxBatch << ", latency cap " << latencyCap << "us" << std::endl;
+
+	// Connection threads use server, so they are all joined before it goes out of scope
+	std::list<Connection> connections;
+
+	while (!quit) {
+		// Reap connections whose clients left
+		for (std::list<Connection>::iterator it = connections.begin(); it != connections.end();) {
+			if (!it->_finished) {
+				it++;
+
+				continue;
+			}
+
+			it->_thread.join();
+
+			close(it->_fd);
+
+			it = connections.erase(it);
+		}
+
+		pollfd p;
+		p.fd = listenFd;
+		p.events = POLLIN;
+
+		if (poll(&p, 1, 200) <= 0)
+			continue;
+
+		int fd = accept(listenFd, nullptr, nullptr);
+
+		if (fd >= 0) {
+			connections.emplace_back(fd);
+			connections.back()._thread = std::thread(serveConnection, &server, &connections.back());
+		}
+	}
+
+	server.stop();
+
+	batcher.join();
+
+	// Wake threads blocked reading from their clients, requests they still submit are refused
+	for (std::list<Connection>::iterator it = connections.begin(); it != connections.end(); it++)
+		shutdown(it->_fd, SHUT_RDWR);
+
+	for (std::list<Connection>::iterator it = connections.begin(); it != connections.end(); it++) {
+		it->_thread.join();
+
+		close(it->_fd);
+	}
+
+	close(listenFd);
+	removeSocket(socketPath);
+
+	std::cout << server.report();
+
+	return 0;
+}